@@ -4,12 +4,15 @@ Main program.
 Written by Corvin Sydow [aka Lirvan; einmeterhecht], 2022 / Updated 2023.
 
 What this program does:
-- First fetch a list of .cfg files located in the input directory
-    (which by default is the directory where the .exe is).                        [-> filelist.h]
+- Start scanning the input directory for .cfg files on several threads
+    (which by default is the directory where the .exe is).                        [-> directory_walker.h, filelist.h]
 - Initialize some stuff related to GL and open window                             [-> gl_stuff.h]
-- For each .cfg file:
-  - Load the .cfg's xml using rapidxml                                            [-> CfgFile.h]
-    - Everything besides <Models> will be ignored (decals, particles, cloth, ...)
+- Whenever the files found so far are used up, take the ones found since and
+  - scan them in parallel. The files are memory-mapped and only
+    <MeshRadius> and <Models> are read, everything else is skipped (decals, particles, cloth, ...) [-> cfg_parser.h]
+  - estimate the work per .cfg file and process the most expensive ones first    [-> planner.h]
+- For each .cfg file (loading, snowmaps, combining and saving are in the library libsnowgen) [-> snowgen.h]:
+  - Find the meshes and textures of the .cfg                                      [-> CfgFile.h]
   - Load all the resources used by this .cfg file:
     - .rdm meshes (using some code copied from Kskudliks rdm-obj converter)       [-> rdm2gl.h]
     - .dds textures (using DirectXTex library by Microsoft)                       [-> dds2gl.h]
@@ -23,6 +26,7 @@ What this program does:
         - Materials using the same diffuse texture will share the snowmap
         - When the snowmap is first created, a black quad is rendered to it to make sure it is empty
       - Calculate the snowmap: The model is rendered to the snowmap using the standard pipeline, but:
+        - Triangles that are steep at all three corners are left out, they cannot receive snow   [-> rdm2gl.h]
         - The Vertexshader does not return the transformed-projected vertex position, but the vertex texture coordinate.
         - Fragmentshader gets the Y (Up) component of the normal (in model space) and stores the likeliness of snow for this fragment in the snowmap.
         - Output is not written to the screen, but to the depth component/Z-buffer, which is linked to the snowmap
@@ -34,7 +38,9 @@ What this program does:
     - "Render" to the textures: Inputs are the snowmap, the original textures and a noise texture.
                                 Outputs are the new diffuse and metallic textures that have snow
     - Fragmentshader combines the input and write snowed versions of the input textures to the output.
-      - Excerpt from the algorithm:
+      - The thresholds and the snow color are compiled into the shaders (--snow_normal_y, --snow_color, --noise_scale),
+        in one variant with and one without metallic output                     [-> shaders.h]
+      - Excerpt from the algorithm, with the default values:
 	    if (normal_y > 0.8) {
             // Snow covers original texture entirely
             float snow_offset = (noise_value - 0.5) * 0.0625;
@@ -50,13 +56,21 @@ What this program does:
             metallic_color.rgb = metallic_color.rgb * orig_color_part;
         }
 
-  Render the snowed model
+  Render the snowed model (only as often as --preview asks for, unless it is saved)
     - Render it to a texture
     - Draw the rendering to the screen
-    - Optionally save the rendering as a file
+    - Optionally save the rendering as a file, or as a thumbnail on a contact sheet   [-> contact_sheet.h]
 
   Save the output textures
-    - The output textures are stored as .dds files; including as many mipmaps as the original had. The compression of the textures to BC7_UNORM takes extremely long.
+    - The output textures are stored as .dds files; including as many mipmaps as the original had and in the same block compression (--diff_format/--metal_format to override). The compression to BC7_UNORM takes extremely long.
+    - So they are read back without waiting for the GPU and compressed on worker threads while the next .cfg file is processed [-> texture_encoder.h]
+    - With --output_archive, all files are appended to one archive instead [-> output_sink.h]
+    - With --atlas_mode, the snowmaps are merged across the .cfg files instead, and the textures are
+      combined and saved once, when all .cfg files are done                       [-> atlas_snowmaps.h]
+- With --watch, the input directory is watched after the first pass, and the .cfg files that use a changed
+  .cfg, .rdm or .dds file are processed again                                    [-> file_watcher.h, dependency_index.h]
+- With --serve, the .cfg files are not searched but read from stdin as jobs, and the result of each one
+  is written to stdout                                                            [-> job_server.h]
 - When done, print a list of .cfg files that were skipped
 
 Thanks to https://www.opengl-tutorial.org/ and https://learnopengl.com/
@@ -67,6 +81,8 @@ Thanks to https://www.opengl-tutorial.org/ and https://learnopengl.com/
 #include <vector>
 #include <set>
 #include <string>
+#include <chrono>
+#include <memory>
 
 #include "src/filelist.h"
 #include "src/CfgFile.h"
@@ -77,18 +93,75 @@ Thanks to https://www.opengl-tutorial.org/ and https://learnopengl.com/
 #include "src/cli_options.h"
 #include "src/matrix2gl.h"
 #include "src/licenses.h"
+#include "src/profiler.h"
+#include "src/benchmark.h"
+#include "src/memory_accounting.h"
+#include "src/planner.h"
+#include "src/cfg_parser.h"
+#include "src/cfg_index.h"
+#include "src/thread_pool.h"
+#include "src/path_table.h"
+#include "src/blocking_queue.h"
+#include "src/directory_walker.h"
+#include "src/mesh_cache.h"
+#include "src/contact_sheet.h"
+#include "src/texture_encoder.h"
+#include "src/output_sink.h"
+#include "src/job_server.h"
+#include "src/file_watcher.h"
+#include "src/dependency_index.h"
+#include "src/snowgen.h"
 
 namespace fs = std::filesystem;
 using namespace std;
 
+// --watch: passes on the .cfg files of the scan, then those affected by changes, until the watcher is stopped
+static void pass_on_changed_cfgs(BlockingQueue<fs::path>* scanned_cfgs, FileWatcher* file_watcher,
+    const DependencyIndex* dependency_index, bool (*is_cfg)(std::string_view), BlockingQueue<fs::path>* discovered_cfgs)
+{
+    fs::path cfg_path;
+    while (scanned_cfgs->pop(&cfg_path)) discovered_cfgs->push(cfg_path);
+    vector<fs::path> changed_paths;
+    // Short enough to stay well below a second from saving a file to writing its snowed textures
+    while (file_watcher->wait_for_changes(&changed_paths, std::chrono::milliseconds(200))) {
+        for (const fs::path& affected_cfg : dependency_index->find_affected_cfgs(changed_paths, is_cfg)) discovered_cfgs->push(affected_cfg);
+        changed_paths.clear();
+    }
+    discovered_cfgs->close();
+}
+
 int main(int argc, char *argv[])
 {
     CliOptions cli_options = CliOptions(argc, argv, std::filesystem::path(__argv[0]).parent_path());
     int return_code = 0;
+    if (cli_options.profile) profiler::enable();
+    TraceFileScope trace_file_scope(cli_options.profile_path);
+    memory_accounting::set_budget(cli_options.memory_budget_mb * 1024 * 1024);
+    mesh_cache::set_limit(cli_options.mesh_cache_mb * 1024 * 1024);
 
-    if (cli_options.display_help_message || cli_options.display_licenses) {
+    if (cli_options.display_help_message || cli_options.display_licenses || cli_options.benchmark_filters) {
         if (cli_options.display_licenses) cout << licenses_string << endl;
         if (cli_options.display_help_message) cout << "help message" << endl;
+        if (cli_options.benchmark_filters) benchmark_path_filters();
+        if (!cli_options.no_prompt) {
+            // Let the user press enter to close window
+            char* _ = new char[2];
+            std::cin.getline(_, 2);
+            delete[] _;
+        }
+        return return_code;
+    }
+
+    if (cli_options.has_extract_archive_path) {
+        try {
+            size_t extracted_count = output_sink::extract_archive(cli_options.extract_archive_path, cli_options.out_path);
+            std::cout << "Extracted " << extracted_count << " files to " << cli_options.out_path.string() << endl;
+            output_sink::print_statistics();
+        }
+        catch (snow_exception) {
+            std::cout << "Could not extract " << cli_options.extract_archive_path.string() << endl;
+            return_code = -1;
+        }
         if (!cli_options.no_prompt) {
             // Let the user press enter to close window
             char* _ = new char[2];
@@ -98,35 +171,88 @@ int main(int argc, char *argv[])
         return return_code;
     }
 
-    vector<std::filesystem::path> target_files;
-    if (cli_options.dir_to_parse.string().ends_with(".cfg")) {
-        target_files.push_back(fs::path(cli_options.dir_to_parse));
+    if (cli_options.has_filter_rules_path) load_filter_rules(cli_options.filter_rules_path);
+
+    // The directory is scanned on several threads while the first files are already processed
+    BlockingQueue<fs::path> discovered_cfgs;
+    unique_ptr<DirectoryWalker> directory_walker;
+    unique_ptr<JobServer> job_server;
+    // --watch: the walker fills scanned_cfgs, pass_on_changed_cfgs passes them and the changed .cfg files on
+    BlockingQueue<fs::path> scanned_cfgs;
+    unique_ptr<FileWatcher> file_watcher;
+    unique_ptr<DependencyIndex> dependency_index;
+    std::thread watch_thread;
+    if (cli_options.serve) {
+        // The .cfg files come from the jobs on stdin, the queue is closed when stdin is closed
+        job_server = make_unique<JobServer>(cli_options, &discovered_cfgs);
+        job_server->start();
+    }
+    else if (cli_options.dir_to_parse.string().ends_with(".cfg")) {
+        discovered_cfgs.push(fs::path(cli_options.dir_to_parse));
+        discovered_cfgs.close();
+    }
+    else if (!fs::is_directory(cli_options.dir_to_parse)) {
+        std::cout << "Error while parsing " << cli_options.dir_to_parse << "" << endl;
+        std::cout << "The specified directory does not exist." << endl;
+        discovered_cfgs.close();
     }
     else {
-        try {
-            if (cli_options.disable_filenamefilters) {
-                get_file_list(cli_options.dir_to_parse, &target_files, &ends_in_cfg);
-            }
-            else {
-                get_file_list(cli_options.dir_to_parse, &target_files, &is_old_world_cfg);
-            }
-            std::cout << "Found " << target_files.size() << " files: " << endl;
-            for (int cfg_index = 0; cfg_index < target_files.size(); cfg_index++) {
-                 std::cout << target_files.at(cfg_index).string() << endl;
-            }
+        bool (*is_cfg)(std::string_view) = cli_options.disable_filenamefilters ? &ends_in_cfg : &is_old_world_cfg;
+        directory_walker = make_unique<DirectoryWalker>(cli_options.dir_to_parse, is_cfg,
+            cli_options.watch ? &scanned_cfgs : &discovered_cfgs);
+        if (cli_options.watch && !cli_options.plan) {
+            // Started together with the scan, so that no change during the first pass is missed
+            file_watcher = make_unique<FileWatcher>(cli_options.dir_to_parse, cli_options.out_path);
+            dependency_index = make_unique<DependencyIndex>();
+            if (!file_watcher->is_watching()) std::cout << "WARNING: Cannot watch " << cli_options.dir_to_parse.string() << " for changes" << endl;
+            watch_thread = std::thread(&pass_on_changed_cfgs, &scanned_cfgs, file_watcher.get(), dependency_index.get(), is_cfg, &discovered_cfgs);
         }
-        catch (std::filesystem::filesystem_error) {
-            std::cout << "Error while parsing " << cli_options.dir_to_parse << "" << endl;
-            if (!fs::exists(cli_options.dir_to_parse)) std::cout << "The specified directory does not exist." << endl;
+    }
+    if (cli_options.watch && !cli_options.plan && !file_watcher) std::cout << "WARNING: --watch only works with an input directory" << endl;
+
+    ThreadPool thread_pool = ThreadPool();
+
+    // Memory-maps and scans the .cfg files in parallel. Unchanged files are taken from the index of the last run.
+    CfgIndex cfg_index_file = CfgIndex(cli_options.use_cfg_index ? fs::path(cli_options.out_path).append("cfg_index.bin") : fs::path());
+    CfgFeed cfg_feed = CfgFeed(&discovered_cfgs, &thread_pool, &cfg_index_file, cli_options);
+
+    if (cli_options.plan) {
+        // Needs all files: waits for the scan to finish. Reads only the headers of textures and meshes.
+        vector<CfgDescription> cfg_descriptions = cfg_feed.take_all();
+        cfg_feed.print_parse_summary();
+        std::cout << "Planning " << cfg_descriptions.size() << " files..." << endl;
+        vector<Texture> planning_default_textures = load_default_textures(false);
+        vector<PlannedCfg> plan = plan_work(cfg_descriptions, &planning_default_textures, cli_options);
+        order_longest_first(plan);
+        print_plan(plan);
+        if (cli_options.use_cfg_index && cfg_feed.has_parsed_changed_files()) cfg_index_file.save(cfg_feed.get_parsed_descriptions());
+        if (!cli_options.no_prompt) {
+            // Let the user press enter to close window
+            char* _ = new char[2];
+            std::cin.getline(_, 2);
+            delete[] _;
         }
+        return return_code;
     }
 
-    GlStuff context_gl = GlStuff();
-    while (glGetError() != GL_NO_ERROR) std::cout << "GL ERROR while initializing" << endl;
-    GLuint snow_program = compile_shaders_to_program(
-        texcoord_as_positon_with_tangents_vertexshader_code, snow_fragmentshader_code);
-    GLuint combine_to_snowed_textures_program = compile_shaders_to_program(
-        empty_vertexshader_code, combine_to_snowed_textures_fragmentshader_code);
+    // The window shows the preview, the generator draws the snowmaps and snowed textures and encodes them [-> snowgen.h]
+    unique_ptr<snowgen::Generator> generator;
+    try {
+        generator = make_unique<snowgen::Generator>(cli_options, cli_options.preview_mode != PreviewMode::off);
+    }
+    catch (snow_exception) {
+        if (directory_walker) directory_walker->stop();
+        if (file_watcher) file_watcher->stop();
+        if (watch_thread.joinable()) watch_thread.join();
+        if (!cli_options.no_prompt) {
+            // Let the user press enter to close window
+            char* _ = new char[2];
+            std::cin.getline(_, 2);
+            delete[] _;
+        }
+        return -2;
+    }
+    GlStuff& context_gl = generator->get_gl();
     GLuint render_isometric_program = compile_shaders_to_program(
         simple_matrix_transform_vertexshader_code, simple_diff_to_texture_fragmentshader_code);
     GLuint texture_to_screen_program = compile_shaders_to_program(
@@ -138,10 +264,6 @@ int main(int argc, char *argv[])
     }
     while (glGetError() != GL_NO_ERROR) {}
 
-    context_gl.load_square_vertexbuffer();
-    context_gl.load_noise_texture(1024);
-    vector<Texture> default_textures = load_default_textures();
-    
     GLuint isometric_framebuffer = create_framebuffer(1);
 
     GLuint isometric_rendering_texture = create_empty_texture(
@@ -155,6 +277,7 @@ int main(int argc, char *argv[])
     glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH_COMPONENT, ISOMETRIC_RENDERING_WIDTH, ISOMETRIC_RENDERING_HEIGHT);
     
     glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_RENDERBUFFER, isometric_depthrenderbuffer);
+    memory_accounting::add(memory_accounting::Category::gl_objects, ISOMETRIC_RENDERING_WIDTH * ISOMETRIC_RENDERING_HEIGHT * 4);
 
     is_framebuffer_ok();
 
@@ -164,8 +287,10 @@ int main(int argc, char *argv[])
     }
 
     if (return_code != 0) {
-        context_gl.cleanup();
-        glfwTerminate();
+        if (directory_walker) directory_walker->stop();
+        if (file_watcher) file_watcher->stop();
+        if (watch_thread.joinable()) watch_thread.join();
+        generator->cleanup();
 
         if (!cli_options.no_prompt) {
             // Let the user press enter to close window
@@ -179,290 +304,228 @@ int main(int argc, char *argv[])
     vector<std::filesystem::path> skipped_files;
     vector<std::filesystem::path> error_files;
     int cfg_index = 0;
+    BenchmarkStats benchmark_stats = BenchmarkStats();
+
+    auto last_preview_time = std::chrono::steady_clock::time_point();
+    constexpr auto throttled_preview_interval = std::chrono::milliseconds(250);
+    if (cli_options.has_output_archive_path) {
+        if (cli_options.serve) {
+            // The archive is only complete at the end of the run, the jobs are reported before
+            std::cout << "WARNING: --output_archive cannot be combined with --serve, the files are saved to "
+                << cli_options.out_path.string() << endl;
+        }
+        else if (!output_sink::open_archive(cli_options.output_archive_path, cli_options.out_path)) {
+            std::cout << "WARNING: The files are saved to " << cli_options.out_path.string() << " instead." << endl;
+        }
+    }
+    TextureEncoder& texture_encoder = generator->get_encoder();
+    unique_ptr<ContactSheet> contact_sheet;
+    if (cli_options.save_renderings && cli_options.contact_sheet_size > 0) {
+        contact_sheet = make_unique<ContactSheet>(cli_options.contact_sheet_size,
+            fs::path(cli_options.out_path).append("debug_renderings"), &context_gl);
+    }
 
-    for (cfg_index = 0; cfg_index < target_files.size(); cfg_index++) {
-        string cfg_path = backward_to_forward_slashes(target_files.at(cfg_index).string());
-        std::cout << "\n\n\nCfg file " << cfg_index + 1 << " / " << target_files.size() << endl;
+    // Files found so far, most expensive first. Planning resolves them with the default textures of the generator.
+    cfg_feed.set_default_textures(generator->get_default_textures());
+    CfgDescription cfg_description;
+    bool is_stopped_by_user = false;
+    for (cfg_index = 0; cfg_feed.next(&cfg_description); cfg_index++) {
+        string cfg_path = backward_to_forward_slashes(cfg_description.cfg_path.string());
+        std::cout << "\n\n\nCfg file " << cfg_index + 1 << " / " << cfg_feed.get_found_count()
+            << (cfg_feed.is_scan_done() || !directory_walker ? "" : " found so far") << endl;
         std::cout << cfg_path << endl;
 
+        // With --serve, the job can override some options for its file
+        const ServeJob* job = job_server ? job_server->start_job(cfg_description.cfg_path) : nullptr;
+        const CliOptions& job_options = job ? job->options : cli_options;
+        auto job_start_time = std::chrono::steady_clock::now();
+        size_t saved_texture_count = 0;
+
+        ProfileScope cfg_scope("process_cfg", cfg_path);
+        memory_accounting::begin_cfg();
         try {
-            CfgFile cfg_file = CfgFile(cfg_path, &default_textures, cli_options);
-            while (glGetError() != GL_NO_ERROR) {} // Clear Error stack
-            
-            bool no_textures_to_save = true;
-            for (auto& [texture_rel_path, texture] : cfg_file.all_textures) {
-                if (texture.save_snowed_texture) no_textures_to_save = false;
-            }
-            
-            if (no_textures_to_save) {
+            // Resolved already by planning, unless the job has its own options
+            std::string resolve_log;
+            unique_ptr<CfgFile> planned_cfg_file = cfg_feed.take_resolved(&resolve_log);
+            if (job) planned_cfg_file.reset();
+            if (planned_cfg_file) std::cout << resolve_log;
+            CfgFile cfg_file = planned_cfg_file ? std::move(*planned_cfg_file)
+                : CfgFile(cfg_description, generator->get_default_textures(), job_options);
+            if (dependency_index) dependency_index->set_dependencies(cfg_description.cfg_path, cfg_file.get_source_files());
+
+            if (!snowgen::Generator::has_textures_to_save(cfg_file)) {
                 std::cout << "No textures to generate snow for were found. Move on to the next file." << endl;
                 skipped_files.push_back(cfg_path);
+                if (job) job_server->report(job, "skipped", 0, job_start_time);
                 continue;
             }
 
-            cfg_file.load_models_and_textures();
-            if (glGetError() != GL_NO_ERROR) throw snow_exception("GL ERROR while loading textures");
+            // Swapping buffers is not free, with --preview throttled the window shows only some of the files
+            auto now = std::chrono::steady_clock::now();
+            bool is_preview_due = job_options.preview_mode == PreviewMode::every
+                || (job_options.preview_mode == PreviewMode::throttled && now - last_preview_time >= throttled_preview_interval);
+            bool is_rendered = is_preview_due || job_options.save_renderings;
 
-            map<string, GLuint> rendered_snowmaps{};
-            map<string, GLuint> framebuffer_ids{};
-            
-            //// Generate snowmaps ////
-
-            for (int i = 0; i < cfg_file.cfg_models.size(); i++) {
-                HardwareRdm& mesh = cfg_file.cfg_models[i].mesh;
-                for (int j = 0; j < mesh.materials_count; j++) {
-                    int cfg_material_index = min(mesh.materials[j].index, cfg_file.cfg_models[i].cfg_materials.size() - 1);
-                    CfgMaterial& cfg_material = cfg_file.cfg_models[i].cfg_materials[cfg_material_index];
-
-                    int width, height;
-
-                    fs::path texture_out_path = cfg_material.textures[0]->out_path;
-                    string texture_rel_path = cfg_material.textures[0]->rel_path;
-
-                    // GLuint old_render_target_texture = render_target_texture;
-                    if (!rendered_snowmaps.contains(texture_rel_path)) {
-                        get_dimensions(cfg_material.textures[0]->texture_id, &width, &height);
-                        
-                        // Create render target
-                        rendered_snowmaps[texture_rel_path] = create_empty_depth_texture(width, height);
-                        framebuffer_ids[texture_rel_path] = create_framebuffer(0);
-                        
-                        GLuint depthrenderbuffer;
-                        glGenRenderbuffers(1, &depthrenderbuffer);
-                        glBindRenderbuffer(GL_RENDERBUFFER, depthrenderbuffer);
-                        glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH_COMPONENT, width, height);
-                        glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_RENDERBUFFER, depthrenderbuffer);
-                        
-                        glFramebufferTexture(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, rendered_snowmaps[texture_rel_path], 0);
-                        
-                        is_framebuffer_ok();
-                        // Clear snowmap
-                        if (cli_options.flat_overwrites_steep) glClearDepth(0.);
-                        else glClearDepth(1.);
-                        glClear(GL_DEPTH_BUFFER_BIT);
-                        /*glUseProgram(clear_snowmap_program);
-                        context_gl.bind_square_buffers();
-                        glDrawElements(GL_TRIANGLES, 6, GL_UNSIGNED_INT, (void*)0);
-                        context_gl.unbind_square_buffers();*/
-                    }
-                    else {
-                        get_dimensions(rendered_snowmaps[texture_rel_path], &width, &height);
-                    }
-
-                    glViewport(0, 0, width, height);
-                    glBindFramebuffer(GL_FRAMEBUFFER, framebuffer_ids[texture_rel_path]); // Render to snowmap
-
-                    // Render snowmap
-                    glUseProgram(snow_program);
-                    glEnable(GL_DEPTH_TEST);
-                    if (cli_options.flat_overwrites_steep) glDepthFunc(GL_GREATER);
-                    else glDepthFunc(GL_LESS);
-
-                    cfg_material.bind_textures(snow_program);
-
-                    mesh.bind_buffers();
-                    context_gl.bind_vertexformat(cfg_material.vertex_format, mesh.vertices_size);
-
-                    glDrawElements(
-                        GL_TRIANGLES,
-                        mesh.materials[j].size,
-                        mesh.get_corner_datatype(),
-                        (void*)(mesh.materials[j].offset * mesh.corner_size)
-                    );
-                    context_gl.unbind_vertexformat(cfg_material.vertex_format);
-
-                    glDisable(GL_DEPTH_TEST);
-
-                    if (glGetError() != GL_NO_ERROR) throw snow_exception("GL ERROR while generating snowmaps");
-                }
-            }
-
-            //// Cover diffuse and metallic textures with snow according to the snowmaps ////
+            // Waits if other work holds too much of the --memory_budget_mb
+            MemoryReservation memory_reservation(cfg_file.estimate_memory_bytes(job_options, is_rendered));
 
-            for (int i = 0; i < cfg_file.cfg_models.size(); i++) {
-                HardwareRdm& mesh = cfg_file.cfg_models[i].mesh;
-                for (int j = 0; j < cfg_file.cfg_models[i].cfg_materials.size(); j++) {
-                    int cfg_material_index = min(mesh.materials[j].index, cfg_file.cfg_models[i].cfg_materials.size() - 1);
-                    CfgMaterial& cfg_material = cfg_file.cfg_models[i].cfg_materials[cfg_material_index];
-                    
-                    // diff and metallic have already been processed
-                    if (cfg_material.textures[0]->is_snow_generated && cfg_material.textures[2]->is_snow_generated) continue;
-                    // diff and metallic do not have to be saved (e.g. default textures)
-                    if ((!cfg_material.textures[0]->save_snowed_texture) && (!cfg_material.textures[2]->save_snowed_texture)) continue;
-                    // diff and metallic are never used by the mesh (which can't be possible at this point but is checked anyway)
-                    if (!rendered_snowmaps.contains(cfg_material.textures[0]->rel_path)) continue;
-
-                    int width, height;
-                    get_dimensions(cfg_material.textures[0]->texture_id, &width, &height);
-
-                    // All textures involved must have the same dimensions, namely those of the diff texture
-                    if (cfg_material.textures[0]->snowed_texture_id == 0 && cfg_material.textures[0]->save_snowed_texture) {
-                        cfg_material.textures[0]->snowed_texture_id = create_empty_texture(
-                            width, height, GL_RGBA, GL_NEAREST, GL_NEAREST, GL_REPEAT);
-                    }
-                    if (cfg_material.textures[2]->snowed_texture_id == 0 && cfg_material.textures[2]->save_snowed_texture) {
-                        cfg_material.textures[2]->snowed_texture_id = create_empty_texture(
-                            width, height, GL_RGBA, GL_NEAREST, GL_NEAREST, GL_REPEAT);
-                    }
-
-                    GLuint framebuffer_id = create_framebuffer(texture_types_count);
-                    glFramebufferTexture(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, cfg_material.textures[0]->snowed_texture_id, 0);
-                    glFramebufferTexture(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT2, cfg_material.textures[2]->snowed_texture_id, 0);
-
-                    glViewport(0, 0, width, height);
-                    glUseProgram(combine_to_snowed_textures_program);
-                    glDisable(GL_BLEND);
-
-                    cfg_material.bind_textures(combine_to_snowed_textures_program);
-
-                    GLuint texture_location_in_shader = glGetUniformLocation(combine_to_snowed_textures_program, "snowmap");
-                    glActiveTexture(GL_TEXTURE3);
-                    glBindTexture(GL_TEXTURE_2D, rendered_snowmaps[cfg_material.textures[0]->rel_path]);
-                    glUniform1i(texture_location_in_shader, 3);
-
-                    texture_location_in_shader = glGetUniformLocation(combine_to_snowed_textures_program, "noise");
-                    glActiveTexture(GL_TEXTURE4);
-                    glBindTexture(GL_TEXTURE_2D, context_gl.noise_texture);
-                    glUniform1i(texture_location_in_shader, 4);
-
-                    context_gl.bind_square_buffers();
-                    glDrawElements(GL_TRIANGLES, 6, GL_UNSIGNED_INT, (void*)0);
-                    context_gl.unbind_square_buffers();
-
-                    if (glGetError() != GL_NO_ERROR) throw snow_exception((string("GL ERROR while combining original texture and snowmap ").append(cfg_material.textures[0]->rel_path)).c_str());
-                    
-                    for (int k = 0; k < texture_types_count; k++)
-                        cfg_material.textures[k]->is_snow_generated = true;
-                    glDeleteFramebuffers(1, &framebuffer_id);
-                }
-            }
+            generator->load(&cfg_file, job_options, is_rendered);
+            generator->draw_snowmaps(&cfg_file, job_options);
+            // In atlas mode the textures are combined when the atlases are saved, only the rendering needs them now
+            if (!cli_options.atlas_mode || is_preview_due || job_options.save_renderings) generator->combine(&cfg_file);
 
             //// Render model to a texture and then to the screen so that the user has something to look at ////
 
-            glBindFramebuffer(GL_FRAMEBUFFER, isometric_framebuffer);
-            glClearDepth(1.);
-            glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
-            glViewport(0, 0, ISOMETRIC_RENDERING_WIDTH, ISOMETRIC_RENDERING_HEIGHT);
+            ProfileScope preview_scope("preview", cfg_path);
+            if (is_preview_due || job_options.save_renderings) {
+                glBindFramebuffer(GL_FRAMEBUFFER, isometric_framebuffer);
+                glClearDepth(1.);
+                glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+                glViewport(0, 0, ISOMETRIC_RENDERING_WIDTH, ISOMETRIC_RENDERING_HEIGHT);
 
-            glUseProgram(render_isometric_program);
-            glEnable(GL_DEPTH_TEST);
-            glDepthFunc(GL_LESS);
+                glUseProgram(render_isometric_program);
+                glEnable(GL_DEPTH_TEST);
+                glDepthFunc(GL_LESS);
             
-            for (int i = 0; i < cfg_file.cfg_models.size(); i++) {
-                HardwareRdm& mesh = cfg_file.cfg_models[i].mesh;
-                mesh.bind_buffers();
-                for (int j = 0; j < mesh.materials_count; j++) {
-                    int cfg_material_index = min(mesh.materials[j].index, cfg_file.cfg_models[i].cfg_materials.size() - 1);
-                    CfgMaterial& cfg_material = cfg_file.cfg_models[i].cfg_materials[cfg_material_index];
+                for (int i = 0; i < cfg_file.cfg_models.size(); i++) {
+                    HardwareRdm& mesh = *cfg_file.cfg_models[i].mesh;
+                    mesh.bind_buffers();
+                    for (int j = 0; j < mesh.materials_count; j++) {
+                        int cfg_material_index = min(mesh.materials[j].index, cfg_file.cfg_models[i].cfg_materials.size() - 1);
+                        CfgMaterial& cfg_material = cfg_file.cfg_models[i].cfg_materials[cfg_material_index];
+                        // Never whole on the graphics card
+                        if (cfg_material.textures[0]->is_tiled) continue;
                     
-                    GLuint texture_location_in_shader = glGetUniformLocation(render_isometric_program, "diff_texture");
-                    glActiveTexture(GL_TEXTURE0);
-                    glBindTexture(GL_TEXTURE_2D, cfg_material.textures[0]->snowed_texture_id);
-                    glUniform1i(texture_location_in_shader, 0);
+                        GLuint texture_location_in_shader = glGetUniformLocation(render_isometric_program, "diff_texture");
+                        glActiveTexture(GL_TEXTURE0);
+                        glBindTexture(GL_TEXTURE_2D, cfg_material.textures[0]->snowed_texture_id);
+                        glUniform1i(texture_location_in_shader, 0);
                     
-                    context_gl.bind_vertexformat(cfg_material.vertex_format, mesh.vertices_size);
+                        context_gl.bind_vertexformat(cfg_material.vertex_format, mesh.vertices_size);
 
-                    GLuint matrix_location_in_shader = glGetUniformLocation(render_isometric_program, "transformation_matrix");
-                    load_isometric_matrix(matrix_location_in_shader, 1.f / cfg_file.mesh_radius);
+                        GLuint matrix_location_in_shader = glGetUniformLocation(render_isometric_program, "transformation_matrix");
+                        load_isometric_matrix(matrix_location_in_shader, 1.f / cfg_file.mesh_radius);
 
-                    glDrawElements(
-                        GL_TRIANGLES,
-                        mesh.materials[j].size,
-                        mesh.get_corner_datatype(),
-                        (void*)(mesh.materials[j].offset* mesh.corner_size)
-                    );
+                        glDrawElements(
+                            GL_TRIANGLES,
+                            mesh.materials[j].size,
+                            mesh.get_corner_datatype(),
+                            (void*)(mesh.materials[j].offset* mesh.corner_size)
+                        );
+                    }
                 }
-            }
 
-            if (glGetError() != GL_NO_ERROR) throw snow_exception("GL ERROR while rendering");
+                if (glGetError() != GL_NO_ERROR) throw snow_exception("GL ERROR while rendering");
+            }
 
-            if (cli_options.save_renderings) {
-                string cfg_rel_path = cfg_path.substr(cfg_path.find("/data/"));
-                fs::path rendering_out_path = fs::path(cli_options.out_path).append("debug_renderings/").concat(
-                    cfg_rel_path.substr(0, cfg_rel_path.length() - 4));
-                gl_texture_to_jpg_file(isometric_rendering_texture, rendering_out_path, true);
+            if (job_options.save_renderings) {
+                if (contact_sheet) {
+                    contact_sheet->add(isometric_rendering_texture, cfg_path);
+                }
+                else {
+                    string cfg_rel_path = cfg_path.substr(cfg_path.find("/data/"));
+                    fs::path rendering_out_path = fs::path(job_options.out_path).append("debug_renderings/").concat(
+                        cfg_rel_path.substr(0, cfg_rel_path.length() - 4));
+                    gl_texture_to_jpg_file(isometric_rendering_texture, rendering_out_path, true);
+                }
             }
 
             if (glGetError() != GL_NO_ERROR) throw snow_exception("GL ERROR while saving the isometric rendering");
 
-            glUseProgram(texture_to_screen_program);
-            glViewport(0, 0, WINDOW_WIDTH, WINDOW_HEIGHT);
-            glBindFramebuffer(GL_FRAMEBUFFER, 0);
-            glDisable(GL_DEPTH_TEST);
+            if (is_preview_due) {
+                glUseProgram(texture_to_screen_program);
+                glViewport(0, 0, WINDOW_WIDTH, WINDOW_HEIGHT);
+                glBindFramebuffer(GL_FRAMEBUFFER, 0);
+                glDisable(GL_DEPTH_TEST);
 
-            GLuint texture_location_in_shader = glGetUniformLocation(texture_to_screen_program, "diff_texture");
-            glActiveTexture(GL_TEXTURE0);
-            glBindTexture(GL_TEXTURE_2D, isometric_rendering_texture);
-            glUniform1i(texture_location_in_shader, 0);
+                GLuint texture_location_in_shader = glGetUniformLocation(texture_to_screen_program, "diff_texture");
+                glActiveTexture(GL_TEXTURE0);
+                glBindTexture(GL_TEXTURE_2D, isometric_rendering_texture);
+                glUniform1i(texture_location_in_shader, 0);
 
 
-            context_gl.bind_square_buffers();
-            glDrawElements(GL_TRIANGLES, 6, GL_UNSIGNED_INT, (void*)0);
-            context_gl.unbind_square_buffers();
+                context_gl.bind_square_buffers();
+                glDrawElements(GL_TRIANGLES, 6, GL_UNSIGNED_INT, (void*)0);
+                context_gl.unbind_square_buffers();
 
-            // Set Window title to the filename of the .cfg currently displayed
-            glfwSetWindowTitle(context_gl.window, target_files.at(cfg_index).filename().string().c_str());
-            glfwSwapBuffers(context_gl.window);
-            glfwPollEvents();
+                // Set Window title to the filename of the .cfg currently displayed
+                glfwSetWindowTitle(context_gl.window, cfg_description.cfg_path.filename().string().c_str());
+                glfwSwapBuffers(context_gl.window);
+                last_preview_time = now;
+            }
+            glfwPollEvents(); // Also when nothing is shown, so that closing the window is noticed
 
             if (glGetError() != GL_NO_ERROR) throw snow_exception("GL ERROR while rendering to screen");
+            preview_scope.end();
 
             //// Save textures ////
 
-            for (auto& [texture_rel_path, texture] : cfg_file.all_textures) {
-                if (texture.type == 1) {
-                    // Do not save normalmaps
-                    texture.is_snowed_version_saved = true;
-                }
-                else if (texture.is_snowed_version_saved) {
-                    // std::cout << "Do not safe texture twice" << endl;
-                } else if (texture.rel_path.find("default_model_") != string::npos) {
-                    // std::cout << "Do not save the default texture " << cfg_constants::texture_names[k];
-                }
-                else if (!texture.save_snowed_texture) {
-                    std::cout << "Do not save vanilla texture " << texture.abs_path << std::endl;
-                    texture.is_snowed_version_saved = true;
-                }
-                else{
-                    if (is_forbidden_texture(texture.rel_path)) {
-                        // If filenamefilters are active, default textures are loaded instead of blacklisted ones.
-                        // If the program reaches this points, filenamefilters are disabled.
-                        std::cout << "Save blacklisted texture " << texture.out_path.string() << endl;
-                    }
-                    if (cli_options.save_png) {
-                        gl_texture_to_png_file(texture.snowed_texture_id, texture.out_path.string() + "0.png", true);
-                    }
-                    if (cli_options.save_dds) {
-                        gl_texture_to_dds_mipmaps(texture.snowed_texture_id, texture.out_path, texture.mipmap_count);
-                    }
-                    texture.is_snowed_version_saved = true;
-                }
-                if (glGetError() != GL_NO_ERROR) throw snow_exception("GL ERROR while saving texture");
-                texture.cleanup();
+            uint64_t snowed_texels = 0;
+            saved_texture_count = generator->save_textures(&cfg_file, job_options, job_options.benchmark ? &snowed_texels : nullptr);
+            benchmark_stats.add_snowed_texels(snowed_texels);
+            if (job) {
+                // The result is only reported when the files are written, also the atlases this job contributed to.
+                // Meanwhile the next job is drawn.
+                saved_texture_count += generator->save_atlases(job_options);
+                texture_encoder.when_written([&job_server, job, saved_texture_count, job_start_time](size_t failed_count) {
+                    job_server->report(job, failed_count == 0 ? "ok" : "error", saved_texture_count, job_start_time);
+                });
             }
+            benchmark_stats.add_processed_cfg();
+            memory_accounting::print_cfg_peaks();
         }
-        catch (snow_exception exception) {
+        catch (const snow_exception&) {
             // std::cout << "Error processing file " << cfg_path << endl;
             error_files.push_back(cfg_path);
             std::cout << "Move on to next file" << endl;
+            // After the textures the job has queued, so that they are not counted for the next one
+            if (job) texture_encoder.when_written([&job_server, job, job_start_time](size_t) {
+                job_server->report(job, "error", 0, job_start_time);
+            });
         }
-        catch (rapidxml::parse_error exception) {
-            std::cout << "Damaged cfg file " << cfg_path << endl;
-            error_files.push_back(cfg_path);
-            std::cout << "Move on to next file" << endl;
-        }
-        catch (exception exception) {
+        catch (const exception&) {
             std::cout << "Uncaught exception in cfg file " << cfg_path << endl;
             error_files.push_back(cfg_path);
             std::cout << "Move on to next file" << endl;
+            // After the textures the job has queued, so that they are not counted for the next one
+            if (job) texture_encoder.when_written([&job_server, job, job_start_time](size_t) {
+                job_server->report(job, "error", 0, job_start_time);
+            });
+        }
+        generator->finish_cfg();
+        if (job_server) {
+            // Reports the jobs whose textures are written until the next job arrives
+            while (texture_encoder.has_unwritten_ranges() && !cfg_feed.wait_for_files(std::chrono::milliseconds(10))) {
+                texture_encoder.poll();
+                glfwPollEvents();
+            }
+        }
+        if (file_watcher && cfg_feed.is_batch_used_up()) {
+            // The textures are read back while the GL thread polls: write them, and the atlases, before waiting for changes
+            generator->finish();
+            std::cout << endl << "Watching " << cli_options.dir_to_parse.string() << " for changes ("
+                << dependency_index->get_cfg_count() << " .cfg files known)" << endl;
         }
         if (glfwWindowShouldClose(context_gl.window)) {
             std::cout << "Window was closed by user. Quit process." << endl;
             return_code = -1;
+            is_stopped_by_user = true;
+            if (directory_walker) directory_walker->stop();
+            if (file_watcher) file_watcher->stop();
             break;
         }
     }
-    if (cfg_index == target_files.size()) std::cout << endl << "Done. ";
+    if (watch_thread.joinable()) watch_thread.join();
+    if (directory_walker) {
+        directory_walker->wait();
+        std::cout << endl << "Scanned " << directory_walker->get_directory_count() << " directories, found "
+            << directory_walker->get_found_count() << " .cfg files." << endl;
+        for (const string& error : directory_walker->get_errors()) std::cout << error << endl;
+    }
+    cfg_feed.print_parse_summary();
+    if (cli_options.use_cfg_index && cfg_feed.has_parsed_changed_files()) cfg_index_file.save(cfg_feed.get_parsed_descriptions());
+
+    if (!is_stopped_by_user) std::cout << endl << "Done. ";
     std::cout << cfg_index << " files processed, "
               << cfg_index - error_files.size() << " successful." << endl;
 
@@ -475,8 +538,21 @@ int main(int argc, char *argv[])
             std::cout << error_path.string() << endl;
         }
     }
-    context_gl.cleanup();
-    glfwTerminate();
+    delete_gl_texture(&isometric_rendering_texture);
+    glDeleteRenderbuffers(1, &isometric_depthrenderbuffer);
+    glDeleteFramebuffers(1, &isometric_framebuffer);
+    memory_accounting::remove(memory_accounting::Category::gl_objects, ISOMETRIC_RENDERING_WIDTH * ISOMETRIC_RENDERING_HEIGHT * 4);
+    if (contact_sheet) contact_sheet->cleanup(); // Saves the last sheet
+    generator->finish(); // Saves the atlases and waits for the last textures
+    output_sink::close_archive();
+    output_sink::print_statistics();
+    generator->cleanup();
+
+    if (cli_options.benchmark) memory_accounting::print_summary();
+    if (cli_options.benchmark) benchmark_stats.print_report();
+    if (cli_options.benchmark) mesh_cache::print_statistics();
+    if (cli_options.benchmark) texture_encoder.print_statistics();
+    trace_file_scope.write();
     
     if (!cli_options.no_prompt) {
         // Let the user press enter to close window
@@ -10,12 +10,16 @@
 #include "dds2gl.h"
 #include "snow_exception.h"
 #include "filelist.h"
-#include "../external/rapidxml/rapidxml.hpp"
 #include "gl_stuff.h"
+#include "profiler.h"
+#include "memory_accounting.h"
+#include "path_table.h"
+#include "mesh_cache.h"
+#include "mapped_file.h"
 
-using namespace rapidxml;
 namespace fs = std::filesystem;
 
+
 fs::path find_datapath(fs::path path_into_data) {
 	fs::path filepath_containing_datapath = path_into_data;
 	bool found_datapath = false;
@@ -40,31 +44,22 @@ std::string remove_whitespaces_at_end(std::string original) {
 }
 
 std::string backward_to_forward_slashes(std::string original) {
-	std::string target = std::string(original);
-	// https://stackoverflow.com/a/20412841
-	int n = 0;
-	while ((n = target.find("\\\\", n)) != std::string::npos) {
-		target.replace(n, 2, "/");
-		n++;
-	}
-	n = 0;
-	while ((n = target.find("\\", n)) != std::string::npos) {
-		target.replace(n, 1, "/");
-		n++;
-	}
-	return target;
+	return path_table::normalize(original);
 }
 
 fs::path backward_to_forward_slashes(fs::path original) {
 	return fs::path(backward_to_forward_slashes(original.string()));
 }
 
-std::vector<Texture> load_default_textures()
+std::vector<Texture> load_default_textures(bool upload_to_gl)
 {
 	std::vector<Texture> default_textures = std::vector<Texture>();
+	// No reallocation: Copies of a Texture would delete the GL texture when the original is destroyed
+	default_textures.reserve(texture_types_count);
 	DirectX::Image image{};
 	for (int i = 0; i < texture_types_count; i++) {
 		default_textures.push_back(Texture(cfg_constants::default_texture_paths[i], fs::path(), fs::path(), i, false));
+		if (!upload_to_gl) continue;
 
 		image.width = 1;
 		image.height = 1;
@@ -78,91 +73,208 @@ std::vector<Texture> load_default_textures()
 	return default_textures;
 }
 
-CfgFile::CfgFile(std::filesystem::path input_filepath, std::vector<Texture>* default_textures, CliOptions cli_options) {
+CfgFile::CfgFile(const CfgDescription& description, std::vector<Texture>* default_textures, const SnowOptions& cli_options,
+	std::ostream& log) {
+	ProfileScope scope("resolve_cfg", description.cfg_path.string());
 
-	if (!fs::exists(input_filepath)) {
-		throw snow_exception("The .cfg file does not exist.");
+	if (!description.error.empty()) {
+		throw snow_exception(description.error.c_str());
 	}
 
-	// Reading file to buffer copied from https://stackoverflow.com/a/29915752
-	std::ifstream xml_stream(input_filepath);
-	// get pointer to associated buffer object
-	std::filebuf* pbuf = xml_stream.rdbuf();
-	// get file size using buffer's members
-	std::size_t size = pbuf->pubseekoff(0, xml_stream.end, xml_stream.in);
-	pbuf->pubseekpos(0, xml_stream.in);
-	// allocate memory to contain file data
-	char* xml_buffer_to_parse = new char[size];
-	for (uint32_t i = 0; i < size; i++) xml_buffer_to_parse[i] = 0; // Make sure buffer is empty
-	// get file data
-	pbuf->sgetn(xml_buffer_to_parse, size);
-	xml_stream.close();
-
-	for (uint32_t i = 0; i < size; i++) {
-		if (xml_buffer_to_parse[i] == 92) {
-			xml_buffer_to_parse[i] = 47; // Replace \ with /
-		}
-		if (xml_buffer_to_parse[i] == -51) {
-			//std::cout << "found 9552 (or -51) char"; // Sometimes there are strange chars at the end of file. No clue where they came from.
-			xml_buffer_to_parse[i] = 0;
-		}
-	}
+	cfg_path = description.cfg_path;
+	mesh_radius = description.mesh_radius;
 
-	// std::cout << "File: \n" << xml_buffer_to_parse << std::endl;
+	if (!description.has_models_tag) {
+		log << "Has no models tag" << std::endl;
+		return;
+	}
+	// CfgMaterials point into textures, so it must never reallocate
+	size_t texture_slot_count = 0;
+	for (const CfgModelDescription& model_description : description.models) {
+		texture_slot_count += model_description.materials.size() * texture_types_count;
+	}
+	textures.reserve(texture_slot_count);
 
-	// Reading XML file using rapidxml
-	xml_document<> doc;
-	doc.parse<0>(xml_buffer_to_parse);
-	xml_node<>* mesh_radius_tag = doc.first_node()->first_node("MeshRadius", 10);
-	mesh_radius = 4;
-	if (mesh_radius_tag) {
+	fs::path data_path = find_datapath(description.cfg_path);
+	for (const CfgModelDescription& model_description : description.models) {
 		try {
-			mesh_radius = std::stof(std::string(mesh_radius_tag->value(), mesh_radius_tag->value_size()));
+			cfg_models.push_back(CfgModel(model_description, data_path, &textures, default_textures, cli_options, log));
 		}
-		catch (std::exception) {
-			mesh_radius = 4;
+		catch (snow_exception exception) {
+			log << "Skip this Model, but process the rest of this cfg" << std::endl;
 		}
 	}
+}
+
+size_t CfgFile::estimate_memory_bytes(const SnowOptions& cli_options, bool is_rendered)
+{
+	// Per texel: RGBA8 source + RGBA8 snowed texture on the graphics card, all at full size, also for textures that
+	// are only decoded in parts. A diffuse texture adds its depth snowmap (2 bytes), a saved one the pixel buffer it
+	// is read back through (RGBA8). The memory for compressing it is reserved by TextureEncoder::save_dds, per texture
+	// until it is written.
+	// Textures processed in tiles only have tiles on the graphics card, the same ones for all of them. Their bands are
+	// reserved by TextureEncoder::add_band.
+	mark_tiled_textures(cli_options, is_rendered);
+	size_t estimate = 0;
+	for (Texture& texture : textures) {
+		if (texture.is_tiled) continue;
+		size_t width, height;
+		if (!get_dds_dimensions(texture.abs_path.wstring(), &width, &height)) continue;
+		size_t bytes_per_texel = 4 + 4;
+		if (texture.type == 0) bytes_per_texel += 2;
+		if (texture.type != 1 && texture.save_snowed_texture) bytes_per_texel += 4;
+		estimate += width * height * bytes_per_texel;
+	}
+	return estimate;
+}
 
-	xml_node<>* models_tag = doc.first_node()->first_node("Models", 6);
+// Where each path id was last added to a vector of textures. Per thread: .cfg files are resolved on several.
+static thread_local path_table::SlotTable texture_slots;
 
-	if (models_tag) {
-		for (xml_node<>* model_tag = models_tag->first_node();
-			model_tag;
-			model_tag = model_tag->next_sibling())
-		{
-			//std::cout << "Found a model tag" << std::endl;
-			try {
-				cfg_models.push_back(CfgModel(model_tag, find_datapath(input_filepath), &all_textures, default_textures, cli_options));
-			}
-			catch (snow_exception exception) {
-				std::cout << "Skip this Model, but process the rest of this cfg" << std::endl;
+Texture* find_texture_by_id(std::vector<Texture>* textures, uint32_t path_id)
+{
+	uint32_t slot = texture_slots.get(path_id);
+	if (slot < textures->size() && (*textures)[slot].path_id == path_id) return &(*textures)[slot];
+	return nullptr;
+}
+
+Texture* add_texture(std::vector<Texture>* textures, const Texture& texture)
+{
+	textures->push_back(texture);
+	texture_slots.set(texture.path_id, uint32_t(textures->size() - 1));
+	return &textures->back();
+}
+
+void CfgFile::load_models_and_textures(const SnowOptions& cli_options, bool is_rendered)
+{
+	// The meshes first: they decide which parts of the textures are decoded
+	for (auto& cfg_model : cfg_models) {
+		cfg_model.load_model();
+	}
+	mark_tiled_textures(cli_options, is_rendered);
+	for (Texture& texture : textures) {
+		if (!texture.is_tiled) texture.decoded_tiles = find_decoded_tiles(texture, cli_options, is_rendered);
+		texture.load();
+	}
+}
+
+static bool uses_texture(const CfgMaterial& cfg_material, const Texture* texture)
+{
+	for (int i = 0; i < texture_types_count; i++) {
+		if (cfg_material.textures[i] == texture) return true;
+	}
+	return false;
+}
+
+bool is_processed_in_tiles(const Texture& diffuse_texture, const std::vector<const Texture*>& combined_textures,
+	const SnowOptions& cli_options, bool is_rendered)
+{
+	size_t width, height;
+	DXGI_FORMAT format;
+	if (!get_dds_dimensions(diffuse_texture.abs_path.wstring(), &width, &height, &format)) return false;
+	if (!DirectX::IsCompressed(format) || !is_processed_in_bands(width, height)) return false;
+	for (const Texture* texture : combined_textures) {
+		size_t texture_width, texture_height;
+		if (!get_dds_dimensions(texture->abs_path.wstring(), &texture_width, &texture_height, &format)) return false;
+		if (!DirectX::IsCompressed(format) || texture_width != width || texture_height != height) return false;
+	}
+	GLint max_texture_size = 0;
+	glGetIntegerv(GL_MAX_TEXTURE_SIZE, &max_texture_size);
+	if (width > size_t(max_texture_size) || height > size_t(max_texture_size)) return true;
+	// In atlas mode, the rendering uses the textures combined again for it: the snowmaps, which are kept across the
+	// .cfg files, must not depend on it
+	return !cli_options.save_png && (!is_rendered || cli_options.atlas_mode);
+}
+
+void CfgFile::mark_tiled_textures(const SnowOptions& cli_options, bool is_rendered)
+{
+	for (Texture& texture : textures) {
+		texture.is_tiled = false;
+		if (texture.type != 0) continue;
+		std::vector<const Texture*> combined_textures;
+		bool is_only_diffuse = true;
+		for (const CfgModel& cfg_model : cfg_models) {
+			for (const CfgMaterial& cfg_material : cfg_model.cfg_materials) {
+				if (cfg_material.textures[0] != &texture) {
+					if (uses_texture(cfg_material, &texture)) is_only_diffuse = false;
+					continue;
+				}
+				for (int i = 1; i < texture_types_count; i++) {
+					if (cfg_material.textures[i]->has_file()) combined_textures.push_back(cfg_material.textures[i]);
+				}
 			}
 		}
+		texture.is_tiled = is_only_diffuse && is_processed_in_tiles(texture, combined_textures, cli_options, is_rendered);
 	}
-	else {
-		std::cout << "Has no models tag" << std::endl;
+	// The diffuse textures are decided, the other textures follow them
+	for (Texture& texture : textures) {
+		if (texture.type == 0) continue;
+		bool is_used = false;
+		bool is_only_with_tiled = true;
+		for (const CfgModel& cfg_model : cfg_models) {
+			for (const CfgMaterial& cfg_material : cfg_model.cfg_materials) {
+				if (!uses_texture(cfg_material, &texture)) continue;
+				is_used = true;
+				if (!cfg_material.textures[0]->is_tiled) is_only_with_tiled = false;
+			}
+		}
+		texture.is_tiled = is_used && is_only_with_tiled;
 	}
-	delete[] xml_buffer_to_parse;
 }
 
-void CfgFile::load_models_and_textures()
+std::shared_ptr<const TileMask> CfgFile::find_decoded_tiles(const Texture& texture, const SnowOptions& cli_options, bool is_rendered)
 {
-	for (auto& [texture_path, texture] : all_textures) {
-		texture.load();
+	if (cli_options.full_decode) return nullptr;
+	size_t width, height;
+	DXGI_FORMAT format;
+	if (!get_dds_dimensions(texture.abs_path.wstring(), &width, &height, &format) || !DirectX::IsCompressed(format)) return nullptr;
+	if (texture.type != 1 && texture.save_snowed_texture) {
+		// Everything that is saved or shown besides the .dds files needs the whole texture
+		if (texture.type == 0 && is_rendered) return nullptr;
+		// In atlas mode, the texture is saved at the end, loaded again completely (see AtlasSnowmaps)
+		if (!cli_options.atlas_mode) {
+			if (cli_options.save_png) return nullptr;
+			if (cli_options.save_dds) {
+				DXGI_FORMAT output_format = get_output_dds_format(format,
+					texture.type == 0 ? cli_options.diff_dds_format : cli_options.metal_dds_format);
+				if (!can_pass_blocks_through(texture.get_abs_path_until_mipmap_indication(), texture.mipmap_count, output_format)) return nullptr;
+			}
+		}
 	}
-	for (auto& cfg_model : cfg_models) {
-		cfg_model.load_model();
+
+	std::vector<const Texture*> diffuse_textures; // Whose snowmaps the texture is combined with
+	for (const CfgModel& cfg_model : cfg_models) {
+		for (const CfgMaterial& cfg_material : cfg_model.cfg_materials) {
+			if (uses_texture(cfg_material, &texture)) diffuse_textures.push_back(cfg_material.textures[0]);
+		}
 	}
+	TileMask tiles = TileMask(int(width), int(height));
+	for (const CfgModel& cfg_model : cfg_models) {
+		if (cfg_model.cfg_materials.empty() || !cfg_model.mesh) continue;
+		const HardwareRdm& mesh = *cfg_model.mesh;
+		for (size_t j = 0; j < mesh.materials.size(); j++) {
+			// The material of the mesh refers to a material of the .cfg the same way as when drawing
+			size_t cfg_material_index = mesh.materials[j].index < cfg_model.cfg_materials.size() ? mesh.materials[j].index : cfg_model.cfg_materials.size() - 1;
+			const CfgMaterial& cfg_material = cfg_model.cfg_materials[cfg_material_index];
+			if (uses_texture(cfg_material, &texture)
+				|| std::find(diffuse_textures.begin(), diffuse_textures.end(), cfg_material.textures[0]) != diffuse_textures.end()) {
+				mesh.mark_snow_footprint(j, cfg_material.vertex_format, cli_options.snow_parameters.min_normal_y, &tiles);
+			}
+		}
+	}
+	// The combine pass reads the neighbouring texels
+	tiles.dilate();
+	if (tiles.is_everything_marked()) return nullptr;
+	return std::make_shared<const TileMask>(tiles);
 }
 
 
-CfgModel::CfgModel(rapidxml::xml_node<>* input_node, std::filesystem::path data_path,
-	std::unordered_map<std::string, Texture>* all_textures, std::vector<Texture>* default_textures, CliOptions cli_options)
+CfgModel::CfgModel(const CfgModelDescription& description, std::filesystem::path data_path,
+	std::vector<Texture>* cfg_textures, std::vector<Texture>* default_textures, const SnowOptions& cli_options, std::ostream& log)
 {
-	// std::cout << "FileName: " << input_node->first_node("FileName", 8)->value() << std::endl;
+	if (!description.error.empty()) throw snow_exception(description.error.c_str());
 
-	std::string relative_path = std::string(input_node->first_node(cfg_constants::rdm_filename_in_cfg)->value());
+	std::string relative_path = description.file_name;
 	rdm_filename = backward_to_forward_slashes(fs::path(data_path).append(relative_path));
 
 	// This one is mainly for data/dlc09/graphics/buildings/residence/residence_tier05_01/residence_tier05_01_02.cfg
@@ -170,125 +282,126 @@ CfgModel::CfgModel(rapidxml::xml_node<>* input_node, std::filesystem::path data_
 	
 	if (!rdm_filename.string().ends_with(".rdm")) throw snow_exception("FileName is not an RDM file");
 	
-	if (!fs::exists(rdm_filename)) {
+	if (!source_file_exists(rdm_filename)) {
 		if (cli_options.has_extracted_maindata_path) {
 			rdm_filename = fs::path(cli_options.extracted_maindata_path).append(relative_path);
 		}
-		if (fs::exists(rdm_filename)) {
-			std::cout << "Load mesh from extracted maindata: " << rdm_filename.string() << std::endl;
+		if (source_file_exists(rdm_filename)) {
+			log << "Load mesh from extracted maindata: " << rdm_filename.string() << std::endl;
 		}
 		else if (!relative_path.ends_with("_lod0.rdm")) {
 			relative_path = relative_path.substr(0, relative_path.length() - 4) + "_lod0.rdm"; // As e.g. in heavy_02.cfg
 			rdm_filename = backward_to_forward_slashes(fs::path(data_path).append(relative_path));
-			if (!fs::exists(rdm_filename) && cli_options.has_extracted_maindata_path) {
+			if (!source_file_exists(rdm_filename) && cli_options.has_extracted_maindata_path) {
 				rdm_filename = fs::path(cli_options.extracted_maindata_path).append(relative_path);
-				std::cout << "Load mesh from extracted maindata: " << rdm_filename.string() << std::endl;
+				log << "Load mesh from extracted maindata: " << rdm_filename.string() << std::endl;
 			}
 		}
 	}
 
-	xml_node<>* materials_tag = input_node->first_node("Materials", 9);
-	for (xml_node<>* material_tag = materials_tag->first_node();
-		material_tag;
-		material_tag = material_tag->next_sibling())
-	{
-		//std::cout << "Found a material tag" << std::endl;
-		cfg_materials.push_back(CfgMaterial(material_tag, data_path, all_textures, default_textures, cli_options));
+	rdm_path_id = path_table::intern(rdm_filename.string());
+
+	for (const CfgMaterialDescription& material_description : description.materials) {
+		cfg_materials.push_back(CfgMaterial(material_description, data_path, cfg_textures, default_textures, cli_options, log));
 	}
 }
 
+std::vector<fs::path> CfgFile::get_source_files() const
+{
+	std::vector<fs::path> source_files;
+	for (const CfgModel& cfg_model : cfg_models) source_files.push_back(cfg_model.rdm_filename);
+	for (const Texture& texture : textures) source_files.push_back(texture.abs_path);
+	return source_files;
+}
+
 void CfgModel::load_model()
 {
-	mesh.load_rdm(rdm_filename);
+	ProfileScope scope("load_mesh", rdm_filename.string());
+	mesh = mesh_cache::get(rdm_filename, rdm_path_id);
 }
 
+void CfgModel::build_snow_indices(float min_normal_y)
+{
+	if (cfg_materials.empty() || !mesh) return;
+	ProfileScope scope("cull_triangles", rdm_filename.string());
+	// The material of the mesh refers to a material of the .cfg the same way as when drawing
+	std::vector<std::string> vertex_formats;
+	for (const Material& material : mesh->materials) {
+		size_t cfg_material_index = material.index < cfg_materials.size() ? material.index : cfg_materials.size() - 1;
+		vertex_formats.push_back(cfg_materials[cfg_material_index].vertex_format);
+	}
+	mesh->build_snow_indices(vertex_formats, min_normal_y);
+}
 
-CfgMaterial::CfgMaterial(rapidxml::xml_node<>* input_node, std::filesystem::path data_path,
-	std::unordered_map<std::string, Texture>* all_textures, std::vector<Texture>* default_textures, CliOptions cli_options)
+
+CfgMaterial::CfgMaterial(const CfgMaterialDescription& description, std::filesystem::path data_path,
+	std::vector<Texture>* cfg_textures, std::vector<Texture>* default_textures, const SnowOptions& cli_options, std::ostream& log)
 {
-	//std::cout << "\n\nReading a material of ConfigType " << input_node->first_node("ConfigType")->value() << std::endl;
-	vertex_format = input_node->first_node("VertexFormat")->value();
+	vertex_format = description.vertex_format;
 
 	for (int i = 0; i < texture_types_count; i++) {
-		rapidxml::xml_node<>* texture_exists_node = input_node->first_node(cfg_constants::textures_exist_tagname_in_cfg[i]);
-		rapidxml::xml_node<>* texture_path_node = input_node->first_node(cfg_constants::textures_path_tagname_in_cfg[i]);
+		const CfgTextureSlot& slot = description.textures[i];
 
 		bool is_texture_valid = false;
 		std::string texture_rel_path = cfg_constants::default_texture_paths[i];
 		textures[i] = &(*default_textures)[i];
 
-		if (texture_exists_node == nullptr) {
-			std::cout << "WARNING: " << cfg_constants::texture_names[i] << " is neither enabled or disabled." << std::endl;
-			std::cout << "There is no <" << cfg_constants::textures_exist_tagname_in_cfg[i] << "> tag. ";
+		if (!slot.has_enabled_tag) {
+			log << "WARNING: " << cfg_constants::texture_names[i] << " is neither enabled or disabled." << std::endl;
+			log << "There is no <" << cfg_constants::textures_exist_tagname_in_cfg[i] << "> tag. ";
 		}
-		else if (texture_exists_node->value_size() != 1) {
-			std::cout << "WARNING: " << cfg_constants::texture_names[i] << " is disabled.";
+		else if (slot.enabled_value.size() != 1) {
+			log << "WARNING: " << cfg_constants::texture_names[i] << " is disabled.";
 		}
-		else if (texture_exists_node->value()[0] != '1') {
-			std::cout << "WARNING: " << cfg_constants::texture_names[i] << " is disabled. ";
-			std::cout << cfg_constants::textures_exist_tagname_in_cfg[i] << " = \"" << texture_exists_node->value() << "\"" << std::endl;
+		else if (slot.enabled_value[0] != '1') {
+			log << "WARNING: " << cfg_constants::texture_names[i] << " is disabled. ";
+			log << cfg_constants::textures_exist_tagname_in_cfg[i] << " = \"" << slot.enabled_value << "\"" << std::endl;
 		}
-		else if (texture_path_node == nullptr) {
+		else if (!slot.has_path_tag) {
 			// Only in data/graphics/ui/3d_objects/world_map/world_map_01.cfg
-			std::cout << "WARNING: There is no <" << cfg_constants::textures_path_tagname_in_cfg[i] << "> tag. ";
+			log << "WARNING: There is no <" << cfg_constants::textures_path_tagname_in_cfg[i] << "> tag. ";
 		}
 		else {
 			// Program reaches this point if there is a texture specified in the .cfg
 
-			texture_rel_path = std::string(texture_path_node->value(), texture_path_node->value_size()); // Read from xml
+			texture_rel_path = slot.path; // Read from xml
 			texture_rel_path = remove_whitespaces_at_end(texture_rel_path); // jje1000/[Gameplay] Bourse V2 GU16/data/moddinggraphics_16/buildings/public/bourse/bourse.cfg
-			int n = 0;
-			while ((n = texture_rel_path.find("\\\\", n)) != std::string::npos) {
-				texture_rel_path.replace(n, 2, "/");
-				n++;
-			}
-			std::replace(texture_rel_path.begin(), texture_rel_path.end(), '/', '\\');
+			texture_rel_path = path_table::normalize(texture_rel_path);
 			if (texture_rel_path.ends_with(".psd") || texture_rel_path.ends_with(".png")) {
 				texture_rel_path = texture_rel_path.substr(0, texture_rel_path.size() - 4) + "_0.dds";
 			}
 			if (is_forbidden_texture(texture_rel_path) && !cli_options.atlas_mode && !cli_options.disable_texture_blacklist) {
-				std::cout << "Texture is blacklisted: " << texture_rel_path << std::endl;
+				log << "Texture is blacklisted: " << texture_rel_path << std::endl;
 			}
 			else {
-				if (all_textures->contains(texture_rel_path)) {
-					textures[i] = &(all_textures->at(texture_rel_path));
+				Texture* known_texture = find_texture_by_id(cfg_textures, path_table::intern(texture_rel_path));
+				if (known_texture) {
+					textures[i] = known_texture;
 					is_texture_valid = true;
 				}
 				else {
 				    // Texture is not used by other materials yet. Try to load it from file.
-					fs::path texture_abs_path;
-					if (cli_options.atlas_mode) {
-						texture_abs_path = backward_to_forward_slashes(fs::path(cli_options.out_path).append(texture_rel_path));
-						if (!fs::exists(texture_abs_path)) texture_abs_path = backward_to_forward_slashes(
-							fs::path(data_path).append(texture_rel_path));
-					}
-					else {
-						texture_abs_path = backward_to_forward_slashes(
-							fs::path(data_path).append(texture_rel_path));
-					}
+					fs::path texture_abs_path = backward_to_forward_slashes(fs::path(data_path).append(texture_rel_path));
 
-					if (fs::exists(texture_abs_path)) {
-						all_textures->insert(std::pair<std::string, Texture>(texture_rel_path,
-							Texture(texture_rel_path, texture_abs_path, cli_options.out_path, i, true)));
-						textures[i] = &(all_textures->at(texture_rel_path));
+					if (source_file_exists(texture_abs_path)) {
+						textures[i] = add_texture(cfg_textures, Texture(texture_rel_path, texture_abs_path, cli_options.out_path, i, true));
 						is_texture_valid = true;
 					}
 					else if (cli_options.has_extracted_maindata_path) {
-						std::cout << "Texture not found: " << texture_abs_path << std::endl;
+						log << "Texture not found: " << texture_abs_path << std::endl;
 						// Try to load from the extracted maindata if the texture is not part of the mod we are generating snow for
 						texture_abs_path = backward_to_forward_slashes(fs::path(cli_options.extracted_maindata_path).append(texture_rel_path));
-						if (fs::exists(texture_abs_path)) {
-							all_textures->insert(std::pair<std::string, Texture>(texture_rel_path,
-								Texture(texture_rel_path, texture_abs_path, cli_options.out_path, i, cli_options.save_non_mod_textures)));
-							textures[i] = &(all_textures->at(texture_rel_path));
+						if (source_file_exists(texture_abs_path)) {
+							textures[i] = add_texture(cfg_textures,
+								Texture(texture_rel_path, texture_abs_path, cli_options.out_path, i, cli_options.save_non_mod_textures));
 							is_texture_valid = true;
 						}
 						else {
-							std::cout << "Texture not found: " << texture_rel_path << std::endl;
+							log << "Texture not found: " << texture_rel_path << std::endl;
 						}
 					}
 					else {
-						std::cout << "Texture not found: " << texture_rel_path << std::endl;
+						log << "Texture not found: " << texture_rel_path << std::endl;
 					}
 				}
 			}
@@ -296,12 +409,17 @@ CfgMaterial::CfgMaterial(rapidxml::xml_node<>* input_node, std::filesystem::path
 
 		if (!is_texture_valid) {
 			textures[i] = &((*default_textures)[i]);
-			std::cout << "Use default texture instead." << std::endl;
+			log << "Use default texture instead." << std::endl;
 		}
 	}
 }
 
 void CfgMaterial::bind_textures(GLuint shader_program_id)
+{
+	::bind_textures(textures, shader_program_id);
+}
+
+void bind_textures(Texture* const* textures, GLuint shader_program_id)
 {
 	for (int i = 0; i < texture_types_count; i++) {
 		GLuint texture_location_in_shader = glGetUniformLocation(shader_program_id, cfg_constants::texture_names[i]);
@@ -315,6 +433,7 @@ void CfgMaterial::bind_textures(GLuint shader_program_id)
 Texture::Texture(std::string texture_rel_path, std::filesystem::path texture_abs_path, std::filesystem::path out_base_path, int texture_type, bool texture_save_snowed_texture)
 {
 	rel_path = texture_rel_path;
+	path_id = path_table::intern(rel_path);
 	abs_path = texture_abs_path;
 	out_path = backward_to_forward_slashes(fs::path(out_base_path).append(
 		rel_path.substr(0, rel_path.size() - 5)));
@@ -323,9 +442,9 @@ Texture::Texture(std::string texture_rel_path, std::filesystem::path texture_abs
 	save_snowed_texture = texture_save_snowed_texture;
 
 	// Count mipmaps
-	std::string abs_path_until_mipmap_indication = abs_path.string().substr(0, abs_path.string().size() - 5);
+	fs::path abs_path_until_mipmap_indication = get_abs_path_until_mipmap_indication();
 	for (mipmap_count = 0;
-		std::filesystem::exists(
+		source_file_exists(
 			fs::path(abs_path_until_mipmap_indication).concat(
 				std::to_string(mipmap_count)).concat(  // The mipmap level as a string
 					".dds"));
@@ -337,14 +456,29 @@ Texture::Texture(std::string texture_rel_path, std::filesystem::path texture_abs
 void Texture::load()
 {
 	if (is_loaded) return;
-	texture_id = dds_file_to_gl_texture(abs_path);
+	DXGI_FORMAT format = DXGI_FORMAT_UNKNOWN;
+	if (is_tiled) {
+		size_t width, height;
+		if (get_dds_dimensions(abs_path.wstring(), &width, &height, &format)) source_format = format;
+		is_loaded = true;
+		return;
+	}
+	ProfileScope scope("decode_texture", abs_path.string());
+	texture_id = dds_file_to_gl_texture(abs_path, &format, decoded_tiles.get());
+	source_format = format;
 	is_loaded = true;
 }
 
+fs::path Texture::get_abs_path_until_mipmap_indication() const
+{
+	return fs::path(abs_path.string().substr(0, abs_path.string().size() - 5));
+}
+
 void Texture::cleanup()
 {
-	glDeleteTextures(1, &texture_id);
-	glDeleteTextures(1, &snowed_texture_id);
+	delete_gl_texture(&texture_id);
+	delete_gl_texture(&snowed_texture_id);
+	is_loaded = false;
 }
 
 Texture::~Texture()
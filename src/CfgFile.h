@@ -5,37 +5,14 @@
 #include <iostream>
 #include <algorithm>
 #include <filesystem>
-#include <unordered_map>
+#include <memory>
 #include "../external/glew-2.2.0/include/GL/glew.h"
 #include "../external/glfw-3.3.6/include/GLFW/glfw3.h"
-#include "../external/rapidxml/rapidxml.hpp"
 
 #include "rdm2gl.h"
-#include "cli_options.h"
-
-#define texture_types_count 3
-
-namespace cfg_constants {
-	enum class texture_names { diff, norm, metallic };
-
-	// These 'texture names' are used as names in the shader and for debug output
-	inline const char* texture_names[] = { "diff_texture", "norm_texture", "metallic_texture" };
-	// In a .cfg file, the tag <DIFFUSE_ENABLED> tells whether the diffuse texture is enabled (similar for the other textures)
-	inline const char* textures_exist_tagname_in_cfg[] = { "DIFFUSE_ENABLED", "NORMAL_ENABLED", "METALLIC_TEX_ENABLED" };
-	// In a .cfg file, the tag <cModelDiffTex> tells the relative diffuse texture path (similar for the other textures)
-	inline const char* textures_path_tagname_in_cfg[] = { "cModelDiffTex", "cModelNormalTex", "cModelMetallicTex" };
-	// Use these textures when no real texture specified
-	inline const char* default_texture_paths[] = {
-		"data/graphics/effects/default_model_diffuse.psd",
-		"data/graphics/effects/default_model_normal.psd",
-		"data/graphics/effects/default_model_mask.psd" };
-	inline const uint32_t default_texture_colors[] = {
-		255,
-		8421376,
-		0,
-	};
-	inline const char* rdm_filename_in_cfg = "FileName";
-}
+#include "snow_options.h"
+#include "cfg_parser.h"
+
 std::filesystem::path find_datapath(std::filesystem::path path_into_data);
 
 std::string remove_whitespaces_at_end(std::string original);
@@ -45,13 +22,20 @@ std::filesystem::path backward_to_forward_slashes(std::filesystem::path original
 class Texture
 {
 public:
-    std::string rel_path;
+    std::string rel_path; // Normalized by path_table
+	uint32_t path_id; // Id of rel_path in the path_table
 	std::filesystem::path abs_path;
 	std::filesystem::path out_path;
 
 	int type; // 0=diffuse; 1=normal; 2=metallic
 	
 	size_t mipmap_count;
+	uint32_t source_format = 0; // DXGI_FORMAT of the .dds file, set by load(). 0 = unknown
+	// If set, load() decodes only these tiles, and the other blocks of the saved texture are copied from the original
+	std::shared_ptr<const TileMask> decoded_tiles;
+	// Drawn, combined and saved one tile at a time by snowgen::Generator, straight from the .dds file: load() leaves it
+	// without a GL texture. Set by CfgFile, see is_processed_in_tiles().
+	bool is_tiled = false;
 	GLuint texture_id = 0;
 	GLuint snowed_texture_id = 0;
 
@@ -63,10 +47,31 @@ public:
 	Texture(std::string texture_rel_path, std::filesystem::path texture_abs_path, std::filesystem::path out_base_path, int texture_type, bool texture_save_snowed_texture);
 	void load();
 	void cleanup();
+	// abs_path without the "0.dds" of miplevel 0
+	std::filesystem::path get_abs_path_until_mipmap_indication() const;
+	// The default textures (see load_default_textures) have no file
+	bool has_file() const { return !abs_path.empty(); }
 	~Texture();
 };
 
-std::vector<Texture> load_default_textures(void);
+// Without upload_to_gl, the default textures can be used to parse .cfg files before GL is initialized
+std::vector<Texture> load_default_textures(bool upload_to_gl = true);
+
+// O(1): the textures are found through a path_table::SlotTable of the calling thread, which only knows those added with
+// add_texture() on it since. For resolving one .cfg file, not for looking up textures of a CfgFile later.
+Texture* find_texture_by_id(std::vector<Texture>* textures, uint32_t path_id);
+// Appends a copy of texture. Returns the copy.
+Texture* add_texture(std::vector<Texture>* textures, const Texture& texture);
+
+// Binds the diffuse, normal and metallic texture to the samplers of the shader program
+void bind_textures(Texture* const* textures, GLuint shader_program_id);
+
+// Whether a diffuse texture is drawn, combined and saved in tiles (see Texture::is_tiled), with the normal and metallic
+// textures of the materials that combine it, without the default textures. They must be block-compressed, of the same
+// size, and processed in bands (see is_processed_in_bands). Those that fit into GL_MAX_TEXTURE_SIZE stay whole if
+// they are shown or saved as .png. Reads only the headers of the .dds files. Needs the GL context.
+bool is_processed_in_tiles(const Texture& diffuse_texture, const std::vector<const Texture*>& combined_textures,
+	const SnowOptions& cli_options, bool is_rendered);
 
 class CfgMaterial
 {
@@ -74,8 +79,8 @@ public:
 	Texture* textures[texture_types_count];
 	std::string vertex_format;
 
-	CfgMaterial(rapidxml::xml_node<>* input_node, std::filesystem::path data_path,
-		std::unordered_map<std::string, Texture>* all_textures, std::vector<Texture>* default_textures, CliOptions cli_options);
+	CfgMaterial(const CfgMaterialDescription& description, std::filesystem::path data_path,
+		std::vector<Texture>* cfg_textures, std::vector<Texture>* default_textures, const SnowOptions& cli_options, std::ostream& log);
 	
 	void bind_textures(GLuint shader_program_id);
 };
@@ -83,24 +88,47 @@ public:
 class CfgModel
 {
 public:
-	CfgModel(rapidxml::xml_node<>* input_node, std::filesystem::path data_path,
-		std::unordered_map<std::string, Texture>* all_textures, std::vector<Texture>* default_textures, CliOptions cli_options);
+	CfgModel(const CfgModelDescription& description, std::filesystem::path data_path,
+		std::vector<Texture>* cfg_textures, std::vector<Texture>* default_textures, const SnowOptions& cli_options, std::ostream& log);
 	void load_model();
+	// Index buffer without the triangles that cannot receive snow (see HardwareRdm::build_snow_indices)
+	void build_snow_indices(float min_normal_y);
 
 	std::filesystem::path rdm_filename;
+	uint32_t rdm_path_id; // Id of rdm_filename in the path_table
 
 	std::vector<CfgMaterial> cfg_materials;
-	HardwareRdm mesh;
+	std::shared_ptr<HardwareRdm> mesh; // From the mesh_cache, set by load_model()
 
 };
 
 class CfgFile
 {
 public:
-	CfgFile(std::filesystem::path input_filepath, std::vector<Texture>* default_textures, CliOptions cli_options);
-	void load_models_and_textures();
+	// Resolves the paths of the meshes and textures. Throws snow_exception if the description has an error.
+	// Missing and disabled textures are reported on log.
+	CfgFile(const CfgDescription& description, std::vector<Texture>* default_textures, const SnowOptions& cli_options,
+		std::ostream& log = std::cout);
+	// Reads only the headers of the .dds files. The arguments are those of load_models_and_textures().
+	size_t estimate_memory_bytes(const SnowOptions& cli_options, bool is_rendered);
+	// is_rendered: the snowed diffuse textures are shown in the preview or saved as renderings, so they must be decoded
+	// completely. Otherwise, textures are only decoded where snow can reach them, unless --full_decode.
+	void load_models_and_textures(const SnowOptions& cli_options, bool is_rendered);
 
 	std::vector<CfgModel> cfg_models;
-	std::unordered_map<std::string, Texture> all_textures;
+	// All textures of this .cfg besides the default textures. Reserved up front, CfgMaterials point into it.
+	std::vector<Texture> textures;
+	// The .rdm files and miplevel 0 of the .dds files this .cfg loads, without the default textures
+	std::vector<std::filesystem::path> get_source_files() const;
+	std::filesystem::path cfg_path;
 	float mesh_radius;
+
+private:
+	// Sets Texture::is_tiled: for diffuse textures that are processed in tiles, and for the other textures that are
+	// only combined with those
+	void mark_tiled_textures(const SnowOptions& cli_options, bool is_rendered);
+	// The tiles of texture that the snow pass reads or writes: under the triangles of the materials that use it, and,
+	// since the combine pass works on whole snowmaps, of all materials that share a diffuse texture with those.
+	// nullptr if the texture has to be decoded completely.
+	std::shared_ptr<const TileMask> find_decoded_tiles(const Texture& texture, const SnowOptions& cli_options, bool is_rendered);
 };
@@ -0,0 +1,240 @@
+#include "atlas_snowmaps.h"
+
+#include <algorithm>
+#include <iostream>
+#include <iterator>
+
+#include "memory_accounting.h"
+
+namespace fs = std::filesystem;
+
+constexpr size_t max_token_length = 0x8000;
+
+AtlasSnowmaps::AtlasSnowmaps(size_t spill_limit, fs::path sidecar_path) : limit(spill_limit), sidecar(sidecar_path)
+{
+}
+
+AtlasSnowmaps::~AtlasSnowmaps()
+{
+	memory_accounting::remove(memory_accounting::Category::snowmaps, memory_bytes);
+	if (sidecar_file.is_open()) {
+		sidecar_file.close();
+		std::error_code error;
+		fs::remove(sidecar, error);
+	}
+}
+
+void AtlasSnowmaps::encode(const uint16_t* values, size_t count, std::vector<uint16_t>* encoded)
+{
+	auto run_length_at = [&](size_t start) {
+		size_t end = start + 1;
+		while (end < count && end - start < max_token_length && values[end] == values[start]) end++;
+		return end - start;
+	};
+	encoded->clear();
+	size_t i = 0;
+	while (i < count) {
+		size_t run_length = run_length_at(i);
+		if (run_length >= 3) {
+			encoded->push_back(uint16_t(0x8000 | (run_length - 1)));
+			encoded->push_back(values[i]);
+			i += run_length;
+			continue;
+		}
+		// Copy up to the next run
+		size_t copy_start = i;
+		size_t copy_end = i + run_length;
+		while (copy_end < count && copy_end - copy_start < max_token_length) {
+			size_t next_run_length = run_length_at(copy_end);
+			if (next_run_length >= 3) break;
+			copy_end = std::min(copy_end + next_run_length, copy_start + max_token_length);
+		}
+		encoded->push_back(uint16_t(copy_end - copy_start - 1));
+		encoded->insert(encoded->end(), values + copy_start, values + copy_end);
+		i = copy_end;
+	}
+}
+
+bool AtlasSnowmaps::decode(const std::vector<uint16_t>& encoded, size_t count, uint16_t* values)
+{
+	size_t decoded_count = 0;
+	for (size_t i = 0; i < encoded.size();) {
+		size_t length = size_t(encoded[i] & 0x7FFF) + 1;
+		bool is_run = (encoded[i] & 0x8000) != 0;
+		i++;
+		if (decoded_count + length > count) return false;
+		if (is_run) {
+			if (i >= encoded.size()) return false;
+			std::fill(values + decoded_count, values + decoded_count + length, encoded[i]);
+			i++;
+		}
+		else {
+			if (i + length > encoded.size()) return false;
+			std::copy(encoded.begin() + i, encoded.begin() + i + length, values + decoded_count);
+			i += length;
+		}
+		decoded_count += length;
+	}
+	return decoded_count == count;
+}
+
+bool AtlasSnowmaps::load(uint32_t diffuse_path_id, int width, int height, std::vector<uint16_t>* depth_values, uint32_t part)
+{
+	auto found = entries.find(diffuse_path_id);
+	if (found == entries.end() || part >= found->second.parts.size()) return false;
+	Part& entry = found->second.parts[part];
+	// A part that was never stored, because a later one was
+	if (entry.width == 0) return false;
+	if (entry.width != width || entry.height != height) {
+		std::cout << "WARNING: The atlas changed its size, its earlier snow is dropped" << std::endl;
+		return false;
+	}
+	depth_values->resize(size_t(width) * height);
+	if (!entry.is_spilled) return decode(entry.encoded, depth_values->size(), depth_values->data());
+
+	std::vector<uint16_t> encoded(entry.sidecar_size);
+	sidecar_file.seekg(std::streamoff(entry.sidecar_offset));
+	sidecar_file.read((char*)encoded.data(), std::streamsize(encoded.size() * sizeof(uint16_t)));
+	if (!sidecar_file) {
+		sidecar_file.clear();
+		std::cout << "WARNING: Could not read " << sidecar.string() << ", the earlier snow of an atlas is dropped" << std::endl;
+		return false;
+	}
+	return decode(encoded, depth_values->size(), depth_values->data());
+}
+
+void AtlasSnowmaps::store(uint32_t diffuse_path_id, int width, int height, const std::vector<uint16_t>& depth_values, uint32_t part)
+{
+	Entry& atlas = entries[diffuse_path_id];
+	if (part >= atlas.parts.size()) atlas.parts.resize(size_t(part) + 1);
+	PartKey key(diffuse_path_id, part);
+	forget_in_memory(key);
+	Part& entry = atlas.parts[part];
+	if (entry.is_spilled) free_in_sidecar(entry.sidecar_offset, entry.sidecar_size * sizeof(uint16_t));
+	entry.width = width;
+	entry.height = height;
+	encode(depth_values.data(), std::min(depth_values.size(), size_t(width) * height), &entry.encoded);
+	entry.encoded.shrink_to_fit();
+	entry.is_spilled = false;
+	size_t entry_bytes = entry.encoded.size() * sizeof(uint16_t);
+	memory_bytes += entry_bytes;
+	memory_accounting::add(memory_accounting::Category::snowmaps, entry_bytes);
+	in_memory_order.push_back(key);
+	if (!atlas.is_changed) changed_ids.push_back(diffuse_path_id);
+	atlas.is_changed = true;
+	spill();
+}
+
+void AtlasSnowmaps::add_material(uint32_t diffuse_path_id, const AtlasMaterial& material)
+{
+	std::vector<AtlasMaterial>& materials = entries[diffuse_path_id].materials;
+	for (const AtlasMaterial& known_material : materials) {
+		if (known_material[2].path_id == material[2].path_id) return;
+	}
+	materials.push_back(material);
+}
+
+std::vector<uint32_t> AtlasSnowmaps::take_changed()
+{
+	std::vector<uint32_t> taken_ids = std::move(changed_ids);
+	changed_ids.clear();
+	for (uint32_t id : taken_ids) entries[id].is_changed = false;
+	return taken_ids;
+}
+
+const std::vector<AtlasMaterial>& AtlasSnowmaps::get_materials(uint32_t diffuse_path_id) const
+{
+	static const std::vector<AtlasMaterial> no_materials;
+	auto found = entries.find(diffuse_path_id);
+	return found == entries.end() ? no_materials : found->second.materials;
+}
+
+void AtlasSnowmaps::forget_in_memory(PartKey key)
+{
+	Part& entry = entries[key.first].parts[key.second];
+	if (entry.is_spilled) return;
+	size_t entry_bytes = entry.encoded.size() * sizeof(uint16_t);
+	memory_bytes -= entry_bytes;
+	memory_accounting::remove(memory_accounting::Category::snowmaps, entry_bytes);
+	entry.encoded = std::vector<uint16_t>();
+	in_memory_order.remove(key);
+}
+
+void AtlasSnowmaps::spill()
+{
+	if (limit == 0) return;
+	// The snowmap stored last stays, it is the one most likely to be needed next
+	while (memory_bytes > limit && in_memory_order.size() > 1) {
+		if (!sidecar_file.is_open()) {
+			std::error_code error;
+			fs::create_directories(sidecar.parent_path(), error);
+			sidecar_file.open(sidecar, std::ios::in | std::ios::out | std::ios::binary | std::ios::trunc);
+			if (!sidecar_file.is_open()) {
+				std::cout << "WARNING: Could not create " << sidecar.string() << ", atlas snowmaps stay in memory" << std::endl;
+				limit = 0;
+				return;
+			}
+		}
+		PartKey spilled_key = in_memory_order.front();
+		Part& entry = entries[spilled_key.first].parts[spilled_key.second];
+		uint64_t entry_bytes = entry.encoded.size() * sizeof(uint16_t);
+		uint64_t offset = allocate_in_sidecar(entry_bytes);
+		sidecar_file.seekp(std::streamoff(offset));
+		sidecar_file.write((const char*)entry.encoded.data(), std::streamsize(entry_bytes));
+		if (!sidecar_file) {
+			sidecar_file.clear();
+			free_in_sidecar(offset, entry_bytes);
+			std::cout << "WARNING: Could not write " << sidecar.string() << ", atlas snowmaps stay in memory" << std::endl;
+			limit = 0;
+			return;
+		}
+		size_t encoded_size = entry.encoded.size();
+		forget_in_memory(spilled_key);
+		entry.is_spilled = true;
+		entry.sidecar_offset = offset;
+		entry.sidecar_size = encoded_size;
+		spilled_count++;
+	}
+}
+
+uint64_t AtlasSnowmaps::allocate_in_sidecar(uint64_t bytes)
+{
+	auto best_fit = free_regions.end();
+	for (auto region = free_regions.begin(); region != free_regions.end(); ++region) {
+		if (region->second >= bytes && (best_fit == free_regions.end() || region->second < best_fit->second)) best_fit = region;
+	}
+	if (best_fit == free_regions.end()) {
+		uint64_t offset = sidecar_end;
+		sidecar_end += bytes;
+		return offset;
+	}
+	uint64_t offset = best_fit->first;
+	uint64_t rest = best_fit->second - bytes;
+	free_regions.erase(best_fit);
+	if (rest > 0) free_regions[offset + bytes] = rest;
+	return offset;
+}
+
+void AtlasSnowmaps::free_in_sidecar(uint64_t offset, uint64_t bytes)
+{
+	if (bytes == 0) return;
+	auto next = free_regions.lower_bound(offset);
+	if (next != free_regions.end() && offset + bytes == next->first) {
+		bytes += next->second;
+		next = free_regions.erase(next);
+	}
+	if (next != free_regions.begin()) {
+		auto previous = std::prev(next);
+		if (previous->first + previous->second == offset) {
+			offset = previous->first;
+			bytes += previous->second;
+			free_regions.erase(previous);
+		}
+	}
+	if (offset + bytes == sidecar_end) {
+		// The file keeps its size, but the next spill starts here
+		sidecar_end = offset;
+		return;
+	}
+	free_regions[offset] = bytes;
+}
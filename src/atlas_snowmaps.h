@@ -0,0 +1,111 @@
+#pragma once
+#include <cstdint>
+#include <cstddef>
+#include <string>
+#include <vector>
+#include <array>
+#include <list>
+#include <map>
+#include <unordered_map>
+#include <fstream>
+#include <filesystem>
+#include <utility>
+
+#include "cfg_parser.h"
+
+/*
+--atlas_mode: atlases are shared by many .cfg files. Instead of adding snow to what an earlier .cfg file saved (a
+decode and a full compression per .cfg file, with the losses adding up), the snowmaps of all .cfg files using an
+atlas are merged, and the atlas is combined and saved once, when the Generator finishes (see snowgen.h).
+
+The merging is done by the depth test: each .cfg file starts from the snowmap merged so far and draws its meshes
+into it, like several models of one .cfg file sharing a texture. This class only keeps the snowmaps between the
+.cfg files, as the 16 bit depth values of the GL texture, run-length encoded: most texels of an atlas are not used
+by any one building and keep the clear value. Beyond spill_limit bytes, the least recently stored snowmaps are moved
+to a sidecar file and read back when they are needed. The space of a snowmap that is stored again is reused by later
+spills, the sidecar only grows when no free region is large enough.
+The snowmap of an atlas that is processed in tiles (see Texture::is_tiled) is kept as one part per tile, each loaded
+and stored on its own, so that only the snowmap of one tile is decoded at a time.
+Only host memory and files, no GL.
+*/
+
+// A texture of a material that uses an atlas, enough to load it again when the atlas is saved
+struct AtlasTexture {
+	uint32_t path_id = 0;
+	std::string rel_path;
+	std::filesystem::path abs_path;
+	std::filesystem::path out_base_path; // out_path of the options the .cfg file was processed with
+	bool save_snowed_texture = false;
+	bool is_default = false; // The default texture of its type, nothing to load
+};
+
+// Diffuse, normal and metallic texture, in the order of CfgMaterial::textures
+using AtlasMaterial = std::array<AtlasTexture, texture_types_count>;
+
+class AtlasSnowmaps
+{
+public:
+	// spill_limit: bytes of encoded snowmaps kept in memory, 0 = no limit. The sidecar file is deleted by the destructor.
+	AtlasSnowmaps(size_t spill_limit, std::filesystem::path sidecar_path);
+	~AtlasSnowmaps();
+
+	AtlasSnowmaps(const AtlasSnowmaps&) = delete;
+	AtlasSnowmaps& operator=(const AtlasSnowmaps&) = delete;
+
+	// The merged snowmap of the diffuse texture, or of one of its tiles (part). False if there is none yet or it has
+	// other dimensions.
+	bool load(uint32_t diffuse_path_id, int width, int height, std::vector<uint16_t>* depth_values, uint32_t part = 0);
+	// Replaces the snowmap or the part with the merged one and marks the atlas as changed
+	void store(uint32_t diffuse_path_id, int width, int height, const std::vector<uint16_t>& depth_values, uint32_t part = 0);
+	// A material combining the atlas with its snowmap. Each metallic texture once per atlas.
+	void add_material(uint32_t diffuse_path_id, const AtlasMaterial& material);
+
+	// The atlases stored since the last call, in the order they were first stored
+	std::vector<uint32_t> take_changed();
+	const std::vector<AtlasMaterial>& get_materials(uint32_t diffuse_path_id) const;
+
+	size_t get_memory_bytes() const { return memory_bytes; }
+	size_t get_spilled_count() const { return spilled_count; }
+
+	// Runs of 3 or more equal values become (0x8000 | length - 1, value), other values are copied behind (length - 1).
+	// Runs and copies are at most 0x8000 values long.
+	static void encode(const uint16_t* values, size_t count, std::vector<uint16_t>* encoded);
+	// False if the encoded values do not decode to exactly count values
+	static bool decode(const std::vector<uint16_t>& encoded, size_t count, uint16_t* values);
+
+private:
+	// A snowmap, or the snowmap of one tile
+	struct Part {
+		int width = 0;
+		int height = 0;
+		std::vector<uint16_t> encoded; // Empty while spilled
+		bool is_spilled = false;
+		uint64_t sidecar_offset = 0;
+		size_t sidecar_size = 0; // In values
+	};
+	struct Entry {
+		std::vector<Part> parts;
+		bool is_changed = false;
+		std::vector<AtlasMaterial> materials;
+	};
+	// The path id of the diffuse texture and the index of the part
+	using PartKey = std::pair<uint32_t, uint32_t>;
+
+	// Moves the least recently stored snowmaps to the sidecar until the limit is kept
+	void spill();
+	void forget_in_memory(PartKey key);
+	// Where to write bytes in the sidecar: the smallest free region they fit into, or its end
+	uint64_t allocate_in_sidecar(uint64_t bytes);
+	void free_in_sidecar(uint64_t offset, uint64_t bytes);
+
+	size_t limit;
+	std::filesystem::path sidecar;
+	std::fstream sidecar_file;
+	uint64_t sidecar_end = 0;
+	std::map<uint64_t, uint64_t> free_regions; // Bytes by offset, neighbouring regions are merged
+	std::unordered_map<uint32_t, Entry> entries;
+	std::list<PartKey> in_memory_order; // Least recently stored first
+	std::vector<uint32_t> changed_ids;
+	size_t memory_bytes = 0;
+	size_t spilled_count = 0;
+};
@@ -0,0 +1,48 @@
+#include "benchmark.h"
+
+#include <iostream>
+
+#ifdef _WIN32
+#include <windows.h>
+#include <psapi.h>
+#else
+#include <sys/resource.h>
+#endif
+
+size_t get_peak_memory_bytes() {
+#ifdef _WIN32
+	PROCESS_MEMORY_COUNTERS memory_counters{};
+	memory_counters.cb = sizeof(memory_counters);
+	if (!GetProcessMemoryInfo(GetCurrentProcess(), &memory_counters, sizeof(memory_counters))) return 0;
+	return memory_counters.PeakWorkingSetSize;
+#else
+	rusage usage{};
+	getrusage(RUSAGE_SELF, &usage);
+	return size_t(usage.ru_maxrss) * 1024; // ru_maxrss is in kilobytes on Linux
+#endif
+}
+
+BenchmarkStats::BenchmarkStats()
+{
+	start = std::chrono::steady_clock::now();
+}
+
+void BenchmarkStats::add_processed_cfg()
+{
+	cfg_count++;
+}
+
+void BenchmarkStats::add_snowed_texels(uint64_t texel_count)
+{
+	snowed_texel_count += texel_count;
+}
+
+void BenchmarkStats::print_report()
+{
+	double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+	double megapixels = snowed_texel_count / 1e6;
+	std::cout << "Benchmark: " << cfg_count << " cfg files in " << seconds << " s" << std::endl;
+	std::cout << "  " << (seconds > 0. ? cfg_count / seconds : 0.) << " CFGs/s" << std::endl;
+	std::cout << "  " << megapixels << " MPix snowed, " << (seconds > 0. ? megapixels / seconds : 0.) << " MPix/s" << std::endl;
+	std::cout << "  Peak memory: " << get_peak_memory_bytes() / (1024 * 1024) << " MB" << std::endl;
+}
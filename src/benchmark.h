@@ -0,0 +1,25 @@
+#pragma once
+#include <chrono>
+#include <cstdint>
+
+/*
+Throughput numbers for --benchmark, meant for runs on the corpus written by tools/synthetic_assets.
+*/
+
+size_t get_peak_memory_bytes();
+
+class BenchmarkStats
+{
+public:
+	BenchmarkStats();
+
+	void add_processed_cfg();
+	void add_snowed_texels(uint64_t texel_count);
+	void print_report();
+
+	uint32_t cfg_count = 0;
+	uint64_t snowed_texel_count = 0;
+
+private:
+	std::chrono::steady_clock::time_point start;
+};
@@ -0,0 +1,74 @@
+#pragma once
+#include <deque>
+#include <vector>
+#include <mutex>
+#include <condition_variable>
+#include <chrono>
+
+/*
+Queue between threads: producers push items, consumers wait for them.
+When the producers are done they close() the queue, which lets waiting consumers return.
+*/
+
+template <typename T>
+class BlockingQueue
+{
+public:
+	void push(T item) {
+		{
+			std::lock_guard<std::mutex> lock(queue_mutex);
+			items.push_back(std::move(item));
+		}
+		item_available.notify_one();
+	}
+
+	// Blocks until an item is available. Returns false if the queue is closed and empty.
+	bool pop(T* item) {
+		std::unique_lock<std::mutex> lock(queue_mutex);
+		item_available.wait(lock, [this] { return !items.empty() || is_closed; });
+		if (items.empty()) return false;
+		*item = std::move(items.front());
+		items.pop_front();
+		return true;
+	}
+
+	// Blocks until at least one item is available, then appends all available items.
+	// Returns false if the queue is closed and empty.
+	bool pop_all(std::vector<T>* popped_items) {
+		std::unique_lock<std::mutex> lock(queue_mutex);
+		item_available.wait(lock, [this] { return !items.empty() || is_closed; });
+		if (items.empty()) return false;
+		for (T& item : items) popped_items->push_back(std::move(item));
+		items.clear();
+		return true;
+	}
+
+	// Waits up to timeout for an item without taking it. Returns true if one is available or the queue is closed.
+	bool wait_for(std::chrono::milliseconds timeout) {
+		std::unique_lock<std::mutex> lock(queue_mutex);
+		return item_available.wait_for(lock, timeout, [this] { return !items.empty() || is_closed; });
+	}
+
+	// Appends all available items without waiting. Returns false if there were none.
+	bool try_pop_all(std::vector<T>* popped_items) {
+		std::lock_guard<std::mutex> lock(queue_mutex);
+		if (items.empty()) return false;
+		for (T& item : items) popped_items->push_back(std::move(item));
+		items.clear();
+		return true;
+	}
+
+	void close() {
+		{
+			std::lock_guard<std::mutex> lock(queue_mutex);
+			is_closed = true;
+		}
+		item_available.notify_all();
+	}
+
+private:
+	std::deque<T> items;
+	std::mutex queue_mutex;
+	std::condition_variable item_available;
+	bool is_closed = false;
+};
@@ -0,0 +1,217 @@
+#include "cfg_index.h"
+
+#include <algorithm>
+#include <fstream>
+#include <iostream>
+#include <cstring>
+#include <unordered_set>
+
+namespace fs = std::filesystem;
+using namespace cfg_index_format;
+
+// The records are written and mapped as they are, their layout must not depend on the compiler
+static_assert(sizeof(Header) == 24 && sizeof(Entry) == 32 && sizeof(Model) == 24 && sizeof(Material) == 68);
+
+std::string cfg_index_key(const fs::path& cfg_path) {
+	std::error_code error;
+	fs::path absolute_path = fs::absolute(cfg_path, error);
+	if (error) absolute_path = cfg_path;
+	std::u8string key = absolute_path.lexically_normal().generic_u8string();
+	return std::string(key.begin(), key.end());
+}
+
+CfgIndex::CfgIndex(fs::path index_file_path)
+{
+	path = index_file_path;
+	if (path.empty() || !fs::exists(path)) return;
+
+	mapped_file = std::make_unique<MappedFile>(path);
+	const char* data = mapped_file->data();
+	uint64_t file_size = mapped_file->size();
+	if (file_size < sizeof(Header)) {
+		unmap();
+		return;
+	}
+	header = (const Header*)data;
+	uint64_t expected_size = sizeof(Header)
+		+ uint64_t(header->entry_count) * sizeof(Entry)
+		+ uint64_t(header->model_count) * sizeof(Model)
+		+ uint64_t(header->material_count) * sizeof(Material)
+		+ header->string_bytes;
+	if (std::memcmp(header->magic, magic, 4) != 0 || header->version != version || expected_size != file_size) {
+		std::cout << "Ignoring outdated or damaged " << path.string() << std::endl;
+		unmap();
+		return;
+	}
+	entries = (const Entry*)(data + sizeof(Header));
+	models = (const Model*)(entries + header->entry_count);
+	materials = (const Material*)(models + header->model_count);
+	strings = (const char*)(materials + header->material_count);
+}
+
+void CfgIndex::unmap()
+{
+	header = nullptr;
+	entries = nullptr;
+	models = nullptr;
+	materials = nullptr;
+	strings = nullptr;
+	mapped_file.reset();
+}
+
+size_t CfgIndex::size() const
+{
+	return header ? header->entry_count : 0;
+}
+
+std::string_view CfgIndex::get_string(IndexString index_string) const
+{
+	// Out of bounds only for damaged files; read_entry() rejects those entries
+	if (uint64_t(index_string.offset) + index_string.length > header->string_bytes) return std::string_view();
+	return std::string_view(strings + index_string.offset, index_string.length);
+}
+
+bool CfgIndex::read_entry(const Entry& entry, CfgDescription* description) const
+{
+	auto is_valid = [this](IndexString index_string) {
+		return uint64_t(index_string.offset) + index_string.length <= header->string_bytes;
+	};
+	if (uint64_t(entry.first_model) + entry.model_count > header->model_count) return false;
+
+	description->mesh_radius = entry.mesh_radius;
+	description->has_models_tag = entry.has_models_tag != 0;
+	description->models.clear();
+	description->models.reserve(entry.model_count);
+	for (uint32_t m = entry.first_model; m < entry.first_model + entry.model_count; m++) {
+		const Model& model = models[m];
+		if (!is_valid(model.file_name) || !is_valid(model.error)) return false;
+		if (uint64_t(model.first_material) + model.material_count > header->material_count) return false;
+
+		CfgModelDescription model_description;
+		model_description.file_name = get_string(model.file_name);
+		model_description.error = get_string(model.error);
+		model_description.materials.reserve(model.material_count);
+		for (uint32_t i = model.first_material; i < model.first_material + model.material_count; i++) {
+			const Material& material = materials[i];
+			if (!is_valid(material.vertex_format)) return false;
+			CfgMaterialDescription material_description;
+			material_description.vertex_format = get_string(material.vertex_format);
+			for (int t = 0; t < texture_types_count; t++) {
+				const TextureSlot& slot = material.textures[t];
+				if (!is_valid(slot.enabled_value) || !is_valid(slot.path)) return false;
+				material_description.textures[t].has_enabled_tag = (slot.flags & 1) != 0;
+				material_description.textures[t].has_path_tag = (slot.flags & 2) != 0;
+				material_description.textures[t].enabled_value = get_string(slot.enabled_value);
+				material_description.textures[t].path = get_string(slot.path);
+			}
+			model_description.materials.push_back(std::move(material_description));
+		}
+		description->models.push_back(std::move(model_description));
+	}
+	return true;
+}
+
+bool CfgIndex::find(const std::string& key, int64_t modification_time, CfgDescription* description) const
+{
+	if (header == nullptr) return false;
+	const Entry* entries_end = entries + header->entry_count;
+	const Entry* found = std::lower_bound(entries, entries_end, std::string_view(key),
+		[this](const Entry& entry, std::string_view searched_key) { return get_string(entry.path) < searched_key; });
+	if (found == entries_end || get_string(found->path) != key) return false;
+	if (found->modification_time != modification_time) return false;
+	return read_entry(*found, description);
+}
+
+void CfgIndex::save(const std::vector<CfgDescription>& descriptions)
+{
+	// Collect the entries: the new descriptions first, then the ones from the current index that were not parsed this time
+	std::vector<std::pair<std::string, const CfgDescription*>> keyed_descriptions;
+	std::unordered_set<std::string> new_keys;
+	for (const CfgDescription& description : descriptions) {
+		if (!description.error.empty()) continue;
+		std::string key = cfg_index_key(description.cfg_path);
+		if (new_keys.insert(key).second) keyed_descriptions.push_back(std::make_pair(key, &description));
+	}
+	std::vector<CfgDescription> kept_descriptions;
+	kept_descriptions.reserve(size()); // No reallocation, keyed_descriptions points into it
+	for (size_t i = 0; i < size(); i++) {
+		std::string key = std::string(get_string(entries[i].path));
+		if (new_keys.contains(key)) continue;
+		CfgDescription kept;
+		kept.modification_time = entries[i].modification_time;
+		if (!read_entry(entries[i], &kept)) continue;
+		kept_descriptions.push_back(std::move(kept));
+		keyed_descriptions.push_back(std::make_pair(key, &kept_descriptions.back()));
+	}
+	std::sort(keyed_descriptions.begin(), keyed_descriptions.end(),
+		[](const auto& a, const auto& b) { return a.first < b.first; });
+
+	// Build the tables
+	std::vector<Entry> new_entries;
+	std::vector<Model> new_models;
+	std::vector<Material> new_materials;
+	std::string new_strings;
+	auto add_string = [&new_strings](std::string_view text) {
+		IndexString index_string{ uint32_t(new_strings.size()), uint32_t(text.size()) };
+		new_strings.append(text);
+		return index_string;
+	};
+	for (const auto& [key, description] : keyed_descriptions) {
+		Entry entry{};
+		entry.path = add_string(key);
+		entry.modification_time = description->modification_time;
+		entry.mesh_radius = description->mesh_radius;
+		entry.has_models_tag = description->has_models_tag ? 1 : 0;
+		entry.first_model = uint32_t(new_models.size());
+		entry.model_count = uint32_t(description->models.size());
+		for (const CfgModelDescription& model_description : description->models) {
+			Model model{};
+			model.file_name = add_string(model_description.file_name);
+			model.error = add_string(model_description.error);
+			model.first_material = uint32_t(new_materials.size());
+			model.material_count = uint32_t(model_description.materials.size());
+			for (const CfgMaterialDescription& material_description : model_description.materials) {
+				Material material{};
+				material.vertex_format = add_string(material_description.vertex_format);
+				for (int t = 0; t < texture_types_count; t++) {
+					const CfgTextureSlot& slot = material_description.textures[t];
+					material.textures[t].flags = (slot.has_enabled_tag ? 1 : 0) | (slot.has_path_tag ? 2 : 0);
+					material.textures[t].enabled_value = add_string(slot.enabled_value);
+					material.textures[t].path = add_string(slot.path);
+				}
+				new_materials.push_back(material);
+			}
+			new_models.push_back(model);
+		}
+		new_entries.push_back(entry);
+	}
+
+	Header new_header{};
+	std::memcpy(new_header.magic, magic, 4);
+	new_header.version = version;
+	new_header.entry_count = uint32_t(new_entries.size());
+	new_header.model_count = uint32_t(new_models.size());
+	new_header.material_count = uint32_t(new_materials.size());
+	new_header.string_bytes = uint32_t(new_strings.size());
+
+	// Write to a temporary file and replace the index when complete, so that an interrupted run does not leave a broken index
+	std::error_code error;
+	fs::create_directories(path.parent_path(), error);
+	fs::path temporary_path = fs::path(path).concat(".tmp");
+	{
+		std::ofstream index_file(temporary_path, std::ofstream::binary);
+		index_file.write((const char*)&new_header, sizeof(Header));
+		index_file.write((const char*)new_entries.data(), new_entries.size() * sizeof(Entry));
+		index_file.write((const char*)new_models.data(), new_models.size() * sizeof(Model));
+		index_file.write((const char*)new_materials.data(), new_materials.size() * sizeof(Material));
+		index_file.write(new_strings.data(), new_strings.size());
+		if (!index_file) {
+			std::cout << "Could not write " << temporary_path.string() << std::endl;
+			return;
+		}
+	}
+	unmap(); // A mapped file cannot be replaced on Windows
+	fs::rename(temporary_path, path, error);
+	if (error) std::cout << "Could not replace " << path.string() << ": " << error.message() << std::endl;
+	else std::cout << "Saved " << new_entries.size() << " .cfg files to " << path.string() << std::endl;
+}
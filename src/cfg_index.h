@@ -0,0 +1,95 @@
+#pragma once
+#include <string>
+#include <vector>
+#include <memory>
+#include <cstdint>
+#include <filesystem>
+
+#include "cfg_parser.h"
+#include "mapped_file.h"
+
+/*
+On-disk cache of CfgDescriptions (cfg_index.bin in the output directory), so that unchanged .cfg files
+do not have to be scanned again on the next run.
+
+The file is memory-mapped and used in place: a header followed by flat tables of fixed-size records
+(entries sorted by path for binary search, models, materials) and one table with all strings.
+An entry is only used if the modification time of the .cfg file has not changed.
+*/
+
+namespace cfg_index_format {
+	constexpr char magic[4] = { 'S', 'G', 'C', 'I' };
+	constexpr uint32_t version = 1;
+
+	struct IndexString { uint32_t offset; uint32_t length; }; // Into the string table
+
+	struct Header {
+		char magic[4];
+		uint32_t version;
+		uint32_t entry_count;
+		uint32_t model_count;
+		uint32_t material_count;
+		uint32_t string_bytes;
+	};
+
+	struct Entry {
+		IndexString path; // cfg_index_key() of the .cfg file
+		int64_t modification_time;
+		float mesh_radius;
+		uint32_t has_models_tag;
+		uint32_t first_model;
+		uint32_t model_count;
+	};
+
+	struct Model {
+		IndexString file_name;
+		IndexString error;
+		uint32_t first_material;
+		uint32_t material_count;
+	};
+
+	struct TextureSlot {
+		uint32_t flags; // 1 = has enabled tag, 2 = has path tag
+		IndexString enabled_value;
+		IndexString path;
+	};
+
+	struct Material {
+		IndexString vertex_format;
+		TextureSlot textures[texture_types_count];
+	};
+}
+
+// Absolute, normalized path with forward slashes
+std::string cfg_index_key(const std::filesystem::path& cfg_path);
+
+class CfgIndex
+{
+public:
+	// Maps the index file if it exists and is valid. Otherwise the index is empty.
+	CfgIndex(std::filesystem::path index_file_path);
+
+	size_t size() const;
+
+	// Fills everything besides cfg_path and returns true if the index has the .cfg file with this modification time.
+	// Can be called from several threads at the same time.
+	bool find(const std::string& key, int64_t modification_time, CfgDescription* description) const;
+
+	// Writes the descriptions (without the damaged ones) and the entries of the current index that are not among them.
+	// The index file is replaced, afterwards this object is empty.
+	void save(const std::vector<CfgDescription>& descriptions);
+
+private:
+	void unmap();
+	std::string_view get_string(cfg_index_format::IndexString index_string) const;
+	bool read_entry(const cfg_index_format::Entry& entry, CfgDescription* description) const;
+
+	std::filesystem::path path;
+	std::unique_ptr<MappedFile> mapped_file;
+
+	const cfg_index_format::Header* header = nullptr;
+	const cfg_index_format::Entry* entries = nullptr;
+	const cfg_index_format::Model* models = nullptr;
+	const cfg_index_format::Material* materials = nullptr;
+	const char* strings = nullptr;
+};
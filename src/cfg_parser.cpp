@@ -0,0 +1,278 @@
+#include "cfg_parser.h"
+
+#include "mapped_file.h"
+#include "profiler.h"
+#include "cfg_index.h"
+
+namespace fs = std::filesystem;
+
+struct DamagedXml {
+	const char* reason;
+};
+
+// Walks through the elements of an XML document without building a DOM.
+// Supports what .cfg files contain: elements, attributes, text, comments, CDATA and processing instructions.
+class XmlScanner
+{
+public:
+	XmlScanner(std::string_view xml_text) : xml(xml_text) {}
+
+	// Reads the start tag of the next child element of the current element.
+	// Returns false (and reads the end tag of the current element) if there are no more children.
+	bool next_child(std::string_view* name, bool* has_content) {
+		while (true) {
+			size_t tag_start = xml.find('<', position);
+			if (tag_start == std::string_view::npos) throw DamagedXml{ "unexpected end of file" };
+			position = tag_start + 1;
+			if (position >= xml.size()) throw DamagedXml{ "unexpected end of file" };
+
+			char first = xml[position];
+			if (first == '/') {
+				skip_past(">");
+				return false;
+			}
+			if (first == '!' || first == '?') {
+				skip_markup();
+				continue;
+			}
+			size_t name_end = xml.find_first_of(" \t\r\n/>", position);
+			if (name_end == std::string_view::npos) throw DamagedXml{ "unexpected end of file" };
+			*name = xml.substr(position, name_end - position);
+			position = name_end;
+			*has_content = !skip_attributes();
+			return true;
+		}
+	}
+
+	// Returns the text of the element whose start tag was just read and skips the rest of the element
+	std::string_view read_text(bool has_content) {
+		if (!has_content) return std::string_view();
+		size_t text_end = xml.find('<', position);
+		if (text_end == std::string_view::npos) throw DamagedXml{ "unexpected end of file" };
+		std::string_view text = xml.substr(position, text_end - position);
+		position = text_end;
+		skip_content(has_content);
+		return text;
+	}
+
+	// Skips everything until after the end tag of the element whose start tag was just read
+	void skip_content(bool has_content) {
+		if (!has_content) return;
+		int depth = 1;
+		while (depth != 0) {
+			size_t tag_start = xml.find('<', position);
+			if (tag_start == std::string_view::npos) throw DamagedXml{ "unexpected end of file" };
+			position = tag_start + 1;
+			if (position >= xml.size()) throw DamagedXml{ "unexpected end of file" };
+
+			char first = xml[position];
+			if (first == '/') {
+				skip_past(">");
+				depth--;
+			}
+			else if (first == '!' || first == '?') {
+				skip_markup();
+			}
+			else if (skip_attributes() == false) {
+				depth++;
+			}
+		}
+	}
+
+private:
+	void skip_past(std::string_view terminator) {
+		size_t found = xml.find(terminator, position);
+		if (found == std::string_view::npos) throw DamagedXml{ "unexpected end of file" };
+		position = found + terminator.size();
+	}
+
+	// position is on the '!' or '?' after '<'
+	void skip_markup() {
+		std::string_view rest = xml.substr(position);
+		if (rest.starts_with("!--")) skip_past("-->");
+		else if (rest.starts_with("![CDATA[")) skip_past("]]>");
+		else if (rest.starts_with("?")) skip_past("?>");
+		else skip_past(">"); // <!DOCTYPE ...>
+	}
+
+	// Skips until after the '>' of a start tag. Returns true if it was an empty element (<tag/>).
+	bool skip_attributes() {
+		char quote = 0;
+		for (; position < xml.size(); position++) {
+			char c = xml[position];
+			if (quote != 0) {
+				if (c == quote) quote = 0;
+			}
+			else if (c == '"' || c == '\'') {
+				quote = c;
+			}
+			else if (c == '>') {
+				position++;
+				return xml[position - 2] == '/';
+			}
+		}
+		throw DamagedXml{ "unexpected end of file" };
+	}
+
+	std::string_view xml;
+	size_t position = 0;
+};
+
+// Resolves the predefined entities and replaces \ with /
+static std::string to_value(std::string_view text) {
+	std::string value;
+	value.reserve(text.size());
+	for (size_t i = 0; i < text.size(); i++) {
+		char c = text[i];
+		if (c == '\\') {
+			value += '/';
+		}
+		else if (c == '&') {
+			std::string_view entity = text.substr(i);
+			if (entity.starts_with("&amp;")) { value += '&'; i += 4; }
+			else if (entity.starts_with("&lt;")) { value += '<'; i += 3; }
+			else if (entity.starts_with("&gt;")) { value += '>'; i += 3; }
+			else if (entity.starts_with("&quot;")) { value += '"'; i += 5; }
+			else if (entity.starts_with("&apos;")) { value += '\''; i += 5; }
+			else value += c;
+		}
+		else {
+			value += c;
+		}
+	}
+	return value;
+}
+
+static CfgMaterialDescription scan_material(XmlScanner& scanner, bool has_content, std::string* error) {
+	CfgMaterialDescription material;
+	bool has_vertex_format = false;
+	std::string_view name;
+	bool child_has_content;
+	while (has_content && scanner.next_child(&name, &child_has_content)) {
+		if (name == "VertexFormat" && !has_vertex_format) {
+			material.vertex_format = to_value(scanner.read_text(child_has_content));
+			has_vertex_format = true;
+			continue;
+		}
+		bool is_used = false;
+		for (int i = 0; i < texture_types_count && !is_used; i++) {
+			CfgTextureSlot& slot = material.textures[i];
+			if (name == cfg_constants::textures_exist_tagname_in_cfg[i] && !slot.has_enabled_tag) {
+				slot.enabled_value = to_value(scanner.read_text(child_has_content));
+				slot.has_enabled_tag = true;
+				is_used = true;
+			}
+			else if (name == cfg_constants::textures_path_tagname_in_cfg[i] && !slot.has_path_tag) {
+				slot.path = to_value(scanner.read_text(child_has_content));
+				slot.has_path_tag = true;
+				is_used = true;
+			}
+		}
+		if (!is_used) scanner.skip_content(child_has_content);
+	}
+	if (!has_vertex_format && error->empty()) *error = "A material has no <VertexFormat>";
+	return material;
+}
+
+static CfgModelDescription scan_model(XmlScanner& scanner, bool has_content) {
+	CfgModelDescription model;
+	bool has_file_name = false;
+	bool has_materials = false;
+	std::string_view name;
+	bool child_has_content;
+	while (has_content && scanner.next_child(&name, &child_has_content)) {
+		if (name == cfg_constants::rdm_filename_in_cfg && !has_file_name) {
+			model.file_name = to_value(scanner.read_text(child_has_content));
+			has_file_name = true;
+		}
+		else if (name == "Materials" && !has_materials) {
+			has_materials = true;
+			bool material_has_content;
+			while (child_has_content && scanner.next_child(&name, &material_has_content)) {
+				model.materials.push_back(scan_material(scanner, material_has_content, &model.error));
+			}
+		}
+		else {
+			scanner.skip_content(child_has_content);
+		}
+	}
+	if (!has_file_name) model.error = "Model has no <FileName>";
+	else if (!has_materials) model.error = "Model has no <Materials>";
+	return model;
+}
+
+bool scan_cfg(std::string_view xml, CfgDescription* description) {
+	// Sometimes there are strange chars (0xCD) at the end of the file. No clue where they came from.
+	xml = xml.substr(0, xml.find_first_of(std::string_view("\xCD\0", 2)));
+
+	try {
+		XmlScanner scanner(xml);
+		std::string_view name;
+		bool root_has_content;
+		if (!scanner.next_child(&name, &root_has_content)) throw DamagedXml{ "no root element" };
+
+		bool has_mesh_radius = false;
+		bool child_has_content;
+		while (root_has_content && scanner.next_child(&name, &child_has_content)) {
+			if (name == "MeshRadius" && !has_mesh_radius) {
+				has_mesh_radius = true;
+				try {
+					description->mesh_radius = std::stof(std::string(scanner.read_text(child_has_content)));
+				}
+				catch (std::exception) {
+					description->mesh_radius = 4;
+				}
+			}
+			else if (name == "Models" && !description->has_models_tag) {
+				description->has_models_tag = true;
+				bool model_has_content;
+				while (child_has_content && scanner.next_child(&name, &model_has_content)) {
+					description->models.push_back(scan_model(scanner, model_has_content));
+				}
+			}
+			else {
+				scanner.skip_content(child_has_content);
+			}
+		}
+	}
+	catch (DamagedXml damaged) {
+		description->error = std::string("Damaged cfg file: ") + damaged.reason;
+		return false;
+	}
+	return true;
+}
+
+CfgDescription read_cfg_description(fs::path cfg_path, const CfgIndex* cfg_index) {
+	ProfileScope scope("parse_cfg", cfg_path.string());
+
+	CfgDescription description;
+	description.cfg_path = cfg_path;
+
+	std::error_code error;
+	fs::file_time_type modification_time = fs::last_write_time(cfg_path, error);
+	if (!error) {
+		description.modification_time = modification_time.time_since_epoch().count();
+		if (cfg_index && cfg_index->find(cfg_index_key(cfg_path), description.modification_time, &description)) {
+			description.is_from_index = true;
+			return description;
+		}
+	}
+
+	MappedFile cfg_file(cfg_path);
+	if (!cfg_file.is_open()) {
+		description.error = "Could not open the .cfg file.";
+		return description;
+	}
+	scan_cfg(cfg_file.view(), &description);
+	return description;
+}
+
+std::vector<CfgDescription> read_cfg_descriptions(const std::vector<fs::path>& cfg_paths, ThreadPool& thread_pool,
+	const CfgIndex* cfg_index)
+{
+	std::vector<CfgDescription> descriptions(cfg_paths.size());
+	thread_pool.parallel_for(cfg_paths.size(), [&](size_t i) {
+		descriptions[i] = read_cfg_description(cfg_paths[i], cfg_index);
+	});
+	return descriptions;
+}
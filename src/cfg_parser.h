@@ -0,0 +1,79 @@
+#pragma once
+#include <string>
+#include <string_view>
+#include <vector>
+#include <filesystem>
+
+#include "thread_pool.h"
+
+class CfgIndex;
+
+#define texture_types_count 3
+
+namespace cfg_constants {
+	enum class texture_names { diff, norm, metallic };
+
+	// These 'texture names' are used as names in the shader and for debug output
+	inline const char* texture_names[] = { "diff_texture", "norm_texture", "metallic_texture" };
+	// In a .cfg file, the tag <DIFFUSE_ENABLED> tells whether the diffuse texture is enabled (similar for the other textures)
+	inline const char* textures_exist_tagname_in_cfg[] = { "DIFFUSE_ENABLED", "NORMAL_ENABLED", "METALLIC_TEX_ENABLED" };
+	// In a .cfg file, the tag <cModelDiffTex> tells the relative diffuse texture path (similar for the other textures)
+	inline const char* textures_path_tagname_in_cfg[] = { "cModelDiffTex", "cModelNormalTex", "cModelMetallicTex" };
+	// Use these textures when no real texture specified
+	inline const char* default_texture_paths[] = {
+		"data/graphics/effects/default_model_diffuse.psd",
+		"data/graphics/effects/default_model_normal.psd",
+		"data/graphics/effects/default_model_mask.psd" };
+	inline const uint32_t default_texture_colors[] = {
+		255,
+		8421376,
+		0,
+	};
+	inline const char* rdm_filename_in_cfg = "FileName";
+}
+
+/*
+The parts of a .cfg file that the snowgenerator uses: <MeshRadius> and <Models>.
+
+The .cfg file is memory-mapped and scanned in place. Only the elements listed here are
+copied out, everything else (particles, decals, cloth, ...) is skipped without building a DOM.
+All values have backslashes replaced with forward slashes.
+*/
+
+// What a material says about one of its textures
+struct CfgTextureSlot {
+	bool has_enabled_tag = false;
+	std::string enabled_value; // "1" if enabled
+	bool has_path_tag = false;
+	std::string path;
+};
+
+struct CfgMaterialDescription {
+	std::string vertex_format;
+	CfgTextureSlot textures[texture_types_count];
+};
+
+struct CfgModelDescription {
+	std::string file_name;
+	std::vector<CfgMaterialDescription> materials;
+	std::string error; // Not empty if the model cannot be used
+};
+
+struct CfgDescription {
+	std::filesystem::path cfg_path;
+	int64_t modification_time = 0;
+	bool is_from_index = false; // Taken from cfg_index.bin instead of scanning the file
+	float mesh_radius = 4;
+	bool has_models_tag = false;
+	std::vector<CfgModelDescription> models;
+	std::string error; // Not empty if the file could not be read or is damaged
+};
+
+// Returns false and sets description->error for damaged files
+bool scan_cfg(std::string_view xml, CfgDescription* description);
+
+// Never throws, errors are returned in CfgDescription::error.
+// Unchanged files are taken from cfg_index instead of scanning them (if cfg_index is not nullptr).
+CfgDescription read_cfg_description(std::filesystem::path cfg_path, const CfgIndex* cfg_index = nullptr);
+std::vector<CfgDescription> read_cfg_descriptions(const std::vector<std::filesystem::path>& cfg_paths, ThreadPool& thread_pool,
+	const CfgIndex* cfg_index = nullptr);
@@ -1,8 +1,10 @@
 #include "cli_options.h"
 
+#include <algorithm>
 #include <filesystem>
 #include <string>
 #include <iostream>
+#include <vector>
 
 namespace fs = std::filesystem;
 using namespace std;
@@ -16,6 +18,7 @@ CliOptions::CliOptions(int argc, char* argv[], fs::path containing_dir) {
 
 	disable_filenamefilters = false;
     disable_texture_blacklist = false;
+    has_filter_rules_path = false;
 	atlas_mode = false;
     save_non_mod_textures = false;
 
@@ -23,10 +26,28 @@ CliOptions::CliOptions(int argc, char* argv[], fs::path containing_dir) {
 
 	save_png = false;
 	save_dds = true;
+    diff_dds_format = DdsFormat::source;
+    metal_dds_format = DdsFormat::source;
+    full_decode = false;
     save_renderings = false;
+    contact_sheet_size = 0;
+    has_output_archive_path = false;
+    has_extract_archive_path = false;
+
+    preview_mode = PreviewMode::throttled;
 
     no_prompt = false;
 
+    memory_budget_mb = 0;
+    mesh_cache_mb = 256;
+
+    use_cfg_index = true;
+
+    plan = false;
+    benchmark_filters = false;
+    benchmark = false;
+    profile = false;
+
     display_help_message = false;
     display_licenses = false;
 
@@ -54,6 +75,9 @@ CliOptions::CliOptions(int argc, char* argv[], fs::path containing_dir) {
             save_png = true;
             save_dds = false;
         }
+        else if (arg == "--full_decode") {
+            full_decode = true;
+        }
         else if (arg == "--save_renderings") {
             save_renderings = true;
         }
@@ -72,6 +96,28 @@ CliOptions::CliOptions(int argc, char* argv[], fs::path containing_dir) {
         else if ((arg == "--no_prompt") || (arg == "--noprompt")) {
             no_prompt = true;
         }
+        else if (arg == "--no_cfg_index") {
+            use_cfg_index = false;
+        }
+        else if (arg == "--watch") {
+            watch = true;
+        }
+        else if (arg == "--serve") {
+            serve = true;
+            no_prompt = true; // stdin carries the jobs
+        }
+        else if ((arg == "--plan") || (arg == "--dry_run")) {
+            plan = true;
+        }
+        else if (arg == "--benchmark_filters") {
+            benchmark_filters = true;
+        }
+        else if (arg == "--benchmark") {
+            benchmark = true;
+        }
+        else if (arg == "--profile") {
+            profile = true;
+        }
         else if ((arg == "--license") || (arg == "--licenses")
 			  || (arg == "--licence") || (arg == "--licences")) {
             display_licenses = true;
@@ -90,6 +136,43 @@ CliOptions::CliOptions(int argc, char* argv[], fs::path containing_dir) {
         else if ((arg == "-d") || (arg == "-data_path") || (arg == "-data")) {
             last_word = "-d";
         }
+        else if (arg == "--memory_budget_mb") {
+            last_word = "--memory_budget_mb";
+        }
+        else if (arg == "--filter_rules") {
+            last_word = "--filter_rules";
+        }
+        else if (arg == "--mesh_cache_mb") {
+            last_word = "--mesh_cache_mb";
+        }
+        else if (arg == "--contact_sheet") {
+            last_word = "--contact_sheet";
+        }
+        else if (arg == "--diff_format") {
+            last_word = "--diff_format";
+        }
+        else if (arg == "--metal_format") {
+            last_word = "--metal_format";
+        }
+        else if (arg == "--snow_normal_y") {
+            last_word = "--snow_normal_y";
+        }
+        else if (arg == "--snow_color") {
+            last_word = "--snow_color";
+        }
+        else if (arg == "--noise_scale") {
+            last_word = "--noise_scale";
+        }
+        else if (arg == "--output_archive") {
+            last_word = "--output_archive";
+        }
+        else if (arg == "--extract_archive") {
+            last_word = "--extract_archive";
+        }
+        else if ((arg == "--preview") || arg.starts_with("--preview=")) {
+            if (arg == "--preview") last_word = "--preview";
+            else set_preview_mode(arg.substr(std::string("--preview=").length()));
+        }
         else {
             if (last_word == "-i") dir_to_parse = fs::path(arg);
             else if (last_word == "-o") out_path = fs::path(arg);
@@ -97,6 +180,80 @@ CliOptions::CliOptions(int argc, char* argv[], fs::path containing_dir) {
                 has_extracted_maindata_path = true;
                 extracted_maindata_path = fs::path(arg);
             }
+            else if (last_word == "--diff_format") {
+                set_dds_format(&diff_dds_format, arg, last_word);
+            }
+            else if (last_word == "--metal_format") {
+                set_dds_format(&metal_dds_format, arg, last_word);
+            }
+            else if (last_word == "--snow_normal_y") {
+                float thresholds[3];
+                if (parse_fractions(arg, thresholds, 3, last_word)) {
+                    if (thresholds[2] >= max_snowmap_normal_y) {
+                        cout << "--snow_normal_y expects a third value below " << max_snowmap_normal_y << ", not " << arg << endl;
+                    }
+                    else if (thresholds[0] <= thresholds[1] && thresholds[1] <= thresholds[2]) {
+                        snow_parameters.min_normal_y = thresholds[0];
+                        snow_parameters.partial_snow_normal_y = thresholds[1];
+                        snow_parameters.full_snow_normal_y = thresholds[2];
+                    }
+                    else {
+                        cout << "--snow_normal_y expects three increasing values, not " << arg << endl;
+                    }
+                }
+            }
+            else if (last_word == "--snow_color") {
+                parse_fractions(arg, snow_parameters.snow_color, 3, last_word);
+            }
+            else if (last_word == "--noise_scale") {
+                try {
+                    float noise_scale = std::stof(arg);
+                    if (noise_scale >= 0.f) snow_parameters.noise_scale = noise_scale;
+                    else cout << "--noise_scale expects a number of 0 or more, not " << arg << endl;
+                }
+                catch (std::exception) {
+                    cout << "--noise_scale expects a number, not " << arg << endl;
+                }
+            }
+            else if (last_word == "--output_archive") {
+                has_output_archive_path = true;
+                output_archive_path = fs::path(arg);
+            }
+            else if (last_word == "--extract_archive") {
+                has_extract_archive_path = true;
+                extract_archive_path = fs::path(arg);
+            }
+            else if (last_word == "--filter_rules") {
+                has_filter_rules_path = true;
+                filter_rules_path = fs::path(arg);
+            }
+            else if (last_word == "--memory_budget_mb") {
+                try {
+                    memory_budget_mb = std::stoul(arg);
+                }
+                catch (std::exception) {
+                    cout << "--memory_budget_mb expects a number of megabytes, not " << arg << endl;
+                }
+            }
+            else if (last_word == "--preview") {
+                set_preview_mode(arg);
+            }
+            else if (last_word == "--contact_sheet") {
+                try {
+                    contact_sheet_size = std::stoul(arg);
+                }
+                catch (std::exception) {
+                    cout << "--contact_sheet expects a number of renderings per sheet, not " << arg << endl;
+                }
+            }
+            else if (last_word == "--mesh_cache_mb") {
+                try {
+                    mesh_cache_mb = std::stoul(arg);
+                }
+                catch (std::exception) {
+                    cout << "--mesh_cache_mb expects a number of megabytes, not " << arg << endl;
+                }
+            }
             else {
                 cout << "Unknown argument: " << arg << endl;
             }
@@ -104,12 +261,102 @@ CliOptions::CliOptions(int argc, char* argv[], fs::path containing_dir) {
         }
     }
 
+    profile_path = fs::path(out_path).append("profile.json");
+
+    // In --serve mode, stdout only carries the results of the jobs (see job_server.h)
+    if (serve) cout.rdbuf(cerr.rdbuf());
+
     cout << "-i " << dir_to_parse << endl;
     cout << "-o " << out_path.string() << endl;
     if (has_extracted_maindata_path) cout << "-d " << extracted_maindata_path.string() << endl;
+    if (has_filter_rules_path) cout << "--filter_rules " << filter_rules_path.string() << endl;
+    if (memory_budget_mb != 0) cout << "--memory_budget_mb " << memory_budget_mb << endl;
+    if (mesh_cache_mb != 256) cout << "--mesh_cache_mb " << mesh_cache_mb << endl;
+    if (contact_sheet_size != 0) cout << "--contact_sheet " << contact_sheet_size << endl;
+    const char* dds_format_names[] = { "source", "bc1", "bc3", "bc4", "bc7" };
+    if (diff_dds_format != DdsFormat::source) cout << "--diff_format " << dds_format_names[int(diff_dds_format)] << endl;
+    if (metal_dds_format != DdsFormat::source) cout << "--metal_format " << dds_format_names[int(metal_dds_format)] << endl;
+    const SnowParameters default_snow_parameters;
+    if (snow_parameters.min_normal_y != default_snow_parameters.min_normal_y
+        || snow_parameters.partial_snow_normal_y != default_snow_parameters.partial_snow_normal_y
+        || snow_parameters.full_snow_normal_y != default_snow_parameters.full_snow_normal_y) {
+        cout << "--snow_normal_y " << snow_parameters.min_normal_y << "," << snow_parameters.partial_snow_normal_y << ","
+            << snow_parameters.full_snow_normal_y << endl;
+    }
+    if (!std::equal(snow_parameters.snow_color, snow_parameters.snow_color + 3, default_snow_parameters.snow_color)) {
+        cout << "--snow_color " << snow_parameters.snow_color[0] << "," << snow_parameters.snow_color[1] << ","
+            << snow_parameters.snow_color[2] << endl;
+    }
+    if (snow_parameters.noise_scale != default_snow_parameters.noise_scale) cout << "--noise_scale " << snow_parameters.noise_scale << endl;
+    if (has_output_archive_path) cout << "--output_archive " << output_archive_path.string() << endl;
+    if (has_extract_archive_path) cout << "--extract_archive " << extract_archive_path.string() << endl;
+    if (preview_mode == PreviewMode::off) cout << "--preview off" << endl;
+    if (preview_mode == PreviewMode::every) cout << "--preview every" << endl;
+    if (serve) cout << "--serve" << endl;
+    if (watch) cout << "--watch" << endl;
     /*
     if (disable_filenamefilters) cout << "--no_ff" << endl;
     if (atlas_mode) cout << "--atlas_mode" << endl;
     if (no_prompt) cout << "--noprompt" << endl;
     */
 }
+
+void CliOptions::set_preview_mode(const std::string& mode)
+{
+    if (mode == "off") preview_mode = PreviewMode::off;
+    else if (mode == "throttled") preview_mode = PreviewMode::throttled;
+    else if (mode == "every") preview_mode = PreviewMode::every;
+    else cout << "--preview expects off, throttled or every, not " << mode << endl;
+}
+
+bool CliOptions::set_job_option(const std::string& name, const std::string& value)
+{
+    if (name == "out") out_path = fs::path(value);
+    else if (name == "diff_format") return set_dds_format(&diff_dds_format, value, "diff_format");
+    else if (name == "metal_format") return set_dds_format(&metal_dds_format, value, "metal_format");
+    else if ((name == "save_png" || name == "save_renderings") && (value == "true" || value == "false")) {
+        (name == "save_png" ? save_png : save_renderings) = value == "true";
+    }
+    else return false;
+    return true;
+}
+
+bool CliOptions::set_dds_format(DdsFormat* dds_format, const std::string& format, const std::string& option)
+{
+    if (format == "source") *dds_format = DdsFormat::source;
+    else if (format == "bc1") *dds_format = DdsFormat::bc1;
+    else if (format == "bc3") *dds_format = DdsFormat::bc3;
+    else if (format == "bc4") *dds_format = DdsFormat::bc4;
+    else if (format == "bc7") *dds_format = DdsFormat::bc7;
+    else {
+        cout << option << " expects source, bc1, bc3, bc4 or bc7, not " << format << endl;
+        return false;
+    }
+    return true;
+}
+
+bool CliOptions::parse_fractions(const std::string& list, float* values, size_t count, const std::string& option)
+{
+    std::vector<float> parsed;
+    size_t start = 0;
+    while (start <= list.size()) {
+        size_t end = list.find(',', start);
+        if (end == std::string::npos) end = list.size();
+        try {
+            size_t parsed_length = 0;
+            float value = std::stof(list.substr(start, end - start), &parsed_length);
+            if (parsed_length != end - start || !(value >= 0.f && value <= 1.f)) break;
+            parsed.push_back(value);
+        }
+        catch (std::exception) {
+            break;
+        }
+        start = end + 1;
+    }
+    if (parsed.size() != count || start <= list.size()) {
+        cout << option << " expects " << count << " comma-separated numbers from 0 to 1, not " << list << endl;
+        return false;
+    }
+    std::copy(parsed.begin(), parsed.end(), values);
+    return true;
+}
@@ -3,30 +3,54 @@
 #include <filesystem>
 #include <string>
 
-class CliOptions
+#include "snow_options.h"
+
+class CliOptions : public SnowOptions
 {
 public:
     CliOptions(int argc, char* argv[], std::filesystem::path containing_dir);
 
     std::filesystem::path dir_to_parse;
-    std::filesystem::path out_path;
-
-    bool has_extracted_maindata_path = false; // Was a fallback path with the extracted maindata passed as command line argument?
-    std::filesystem::path extracted_maindata_path;
 
     bool disable_filenamefilters = false;
-    bool disable_texture_blacklist = false;
-    bool atlas_mode = false;
-    bool save_non_mod_textures = false;
-
-    bool flat_overwrites_steep = true;
+    bool has_filter_rules_path = false; // Additional black-/whitelist rules, see add_rules_from_file()
+    std::filesystem::path filter_rules_path;
+    size_t contact_sheet_size = 0; // Renderings per contact sheet with --save_renderings. 0 = one .jpg per .cfg file
+    bool has_output_archive_path = false; // Write all generated files into one archive instead of below out_path
+    std::filesystem::path output_archive_path;
+    bool has_extract_archive_path = false; // Only extract an archive to out_path
+    std::filesystem::path extract_archive_path;
 
-    bool save_png = false;
-    bool save_dds = true;
-    bool save_renderings = false;
+    PreviewMode preview_mode = PreviewMode::throttled;
 
     bool no_prompt = false;
 
+    size_t memory_budget_mb = 0; // 0 = unlimited
+    size_t mesh_cache_mb = 256; // Meshes kept for later .cfg files after the .cfg using them is done. 0 = no cache
+
+    bool use_cfg_index = true; // Read/write cfg_index.bin in the output directory instead of scanning unchanged .cfg files
+
+    bool plan = false; // Only print the estimated work per .cfg file, process nothing
+
+    bool watch = false; // After processing the input directory, process the .cfg files again whose files change (see FileWatcher)
+    bool serve = false; // Process the .cfg files sent on stdin, keeping the GL context and the caches (see JobServer)
+
+    bool benchmark_filters = false; // Only measure the path filters on generated paths
+
+    bool benchmark = false; // Print throughput numbers and the peak memory usage at the end
+    bool profile = false; // Write a timeline of the processing stages to profile_path
+    std::filesystem::path profile_path;
+
     bool display_help_message = false;
     bool display_licenses = false;
+
+    // The options a --serve job can override for its .cfg file: out, diff_format, metal_format, save_png, save_renderings.
+    // Returns false for other names and invalid values.
+    bool set_job_option(const std::string& name, const std::string& value);
+
+private:
+    void set_preview_mode(const std::string& mode);
+    bool set_dds_format(DdsFormat* dds_format, const std::string& format, const std::string& option);
+    // Comma-separated numbers from 0 to 1, like 0.3,0.4,0.8. Leaves values unchanged if there are not count of them.
+    bool parse_fractions(const std::string& list, float* values, size_t count, const std::string& option);
 };
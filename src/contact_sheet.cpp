@@ -0,0 +1,107 @@
+#include "contact_sheet.h"
+
+#include <iostream>
+#include <sstream>
+#include <cmath>
+#include <cstdio>
+
+#include "shaders.h"
+#include "dds2gl.h"
+#include "output_sink.h"
+
+// The clear color of the previews stays as it is
+static void clear_to_black()
+{
+	GLfloat previous_clear_color[4];
+	glGetFloatv(GL_COLOR_CLEAR_VALUE, previous_clear_color);
+	glClearColor(0., 0., 0., 1.);
+	glClear(GL_COLOR_BUFFER_BIT);
+	glClearColor(previous_clear_color[0], previous_clear_color[1], previous_clear_color[2], previous_clear_color[3]);
+}
+
+ContactSheet::ContactSheet(size_t thumbnails_per_sheet, std::filesystem::path out_directory, GlStuff* context_gl)
+	: gl(context_gl), directory(out_directory), capacity(thumbnails_per_sheet > 0 ? thumbnails_per_sheet : 1)
+{
+	columns = int(std::ceil(std::sqrt(double(capacity))));
+	rows = int((capacity + columns - 1) / columns);
+
+	sheet_texture = create_empty_texture(columns * thumbnail_size, rows * thumbnail_size, GL_RGB, GL_NEAREST, GL_NEAREST, GL_CLAMP_TO_EDGE);
+	sheet_framebuffer = create_framebuffer(1);
+	glFramebufferTexture(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, sheet_texture, 0);
+	is_framebuffer_ok();
+	clear_to_black();
+
+	copy_program = compile_shaders_to_program(empty_vertexshader_code, copy_from_texture_fragmentshader_code);
+}
+
+ContactSheet::~ContactSheet()
+{
+	cleanup();
+}
+
+void ContactSheet::add(GLuint rendering_texture, const std::string& cfg_path)
+{
+	// Trilinear filtering over the mipmaps of the rendering, a single bilinear lookup per thumbnail pixel would alias
+	glBindTexture(GL_TEXTURE_2D, rendering_texture);
+	glGenerateMipmap(GL_TEXTURE_2D);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+
+	// Row 0 of the texture is the first row of the .jpg, like the renderings themselves
+	int cell = int(cell_cfg_paths.size());
+	glBindFramebuffer(GL_FRAMEBUFFER, sheet_framebuffer);
+	glViewport((cell % columns) * thumbnail_size, (cell / columns) * thumbnail_size, thumbnail_size, thumbnail_size);
+	glDisable(GL_DEPTH_TEST);
+	glUseProgram(copy_program);
+
+	GLuint texture_location_in_shader = glGetUniformLocation(copy_program, "diff_texture");
+	glActiveTexture(GL_TEXTURE0);
+	glBindTexture(GL_TEXTURE_2D, rendering_texture);
+	glUniform1i(texture_location_in_shader, 0);
+
+	gl->bind_square_buffers();
+	glDrawElements(GL_TRIANGLES, 6, GL_UNSIGNED_INT, (void*)0);
+	gl->unbind_square_buffers();
+
+	glBindTexture(GL_TEXTURE_2D, rendering_texture);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+
+	cell_cfg_paths.push_back(cfg_path);
+	if (cell_cfg_paths.size() == capacity) flush();
+}
+
+void ContactSheet::flush()
+{
+	if (cell_cfg_paths.empty()) return;
+	sheet_count++;
+	char sheet_name[32];
+	snprintf(sheet_name, sizeof(sheet_name), "contact_sheet_%04zu", sheet_count);
+
+	gl_texture_to_jpg_file(sheet_texture, std::filesystem::path(directory).append(std::string(sheet_name) + ".jpg"), false);
+
+	std::ostringstream cell_list;
+	for (size_t cell = 0; cell < cell_cfg_paths.size(); cell++) {
+		cell_list << "row " << cell / columns + 1 << ", column " << cell % columns + 1 << ": " << cell_cfg_paths[cell] << "\n";
+	}
+	std::string cell_list_text = cell_list.str();
+	std::filesystem::path cell_list_path = std::filesystem::path(directory).append(std::string(sheet_name) + ".txt");
+	if (!output_sink::write_file(cell_list_path, cell_list_text.data(), cell_list_text.size())) {
+		std::cout << "Could not save to \"" << cell_list_path.string() << "\"" << std::endl;
+	}
+	cell_cfg_paths.clear();
+
+	// Empty cells of the next sheet stay black
+	glBindFramebuffer(GL_FRAMEBUFFER, sheet_framebuffer);
+	glViewport(0, 0, columns * thumbnail_size, rows * thumbnail_size);
+	clear_to_black();
+}
+
+void ContactSheet::cleanup()
+{
+	if (sheet_framebuffer == 0) return;
+	flush();
+	delete_gl_texture(&sheet_texture);
+	glDeleteFramebuffers(1, &sheet_framebuffer);
+	sheet_framebuffer = 0;
+	glDeleteProgram(copy_program);
+	copy_program = 0;
+}
@@ -0,0 +1,45 @@
+#pragma once
+#include <string>
+#include <vector>
+#include <filesystem>
+#include "../external/glew-2.2.0/include/GL/glew.h"
+
+#include "gl_stuff.h"
+
+/*
+Collects downscaled isometric renderings (--save_renderings with --contact_sheet N) into one image per N .cfg files,
+instead of encoding a 1600x1600 .jpg for each of them. The thumbnails are drawn on the GPU, a sheet is only read back
+and encoded when it is full. Next to each contact_sheet_0001.jpg, contact_sheet_0001.txt lists the .cfg file of each cell.
+*/
+
+class ContactSheet
+{
+public:
+	static constexpr int thumbnail_size = 256;
+
+	ContactSheet(size_t thumbnails_per_sheet, std::filesystem::path out_directory, GlStuff* context_gl);
+	~ContactSheet();
+
+	ContactSheet(const ContactSheet&) = delete;
+	ContactSheet& operator=(const ContactSheet&) = delete;
+
+	// Draws the rendering into the next cell. Changes the bound framebuffer, program and viewport.
+	void add(GLuint rendering_texture, const std::string& cfg_path);
+	// Saves the current sheet, if it has any thumbnails
+	void flush();
+	void cleanup();
+
+private:
+	GlStuff* gl;
+	std::filesystem::path directory;
+	size_t capacity;
+	int columns;
+	int rows;
+
+	GLuint sheet_texture = 0;
+	GLuint sheet_framebuffer = 0;
+	GLuint copy_program = 0;
+
+	std::vector<std::string> cell_cfg_paths;
+	size_t sheet_count = 0;
+};
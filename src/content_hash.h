@@ -0,0 +1,44 @@
+#pragma once
+#include <cstdint>
+#include <cstddef>
+#include <array>
+#include <string_view>
+
+/*
+SHA-256 of the contents of meshes and of snowed pixels, to find identical ones. A collision would silently reuse a
+mesh or link a texture under the wrong name, so a 256 bit cryptographic hash is used instead of a fast 64 bit one.
+*/
+
+struct ContentHash {
+	std::array<uint32_t, 8> words{};
+
+	bool operator==(const ContentHash& other) const = default;
+};
+
+// For unordered_maps: the words are already evenly distributed
+struct ContentHashHasher {
+	size_t operator()(const ContentHash& hash) const { return (size_t(hash.words[0]) << 32) ^ hash.words[1]; }
+};
+
+// Hashes data given in parts, as if they were one buffer
+class ContentHasher
+{
+public:
+	ContentHasher();
+	void add(const void* data, size_t size);
+	void add(std::string_view data) { add(data.data(), data.size()); }
+	template <typename Value>
+	void add_value(const Value& value) { add(&value, sizeof(value)); }
+	// The hasher must not be used afterwards
+	ContentHash finish();
+
+private:
+	void add_block(const uint8_t* block);
+
+	std::array<uint32_t, 8> state;
+	uint8_t buffer[64];
+	size_t buffered_size = 0;
+	uint64_t total_size = 0;
+};
+
+ContentHash hash_content(const void* data, size_t size);
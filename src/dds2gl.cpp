@@ -3,12 +3,18 @@
 #include <iostream>
 #include <fstream>
 #include <string>
+#include <cstring>
 #include <filesystem>
 
 #include <d3d11.h>
 #include <wrl/client.h>
 
 #include "snow_exception.h"
+#include "profiler.h"
+#include "memory_accounting.h"
+#include "output_sink.h"
+#include "gl_stuff.h"
+#include "mapped_file.h"
 
 
 std::wstring string_to_16bit_unicode_wstring(std::string input_string) {
@@ -25,7 +31,7 @@ std::wstring string_to_16bit_unicode_wstring(std::string input_string) {
 
 const wchar_t* GetErrorDesc(HRESULT hr) // Code copied from Texconv.cpp (MIT-license) (https://github.com/microsoft/DirectXTex/blob/main/Texconv/texconv.cpp)
 {
-	static wchar_t desc[1024] = {};
+	static thread_local wchar_t desc[1024] = {}; // Encoder threads call this too
 
 	LPWSTR errorText = nullptr;
 
@@ -53,6 +59,24 @@ const wchar_t* GetErrorDesc(HRESULT hr) // Code copied from Texconv.cpp (MIT-lic
 	return desc;
 }
 
+// The code and the description of GetErrorDesc for the log streams of the workers, in UTF-8
+static std::string describe_error(HRESULT hr)
+{
+	const wchar_t* desc = GetErrorDesc(hr);
+	int size = WideCharToMultiByte(CP_UTF8, 0, desc, -1, nullptr, 0, nullptr, nullptr);
+	std::string text(size > 1 ? size - 1 : 0, '\0');
+	if (size > 1) WideCharToMultiByte(CP_UTF8, 0, desc, -1, text.data(), size, nullptr, nullptr);
+	return std::to_string(static_cast<unsigned int>(hr)) + text;
+}
+
+// Through MappedFile, so that a SourceResolver can supply the file
+static HRESULT load_dds_file(const std::filesystem::path& path, DirectX::TexMetadata* info, DirectX::ScratchImage& image)
+{
+	MappedFile file(path);
+	if (!file.is_open()) return E_FAIL;
+	return DirectX::LoadFromDDSMemory(file.data(), file.size(), DirectX::DDS_FLAGS_ALLOW_LARGE_FILES, info, image);
+}
+
 GLuint directx_image_to_gl_texture(const DirectX::Image* image) {
 	GLuint texture_id;
 	glGenTextures(1, &texture_id);
@@ -70,6 +94,7 @@ GLuint directx_image_to_gl_texture(const DirectX::Image* image) {
 		GL_TEXTURE_2D, 0, // Target
 		GL_RGBA8, image->width, image->height, 0, // How to store the image
 		GL_RGBA, GL_UNSIGNED_BYTE, image->pixels); // The data from DirectX
+	memory_accounting::track_gl_texture(texture_id, memory_accounting::Category::decoded_textures, image->width * image->height * 4);
 
 	glfwPollEvents();
 
@@ -80,13 +105,135 @@ GLuint directx_image_to_gl_texture(const DirectX::Image* image) {
 	return texture_id;
 }
 
-GLuint dds_file_to_gl_texture(std::wstring dds_filepath) {
+// Calls function(x, y, width, height) in texels for each run of marked tiles in a row of tiles, at the miplevel
+// where a tile has tile_texels texels and the image width x height texels
+template <typename Function>
+static void for_each_marked_run(const TileMask& tiles, int row, size_t tile_texels, size_t width, size_t height, Function function)
+{
+	size_t y = size_t(row) * tile_texels;
+	if (y >= height) return;
+	size_t run_height = height - y < tile_texels ? height - y : tile_texels;
+	for (int column = 0; column < tiles.get_columns(); column++) {
+		if (!tiles.is_marked(column, row)) continue;
+		int run_end = column + 1;
+		while (run_end < tiles.get_columns() && tiles.is_marked(run_end, row)) run_end++;
+		size_t x = size_t(column) * tile_texels;
+		size_t x_end = size_t(run_end) * tile_texels < width ? size_t(run_end) * tile_texels : width;
+		if (x < x_end) function(x, y, x_end - x, run_height);
+		column = run_end;
+	}
+}
+
+// A view of the blocks of a block-compressed image, from texel (x, y) on, which must be on the border of a block
+static DirectX::Image block_region(const DirectX::Image& image, size_t x, size_t y, size_t width, size_t height)
+{
+	size_t block_bytes = DirectX::BitsPerPixel(image.format) * 2; // 16 texels per block
+	DirectX::Image region = image;
+	region.width = width;
+	region.height = height;
+	region.pixels = image.pixels + (y / 4) * image.rowPitch + (x / 4) * block_bytes;
+	region.slicePitch = image.rowPitch * ((height + 3) / 4);
+	return region;
+}
+
+// The same for RGBA8 pixels
+static DirectX::Image pixel_region(const DirectX::Image& image, size_t x, size_t y, size_t width, size_t height)
+{
+	DirectX::Image region = image;
+	region.width = width;
+	region.height = height;
+	region.pixels = image.pixels + y * image.rowPitch + x * 4;
+	region.slicePitch = image.rowPitch * height;
+	return region;
+}
+
+// band_rows are whole blocks down to miplevel 6
+constexpr size_t band_miplevels = 7;
+
+// The miplevels of the bands are only the rows of the miplevels of the whole texture if both sides are multiples of
+// band_rows. Smaller textures are not worth it.
+bool is_processed_in_bands(size_t width, size_t height)
+{
+	return width * height > size_t(2048) * 2048 && width % band_rows == 0 && height % band_rows == 0;
+}
+
+size_t estimate_encode_memory_bytes(size_t width, size_t height)
+{
+	// Per texel: the RGBA8 copy of the readback, which is always full size (the hash for the deduplication reads it
+	// as a whole), mipmaps (4/3 of the readback) and the compressed output (up to 1 byte, 4/3 with mipmaps).
+	// In bands, only one band of mipmaps and output exists at a time.
+	if (is_processed_in_bands(width, height)) return width * height * 4 + width * band_rows * (6 + 2);
+	return width * height * (4 + 6 + 2);
+}
+
+// Decodes a block-compressed image in parts: in bands of rows, or only the tiles in decoded_tiles.
+// Only the GL texture has the whole size, the decoded pixels are never all in memory at once.
+static GLuint decode_to_gl_texture(const DirectX::Image& image, const TileMask* decoded_tiles)
+{
+	GLuint texture_id = create_empty_texture(int(image.width), int(image.height), GL_RGBA, GL_LINEAR, GL_NEAREST, GL_REPEAT,
+		memory_accounting::Category::decoded_textures);
+
+	if (decoded_tiles) {
+		// The combine pass also writes the tiles that are not decoded, the blocks saved there are the original ones.
+		// They are cleared anyway: the pixels read back are hashed to find identical textures.
+		GLfloat clear_color[4];
+		glGetFloatv(GL_COLOR_CLEAR_VALUE, clear_color);
+		GLuint framebuffer_id = create_framebuffer(1);
+		glFramebufferTexture(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, texture_id, 0);
+		glClearColor(0.f, 0.f, 0.f, 0.f);
+		glClear(GL_COLOR_BUFFER_BIT);
+		glClearColor(clear_color[0], clear_color[1], clear_color[2], clear_color[3]);
+		glBindFramebuffer(GL_FRAMEBUFFER, 0);
+		glDeleteFramebuffers(1, &framebuffer_id);
+	}
+
+	glBindTexture(GL_TEXTURE_2D, texture_id);
+	glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+	bool is_decoded = true;
+	auto decode_region = [&](size_t x, size_t y, size_t width, size_t height) {
+		if (!is_decoded) return;
+		TrackedAllocation decode_scratch(memory_accounting::Category::decoded_textures, width * height * 4);
+		DirectX::ScratchImage decoded_region;
+		if (FAILED(DirectX::Decompress(block_region(image, x, y, width, height), DXGI_FORMAT_R8G8B8A8_UNORM, decoded_region))) {
+			is_decoded = false;
+			return;
+		}
+		glTexSubImage2D(GL_TEXTURE_2D, 0, GLint(x), GLint(y), GLsizei(width), GLsizei(height),
+			GL_RGBA, GL_UNSIGNED_BYTE, decoded_region.GetImage(0, 0, 0)->pixels);
+	};
+
+	if (!decoded_tiles) {
+		for (size_t y = 0; y < image.height && is_decoded; y += band_rows) {
+			decode_region(0, y, image.width, image.height - y < band_rows ? image.height - y : band_rows);
+			glfwPollEvents();
+		}
+	}
+	for (int row = 0; decoded_tiles && row < decoded_tiles->get_rows() && is_decoded; row++) {
+		for_each_marked_run(*decoded_tiles, row, TileMask::tile_size, image.width, image.height, [&](size_t x, size_t y, size_t width, size_t height) {
+			// One block more on each side: the combine pass reads the neighbours of a texel in the snowmap, and filtering
+			// may touch those of the textures, the edges of the decoded tiles must not see the cleared texels
+			size_t x_end = x + width + 4 <= image.width ? x + width + 4 : image.width;
+			size_t y_end = y + height + 4 <= image.height ? y + height + 4 : image.height;
+			x = x >= 4 ? x - 4 : 0;
+			y = y >= 4 ? y - 4 : 0;
+			decode_region(x, y, x_end - x, y_end - y);
+		});
+		glfwPollEvents();
+	}
+	if (!is_decoded) {
+		delete_gl_texture(&texture_id);
+		throw snow_exception("Texture extraction failed...");
+	}
+	return texture_id;
+}
+
+GLuint dds_file_to_gl_texture(std::wstring dds_filepath, DXGI_FORMAT* source_format, const TileMask* decoded_tiles) {
 	DirectX::TexMetadata info;
 	std::unique_ptr<DirectX::ScratchImage> scratchimage(new (std::nothrow) DirectX::ScratchImage);
 
 	glfwPollEvents();
 
-	long hr = DirectX::LoadFromDDSFile(dds_filepath.c_str(), DirectX::DDS_FLAGS_ALLOW_LARGE_FILES, &info, *scratchimage);
+	long hr = load_dds_file(dds_filepath, &info, *scratchimage);
 	
 	glfwPollEvents();
 	
@@ -96,7 +243,24 @@ GLuint dds_file_to_gl_texture(std::wstring dds_filepath) {
 		throw snow_exception("Texture loading from dds file failed...");
 	}
 	else {
+		if (source_format) *source_format = info.format;
 	    auto image = scratchimage->GetImage(0, 0, 0);
+		GLint max_texture_size = 0;
+		glGetIntegerv(GL_MAX_TEXTURE_SIZE, &max_texture_size);
+		if (image->width > size_t(max_texture_size) || image->height > size_t(max_texture_size)) {
+			scratchimage->Release();
+			std::wcout << "Texture is larger than the " << max_texture_size << " texels the graphics card supports: " << dds_filepath << std::endl;
+			throw snow_exception("Texture too large for the graphics card");
+		}
+		if (decoded_tiles && (image->width != size_t(decoded_tiles->get_width()) || image->height != size_t(decoded_tiles->get_height()))) {
+			decoded_tiles = nullptr;
+		}
+		if (DirectX::IsCompressed(image->format) && image->width % 4 == 0 && image->height % 4 == 0
+			&& (decoded_tiles || image->height > band_rows)) {
+			GLuint texture_id = decode_to_gl_texture(*image, decoded_tiles);
+			scratchimage->Release();
+			return texture_id;
+		}
 	    /*
 		std::cout << "Texture_width: " << image->width << std::endl;
 	    std::cout << "Texture_height: " << image->height << std::endl;
@@ -108,6 +272,7 @@ GLuint dds_file_to_gl_texture(std::wstring dds_filepath) {
 		uint32_t pixel_count = image->width * image->height;
 
 		// We want to convert the image to DXGI_FORMAT_R8G8B8A8_UINT (='30')
+		TrackedAllocation decode_scratch(memory_accounting::Category::decoded_textures, size_t(pixel_count) * 4);
 		std::unique_ptr<DirectX::ScratchImage> extracted_scratchimage(new (std::nothrow) DirectX::ScratchImage);
 		hr = Decompress(image, scratchimage->GetImageCount(), info, DXGI_FORMAT_R8G8B8A8_UNORM, *extracted_scratchimage);
 
@@ -146,34 +311,78 @@ GLuint dds_file_to_gl_texture(std::wstring dds_filepath) {
 	return 0;
 }
 
-DirectX::Image gl_texture_to_dx_image(GLuint texture_id) {
+MappedDds::MappedDds(const std::filesystem::path& path) : file(path)
+{
+	DirectX::TexMetadata info;
+	if (!file.is_open() || FAILED(DirectX::GetMetadataFromDDSMemory(file.data(), file.size(), DirectX::DDS_FLAGS_ALLOW_LARGE_FILES, info))) return;
+	if (!DirectX::IsCompressed(info.format) || info.dimension != DirectX::TEX_DIMENSION_TEXTURE2D || info.arraySize != 1) return;
+	// The magic number and the DDS_HEADER, then the DDS_HEADER_DXT10 if the FourCC of the pixel format is "DX10".
+	// The blocks of miplevel 0 follow. Block-compressed formats are never converted by LoadFromDDSMemory.
+	size_t pixels_offset = 4 + 124;
+	if (std::memcmp(file.data() + 84, "DX10", 4) == 0) pixels_offset += 20;
+	size_t row_pitch, slice_pitch;
+	if (FAILED(DirectX::ComputePitch(info.format, info.width, info.height, row_pitch, slice_pitch))) return;
+	if (pixels_offset + slice_pitch > file.size()) return;
+	image.width = info.width;
+	image.height = info.height;
+	image.format = info.format;
+	image.rowPitch = row_pitch;
+	image.slicePitch = slice_pitch;
+	image.pixels = (uint8_t*)(file.data() + pixels_offset); // Only read
+}
+
+bool MappedDds::decode_to_gl_texture(size_t x, size_t y, size_t width, size_t height, GLuint texture_id) const
+{
+	if (!is_open() || x % 4 != 0 || y % 4 != 0 || x + width > image.width || y + height > image.height) return false;
+	TrackedAllocation decode_scratch(memory_accounting::Category::decoded_textures, width * height * 4);
+	DirectX::ScratchImage decoded_region;
+	if (FAILED(DirectX::Decompress(block_region(image, x, y, width, height), DXGI_FORMAT_R8G8B8A8_UNORM, decoded_region))) return false;
+	glBindTexture(GL_TEXTURE_2D, texture_id);
+	glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+	glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, GLsizei(width), GLsizei(height), GL_RGBA, GL_UNSIGNED_BYTE, decoded_region.GetImage(0, 0, 0)->pixels);
+	return true;
+}
+
+bool get_dds_dimensions(std::wstring dds_filepath, size_t* width, size_t* height, DXGI_FORMAT* format) {
+	// Only reads the header, the rest of the mapping is not touched
+	DirectX::TexMetadata info;
+	MappedFile file(dds_filepath);
+	if (!file.is_open()) return false;
+	long hr = DirectX::GetMetadataFromDDSMemory(file.data(), file.size(), DirectX::DDS_FLAGS_ALLOW_LARGE_FILES, info);
+	if (FAILED(hr)) return false;
+	*width = info.width;
+	*height = info.height;
+	if (format) *format = info.format;
+	return true;
+}
+
+DirectX::Image gl_texture_to_dx_image(GLuint texture_id, DirectX::ScratchImage& pixel_storage, std::string path_argument) {
+	ProfileScope scope("readback", std::move(path_argument));
     glBindTexture(GL_TEXTURE_2D, texture_id);
 
 	int width, height;
 	glGetTexLevelParameteriv(GL_TEXTURE_2D, 0, GL_TEXTURE_WIDTH, &width);
 	glGetTexLevelParameteriv(GL_TEXTURE_2D, 0, GL_TEXTURE_HEIGHT, &height);
 	if (glGetError() != GL_NO_ERROR) std::cout << "GL ERROR while trying to get texture informations" << std::endl;
-	uint32_t pixel_count = width * height;
 
-	uint8_t* image_buffer = new uint8_t[pixel_count * 4];
+	long hr = pixel_storage.Initialize2D(DXGI_FORMAT_R8G8B8A8_UNORM, width, height, 1, 1);
+	if (FAILED(hr)) throw snow_exception("Could not allocate memory for reading back a texture");
+	DirectX::Image image = *pixel_storage.GetImage(0, 0, 0);
 
-	glGetTexImage(GL_TEXTURE_2D, 0, GL_RGBA, GL_UNSIGNED_BYTE, image_buffer);
+	glPixelStorei(GL_PACK_ALIGNMENT, 1);
+	glGetTexImage(GL_TEXTURE_2D, 0, GL_RGBA, GL_UNSIGNED_BYTE, image.pixels);
 	if (glGetError() != GL_NO_ERROR) std::cout << "GL ERROR while trying to get texture data" << std::endl;
-
-	DirectX::Image image{};
-	image.width = width;
-	image.height = height;
-	image.pixels = image_buffer;
-	image.format = DXGI_FORMAT_R8G8B8A8_UNORM;
-	image.rowPitch = image.width * 4;
-	image.slicePitch = pixel_count * 4;
 	return image;
 }
 
 int save_dx_image_to_file(DirectX::Image image, GUID wic_codec, std::filesystem::path filename) {
-    std::filesystem::create_directories(filename.parent_path());
+	ProfileScope scope("write_image", filename.string());
 	
-	long hr = DirectX::SaveToWICFile(image, DirectX::WIC_FLAGS_NONE, wic_codec, filename.c_str());
+	DirectX::Blob encoded_image;
+	long hr = DirectX::SaveToWICMemory(image, DirectX::WIC_FLAGS_NONE, wic_codec, encoded_image);
+	if (SUCCEEDED(hr) && !output_sink::write_file(filename, encoded_image.GetBufferPointer(), encoded_image.GetBufferSize())) {
+		hr = E_FAIL;
+	}
 
 	if (FAILED(hr)) {
 		std::cout << "Could not save to \"" << filename.string() << "\"" << std::endl;
@@ -195,9 +404,10 @@ int gl_texture_to_png_file(GLuint texture_id, std::filesystem::path filename, bo
 		}
 	}
 
-	DirectX::Image image = gl_texture_to_dx_image(texture_id);
-	save_dx_image_to_file(image, DirectX::GetWICCodec(DirectX::WIC_CODEC_PNG), filename);
-	delete[] image.pixels;
+	DirectX::ScratchImage pixel_storage;
+	DirectX::Image image = gl_texture_to_dx_image(texture_id, pixel_storage, filename.string());
+	TrackedAllocation readback_memory(memory_accounting::Category::mip_scratch, image.slicePitch);
+	return save_dx_image_to_file(image, DirectX::GetWICCodec(DirectX::WIC_CODEC_PNG), filename);
 }
 
 int gl_texture_to_jpg_file(GLuint texture_id, std::filesystem::path filename, boolean append_extension)
@@ -209,9 +419,10 @@ int gl_texture_to_jpg_file(GLuint texture_id, std::filesystem::path filename, bo
 		}
 	}
 
-	DirectX::Image image = gl_texture_to_dx_image(texture_id);
-	save_dx_image_to_file(image, DirectX::GetWICCodec(DirectX::WIC_CODEC_JPEG), filename);
-	delete[] image.pixels;
+	DirectX::ScratchImage pixel_storage;
+	DirectX::Image image = gl_texture_to_dx_image(texture_id, pixel_storage, filename.string());
+	TrackedAllocation readback_memory(memory_accounting::Category::mip_scratch, image.slicePitch);
+	return save_dx_image_to_file(image, DirectX::GetWICCodec(DirectX::WIC_CODEC_JPEG), filename);
 }
 
 Microsoft::WRL::ComPtr<ID3D11Device> get_d3d11_device() {
@@ -248,7 +459,8 @@ Microsoft::WRL::ComPtr<ID3D11Device> get_d3d11_device() {
 	return device;
 }
 
-void gl_texture_to_dds_mipmaps(GLuint texture_id, std::filesystem::path filename_until_mipmap_indication, size_t mipmap_count)
+void gl_texture_to_dds_mipmaps(GLuint texture_id, std::filesystem::path filename_until_mipmap_indication, size_t mipmap_count,
+	DXGI_FORMAT format)
 {
 	// In case of errors: Do not throw an exception, but just return without saving the texture.
 	if (mipmap_count == 0) return;
@@ -257,18 +469,403 @@ void gl_texture_to_dds_mipmaps(GLuint texture_id, std::filesystem::path filename
 	// Update the window from time to time (Otherwise it won't react for some seconds)
 	glfwPollEvents();
 
-	glBindTexture(GL_TEXTURE_2D, texture_id);
+	DirectX::ScratchImage pixel_storage;
+	DirectX::Image image = gl_texture_to_dx_image(texture_id, pixel_storage, filename_until_mipmap_indication.string());
+	TrackedAllocation readback_memory(memory_accounting::Category::mip_scratch, image.slicePitch);
+	dx_image_to_dds_mipmaps(image, filename_until_mipmap_indication, mipmap_count, format);
+}
 
-	int width, height;
-	glGetTexLevelParameteriv(GL_TEXTURE_2D, 0, GL_TEXTURE_WIDTH, &width);
-	glGetTexLevelParameteriv(GL_TEXTURE_2D, 0, GL_TEXTURE_HEIGHT, &height);
-	if (mipmap_count == 1 && width >= 32 && height >= 32) mipmap_count = 4; // Generate mipmaps also if the original did not have them
+bool gl_pixels_to_dx_image(const uint8_t* pixels, int width, int height, DirectX::ScratchImage& pixel_storage)
+{
+	long hr = pixel_storage.Initialize2D(DXGI_FORMAT_R8G8B8A8_UNORM, width, height, 1, 1);
+	if (FAILED(hr)) return false;
+	memcpy(pixel_storage.GetImage(0, 0, 0)->pixels, pixels, size_t(width) * height * 4);
+	return true;
+}
+
+DXGI_FORMAT get_output_dds_format(DXGI_FORMAT source_format, DdsFormat requested_format)
+{
+	// The snowed pixels are the same values as the decoded ones, an sRGB source stays sRGB
+	bool is_srgb = DirectX::IsSRGB(source_format);
+	switch (requested_format) {
+	case DdsFormat::bc1: return is_srgb ? DXGI_FORMAT_BC1_UNORM_SRGB : DXGI_FORMAT_BC1_UNORM;
+	case DdsFormat::bc3: return is_srgb ? DXGI_FORMAT_BC3_UNORM_SRGB : DXGI_FORMAT_BC3_UNORM;
+	case DdsFormat::bc4: return DXGI_FORMAT_BC4_UNORM;
+	case DdsFormat::bc7: return is_srgb ? DXGI_FORMAT_BC7_UNORM_SRGB : DXGI_FORMAT_BC7_UNORM;
+	default: break;
+	}
+	switch (source_format) {
+	case DXGI_FORMAT_BC1_UNORM:
+	case DXGI_FORMAT_BC1_UNORM_SRGB:
+	case DXGI_FORMAT_BC2_UNORM:
+	case DXGI_FORMAT_BC2_UNORM_SRGB:
+	case DXGI_FORMAT_BC3_UNORM:
+	case DXGI_FORMAT_BC3_UNORM_SRGB:
+	case DXGI_FORMAT_BC4_UNORM:
+	case DXGI_FORMAT_BC5_UNORM:
+	case DXGI_FORMAT_BC7_UNORM:
+	case DXGI_FORMAT_BC7_UNORM_SRGB:
+		return source_format;
+	default:
+		// Uncompressed, signed or HDR formats: the snowed pixels are 8 bit RGBA
+		return is_srgb ? DXGI_FORMAT_BC7_UNORM_SRGB : DXGI_FORMAT_BC7_UNORM;
+	}
+}
+
+bool is_source_format_kept(DXGI_FORMAT source_format, DdsFormat requested_format)
+{
+	return requested_format != DdsFormat::source || get_output_dds_format(source_format, requested_format) == source_format;
+}
+
+std::string get_format_name(DXGI_FORMAT format)
+{
+	switch (format) {
+	case DXGI_FORMAT_BC1_UNORM: return "BC1_UNORM";
+	case DXGI_FORMAT_BC1_UNORM_SRGB: return "BC1_UNORM_SRGB";
+	case DXGI_FORMAT_BC2_UNORM: return "BC2_UNORM";
+	case DXGI_FORMAT_BC2_UNORM_SRGB: return "BC2_UNORM_SRGB";
+	case DXGI_FORMAT_BC3_UNORM: return "BC3_UNORM";
+	case DXGI_FORMAT_BC3_UNORM_SRGB: return "BC3_UNORM_SRGB";
+	case DXGI_FORMAT_BC4_UNORM: return "BC4_UNORM";
+	case DXGI_FORMAT_BC4_SNORM: return "BC4_SNORM";
+	case DXGI_FORMAT_BC5_UNORM: return "BC5_UNORM";
+	case DXGI_FORMAT_BC5_SNORM: return "BC5_SNORM";
+	case DXGI_FORMAT_BC6H_UF16: return "BC6H_UF16";
+	case DXGI_FORMAT_BC6H_SF16: return "BC6H_SF16";
+	case DXGI_FORMAT_BC7_UNORM: return "BC7_UNORM";
+	case DXGI_FORMAT_BC7_UNORM_SRGB: return "BC7_UNORM_SRGB";
+	case DXGI_FORMAT_R8G8B8A8_UNORM: return "R8G8B8A8_UNORM";
+	case DXGI_FORMAT_R8G8B8A8_UNORM_SRGB: return "R8G8B8A8_UNORM_SRGB";
+	case DXGI_FORMAT_R8G8B8A8_SNORM: return "R8G8B8A8_SNORM";
+	case DXGI_FORMAT_B8G8R8A8_UNORM: return "B8G8R8A8_UNORM";
+	case DXGI_FORMAT_B8G8R8A8_UNORM_SRGB: return "B8G8R8A8_UNORM_SRGB";
+	case DXGI_FORMAT_B8G8R8X8_UNORM: return "B8G8R8X8_UNORM";
+	case DXGI_FORMAT_B8G8R8X8_UNORM_SRGB: return "B8G8R8X8_UNORM_SRGB";
+	case DXGI_FORMAT_B5G6R5_UNORM: return "B5G6R5_UNORM";
+	case DXGI_FORMAT_B5G5R5A1_UNORM: return "B5G5R5A1_UNORM";
+	case DXGI_FORMAT_B4G4R4A4_UNORM: return "B4G4R4A4_UNORM";
+	case DXGI_FORMAT_R10G10B10A2_UNORM: return "R10G10B10A2_UNORM";
+	case DXGI_FORMAT_R8_UNORM: return "R8_UNORM";
+	case DXGI_FORMAT_R8G8_UNORM: return "R8G8_UNORM";
+	case DXGI_FORMAT_A8_UNORM: return "A8_UNORM";
+	case DXGI_FORMAT_R16G16B16A16_FLOAT: return "R16G16B16A16_FLOAT";
+	case DXGI_FORMAT_R16G16B16A16_UNORM: return "R16G16B16A16_UNORM";
+	case DXGI_FORMAT_R32G32B32A32_FLOAT: return "R32G32B32A32_FLOAT";
+	case DXGI_FORMAT_R11G11B10_FLOAT: return "R11G11B10_FLOAT";
+	default: return "DXGI format " + std::to_string(int(format));
+	}
+}
+
+static std::filesystem::path miplevel_path(const std::filesystem::path& filename_until_mipmap_indication, size_t miplevel)
+{
+	return std::filesystem::path(filename_until_mipmap_indication).concat(std::to_string(miplevel)).concat(".dds");
+}
+
+// Miplevels 0 to 3 have tiles of 64 to 8 texels, whole blocks: the blocks outside of the decoded tiles are copied.
+// From miplevel 4 on (4 texels, one block per tile), the original miplevel 4 is decoded, the decoded tiles are put in
+// and the smaller miplevels are generated from that.
+constexpr size_t passthrough_miplevels = 4;
+
+bool can_pass_blocks_through(std::filesystem::path source_until_mipmap_indication, size_t mipmap_count, DXGI_FORMAT output_format)
+{
+	// A single miplevel gets generated ones, which have no originals
+	if (mipmap_count < 2 || !DirectX::IsCompressed(output_format)) return false;
+	size_t width0, height0;
+	for (size_t i = 0; i < mipmap_count && i <= passthrough_miplevels; i++) {
+		size_t width, height;
+		DXGI_FORMAT format;
+		if (!get_dds_dimensions(miplevel_path(source_until_mipmap_indication, i).wstring(), &width, &height, &format)) return false;
+		if (i == 0) {
+			width0 = width;
+			height0 = height;
+			if (width0 % TileMask::tile_size != 0 || height0 % TileMask::tile_size != 0) return false;
+		}
+		if (format != output_format || width != width0 >> i || height != height0 >> i) return false;
+	}
+	return true;
+}
+
+static bool is_compressed_on_graphics_card(DXGI_FORMAT format)
+{
+	return format == DXGI_FORMAT_BC7_UNORM || format == DXGI_FORMAT_BC7_UNORM_SRGB;
+}
+
+// BC7 on the graphics card (device), BC1 to BC5 on the CPU, which is fast enough for them
+static HRESULT compress_images(const DirectX::Image* images, size_t image_count, const DirectX::TexMetadata& metadata, DXGI_FORMAT format,
+	ID3D11Device* device, DirectX::ScratchImage& compressed)
+{
+	// The pixels are already sRGB values if the format is sRGB, they must not be converted
+	DirectX::TEX_COMPRESS_FLAGS compress_flags = DirectX::IsSRGB(format) ? DirectX::TEX_COMPRESS_SRGB_IN : DirectX::TEX_COMPRESS_DEFAULT;
+	if (device) return DirectX::Compress(device, images, image_count, metadata, format, compress_flags, 1.0f, compressed);
+	return DirectX::Compress(images, image_count, metadata, format, compress_flags, DirectX::TEX_THRESHOLD_DEFAULT, compressed);
+}
+
+static HRESULT compress_image(const DirectX::Image& image, DXGI_FORMAT format, ID3D11Device* device, DirectX::ScratchImage& compressed)
+{
+	DirectX::TexMetadata metadata{};
+	metadata.width = image.width;
+	metadata.height = image.height;
+	metadata.depth = 1;
+	metadata.arraySize = 1;
+	metadata.mipLevels = 1;
+	metadata.format = image.format;
+	metadata.dimension = DirectX::TEX_DIMENSION_TEXTURE2D;
+	return compress_images(&image, 1, metadata, format, device, compressed);
+}
+
+// The miplevels of image in format, where only the tiles that were decoded are compressed (see BlockPassthrough)
+static HRESULT compress_with_passthrough(const DirectX::Image& image, size_t mipmap_count, DXGI_FORMAT format,
+	const BlockPassthrough& passthrough, ID3D11Device* device, DirectX::ScratchImage& compressed_mipmaps)
+{
+	const TileMask& tiles = *passthrough.decoded_tiles;
+	if (image.width != size_t(tiles.get_width()) || image.height != size_t(tiles.get_height())) return E_FAIL;
+	size_t block_bytes = DirectX::BitsPerPixel(format) * 2;
+
+	size_t generated_count = mipmap_count <= passthrough_miplevels ? mipmap_count : passthrough_miplevels + 1;
+	DirectX::ScratchImage mipmaps;
+	HRESULT hr = DirectX::GenerateMipMaps(image, DirectX::TEX_FILTER_LINEAR, generated_count, mipmaps);
+	if (FAILED(hr)) return hr;
+	TrackedAllocation mipmap_memory(memory_accounting::Category::mip_scratch, mipmaps.GetPixelsSize());
+	hr = compressed_mipmaps.Initialize2D(format, image.width, image.height, 1, mipmap_count);
+	if (FAILED(hr)) return hr;
+
+	for (size_t i = 0; i < generated_count && i < passthrough_miplevels; i++) {
+		DirectX::ScratchImage source;
+		hr = load_dds_file(miplevel_path(passthrough.source_until_mipmap_indication, i), nullptr, source);
+		if (FAILED(hr)) return hr;
+		const DirectX::Image& source_image = *source.GetImage(0, 0, 0);
+		const DirectX::Image& target = *compressed_mipmaps.GetImage(i, 0, 0);
+		if (source_image.format != format || source_image.width != target.width || source_image.height != target.height
+			|| source_image.rowPitch != target.rowPitch) {
+			return E_FAIL;
+		}
+		std::memcpy(target.pixels, source_image.pixels, target.slicePitch);
+
+		const DirectX::Image& decoded = *mipmaps.GetImage(i, 0, 0);
+		for (int row = 0; row < tiles.get_rows() && SUCCEEDED(hr); row++) {
+			for_each_marked_run(tiles, row, TileMask::tile_size >> i, target.width, target.height, [&](size_t x, size_t y, size_t width, size_t height) {
+				if (FAILED(hr)) return;
+				DirectX::ScratchImage compressed_run;
+				hr = compress_image(pixel_region(decoded, x, y, width, height), format, device, compressed_run);
+				if (FAILED(hr)) return;
+				const DirectX::Image& run = *compressed_run.GetImage(0, 0, 0);
+				for (size_t block_row = 0; block_row < height / 4; block_row++) {
+					std::memcpy(target.pixels + (y / 4 + block_row) * target.rowPitch + (x / 4) * block_bytes,
+						run.pixels + block_row * run.rowPitch, (width / 4) * block_bytes);
+				}
+			});
+		}
+		if (FAILED(hr)) return hr;
+	}
+	if (mipmap_count <= passthrough_miplevels) return S_OK;
+
+	DirectX::ScratchImage source;
+	hr = load_dds_file(miplevel_path(passthrough.source_until_mipmap_indication, passthrough_miplevels), nullptr, source);
+	if (FAILED(hr)) return hr;
+	DirectX::ScratchImage composed;
+	hr = DirectX::Decompress(*source.GetImage(0, 0, 0), DXGI_FORMAT_R8G8B8A8_UNORM, composed);
+	if (FAILED(hr)) return hr;
+	const DirectX::Image& composed_image = *composed.GetImage(0, 0, 0);
+	const DirectX::Image& decoded = *mipmaps.GetImage(passthrough_miplevels, 0, 0);
+	if (composed_image.width != decoded.width || composed_image.height != decoded.height) return E_FAIL;
+	for (int row = 0; row < tiles.get_rows(); row++) {
+		for_each_marked_run(tiles, row, TileMask::tile_size >> passthrough_miplevels, decoded.width, decoded.height,
+			[&](size_t x, size_t y, size_t width, size_t height) {
+				for (size_t texel_row = y; texel_row < y + height; texel_row++) {
+					std::memcpy(composed_image.pixels + texel_row * composed_image.rowPitch + x * 4,
+						decoded.pixels + texel_row * decoded.rowPitch + x * 4, width * 4);
+				}
+			});
+	}
+
+	DirectX::ScratchImage small_mipmaps;
+	size_t small_mipmap_count = mipmap_count - passthrough_miplevels;
+	hr = small_mipmap_count == 1 ? small_mipmaps.InitializeFromImage(composed_image)
+		: DirectX::GenerateMipMaps(composed_image, DirectX::TEX_FILTER_LINEAR, small_mipmap_count, small_mipmaps);
+	if (FAILED(hr)) return hr;
+	DirectX::ScratchImage compressed_small_mipmaps;
+	hr = compress_images(small_mipmaps.GetImages(), small_mipmaps.GetImageCount(), small_mipmaps.GetMetadata(), format, device,
+		compressed_small_mipmaps);
+	if (FAILED(hr)) return hr;
+	for (size_t i = 0; i < small_mipmap_count; i++) {
+		const DirectX::Image& small_mipmap = *compressed_small_mipmaps.GetImage(i, 0, 0);
+		const DirectX::Image& target = *compressed_mipmaps.GetImage(passthrough_miplevels + i, 0, 0);
+		if (small_mipmap.slicePitch != target.slicePitch) return E_FAIL;
+		std::memcpy(target.pixels, small_mipmap.pixels, target.slicePitch);
+	}
+	return S_OK;
+}
 
-	DirectX::Image image = gl_texture_to_dx_image(texture_id);
+static bool write_dds_miplevels(const DirectX::ScratchImage& compressed_mipmaps, std::filesystem::path filename_until_mipmap_indication,
+	size_t mipmap_count, std::ostream& log)
+{
+	TrackedAllocation encode_memory(memory_accounting::Category::encode_output, compressed_mipmaps.GetPixelsSize());
+
+	ProfileScope write_scope("write_dds", filename_until_mipmap_indication.string());
+	bool is_every_miplevel_saved = true;
+	for (size_t i = 0; i < mipmap_count; i++) {
+		std::filesystem::path full_out_path = miplevel_path(filename_until_mipmap_indication, i);
+		DirectX::Blob encoded_mipmap;
+		long hr = DirectX::SaveToDDSMemory(
+			*compressed_mipmaps.GetImage(i, 0, 0),
+			DirectX::DDS_FLAGS_ALLOW_LARGE_FILES,
+			encoded_mipmap);
+		if (SUCCEEDED(hr) && !output_sink::write_file(full_out_path, encoded_mipmap.GetBufferPointer(), encoded_mipmap.GetBufferSize())) {
+			hr = E_FAIL;
+		}
+
+		if (FAILED(hr)) {
+			is_every_miplevel_saved = false;
+			log << "WARNING: Could not save to \"" << filename_until_mipmap_indication << "\"" << std::endl;
+			log << describe_error(hr) << std::endl;
+		}
+		else {
+			
+		}
+	}
+	log << "Saved " << mipmap_count << " miplevels for " << filename_until_mipmap_indication.string() << std::endl;
+	return is_every_miplevel_saved;
+}
+
+// Miplevels 0 to 6 are generated and compressed from one band of rows at a time and appended to their files. The 2x2
+// filter of exact halvings never reads across the bands. Miplevel 6 is collected, the smaller ones are generated from it.
+DdsBandWriter::DdsBandWriter(std::filesystem::path filename_until_mipmap_indication, size_t width, size_t height, size_t mipmap_count,
+	DXGI_FORMAT format)
+	: width(width), height(height), mipmap_count(mipmap_count), format(format)
+{
+	banded_count = mipmap_count < band_miplevels ? mipmap_count : band_miplevels;
+	if (is_compressed_on_graphics_card(format)) device = get_d3d11_device();
+	for (size_t i = 0; i < mipmap_count && SUCCEEDED(status); i++) {
+		files.push_back(std::make_unique<output_sink::StreamedFile>(miplevel_path(filename_until_mipmap_indication, i)));
+		DirectX::TexMetadata metadata{};
+		metadata.width = width >> i > 0 ? width >> i : 1;
+		metadata.height = height >> i > 0 ? height >> i : 1;
+		metadata.depth = 1;
+		metadata.arraySize = 1;
+		metadata.mipLevels = 1;
+		metadata.format = format;
+		metadata.dimension = DirectX::TEX_DIMENSION_TEXTURE2D;
+		// The same header SaveToDDSMemory writes for a single miplevel
+		uint8_t header[256];
+		size_t header_size = 0;
+		status = DirectX::EncodeDDSHeader(metadata, DirectX::DDS_FLAGS_ALLOW_LARGE_FILES, header, sizeof(header), header_size);
+		if (SUCCEEDED(status) && !files.back()->append(header, header_size)) status = E_FAIL;
+	}
+	if (SUCCEEDED(status) && mipmap_count > banded_count) {
+		status = last_banded_miplevel.Initialize2D(DXGI_FORMAT_R8G8B8A8_UNORM,
+			width >> (banded_count - 1), height >> (banded_count - 1), 1, 1);
+	}
+}
+
+HRESULT DdsBandWriter::add_band(const DirectX::Image& band)
+{
+	if (FAILED(status)) return status;
+	if (band.width != width || band.height != band_rows || next_row + band_rows > height) return status = E_INVALIDARG;
+	DirectX::ScratchImage band_mipmaps;
+	HRESULT hr = banded_count == 1 ? band_mipmaps.InitializeFromImage(band)
+		: DirectX::GenerateMipMaps(band, DirectX::TEX_FILTER_LINEAR, banded_count, band_mipmaps);
+	if (FAILED(hr)) return status = hr;
+	TrackedAllocation mipmap_memory(memory_accounting::Category::mip_scratch, band_mipmaps.GetPixelsSize());
+	DirectX::ScratchImage compressed_band;
+	hr = compress_images(band_mipmaps.GetImages(), band_mipmaps.GetImageCount(), band_mipmaps.GetMetadata(), format, device.Get(), compressed_band);
+	if (FAILED(hr)) return status = hr;
+	TrackedAllocation encode_memory(memory_accounting::Category::encode_output, compressed_band.GetPixelsSize());
+	for (size_t i = 0; i < banded_count; i++) {
+		const DirectX::Image& compressed_miplevel = *compressed_band.GetImage(i, 0, 0);
+		if (!files[i]->append(compressed_miplevel.pixels, compressed_miplevel.slicePitch)) return status = E_FAIL;
+	}
+	if (mipmap_count > banded_count) {
+		const DirectX::Image& band_miplevel = *band_mipmaps.GetImage(banded_count - 1, 0, 0);
+		const DirectX::Image& target = *last_banded_miplevel.GetImage(0, 0, 0);
+		std::memcpy(target.pixels + (next_row >> (banded_count - 1)) * target.rowPitch, band_miplevel.pixels, band_miplevel.slicePitch);
+	}
+	next_row += band_rows;
+	return S_OK;
+}
+
+HRESULT DdsBandWriter::finish()
+{
+	if (FAILED(status)) return status;
+	if (next_row != height) return status = E_FAIL;
+	if (mipmap_count > banded_count) {
+		DirectX::ScratchImage small_mipmaps;
+		HRESULT hr = DirectX::GenerateMipMaps(*last_banded_miplevel.GetImage(0, 0, 0), DirectX::TEX_FILTER_LINEAR,
+			mipmap_count - banded_count + 1, small_mipmaps);
+		if (FAILED(hr)) return status = hr;
+		DirectX::ScratchImage compressed_small_mipmaps;
+		hr = compress_images(small_mipmaps.GetImages(), small_mipmaps.GetImageCount(), small_mipmaps.GetMetadata(), format, device.Get(),
+			compressed_small_mipmaps);
+		if (FAILED(hr)) return status = hr;
+		// Its first miplevel has already been written from the bands
+		for (size_t i = banded_count; i < mipmap_count; i++) {
+			const DirectX::Image& compressed_miplevel = *compressed_small_mipmaps.GetImage(i - banded_count + 1, 0, 0);
+			if (!files[i]->append(compressed_miplevel.pixels, compressed_miplevel.slicePitch)) return status = E_FAIL;
+		}
+	}
+
+	for (auto& file : files) {
+		if (!file->finish()) return status = E_FAIL;
+	}
+	return S_OK;
+}
+
+static HRESULT write_dds_miplevels_in_bands(const DirectX::Image& image, std::filesystem::path filename_until_mipmap_indication,
+	size_t mipmap_count, DXGI_FORMAT format)
+{
+	DdsBandWriter writer(filename_until_mipmap_indication, image.width, image.height, mipmap_count, format);
+	for (size_t y = 0; y < image.height; y += band_rows) {
+		HRESULT hr = writer.add_band(pixel_region(image, 0, y, image.width, band_rows));
+		if (FAILED(hr)) return hr;
+	}
+	return writer.finish();
+}
+
+size_t dx_image_to_dds_mipmaps(const DirectX::Image& image, std::filesystem::path filename_until_mipmap_indication, size_t mipmap_count,
+	DXGI_FORMAT format, std::ostream& log, const BlockPassthrough& passthrough)
+{
+	// In case of errors: Do not throw an exception, but just return without saving the texture.
+	if (mipmap_count == 0) return 0;
+	if (mipmap_count == 1 && image.width >= 32 && image.height >= 32) mipmap_count = 4; // Generate mipmaps also if the original did not have them
 
 	std::unique_ptr<DirectX::ScratchImage> mipmaps(new (std::nothrow) DirectX::ScratchImage);
+	std::unique_ptr<DirectX::ScratchImage> compressed_mipmaps(new (std::nothrow) DirectX::ScratchImage);
 	long hr; // Stores error codes of DirectX operations
+	bool is_passed_through = passthrough.decoded_tiles && mipmap_count >= 2;
+
+	// The DdsBandWriter gets its own access to the graphics card
+	if (!is_passed_through && is_processed_in_bands(image.width, image.height)) {
+		ProfileScope band_scope("encode_bands", filename_until_mipmap_indication.string());
+		hr = write_dds_miplevels_in_bands(image, filename_until_mipmap_indication, mipmap_count, format);
+		if (FAILED(hr)) {
+			log << describe_error(hr) << std::endl;
+			log << "Could not save the miplevels of " << filename_until_mipmap_indication.string() << "0.dds in bands" << std::endl;
+			log << "This texture won't be saved." << std::endl;
+			return 0;
+		}
+		log << "Saved " << mipmap_count << " miplevels for " << filename_until_mipmap_indication.string() << std::endl;
+		return mipmap_count;
+	}
+
+	// Get access to the graphics card for compressing the image
+	Microsoft::WRL::ComPtr<ID3D11Device> device;
+	if (is_compressed_on_graphics_card(format)) device = get_d3d11_device();
+
+	if (is_passed_through) {
+		ProfileScope compress_scope("compress_tiles", filename_until_mipmap_indication.string());
+		hr = compress_with_passthrough(image, mipmap_count, format, passthrough, device.Get(), *compressed_mipmaps);
+		if (FAILED(hr)) {
+			compressed_mipmaps->Release();
+			log << describe_error(hr) << std::endl;
+			log << "Could not combine the tiles with snow and the original miplevels of "
+				<< passthrough.source_until_mipmap_indication.string() << "...\nTexture path: " << filename_until_mipmap_indication << "0.dds" << std::endl;
+			log << "This texture won't be saved." << std::endl;
+			return 0;
+		}
+		compress_scope.end();
+		return write_dds_miplevels(*compressed_mipmaps, filename_until_mipmap_indication, mipmap_count, log) ? mipmap_count : 0;
+	}
 
+	ProfileScope mipmap_scope("generate_mipmaps", filename_until_mipmap_indication.string());
 	if (mipmap_count == 1) {
 		mipmaps->InitializeFromImage(image);
 	}
@@ -277,59 +874,29 @@ void gl_texture_to_dds_mipmaps(GLuint texture_id, std::filesystem::path filename
 
 		if (FAILED(hr)) {
 			mipmaps->Release();
-			delete[] image.pixels;
-			std::wcout << static_cast<unsigned int>(hr) << std::wstring(GetErrorDesc(hr)) << std::endl;
-			std::cerr << "WARNING: Could not generate mipmaps for " << filename_until_mipmap_indication.string() << "0.dds" << std::endl;
-			std::cout << "This texture won't be saved." << std::endl;
-			return;
+			log << describe_error(hr) << std::endl;
+			log << "WARNING: Could not generate mipmaps for " << filename_until_mipmap_indication.string() << "0.dds" << std::endl;
+			log << "This texture won't be saved." << std::endl;
+			return 0;
 		}
 	}
 
-	// Update the window from time to time (Otherwise it won't react for some seconds)
-	glfwPollEvents();
+	mipmap_scope.end();
+	TrackedAllocation mipmap_memory(memory_accounting::Category::mip_scratch, mipmaps->GetPixelsSize());
 
-	// Get access to the graphics card for compressing the image
-	Microsoft::WRL::ComPtr<ID3D11Device> device = get_d3d11_device();
-	std::unique_ptr<DirectX::ScratchImage> compressed_mipmaps(new (std::nothrow) DirectX::ScratchImage);
-	hr = DirectX::Compress(
-		device.Get(),
-		mipmaps->GetImages(),
-		mipmaps->GetImageCount(),
-		mipmaps->GetMetadata(),
-		DXGI_FORMAT_BC7_UNORM,
-		DirectX::TEX_COMPRESS_DEFAULT,
-		1.0f,
-		*compressed_mipmaps);
+	ProfileScope compress_scope(is_compressed_on_graphics_card(format) ? "compress_bc7" : "compress_bc1_bc5",
+		filename_until_mipmap_indication.string());
+	hr = compress_images(mipmaps->GetImages(), mipmaps->GetImageCount(), mipmaps->GetMetadata(), format, device.Get(), *compressed_mipmaps);
 	mipmaps->Release();
-	delete[] image.pixels;
 	if (FAILED(hr)) {
 		compressed_mipmaps->Release();
-		std::wcout << static_cast<unsigned int>(hr) << std::wstring(GetErrorDesc(hr)) << std::endl;
-		std::cerr << "Could not compress to BC7_UNORM...\nTexture path: " << filename_until_mipmap_indication << "0.dds" << std::endl;
-		std::cout << "This texture won't be saved." << std::endl;
-		return;
-	}
-	std::filesystem::create_directories(filename_until_mipmap_indication.parent_path());
-	for (size_t i = 0; i < mipmap_count; i++) {
-
-		// Update the window from time to time (Otherwise it won't react for some seconds)
-		glfwPollEvents();
-
-		std::filesystem::path full_out_path = std::filesystem::path(filename_until_mipmap_indication).concat(
-			std::to_string(i)).concat(".dds");
-		long hr = DirectX::SaveToDDSFile(
-			*compressed_mipmaps->GetImage(i, 0, 0),
-			DirectX::DDS_FLAGS_ALLOW_LARGE_FILES,
-			full_out_path.wstring().c_str());
-
-		if (FAILED(hr)) {
-			std::cout << "WARNING: Could not save to \"" << filename_until_mipmap_indication << "\"" << std::endl;
-			std::wcout << static_cast<unsigned int>(hr) << std::wstring(GetErrorDesc(hr)) << std::endl;
-		}
-		else {
-			
-		}
+		log << describe_error(hr) << std::endl;
+		log << "Could not compress to DXGI format " << int(format) << "...\nTexture path: " << filename_until_mipmap_indication << "0.dds" << std::endl;
+		log << "This texture won't be saved." << std::endl;
+		return 0;
 	}
-	std::cout << "Saved " << mipmap_count << " miplevels for " << filename_until_mipmap_indication.string() << std::endl;
+	compress_scope.end();
+	bool is_every_miplevel_saved = write_dds_miplevels(*compressed_mipmaps, filename_until_mipmap_indication, mipmap_count, log);
 	compressed_mipmaps->Release();
-}
+	return is_every_miplevel_saved ? mipmap_count : 0;
+}
\ No newline at end of file
@@ -1,16 +1,112 @@
 #pragma once
 #include <string>
 #include <filesystem>
+#include <iostream>
+#include <memory>
+#include <vector>
+#include <d3d11.h>
+#include <wrl/client.h>
 #include "../external/glew-2.2.0/include/GL/glew.h"
 #include "../external/glfw-3.3.6/include/GLFW/glfw3.h"
 #include "../external/DirectXTex/DirectXTex.h"
 
+#include "snow_options.h"
+#include "tile_mask.h"
+#include "mapped_file.h"
+#include "output_sink.h"
+
+// How a texture that was decoded only in some tiles (see TileMask) is saved: the blocks of the other tiles are
+// copied from the original miplevels, which must have the output format and halve the size at each level.
+struct BlockPassthrough {
+	std::shared_ptr<const TileMask> decoded_tiles; // nullptr: the whole texture is compressed
+	std::filesystem::path source_until_mipmap_indication;
+};
+
 std::wstring string_to_16bit_unicode_wstring(std::string input_string);
 GLuint directx_image_to_gl_texture(const DirectX::Image * image);
-GLuint dds_file_to_gl_texture(std::wstring dds_filepath);
+// source_format (optional) receives the format the .dds file is stored in.
+// With decoded_tiles, only these tiles of a block-compressed texture are decoded, the others stay transparent black.
+GLuint dds_file_to_gl_texture(std::wstring dds_filepath, DXGI_FORMAT* source_format = nullptr, const TileMask* decoded_tiles = nullptr);
+bool get_dds_dimensions(std::wstring dds_filepath, size_t* width, size_t* height, DXGI_FORMAT* format = nullptr);
 
-DirectX::Image gl_texture_to_dx_image(GLuint texture_id);
+// The pixels of the returned image are owned by pixel_storage. path_argument is the file the pixels are saved to, for --profile.
+DirectX::Image gl_texture_to_dx_image(GLuint texture_id, DirectX::ScratchImage& pixel_storage, std::string path_argument);
 int save_dx_image_to_file(DirectX::Image image, GUID wic_codec, std::filesystem::path filename);
 int gl_texture_to_png_file(GLuint texture_id, std::filesystem::path filename, boolean append_extension);
 int gl_texture_to_jpg_file(GLuint texture_id, std::filesystem::path filename, boolean append_extension);
-void gl_texture_to_dds_mipmaps(GLuint texture_id, std::filesystem::path filename_until_mipmap_indication, size_t mipmap_count);
+void gl_texture_to_dds_mipmaps(GLuint texture_id, std::filesystem::path filename_until_mipmap_indication, size_t mipmap_count,
+	DXGI_FORMAT format = DXGI_FORMAT_BC7_UNORM);
+// The block compression of a snowed texture: by default the one of the original, BC7 if it cannot be kept (e.g. BC6H
+// or an uncompressed format). BC7 is compressed on the graphics card, BC1 to BC5 on the CPU.
+DXGI_FORMAT get_output_dds_format(DXGI_FORMAT source_format, DdsFormat requested_format);
+// false if DdsFormat::source was requested, but the texture is saved as BC7 instead, which is worth a warning
+bool is_source_format_kept(DXGI_FORMAT source_format, DdsFormat requested_format);
+// "BC7_UNORM_SRGB", "R8G8B8A8_UNORM", ..., or "DXGI format <number>" for formats .dds files of the game do not use
+std::string get_format_name(DXGI_FORMAT format);
+// Rows of texels that are decoded, mipmapped and compressed at a time
+constexpr size_t band_rows = 256;
+// Textures larger than 2048x2048 texels whose sides are multiples of band_rows are decoded, mipmapped, compressed and
+// written in bands of rows (see DdsBandWriter), so that the scratch memory for their mipmaps and compressed output does
+// not grow with their height. Block-compressed ones are also drawn, combined and read back in tiles (see
+// Texture::is_tiled), then nothing of them is whole on the graphics card or in memory.
+bool is_processed_in_bands(size_t width, size_t height);
+// Host memory for saving a snowed texture that is read back as a whole: the pixels, the mipmaps and the compressed output
+size_t estimate_encode_memory_bytes(size_t width, size_t height);
+
+// Miplevel 0 of a block-compressed .dds file, decoded one region at a time straight from its mapping (see
+// mapped_file.h). Only the decoded region is in memory.
+class MappedDds
+{
+public:
+	explicit MappedDds(const std::filesystem::path& path);
+	// false if the file cannot be read, is damaged or not block-compressed
+	bool is_open() const { return image.pixels != nullptr; }
+	size_t get_width() const { return image.width; }
+	size_t get_height() const { return image.height; }
+	// Decodes width x height texels from (x, y) on, which must be on the border of a block, into the GL texture at (0, 0)
+	bool decode_to_gl_texture(size_t x, size_t y, size_t width, size_t height, GLuint texture_id) const;
+
+private:
+	MappedFile file;
+	DirectX::Image image{};
+};
+
+// Writes the miplevels of a texture whose pixels arrive one band of band_rows rows at a time, from row 0 on. Its sides
+// must be multiples of band_rows. Only the files of finish() replace the existing ones: a writer destroyed before
+// leaves them as they are. The first error is returned again by all later calls.
+class DdsBandWriter
+{
+public:
+	// Opens the files and writes their headers
+	DdsBandWriter(std::filesystem::path filename_until_mipmap_indication, size_t width, size_t height, size_t mipmap_count,
+		DXGI_FORMAT format);
+	DdsBandWriter(const DdsBandWriter&) = delete;
+	DdsBandWriter& operator=(const DdsBandWriter&) = delete;
+
+	// band: width x band_rows RGBA8 texels
+	HRESULT add_band(const DirectX::Image& band);
+	// Generates the miplevels below those of the bands and moves the files to their paths
+	HRESULT finish();
+
+private:
+	size_t width;
+	size_t height;
+	size_t mipmap_count;
+	size_t banded_count; // Miplevels generated from the bands, the smaller ones from the last of them
+	DXGI_FORMAT format;
+	Microsoft::WRL::ComPtr<ID3D11Device> device; // For BC7
+	std::vector<std::unique_ptr<output_sink::StreamedFile>> files;
+	DirectX::ScratchImage last_banded_miplevel; // Collected from the bands
+	size_t next_row = 0;
+	HRESULT status = S_OK;
+};
+// Whether the snowed texture can be saved with a BlockPassthrough: reads only the headers of the miplevels
+bool can_pass_blocks_through(std::filesystem::path source_until_mipmap_indication, size_t mipmap_count, DXGI_FORMAT output_format);
+// Copies pixels read back from GL (RGBA8) into a DirectX image. Returns false if the memory could not be allocated.
+bool gl_pixels_to_dx_image(const uint8_t* pixels, int width, int height, DirectX::ScratchImage& pixel_storage);
+// The part of gl_texture_to_dds_mipmaps that does not need GL: generating the mipmaps, compressing and writing them.
+// Can run on any thread; messages and errors go to log.
+// Returns the number of miplevels saved (more than mipmap_count if they were generated), 0 if not all of them could be saved.
+// With passthrough, only the decoded tiles of image are compressed.
+size_t dx_image_to_dds_mipmaps(const DirectX::Image& image, std::filesystem::path filename_until_mipmap_indication, size_t mipmap_count,
+	DXGI_FORMAT format, std::ostream& log = std::cout, const BlockPassthrough& passthrough = BlockPassthrough());
@@ -0,0 +1,72 @@
+#include "dependency_index.h"
+
+#include <algorithm>
+#include <cctype>
+
+namespace fs = std::filesystem;
+
+std::string DependencyIndex::key_of(const fs::path& path)
+{
+	std::error_code error;
+	fs::path absolute_path = fs::absolute(path, error);
+	std::string key = (error ? path : absolute_path).lexically_normal().generic_string();
+#ifdef _WIN32
+	// Paths are case-insensitive, and the .cfg files do not always match the case of the files
+	std::transform(key.begin(), key.end(), key.begin(), [](unsigned char c) { return char(std::tolower(c)); });
+#endif
+	// "texture_diff_0.dds", "texture_diff_3.dds" -> "texture_diff_"
+	if (key.ends_with(".dds")) {
+		size_t digits_start = key.size() - 4;
+		while (digits_start > 0 && std::isdigit((unsigned char)key[digits_start - 1])) digits_start--;
+		if (digits_start < key.size() - 4) key.resize(digits_start);
+	}
+	return key;
+}
+
+void DependencyIndex::set_dependencies(const fs::path& cfg_path, const std::vector<fs::path>& source_files)
+{
+	std::string cfg_key = key_of(cfg_path);
+	std::vector<std::string> file_keys;
+	for (const fs::path& source_file : source_files) file_keys.push_back(key_of(source_file));
+
+	std::lock_guard<std::mutex> lock(index_mutex);
+	for (const std::string& old_file_key : files_by_cfg[cfg_key]) {
+		auto users = cfgs_by_file.find(old_file_key);
+		if (users == cfgs_by_file.end()) continue;
+		users->second.erase(cfg_key);
+		if (users->second.empty()) cfgs_by_file.erase(users);
+	}
+	for (const std::string& file_key : file_keys) cfgs_by_file[file_key].insert(cfg_key);
+	files_by_cfg[cfg_key] = std::move(file_keys);
+	cfg_paths[cfg_key] = cfg_path;
+}
+
+std::vector<fs::path> DependencyIndex::find_affected_cfgs(const std::vector<fs::path>& changed_paths,
+	bool (*is_cfg)(std::string_view)) const
+{
+	std::vector<fs::path> affected_cfgs;
+	std::set<std::string> affected_keys;
+	std::lock_guard<std::mutex> lock(index_mutex);
+	for (const fs::path& changed_path : changed_paths) {
+		std::string changed_key = key_of(changed_path);
+		if (is_cfg(changed_path.generic_string())) {
+			// Also new .cfg files, which are not in the index yet. Temporary files of editors may be gone already.
+			if (!fs::is_regular_file(changed_path)) continue;
+			auto known_path = cfg_paths.find(changed_key);
+			if (affected_keys.insert(changed_key).second) affected_cfgs.push_back(known_path != cfg_paths.end() ? known_path->second : changed_path);
+			continue;
+		}
+		auto users = cfgs_by_file.find(changed_key);
+		if (users == cfgs_by_file.end()) continue;
+		for (const std::string& cfg_key : users->second) {
+			if (affected_keys.insert(cfg_key).second) affected_cfgs.push_back(cfg_paths.at(cfg_key));
+		}
+	}
+	return affected_cfgs;
+}
+
+size_t DependencyIndex::get_cfg_count() const
+{
+	std::lock_guard<std::mutex> lock(index_mutex);
+	return files_by_cfg.size();
+}
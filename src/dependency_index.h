@@ -0,0 +1,36 @@
+#pragma once
+#include <string>
+#include <string_view>
+#include <vector>
+#include <set>
+#include <mutex>
+#include <unordered_map>
+#include <filesystem>
+
+/*
+Which .cfg files use which .rdm and .dds files, for --watch: maps a changed file to the .cfg files that have to
+be processed again. Filled while the .cfg files are processed, so it holds the files they actually loaded.
+A .dds file stands for all miplevels of its texture: a change to any of them affects the users of the texture.
+Can be used from any thread.
+*/
+
+class DependencyIndex
+{
+public:
+	// Replaces what was known about the .cfg file
+	void set_dependencies(const std::filesystem::path& cfg_path, const std::vector<std::filesystem::path>& source_files);
+	// The .cfg files using one of the changed files, and the changed .cfg files themselves if is_cfg accepts them.
+	// Each .cfg file once, in the order of the changes.
+	std::vector<std::filesystem::path> find_affected_cfgs(const std::vector<std::filesystem::path>& changed_paths,
+		bool (*is_cfg)(std::string_view)) const;
+	size_t get_cfg_count() const;
+
+private:
+	// Comparable paths: absolute, generic, without the miplevel of .dds files
+	static std::string key_of(const std::filesystem::path& path);
+
+	mutable std::mutex index_mutex;
+	std::unordered_map<std::string, std::set<std::string>> cfgs_by_file;
+	std::unordered_map<std::string, std::vector<std::string>> files_by_cfg;
+	std::unordered_map<std::string, std::filesystem::path> cfg_paths; // As they were processed, by key
+};
@@ -0,0 +1,129 @@
+#include "directory_walker.h"
+
+#include <chrono>
+
+namespace fs = std::filesystem;
+
+DirectoryWalker::DirectoryWalker(fs::path root_directory, bool (*check_function)(std::string_view),
+	BlockingQueue<fs::path>* output_queue, size_t thread_count)
+	: check(check_function), output(output_queue)
+{
+	if (thread_count == 0) {
+		// Reading directories mostly waits for the disk or the network, more threads than cores would not help
+		thread_count = std::thread::hardware_concurrency();
+		if (thread_count == 0) thread_count = 4;
+		if (thread_count > 8) thread_count = 8;
+	}
+	for (size_t i = 0; i < thread_count; i++) queues.push_back(std::make_unique<DirectoryQueue>());
+
+	pending_directories = 1;
+	queues[0]->directories.push_back(std::move(root_directory));
+	for (size_t i = 0; i < thread_count; i++) workers.emplace_back(&DirectoryWalker::work, this, i);
+}
+
+DirectoryWalker::~DirectoryWalker()
+{
+	wait();
+}
+
+void DirectoryWalker::wait()
+{
+	for (std::thread& worker : workers) {
+		if (worker.joinable()) worker.join();
+	}
+}
+
+void DirectoryWalker::stop()
+{
+	is_stopping = true;
+	directory_available.notify_all();
+	wait();
+	output->close();
+}
+
+std::vector<std::string> DirectoryWalker::get_errors()
+{
+	std::lock_guard<std::mutex> lock(errors_mutex);
+	return errors;
+}
+
+bool DirectoryWalker::take_directory(size_t worker_index, fs::path* directory)
+{
+	{
+		DirectoryQueue& own_queue = *queues[worker_index];
+		std::lock_guard<std::mutex> lock(own_queue.queue_mutex);
+		if (!own_queue.directories.empty()) {
+			*directory = std::move(own_queue.directories.back());
+			own_queue.directories.pop_back();
+			return true;
+		}
+	}
+	// Steal the oldest directory of another thread, it is the one closest to the root and has the most work below it
+	for (size_t offset = 1; offset < queues.size(); offset++) {
+		DirectoryQueue& other_queue = *queues[(worker_index + offset) % queues.size()];
+		std::lock_guard<std::mutex> lock(other_queue.queue_mutex);
+		if (!other_queue.directories.empty()) {
+			*directory = std::move(other_queue.directories.front());
+			other_queue.directories.pop_front();
+			return true;
+		}
+	}
+	return false;
+}
+
+void DirectoryWalker::read_directory(size_t worker_index, const fs::path& directory)
+{
+	std::error_code error;
+	fs::directory_iterator entries(directory, error);
+	if (error) {
+		std::lock_guard<std::mutex> lock(errors_mutex);
+		errors.push_back("Could not read directory " + directory.string() + ": " + error.message());
+		return;
+	}
+	directory_count++;
+
+	for (; entries != fs::directory_iterator(); entries.increment(error)) {
+		const fs::directory_entry& entry = *entries;
+		std::error_code type_error;
+		// Like recursive_directory_iterator, do not follow links to directories
+		if (entry.is_directory(type_error) && !entry.is_symlink(type_error)) {
+			pending_directories++; // Before this directory is done, so the count cannot reach 0 in between
+			{
+				DirectoryQueue& own_queue = *queues[worker_index];
+				std::lock_guard<std::mutex> lock(own_queue.queue_mutex);
+				own_queue.directories.push_back(entry.path());
+			}
+			directory_available.notify_one();
+		}
+		else if (check(entry.path().generic_string())) {
+			found_count++;
+			output->push(entry.path());
+		}
+	}
+	if (error) {
+		std::lock_guard<std::mutex> lock(errors_mutex);
+		errors.push_back("Could not read all of directory " + directory.string() + ": " + error.message());
+	}
+}
+
+void DirectoryWalker::work(size_t worker_index)
+{
+	fs::path directory;
+	while (!is_stopping) {
+		if (take_directory(worker_index, &directory)) {
+			read_directory(worker_index, directory);
+			if (--pending_directories == 0) {
+				// This was the last directory, nothing can be added anymore
+				output->close();
+				directory_available.notify_all();
+				return;
+			}
+			continue;
+		}
+		if (pending_directories == 0) return;
+		// Other threads are still reading and may find more directories. The timeout covers a notification
+		// that was sent between the failed take_directory() and the wait.
+		std::unique_lock<std::mutex> lock(idle_mutex);
+		directory_available.wait_for(lock, std::chrono::milliseconds(5));
+	}
+}
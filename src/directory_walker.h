@@ -0,0 +1,68 @@
+#pragma once
+#include <string>
+#include <string_view>
+#include <vector>
+#include <deque>
+#include <memory>
+#include <thread>
+#include <mutex>
+#include <atomic>
+#include <condition_variable>
+#include <filesystem>
+
+#include "blocking_queue.h"
+
+/*
+Scans a directory tree on several threads and pushes the matching files into a queue as soon as they are found,
+so that processing can start while the scan is still running (which matters on network shares).
+
+Each thread has its own queue of directories to read. It takes the most recently found directory from its own queue
+(depth first) and, when that is empty, steals the oldest directory from the queue of another thread.
+When all directories are read, the output queue is closed.
+*/
+
+class DirectoryWalker
+{
+public:
+	// thread_count 0 = a few threads, depending on the hardware
+	DirectoryWalker(std::filesystem::path root_directory, bool (*check_function)(std::string_view),
+		BlockingQueue<std::filesystem::path>* output_queue, size_t thread_count = 0);
+	~DirectoryWalker();
+
+	DirectoryWalker(const DirectoryWalker&) = delete;
+	DirectoryWalker& operator=(const DirectoryWalker&) = delete;
+
+	void wait();
+	// Lets the threads finish the directories they are reading and closes the output queue
+	void stop();
+	size_t get_found_count() const { return found_count; }
+	size_t get_directory_count() const { return directory_count; }
+	// Directories that could not be read. Only complete after wait().
+	std::vector<std::string> get_errors();
+
+private:
+	struct DirectoryQueue {
+		std::mutex queue_mutex;
+		std::deque<std::filesystem::path> directories;
+	};
+
+	void work(size_t worker_index);
+	bool take_directory(size_t worker_index, std::filesystem::path* directory);
+	void read_directory(size_t worker_index, const std::filesystem::path& directory);
+
+	bool (*check)(std::string_view);
+	BlockingQueue<std::filesystem::path>* output;
+
+	std::vector<std::unique_ptr<DirectoryQueue>> queues;
+	std::vector<std::thread> workers;
+	std::atomic<size_t> pending_directories = 0; // Queued or being read
+	std::atomic<size_t> found_count = 0;
+	std::atomic<size_t> directory_count = 0;
+	std::atomic<bool> is_stopping = false;
+
+	std::mutex idle_mutex;
+	std::condition_variable directory_available;
+
+	std::mutex errors_mutex;
+	std::vector<std::string> errors;
+};
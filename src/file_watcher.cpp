@@ -0,0 +1,174 @@
+#include "file_watcher.h"
+
+#include <set>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <sys/inotify.h>
+#include <poll.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+namespace fs = std::filesystem;
+
+static std::string generic_absolute(const fs::path& path)
+{
+	std::error_code error;
+	fs::path absolute_path = fs::absolute(path, error);
+	return (error ? path : absolute_path).lexically_normal().generic_string();
+}
+
+FileWatcher::FileWatcher(fs::path root_directory, fs::path ignored_directory)
+	: root(fs::path(generic_absolute(root_directory)))
+{
+	ignored_prefix = generic_absolute(ignored_directory);
+	if (!ignored_prefix.ends_with('/')) ignored_prefix += '/';
+#ifdef _WIN32
+	HANDLE directory = CreateFileW(root.wstring().c_str(), FILE_LIST_DIRECTORY, FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE,
+		nullptr, OPEN_EXISTING, FILE_FLAG_BACKUP_SEMANTICS, nullptr);
+	if (directory == INVALID_HANDLE_VALUE) {
+		changes.close();
+		return;
+	}
+	directory_handle = directory;
+#else
+	inotify_fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+	if (inotify_fd < 0 || pipe(stop_pipe) != 0) {
+		changes.close();
+		return;
+	}
+	add_watches(root, false);
+	if (directories_by_watch.empty()) {
+		changes.close();
+		return;
+	}
+#endif
+	is_started = true;
+	watcher = std::thread(&FileWatcher::watch, this);
+}
+
+FileWatcher::~FileWatcher()
+{
+	stop();
+	if (watcher.joinable()) watcher.join();
+#ifdef _WIN32
+	if (directory_handle) CloseHandle(directory_handle);
+#else
+	if (inotify_fd >= 0) close(inotify_fd);
+	if (stop_pipe[0] >= 0) close(stop_pipe[0]);
+	if (stop_pipe[1] >= 0) close(stop_pipe[1]);
+#endif
+}
+
+void FileWatcher::stop()
+{
+	if (is_stopped.exchange(true)) return;
+	if (is_started) {
+#ifdef _WIN32
+		CancelIoEx(directory_handle, nullptr);
+#else
+		char stop_signal = 1;
+		(void)!write(stop_pipe[1], &stop_signal, 1);
+#endif
+	}
+	changes.close();
+}
+
+bool FileWatcher::wait_for_changes(std::vector<fs::path>* changed_paths, std::chrono::milliseconds quiet_period)
+{
+	std::vector<fs::path> changed;
+	if (!changes.pop_all(&changed)) return false;
+	do {
+		std::this_thread::sleep_for(quiet_period);
+	} while (changes.try_pop_all(&changed) && !is_stopped);
+
+	std::set<std::string> reported;
+	for (const fs::path& path : changed) {
+		if (reported.insert(path.generic_string()).second) changed_paths->push_back(path);
+	}
+	return true;
+}
+
+void FileWatcher::report(const fs::path& path)
+{
+	if (generic_absolute(path).starts_with(ignored_prefix)) return;
+	changes.push(path);
+}
+
+#ifdef _WIN32
+
+void FileWatcher::watch()
+{
+	// DWORD-aligned, as ReadDirectoryChangesW requires
+	std::vector<DWORD> buffer(16 * 1024);
+	while (!is_stopped) {
+		DWORD returned_bytes = 0;
+		BOOL is_read = ReadDirectoryChangesW(directory_handle, buffer.data(), DWORD(buffer.size() * sizeof(DWORD)), TRUE,
+			FILE_NOTIFY_CHANGE_FILE_NAME | FILE_NOTIFY_CHANGE_DIR_NAME | FILE_NOTIFY_CHANGE_LAST_WRITE, &returned_bytes, nullptr, nullptr);
+		if (!is_read) break; // Also when stop() cancels the call
+		// 0 bytes: more changes than fit into the buffer, they are lost
+		const char* position = (const char*)buffer.data();
+		for (DWORD offset = 0; returned_bytes > 0;) {
+			const FILE_NOTIFY_INFORMATION* notification = (const FILE_NOTIFY_INFORMATION*)(position + offset);
+			if (notification->Action == FILE_ACTION_ADDED || notification->Action == FILE_ACTION_MODIFIED
+				|| notification->Action == FILE_ACTION_RENAMED_NEW_NAME) {
+				std::wstring relative_path(notification->FileName, notification->FileNameLength / sizeof(WCHAR));
+				report(fs::path(root).append(relative_path));
+			}
+			if (notification->NextEntryOffset == 0) break;
+			offset += notification->NextEntryOffset;
+		}
+	}
+	changes.close();
+}
+
+#else
+
+void FileWatcher::add_watches(const fs::path& directory, bool report_files)
+{
+	int watch = inotify_add_watch(inotify_fd, directory.c_str(), IN_CLOSE_WRITE | IN_MOVED_TO | IN_CREATE | IN_ONLYDIR);
+	if (watch < 0) return;
+	directories_by_watch[watch] = directory;
+	std::error_code error;
+	for (const fs::directory_entry& entry : fs::directory_iterator(directory, error)) {
+		std::error_code entry_error;
+		if (entry.is_directory(entry_error)) add_watches(entry.path(), report_files);
+		else if (report_files && entry.is_regular_file(entry_error)) report(entry.path());
+	}
+}
+
+void FileWatcher::watch()
+{
+	alignas(inotify_event) char buffer[64 * 1024];
+	pollfd poll_fds[2] = { { inotify_fd, POLLIN, 0 }, { stop_pipe[0], POLLIN, 0 } };
+	while (!is_stopped) {
+		if (poll(poll_fds, 2, -1) < 0) continue;
+		if (poll_fds[1].revents != 0) break;
+		ssize_t read_bytes;
+		while ((read_bytes = read(inotify_fd, buffer, sizeof(buffer))) > 0) {
+			for (ssize_t offset = 0; offset < read_bytes;) {
+				const inotify_event* event = (const inotify_event*)(buffer + offset);
+				offset += sizeof(inotify_event) + event->len;
+				auto directory = directories_by_watch.find(event->wd);
+				if (event->mask & IN_IGNORED) {
+					if (directory != directories_by_watch.end()) directories_by_watch.erase(directory);
+					continue;
+				}
+				if (directory == directories_by_watch.end() || event->len == 0) continue;
+				fs::path path = fs::path(directory->second).append(event->name);
+				if (event->mask & IN_ISDIR) {
+					// Files copied in with the directory may have been written before the watch was added
+					if (event->mask & (IN_CREATE | IN_MOVED_TO)) add_watches(path, true);
+				}
+				else if (event->mask & (IN_CLOSE_WRITE | IN_MOVED_TO)) {
+					report(path);
+				}
+			}
+		}
+	}
+	changes.close();
+}
+
+#endif
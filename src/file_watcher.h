@@ -0,0 +1,56 @@
+#pragma once
+#include <string>
+#include <vector>
+#include <chrono>
+#include <thread>
+#include <atomic>
+#include <unordered_map>
+#include <filesystem>
+
+#include "blocking_queue.h"
+
+/*
+Reports the files that are written, created or renamed below a directory, for --watch.
+Uses ReadDirectoryChangesW on Windows and inotify (one watch per directory, new directories are added as they appear)
+elsewhere. The notifications are collected on a thread; wait_for_changes() hands them out in batches.
+*/
+
+class FileWatcher
+{
+public:
+	// Changes below ignored_directory (the output directory, which is often inside the input directory) are not reported
+	FileWatcher(std::filesystem::path root_directory, std::filesystem::path ignored_directory);
+	~FileWatcher();
+
+	FileWatcher(const FileWatcher&) = delete;
+	FileWatcher& operator=(const FileWatcher&) = delete;
+
+	// False if the directory cannot be watched, then wait_for_changes() returns false right away
+	bool is_watching() const { return is_started; }
+	// Waits for a change, then until no further change has come for quiet_period (editors and exporters save in
+	// several steps) and returns each changed file once. Returns false after stop().
+	bool wait_for_changes(std::vector<std::filesystem::path>* changed_paths, std::chrono::milliseconds quiet_period);
+	void stop();
+
+private:
+	void watch();
+	void report(const std::filesystem::path& path);
+#ifndef _WIN32
+	// Adds watches for the directory and all directories below it. Reports the files in them if report_files is set.
+	void add_watches(const std::filesystem::path& directory, bool report_files);
+#endif
+
+	std::filesystem::path root;
+	std::string ignored_prefix; // Generic, with a trailing slash
+	BlockingQueue<std::filesystem::path> changes;
+	std::thread watcher;
+	std::atomic<bool> is_stopped = false;
+	bool is_started = false;
+#ifdef _WIN32
+	void* directory_handle = nullptr;
+#else
+	int inotify_fd = -1;
+	int stop_pipe[2] = { -1, -1 };
+	std::unordered_map<int, std::filesystem::path> directories_by_watch;
+#endif
+};
@@ -4,13 +4,37 @@
 #include <filesystem>
 #include <iostream>
 #include <algorithm>
-#include "dds2gl.h"
 
-bool ends_in_cfg(std::string path) {
+void add_builtin_filter_rules(PatternMatcher* matcher)
+{
+	for (int i = 0; i < BLACKLIST_SIZE; i++) matcher->add_pattern(blacklist[i], path_categories::blacklist);
+	for (int i = 0; i < WHITELIST_SIZE; i++) matcher->add_pattern(whitelist[i], path_categories::whitelist);
+	for (int i = 0; i < TEXTURE_BLACKLIST_SIZE; i++) matcher->add_pattern(texture_blacklist[i], path_categories::texture_blacklist);
+}
+
+static PatternMatcher& path_filter()
+{
+	static PatternMatcher matcher = [] {
+		PatternMatcher builtin_matcher;
+		add_builtin_filter_rules(&builtin_matcher);
+		builtin_matcher.compile();
+		return builtin_matcher;
+	}();
+	return matcher;
+}
+
+bool load_filter_rules(std::filesystem::path rules_file)
+{
+	if (!add_rules_from_file(&path_filter(), rules_file)) return false;
+	path_filter().compile();
+	return true;
+}
+
+bool ends_in_cfg(std::string_view path) {
 	return path.ends_with(".cfg");
 }
 
-void get_file_list(std::filesystem::path directory_path, std::vector<std::filesystem::path>* target_files, bool (*check_function)(std::string))
+void get_file_list(std::filesystem::path directory_path, std::vector<std::filesystem::path>* target_files, bool (*check_function)(std::string_view))
 {
 	//std::cout << "Parse: " << directory_path.string() << std::endl;
 	for (const auto& entry : std::filesystem::recursive_directory_iterator(directory_path)) {
@@ -20,35 +44,20 @@ void get_file_list(std::filesystem::path directory_path, std::vector<std::filesy
 	}
 }
 
-bool is_old_world(std::string path)
+bool is_old_world(std::string_view path)
 {
-	int i;
-	for (i = 0; i < BLACKLIST_SIZE; i++) {
-		if (path.find(blacklist[i]) != std::string::npos) break;
-	}
-	if (i == BLACKLIST_SIZE) return true;
-	else {
-		for (i = 0; i < WHITELIST_SIZE; i++) {
-			if (path.find(whitelist[i]) != std::string::npos) break;
-		}
-		return i != WHITELIST_SIZE;
-	}
+	uint32_t categories = path_filter().match(path);
+	if ((categories & path_categories::blacklist) == 0) return true;
+	return (categories & path_categories::whitelist) != 0;
 }
 
-bool is_forbidden_texture(std::string path)
+bool is_forbidden_texture(std::string_view path)
 {
-	std::replace(path.begin(), path.end(), '\\', '/');
-	int i;
-	for (i = 0; i < TEXTURE_BLACKLIST_SIZE; i++) {
-		if (path.find(texture_blacklist[i]) != std::string::npos) break;
-	}
-	return i != TEXTURE_BLACKLIST_SIZE;
+	return (path_filter().match(path) & path_categories::texture_blacklist) != 0;
 }
 
-bool is_old_world_cfg(std::string path)
+bool is_old_world_cfg(std::string_view path)
 {
 	if (!ends_in_cfg(path)) return false;
-	std::replace(path.begin(), path.end(), '\\', '/');
-	if (!is_old_world(path)) return false;
-	return true;
+	return is_old_world(path);
 }
@@ -3,6 +3,9 @@
 #include <vector>
 #include <filesystem>
 #include <iostream>
+#include <string_view>
+
+#include "path_filter.h"
 
 #define BLACKLIST_SIZE 34
 const inline char* blacklist[] = {
@@ -71,8 +74,13 @@ const inline char* whitelist[] = {
 	"shipyard" // This also generates snow for the shipyard of Angereb.
 };
 
-bool ends_in_cfg(std::string path);
-bool is_old_world(std::string path);
-bool is_old_world_cfg(std::string path);
-bool is_forbidden_texture(std::string path);
-void get_file_list(std::filesystem::path directory_path, std::vector<std::filesystem::path>* target_files, bool (*check_function)(std::string));
+// The lists above are compiled into one PatternMatcher, which classifies a path in one pass
+void add_builtin_filter_rules(PatternMatcher* matcher);
+// Adds rules from a file (see add_rules_from_file) to the lists above. Call it before any of the functions below.
+bool load_filter_rules(std::filesystem::path rules_file);
+
+bool ends_in_cfg(std::string_view path);
+bool is_old_world(std::string_view path);
+bool is_old_world_cfg(std::string_view path);
+bool is_forbidden_texture(std::string_view path);
+void get_file_list(std::filesystem::path directory_path, std::vector<std::filesystem::path>* target_files, bool (*check_function)(std::string_view));
@@ -0,0 +1,117 @@
+#pragma once
+#include <cctype>
+#include <string>
+#include <vector>
+#include <utility>
+
+// The JSON of the --serve jobs (see job_server.h), only what they need: one object whose values are strings, numbers,
+// true or false
+class FlatJsonReader
+{
+public:
+	explicit FlatJsonReader(const std::string& text) : text(text) {}
+
+	// Numbers and booleans are returned as their text
+	bool read_object(std::vector<std::pair<std::string, std::string>>* fields, std::string* error)
+	{
+		skip_whitespace();
+		if (!consume('{')) return fail("expected {", error);
+		skip_whitespace();
+		if (!consume('}')) {
+			while (true) {
+				std::string key, value;
+				skip_whitespace();
+				if (!read_string(&key)) return fail("expected a key in quotes", error);
+				skip_whitespace();
+				if (!consume(':')) return fail("expected : after \"" + key + "\"", error);
+				skip_whitespace();
+				if (!read_string(&value) && !read_literal(&value)) return fail("expected a string, number, true or false for \"" + key + "\"", error);
+				fields->emplace_back(key, value);
+				skip_whitespace();
+				if (consume('}')) break;
+				if (!consume(',')) return fail("expected , or }", error);
+			}
+		}
+		skip_whitespace();
+		if (position != text.size()) return fail("unexpected text after }", error);
+		return true;
+	}
+
+private:
+	bool fail(const std::string& message, std::string* error)
+	{
+		*error = message + " at character " + std::to_string(position + 1);
+		return false;
+	}
+
+	void skip_whitespace()
+	{
+		while (position < text.size() && (text[position] == ' ' || text[position] == '\t' || text[position] == '\r' || text[position] == '\n')) position++;
+	}
+
+	bool consume(char c)
+	{
+		if (position >= text.size() || text[position] != c) return false;
+		position++;
+		return true;
+	}
+
+	bool read_string(std::string* value)
+	{
+		if (!consume('"')) return false;
+		while (position < text.size()) {
+			char c = text[position++];
+			if (c == '"') return true;
+			if (c != '\\') {
+				value->push_back(c);
+				continue;
+			}
+			if (position >= text.size()) return false;
+			char escaped = text[position++];
+			switch (escaped) {
+			case '"': case '\\': case '/': value->push_back(escaped); break;
+			case 'b': value->push_back('\b'); break;
+			case 'f': value->push_back('\f'); break;
+			case 'n': value->push_back('\n'); break;
+			case 'r': value->push_back('\r'); break;
+			case 't': value->push_back('\t'); break;
+			case 'u': {
+				if (position + 4 > text.size()) return false;
+				unsigned code_point = 0;
+				for (size_t end = position + 4; position < end; position++) {
+					char digit = text[position];
+					if (!isxdigit((unsigned char)digit)) return false;
+					code_point = code_point * 16 + (isdigit((unsigned char)digit) ? digit - '0' : (tolower((unsigned char)digit) - 'a' + 10));
+				}
+				// As UTF-8, surrogate pairs are not combined
+				if (code_point < 0x80) {
+					value->push_back(char(code_point));
+				}
+				else if (code_point < 0x800) {
+					value->push_back(char(0xC0 | (code_point >> 6)));
+					value->push_back(char(0x80 | (code_point & 0x3F)));
+				}
+				else {
+					value->push_back(char(0xE0 | (code_point >> 12)));
+					value->push_back(char(0x80 | ((code_point >> 6) & 0x3F)));
+					value->push_back(char(0x80 | (code_point & 0x3F)));
+				}
+				break;
+			}
+			default: return false;
+			}
+		}
+		return false;
+	}
+
+	bool read_literal(std::string* value)
+	{
+		size_t start = position;
+		while (position < text.size() && (isalnum((unsigned char)text[position]) || text[position] == '-' || text[position] == '+' || text[position] == '.')) position++;
+		*value = text.substr(start, position - start);
+		return !value->empty();
+	}
+
+	const std::string& text;
+	size_t position = 0;
+};
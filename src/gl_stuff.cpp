@@ -11,13 +11,14 @@
 https://github.com/opengl-tutorials/ogl/tree/master/tutorial14_render_to_texture
 (The example code of https://www.opengl-tutorial.org/ )*/
 
-GlStuff::GlStuff(bool init) {
+GlStuff::GlStuff(bool init, bool visible_window) {
 	glfwInit();
 	glfwWindowHint(GLFW_SAMPLES, 4);
 	glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 3);
 	glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 3);
 
 	glfwWindowHint(GLFW_OPENGL_PROFILE, GLFW_OPENGL_CORE_PROFILE);
+	glfwWindowHint(GLFW_VISIBLE, visible_window ? GLFW_TRUE : GLFW_FALSE);
 
 	window = glfwCreateWindow(WINDOW_WIDTH, WINDOW_HEIGHT, "Window providing Context for GL", NULL, NULL);
 	if (window == NULL) {
@@ -27,6 +28,8 @@ GlStuff::GlStuff(bool init) {
 	}
 
 	glfwMakeContextCurrent(window);
+	// glfwSwapBuffers must not wait for the display, the preview is not what the user waits for
+	glfwSwapInterval(0);
 
 	glfwGetFramebufferSize(window, &window_w, &window_h);
 	glViewport(0, 0, window_w, window_h);
@@ -53,12 +56,14 @@ void get_dimensions(GLuint texture_id, int* width, int* height) {
 	glGetTexLevelParameteriv(GL_TEXTURE_2D, 0, GL_TEXTURE_HEIGHT,height);
 }
 
-GLuint create_empty_texture(int width, int height, GLenum format, GLenum mag_filter, GLenum min_filter, GLenum wrap_method) {
+GLuint create_empty_texture(int width, int height, GLenum format, GLenum mag_filter, GLenum min_filter, GLenum wrap_method,
+	memory_accounting::Category category) {
 	GLuint texture_id;
 	glGenTextures(1, &texture_id);
 	glBindTexture(GL_TEXTURE_2D, texture_id);
 
 	glTexImage2D(GL_TEXTURE_2D, 0, format, width, height, 0, format, GL_UNSIGNED_BYTE, 0);
+	memory_accounting::track_gl_texture(texture_id, category, size_t(width) * height * (format == GL_RGB ? 3 : 4));
 
 	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, mag_filter);
 	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, min_filter);
@@ -73,6 +78,7 @@ GLuint create_empty_depth_texture(int width, int height) {
 	glBindTexture(GL_TEXTURE_2D, texture_id);
 
 	glTexImage2D(GL_TEXTURE_2D, 0, GL_DEPTH_COMPONENT16, width, height, 0, GL_DEPTH_COMPONENT, GL_FLOAT, 0);
+	memory_accounting::track_gl_texture(texture_id, memory_accounting::Category::snowmaps, size_t(width) * height * 2);
 
 	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
 	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
@@ -224,6 +230,41 @@ void GlStuff::bind_or_unbind_vertexformat(std::string vertex_format, uint32_t ve
 }
 
 
+bool find_vertex_attribute(std::string_view vertex_format, char attribute_name, uint32_t* offset, uint8_t* size, char* datatype)
+{
+	// Same layout rules as bind_or_unbind_vertexformat
+	uint32_t offset_to_attribute_in_buffer = 0;
+	size_t offset_to_attribute_in_vertex_format_string = 0;
+	while (offset_to_attribute_in_vertex_format_string <= vertex_format.length()) {
+		size_t attribute_end = vertex_format.find('_', offset_to_attribute_in_vertex_format_string);
+		if (attribute_end == std::string_view::npos) attribute_end = vertex_format.length();
+		std::string_view attribute_description = vertex_format.substr(offset_to_attribute_in_vertex_format_string,
+			attribute_end - offset_to_attribute_in_vertex_format_string);
+
+		if (attribute_description.length() == 3) {
+			uint8_t attribute_size = ((uint8_t)attribute_description[1]) - 48;
+			if (attribute_description[0] == attribute_name) {
+				*offset = offset_to_attribute_in_buffer;
+				*size = attribute_size;
+				*datatype = attribute_description[2];
+				return true;
+			}
+			offset_to_attribute_in_buffer += attribute_size * get_bytesize_for_rdm_datatype(attribute_description[2]);
+		}
+		else {
+			// Unknown attributes (e.g. the '37' in P3f_N3b_37_T2f)
+			uint32_t skipped_bytes = 0;
+			for (char c : attribute_description) {
+				if (c < '0' || c > '9') return false;
+				skipped_bytes = skipped_bytes * 10 + (c - '0');
+			}
+			offset_to_attribute_in_buffer += skipped_bytes;
+		}
+		offset_to_attribute_in_vertex_format_string = attribute_end + 1;
+	}
+	return false;
+}
+
 int GlStuff::load_square_vertexbuffer() {
 	static const GLfloat square_vertexbuffer_data[] = {
 		/* Interleaved: Alternating Position and Texture coordinate (In Anno: P3fT2f) */
@@ -273,6 +314,7 @@ void GlStuff::load_noise_texture(int sidelength)
 	glGenTextures(1, &noise_texture);
 	glBindTexture(GL_TEXTURE_2D, noise_texture);
 	glTexImage2D(GL_TEXTURE_2D, 0, GL_R32F, sidelength, sidelength, 0, GL_RED, GL_FLOAT, (void*)noise_buffer);
+	memory_accounting::track_gl_texture(noise_texture, memory_accounting::Category::gl_objects, size_t(sidelength) * sidelength * 4);
 	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
 	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
 	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
@@ -292,7 +334,7 @@ void GlStuff::unbind_square_buffers()
 }
 void GlStuff::cleanup()
 {
-	glDeleteTextures(1, &noise_texture);
+	delete_gl_texture(&noise_texture);
 	glDeleteBuffers(1, &square_vertexbuffer);
 	glDeleteBuffers(1, &square_indexbuffer);
 }
@@ -1,7 +1,8 @@
 #pragma once
 #include <string>
+#include <string_view>
 #include <random>
-#include "gl_stuff.h"
+#include "memory_accounting.h"
 #include "../external/glew-2.2.0/include/GL/glew.h"
 #include "../external/glfw-3.3.6/include/GLFW/glfw3.h"
 
@@ -13,11 +14,15 @@ inline const int WINDOW_HEIGHT = 800;
 inline const char* VERTEX_ATTRIBUTES = "PNGBTCCIIIIWWWW";
 #define MAX_VERTEX_ATTRIBUTES 15; // length of VERTEX_ATTRIBUTES
 
-GLuint create_empty_texture(int width, int height, GLenum format, GLenum mag_filter, GLenum min_filter, GLenum wrap_method);
+GLuint create_empty_texture(int width, int height, GLenum format, GLenum mag_filter, GLenum min_filter, GLenum wrap_method,
+	memory_accounting::Category category = memory_accounting::Category::gl_objects);
 GLuint create_empty_depth_texture(int width, int height);
 void get_dimensions(GLuint texture_id, int* width, int* height);
 GLuint create_framebuffer(uint8_t number_of_drawbuffers);
 bool is_framebuffer_ok();
+// Byte offset in the vertex, component count and datatype ('f', 'h' or 'b') of an attribute (e.g. 'N')
+// of a vertex format like P4h_N4b_G4b_B4b_T2h. Returns false if the format does not have the attribute.
+bool find_vertex_attribute(std::string_view vertex_format, char attribute_name, uint32_t* offset, uint8_t* size, char* datatype);
 
 class GlStuff{
 public:
@@ -31,7 +36,8 @@ public:
 
     int status;
 
-    GlStuff(bool init=true);
+    // A hidden window still provides the GL context, e.g. for --preview off
+    GlStuff(bool init=true, bool visible_window=true);
     ~GlStuff();
 
     void bind_or_unbind_vertexformat(std::string vertex_format, uint32_t vertices_size, bool unbind);
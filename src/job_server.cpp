@@ -0,0 +1,147 @@
+#include "job_server.h"
+
+#include <cstdio>
+#include <cctype>
+#include <iostream>
+#include <sstream>
+#include <vector>
+#include <utility>
+#include <windows.h>
+
+#include "flat_json_reader.h"
+
+namespace fs = std::filesystem;
+
+static std::string json_string(const std::string& value)
+{
+	std::string quoted = "\"";
+	for (char c : value) {
+		if (c == '"' || c == '\\') {
+			quoted.push_back('\\');
+			quoted.push_back(c);
+		}
+		else if ((unsigned char)c < 0x20) {
+			char escaped[8];
+			std::snprintf(escaped, sizeof(escaped), "\\u%04x", unsigned(c));
+			quoted += escaped;
+		}
+		else {
+			quoted.push_back(c);
+		}
+	}
+	return quoted + "\"";
+}
+
+JobServer::JobServer(const CliOptions& server_options, BlockingQueue<fs::path>* discovered_cfgs)
+	: server_options(server_options), discovered(discovered_cfgs)
+{
+}
+
+JobServer::~JobServer()
+{
+	if (!reader.joinable()) return;
+	is_stopping = true;
+	// The reader may not have entered the read yet when it is cancelled, then it is cancelled again
+	while (!is_input_closed) {
+		CancelSynchronousIo(reader.native_handle());
+		std::this_thread::sleep_for(std::chrono::milliseconds(10));
+	}
+	reader.join();
+}
+
+void JobServer::start()
+{
+	reader = std::thread(&JobServer::read_jobs, this);
+}
+
+void JobServer::read_jobs()
+{
+	std::string line;
+	while (!is_stopping && std::getline(std::cin, line)) {
+		if (line.find_first_not_of(" \t\r") == std::string::npos) continue;
+		std::string id;
+		std::string message = add_job(line, &id);
+		if (!message.empty()) {
+			write_result("{\"id\": " + json_string(id) + ", \"status\": \"invalid\", \"message\": " + json_string(message) + "}");
+		}
+	}
+	is_input_closed = true;
+	discovered->close();
+}
+
+std::string JobServer::add_job(const std::string& line, std::string* id)
+{
+	std::vector<std::pair<std::string, std::string>> fields;
+	std::string error;
+	try {
+		if (!FlatJsonReader(line).read_object(&fields, &error)) return error;
+	}
+	catch (const std::exception& exception) {
+		return exception.what();
+	}
+
+	auto job = std::make_unique<ServeJob>(ServeJob{ "", fs::path(), server_options, std::chrono::steady_clock::now() });
+	for (const auto& [key, value] : fields) {
+		if (key == "id") {
+			job->id = value;
+			*id = value;
+		}
+	}
+	for (const auto& [key, value] : fields) {
+		if (key == "id") continue;
+		if (key == "cfg") job->cfg_path = fs::path(value);
+		else if (!job->options.set_job_option(key, value)) return "unknown option or invalid value: \"" + key + "\": " + value;
+	}
+	if (job->cfg_path.empty()) return "no \"cfg\"";
+	if (job->cfg_path.extension() != ".cfg" || !fs::is_regular_file(job->cfg_path)) return "not a .cfg file: " + job->cfg_path.string();
+
+	fs::path cfg_path = job->cfg_path;
+	{
+		std::lock_guard<std::mutex> lock(jobs_mutex);
+		pending_jobs.push_back(std::move(job));
+	}
+	discovered->push(cfg_path);
+	return "";
+}
+
+const ServeJob* JobServer::start_job(const fs::path& cfg_path)
+{
+	std::lock_guard<std::mutex> lock(jobs_mutex);
+	for (const std::unique_ptr<ServeJob>& job : pending_jobs) {
+		if (job->cfg_path == cfg_path && !job->is_started) {
+			job->is_started = true;
+			return job.get();
+		}
+	}
+	return nullptr;
+}
+
+void JobServer::report(const ServeJob* job, const std::string& status, size_t saved_texture_count,
+	std::chrono::steady_clock::time_point start_time)
+{
+	auto now = std::chrono::steady_clock::now();
+	std::ostringstream result;
+	result.imbue(std::locale::classic());
+	result << "{\"id\": " << json_string(job->id) << ", \"cfg\": " << json_string(job->cfg_path.generic_string())
+		<< ", \"status\": " << json_string(status) << ", \"textures\": " << saved_texture_count
+		<< ", \"queued_seconds\": " << std::chrono::duration<double>(start_time - job->received_time).count()
+		<< ", \"seconds\": " << std::chrono::duration<double>(now - start_time).count() << "}";
+	write_result(result.str());
+
+	std::lock_guard<std::mutex> lock(jobs_mutex);
+	for (auto it = pending_jobs.begin(); it != pending_jobs.end(); ++it) {
+		if (it->get() == job) {
+			pending_jobs.erase(it);
+			break;
+		}
+	}
+}
+
+void JobServer::write_result(const std::string& json_line)
+{
+	// std::cout goes to stderr in this mode (see CliOptions), the C stream is still stdout
+	std::lock_guard<std::mutex> lock(output_mutex);
+	std::fputs(json_line.c_str(), stdout);
+	std::fputc('\n', stdout);
+	std::fflush(stdout);
+}
@@ -0,0 +1,72 @@
+#pragma once
+#include <cstddef>
+#include <string>
+#include <filesystem>
+#include <chrono>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <atomic>
+
+#include "cli_options.h"
+#include "blocking_queue.h"
+
+/*
+--serve: the program starts once (window, shaders, noise texture, default textures, mesh cache) and then processes
+the .cfg files it is sent on stdin, one job per line as a JSON object:
+  {"id": "castle", "cfg": "C:/mods/castle/data/graphics/castle.cfg", "out": "C:/mods/castle_snow", "diff_format": "bc7"}
+Only "cfg" is required. "id" is any string that is echoed in the result. "out", "diff_format", "metal_format",
+"save_png" and "save_renderings" override the options the server was started with, for this job only.
+Backslashes in paths must be escaped, as always in JSON.
+
+For each job, one line is written to stdout when its files are saved:
+  {"id": "castle", "cfg": "...", "status": "ok", "textures": 3, "queued_seconds": 0.01, "seconds": 1.52}
+status is ok, skipped (no textures to generate snow for), error, or invalid (the line is not a job, "message" says why).
+Results may come in another order than the jobs: jobs that arrive together are processed longest first (see CfgFeed).
+The next job is drawn while the textures of the last one are compressed (see TextureEncoder::when_written).
+Everything else the program prints goes to stderr in this mode. The server ends when stdin is closed.
+*/
+
+struct ServeJob {
+	std::string id;
+	std::filesystem::path cfg_path;
+	CliOptions options; // Those of the server, with the overrides of the job
+	std::chrono::steady_clock::time_point received_time;
+	bool is_started = false; // Its result may be reported only after the next jobs have started
+};
+
+class JobServer
+{
+public:
+	JobServer(const CliOptions& server_options, BlockingQueue<std::filesystem::path>* discovered_cfgs);
+	// Cancels the read of the reader thread and waits for it
+	~JobServer();
+
+	JobServer(const JobServer&) = delete;
+	JobServer& operator=(const JobServer&) = delete;
+
+	// Reads jobs on a thread and pushes their .cfg paths to discovered_cfgs, which is closed when stdin is closed
+	void start();
+	// The oldest job for the .cfg file that has not been started yet, or nullptr. Marks it as started.
+	const ServeJob* start_job(const std::filesystem::path& cfg_path);
+	// Writes the result line and forgets the job
+	void report(const ServeJob* job, const std::string& status, size_t saved_texture_count,
+		std::chrono::steady_clock::time_point start_time);
+
+private:
+	void read_jobs();
+	// Returns the message for the invalid line, or "" if the job was queued
+	std::string add_job(const std::string& line, std::string* id);
+	void write_result(const std::string& json_line);
+
+	const CliOptions& server_options;
+	BlockingQueue<std::filesystem::path>* discovered;
+	std::thread reader;
+	std::atomic<bool> is_input_closed = false;
+	std::atomic<bool> is_stopping = false;
+
+	std::mutex jobs_mutex;
+	std::list<std::unique_ptr<ServeJob>> pending_jobs; // In the order they arrived
+	std::mutex output_mutex;
+};
@@ -0,0 +1,90 @@
+#include "mapped_file.h"
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+static thread_local const SourceResolver* current_resolver = nullptr;
+
+SourceResolverScope::SourceResolverScope(const SourceResolver* resolver) : previous_resolver(current_resolver)
+{
+	current_resolver = resolver && *resolver ? resolver : nullptr;
+}
+
+SourceResolverScope::~SourceResolverScope()
+{
+	current_resolver = previous_resolver;
+}
+
+bool source_file_exists(const std::filesystem::path& path)
+{
+	if (current_resolver && (*current_resolver)(path)) return true;
+	std::error_code error;
+	return std::filesystem::exists(path, error);
+}
+
+MappedFile::MappedFile(std::filesystem::path path)
+{
+	if (current_resolver) {
+		resolved_bytes = (*current_resolver)(path);
+		if (resolved_bytes) {
+			mapped_data = resolved_bytes->data();
+			file_size = resolved_bytes->size();
+			return;
+		}
+	}
+#ifdef _WIN32
+	HANDLE file = CreateFileW(path.wstring().c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr,
+		OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+	if (file == INVALID_HANDLE_VALUE) return;
+	file_handle = file;
+
+	LARGE_INTEGER size;
+	if (!GetFileSizeEx(file, &size)) return;
+	file_size = size_t(size.QuadPart);
+	if (file_size == 0) {
+		is_empty_file = true;
+		return;
+	}
+
+	mapping_handle = CreateFileMappingW(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+	if (mapping_handle == nullptr) return;
+	mapped_data = (const char*)MapViewOfFile(mapping_handle, FILE_MAP_READ, 0, 0, 0);
+	is_mapped = mapped_data != nullptr;
+#else
+	int file = open(path.c_str(), O_RDONLY);
+	if (file < 0) return;
+	struct stat file_status;
+	if (fstat(file, &file_status) == 0) {
+		file_size = size_t(file_status.st_size);
+		if (file_size == 0) {
+			is_empty_file = true;
+		}
+		else {
+			void* mapping = mmap(nullptr, file_size, PROT_READ, MAP_PRIVATE, file, 0);
+			if (mapping != MAP_FAILED) {
+				mapped_data = (const char*)mapping;
+				is_mapped = true;
+			}
+		}
+	}
+	close(file); // The mapping stays valid
+#endif
+	if (!is_mapped) file_size = 0;
+}
+
+MappedFile::~MappedFile()
+{
+#ifdef _WIN32
+	if (mapped_data) UnmapViewOfFile(mapped_data);
+	if (mapping_handle) CloseHandle(mapping_handle);
+	if (file_handle) CloseHandle(file_handle);
+#else
+	if (is_mapped) munmap((void*)mapped_data, file_size);
+#endif
+}
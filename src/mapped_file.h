@@ -0,0 +1,62 @@
+#pragma once
+#include <filesystem>
+#include <string_view>
+#include <cstddef>
+#include <functional>
+#include <memory>
+#include <vector>
+
+/*
+Read-only memory mapping of a whole file. The contents are read by the OS on first access,
+nothing is copied into a buffer of our own.
+
+The source files (.cfg, .rdm and .dds) are all read through it. While a SourceResolverScope exists on a thread, its
+resolver is asked for the bytes of a file first, for programs that have the files only in memory (see snowgen.h).
+*/
+
+// Returns the bytes of the file at the absolute path, or nullptr if it is to be read from the disk
+using SourceResolver = std::function<std::shared_ptr<const std::vector<char>>(const std::filesystem::path& path)>;
+
+// The MappedFiles opened on this thread ask resolver while the scope exists, nullptr or an empty resolver: none.
+// Scopes can be nested.
+class SourceResolverScope
+{
+public:
+	explicit SourceResolverScope(const SourceResolver* resolver);
+	~SourceResolverScope();
+
+	SourceResolverScope(const SourceResolverScope&) = delete;
+	SourceResolverScope& operator=(const SourceResolverScope&) = delete;
+
+private:
+	const SourceResolver* previous_resolver;
+};
+
+// Whether a MappedFile of the path would open: the resolver has it, or it exists on the disk
+bool source_file_exists(const std::filesystem::path& path);
+
+class MappedFile
+{
+public:
+	MappedFile(std::filesystem::path path);
+	~MappedFile();
+
+	MappedFile(const MappedFile&) = delete;
+	MappedFile& operator=(const MappedFile&) = delete;
+
+	bool is_open() const { return is_mapped || is_empty_file || resolved_bytes; }
+	const char* data() const { return mapped_data; }
+	size_t size() const { return file_size; }
+	std::string_view view() const { return std::string_view(mapped_data, file_size); }
+
+private:
+	const char* mapped_data = nullptr;
+	size_t file_size = 0;
+	bool is_mapped = false;
+	bool is_empty_file = false; // Empty files cannot be mapped, but opening them did not fail
+	std::shared_ptr<const std::vector<char>> resolved_bytes; // From the SourceResolver, instead of a mapping
+#ifdef _WIN32
+	void* file_handle = nullptr;
+	void* mapping_handle = nullptr;
+#endif
+};
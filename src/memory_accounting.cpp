@@ -0,0 +1,164 @@
+#include "memory_accounting.h"
+
+#include <mutex>
+#include <condition_variable>
+#include <unordered_map>
+#include <iostream>
+#include <utility>
+
+namespace ma = memory_accounting;
+
+static std::mutex accounting_mutex;
+static size_t current_bytes[ma::category_count] = {};
+static size_t peak_bytes[ma::category_count] = {};
+static size_t cfg_peak_bytes[ma::category_count] = {};
+static size_t current_total_bytes = 0;
+static size_t peak_total_bytes = 0;
+static size_t cfg_peak_total_bytes = 0;
+static std::unordered_map<GLuint, std::pair<ma::Category, size_t>> gl_texture_sizes;
+
+static size_t budget_bytes = 0;
+static size_t reserved_total_bytes = 0;
+static size_t worker_reserved_bytes = 0; // Part of reserved_total_bytes
+static std::condition_variable reservation_released;
+
+static double to_mb(size_t bytes) {
+	return bytes / (1024. * 1024.);
+}
+
+void ma::add(Category category, size_t bytes) {
+	std::lock_guard<std::mutex> lock(accounting_mutex);
+	int c = (int)category;
+	current_bytes[c] += bytes;
+	current_total_bytes += bytes;
+	if (current_bytes[c] > peak_bytes[c]) peak_bytes[c] = current_bytes[c];
+	if (current_bytes[c] > cfg_peak_bytes[c]) cfg_peak_bytes[c] = current_bytes[c];
+	if (current_total_bytes > peak_total_bytes) peak_total_bytes = current_total_bytes;
+	if (current_total_bytes > cfg_peak_total_bytes) cfg_peak_total_bytes = current_total_bytes;
+}
+
+void ma::remove(Category category, size_t bytes) {
+	std::lock_guard<std::mutex> lock(accounting_mutex);
+	int c = (int)category;
+	if (bytes > current_bytes[c]) bytes = current_bytes[c]; // Should not happen; do not wrap around
+	current_bytes[c] -= bytes;
+	current_total_bytes -= bytes;
+}
+
+void ma::track_gl_texture(GLuint texture_id, Category category, size_t bytes) {
+	if (texture_id == 0) return;
+	add(category, bytes);
+	std::lock_guard<std::mutex> lock(accounting_mutex);
+	gl_texture_sizes[texture_id] = std::make_pair(category, bytes);
+}
+
+void ma::untrack_gl_texture(GLuint texture_id) {
+	std::pair<Category, size_t> entry;
+	{
+		std::lock_guard<std::mutex> lock(accounting_mutex);
+		auto it = gl_texture_sizes.find(texture_id);
+		if (it == gl_texture_sizes.end()) return;
+		entry = it->second;
+		gl_texture_sizes.erase(it);
+	}
+	remove(entry.first, entry.second);
+}
+
+size_t ma::current_total() {
+	std::lock_guard<std::mutex> lock(accounting_mutex);
+	return current_total_bytes;
+}
+
+size_t ma::peak_total() {
+	std::lock_guard<std::mutex> lock(accounting_mutex);
+	return peak_total_bytes;
+}
+
+void ma::set_budget(size_t bytes) {
+	std::lock_guard<std::mutex> lock(accounting_mutex);
+	budget_bytes = bytes;
+}
+
+size_t ma::get_budget() {
+	std::lock_guard<std::mutex> lock(accounting_mutex);
+	return budget_bytes;
+}
+
+bool ma::is_over_budget() {
+	std::lock_guard<std::mutex> lock(accounting_mutex);
+	return budget_bytes != 0 && current_total_bytes > budget_bytes;
+}
+
+void ma::begin_cfg() {
+	std::lock_guard<std::mutex> lock(accounting_mutex);
+	for (int c = 0; c < category_count; c++) cfg_peak_bytes[c] = current_bytes[c];
+	cfg_peak_total_bytes = current_total_bytes;
+}
+
+void ma::print_cfg_peaks() {
+	std::lock_guard<std::mutex> lock(accounting_mutex);
+	std::cout << "Peak memory: " << to_mb(cfg_peak_total_bytes) << " MB (";
+	for (int c = 0; c < category_count; c++) {
+		if (c != 0) std::cout << ", ";
+		std::cout << category_names[c] << " " << to_mb(cfg_peak_bytes[c]) << " MB";
+	}
+	std::cout << ")" << std::endl;
+}
+
+void ma::print_summary() {
+	std::lock_guard<std::mutex> lock(accounting_mutex);
+	std::cout << "Peak tracked memory: " << to_mb(peak_total_bytes) << " MB" << std::endl;
+	for (int c = 0; c < category_count; c++) {
+		std::cout << "  " << category_names[c] << ": peak " << to_mb(peak_bytes[c]) << " MB, still allocated "
+			<< to_mb(current_bytes[c]) << " MB" << std::endl;
+	}
+}
+
+MemoryReservation::MemoryReservation(size_t bytes, bool is_released_by_worker)
+{
+	reserved_bytes = bytes;
+	is_worker_reservation = is_released_by_worker;
+	std::unique_lock<std::mutex> lock(accounting_mutex);
+	if (budget_bytes != 0) {
+		if (bytes > budget_bytes) {
+			std::cout << "WARNING: " << to_mb(bytes) << " MB are needed, which is more than the memory budget of "
+				<< to_mb(budget_bytes) << " MB" << std::endl;
+		}
+		// Wait for the workers to finish textures. Only they release reservations while this thread waits.
+		reservation_released.wait(lock, [&] {
+			return worker_reserved_bytes == 0 || reserved_total_bytes + bytes <= budget_bytes;
+		});
+	}
+	reserved_total_bytes += bytes;
+	if (is_worker_reservation) worker_reserved_bytes += bytes;
+}
+
+MemoryReservation::~MemoryReservation()
+{
+	{
+		std::lock_guard<std::mutex> lock(accounting_mutex);
+		reserved_total_bytes -= reserved_bytes;
+		if (is_worker_reservation) worker_reserved_bytes -= reserved_bytes;
+	}
+	reservation_released.notify_all();
+}
+
+TrackedAllocation::TrackedAllocation(ma::Category category, size_t bytes)
+{
+	tracked_category = category;
+	tracked_bytes = bytes;
+	ma::add(tracked_category, tracked_bytes);
+}
+
+TrackedAllocation::~TrackedAllocation()
+{
+	ma::remove(tracked_category, tracked_bytes);
+}
+
+void delete_gl_texture(GLuint* texture_id)
+{
+	if (*texture_id == 0) return;
+	ma::untrack_gl_texture(*texture_id);
+	glDeleteTextures(1, texture_id);
+	*texture_id = 0;
+}
@@ -0,0 +1,72 @@
+#pragma once
+#include <cstdint>
+#include <cstddef>
+#include "../external/glew-2.2.0/include/GL/glew.h"
+
+/*
+Bookkeeping of the big allocations (host and GL memory), grouped by what they are used for.
+The peaks are reported per .cfg file. With --memory_budget_mb, work that would exceed the budget
+has to wait (MemoryReservation) until other work has released its memory.
+*/
+
+namespace memory_accounting {
+	enum class Category { decoded_textures, snowmaps, mip_scratch, encode_output, gl_objects, mesh_data };
+	constexpr int category_count = 6;
+	inline const char* category_names[] = { "decoded textures", "snowmaps", "mip scratch", "encode output", "GL objects", "mesh data" };
+
+	void add(Category category, size_t bytes);
+	void remove(Category category, size_t bytes);
+
+	// GL textures are tracked by id so that deleting them does not require knowing their size
+	void track_gl_texture(GLuint texture_id, Category category, size_t bytes);
+	void untrack_gl_texture(GLuint texture_id);
+
+	size_t current_total();
+	size_t peak_total();
+
+	void set_budget(size_t bytes); // 0 = no budget
+	size_t get_budget();
+	bool is_over_budget();
+
+	// Resets the per-cfg peaks
+	void begin_cfg();
+	void print_cfg_peaks();
+	void print_summary();
+}
+
+// Holds an estimate of the memory some work is going to need. The constructor blocks as long as the budget
+// would be exceeded and reservations that worker threads release (the encoding of saved textures) are active.
+// The reservations are made on the GL thread: it cannot wait for the ones it releases itself, so a reservation
+// that is larger than the budget is let through (with a warning) once the workers are done.
+class MemoryReservation
+{
+public:
+	// is_released_by_worker: the reservation is handed to a worker thread, which destroys it when its task is done
+	MemoryReservation(size_t bytes, bool is_released_by_worker = false);
+	~MemoryReservation();
+
+	MemoryReservation(const MemoryReservation&) = delete;
+	MemoryReservation& operator=(const MemoryReservation&) = delete;
+
+private:
+	size_t reserved_bytes;
+	bool is_worker_reservation;
+};
+
+// Counts bytes of a category for as long as it exists, e.g. for scratch buffers
+class TrackedAllocation
+{
+public:
+	TrackedAllocation(memory_accounting::Category category, size_t bytes);
+	~TrackedAllocation();
+
+	TrackedAllocation(const TrackedAllocation&) = delete;
+	TrackedAllocation& operator=(const TrackedAllocation&) = delete;
+
+private:
+	memory_accounting::Category tracked_category;
+	size_t tracked_bytes;
+};
+
+// Deletes the texture, removes it from the memory accounting and sets the id to 0
+void delete_gl_texture(GLuint* texture_id);
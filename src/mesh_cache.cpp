@@ -0,0 +1,174 @@
+#include "mesh_cache.h"
+
+#include <iostream>
+#include <unordered_map>
+#include <string_view>
+
+#include "mapped_file.h"
+#include "memory_accounting.h"
+#include "snow_exception.h"
+#include "path_table.h"
+#include "content_hash.h"
+
+namespace fs = std::filesystem;
+
+// Files of different size never share a mesh. Files of the same size and hash are compared before they do.
+struct ContentKey {
+	uint64_t size = 0;
+	ContentHash hash;
+
+	bool operator==(const ContentKey& other) const = default;
+};
+
+struct ContentKeyHasher {
+	size_t operator()(const ContentKey& key) const { return ContentHashHasher()(key.hash) ^ size_t(key.size); }
+};
+
+struct CachedMesh {
+	std::shared_ptr<HardwareRdm> mesh;
+	fs::path rdm_path; // The file it was loaded from, to compare other files with the same key
+	size_t bytes = 0; // GL buffers and the copies on the host
+	uint64_t last_use = 0;
+};
+
+// What the contents of a path were when it was last loaded
+struct CachedPath {
+	uint32_t path_id = path_table::invalid_id;
+	ContentKey content_key;
+	fs::file_time_type modification_time;
+	uintmax_t file_size = 0;
+};
+
+static std::unordered_map<ContentKey, CachedMesh, ContentKeyHasher> meshes_by_content;
+static std::vector<CachedPath> cached_paths;
+static path_table::SlotTable cached_path_slots;
+static size_t limit_bytes = 256 * 1024 * 1024;
+static uint64_t use_counter = 0;
+
+static size_t request_count = 0;
+static size_t path_hit_count = 0;
+static size_t content_hit_count = 0; // Different path, same bytes
+static size_t load_count = 0;
+static size_t evicted_count = 0;
+static uint64_t reused_bytes = 0;
+
+// Whether the file the mesh was loaded from still has the contents
+static bool has_contents(const CachedMesh& cached_mesh, std::string_view contents)
+{
+	MappedFile file(cached_mesh.rdm_path);
+	return file.is_open() && file.view() == contents;
+}
+
+static std::shared_ptr<HardwareRdm> load_uncached(const fs::path& rdm_path)
+{
+	load_count++;
+	std::shared_ptr<HardwareRdm> mesh = std::make_shared<HardwareRdm>();
+	mesh->load_rdm(rdm_path);
+	return mesh;
+}
+
+static CachedPath* find_cached_path(uint32_t rdm_path_id)
+{
+	uint32_t slot = cached_path_slots.get(rdm_path_id);
+	if (slot < cached_paths.size() && cached_paths[slot].path_id == rdm_path_id) return &cached_paths[slot];
+	return nullptr;
+}
+
+std::shared_ptr<HardwareRdm> mesh_cache::get(const fs::path& rdm_path, uint32_t rdm_path_id)
+{
+	request_count++;
+	if (limit_bytes == 0) return load_uncached(rdm_path);
+
+	std::error_code error;
+	fs::file_time_type modification_time = fs::last_write_time(rdm_path, error);
+	uintmax_t file_size = error ? 0 : fs::file_size(rdm_path, error);
+
+	CachedPath* cached_path = find_cached_path(rdm_path_id);
+	if (!error && cached_path && cached_path->modification_time == modification_time && cached_path->file_size == file_size) {
+		auto cached_mesh = meshes_by_content.find(cached_path->content_key);
+		if (cached_mesh != meshes_by_content.end()) {
+			path_hit_count++;
+			reused_bytes += cached_mesh->second.bytes;
+			cached_mesh->second.last_use = ++use_counter;
+			return cached_mesh->second.mesh;
+		}
+	}
+
+	// The contents are read anyway, load_rdm finds them in the file cache of the OS afterwards
+	MappedFile file(rdm_path);
+	if (!file.is_open()) {
+		std::cout << "Could not open " << rdm_path << std::endl;
+		throw snow_exception("Could not open RDM file");
+	}
+	ContentKey content_key = ContentKey{ file.size(), hash_content(file.data(), file.size()) };
+	if (!error) {
+		if (!cached_path) {
+			cached_path_slots.set(rdm_path_id, uint32_t(cached_paths.size()));
+			cached_path = &cached_paths.emplace_back();
+		}
+		*cached_path = CachedPath{ rdm_path_id, content_key, modification_time, file_size };
+	}
+
+	auto cached_mesh = meshes_by_content.find(content_key);
+	if (cached_mesh != meshes_by_content.end()) {
+		if (has_contents(cached_mesh->second, file.view())) {
+			content_hit_count++;
+			reused_bytes += cached_mesh->second.bytes;
+			cached_mesh->second.last_use = ++use_counter;
+			return cached_mesh->second.mesh;
+		}
+		// The file of the cached mesh has changed since (or the hash collided): this one is not shared
+		if (cached_path) cached_path->modification_time = fs::file_time_type();
+		return load_uncached(rdm_path);
+	}
+
+	std::shared_ptr<HardwareRdm> mesh = load_uncached(rdm_path);
+	meshes_by_content[content_key] = CachedMesh{ mesh, rdm_path, mesh->get_buffer_bytes() + mesh->get_host_bytes(), ++use_counter };
+	return mesh;
+}
+
+void mesh_cache::set_limit(size_t bytes)
+{
+	limit_bytes = bytes;
+	trim();
+}
+
+void mesh_cache::trim()
+{
+	size_t unused_bytes = 0;
+	for (const auto& [content_key, cached_mesh] : meshes_by_content) {
+		if (cached_mesh.mesh.use_count() == 1) unused_bytes += cached_mesh.bytes;
+	}
+
+	while (unused_bytes > 0 && (unused_bytes > limit_bytes || memory_accounting::is_over_budget())) {
+		auto least_recently_used = meshes_by_content.end();
+		for (auto it = meshes_by_content.begin(); it != meshes_by_content.end(); it++) {
+			if (it->second.mesh.use_count() != 1) continue;
+			if (least_recently_used == meshes_by_content.end() || it->second.last_use < least_recently_used->second.last_use) {
+				least_recently_used = it;
+			}
+		}
+		if (least_recently_used == meshes_by_content.end()) break;
+
+		ContentKey content_key = least_recently_used->first;
+		unused_bytes -= least_recently_used->second.bytes;
+		meshes_by_content.erase(least_recently_used); // Deletes the GL buffers
+		std::erase_if(cached_paths, [&content_key](const CachedPath& cached_path) { return cached_path.content_key == content_key; });
+		for (size_t i = 0; i < cached_paths.size(); i++) cached_path_slots.set(cached_paths[i].path_id, uint32_t(i));
+		evicted_count++;
+	}
+}
+
+void mesh_cache::clear()
+{
+	meshes_by_content.clear();
+	cached_paths.clear();
+}
+
+void mesh_cache::print_statistics()
+{
+	std::cout << "Mesh cache: " << request_count << " meshes requested, " << load_count << " loaded, "
+		<< path_hit_count << " reused by path, " << content_hit_count << " reused by identical contents at another path, "
+		<< evicted_count << " dropped" << std::endl;
+	std::cout << "  " << reused_bytes / (1024. * 1024.) << " MB of mesh uploads saved" << std::endl;
+}
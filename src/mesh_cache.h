@@ -0,0 +1,33 @@
+#pragma once
+#include <cstdint>
+#include <cstddef>
+#include <memory>
+#include <filesystem>
+
+#include "rdm2gl.h"
+
+/*
+Uploaded meshes, shared by all .cfg files of a run.
+
+A mesh is found by the path_table id of its .rdm file (through a path_table::SlotTable) and, if that path has not been
+loaded yet (or the file has changed), by the size and SHA-256 of its contents, so that byte-identical copies at different
+paths share one mesh. Before a copy shares a mesh, its bytes are compared with the file the mesh was loaded from.
+The .cfg files hold the meshes they use, meshes no .cfg holds are kept until trim() drops them. The limit counts the
+GL buffers and the copies of the vertices and indices on the host (see HardwareRdm::vertex_data).
+Only to be used on the thread that owns the GL context.
+*/
+
+namespace mesh_cache {
+	// Loads the file only if neither the path nor a file with the same contents is cached.
+	// Throws snow_exception for broken files, like HardwareRdm::load_rdm.
+	std::shared_ptr<HardwareRdm> get(const std::filesystem::path& rdm_path, uint32_t rdm_path_id);
+
+	void set_limit(size_t bytes); // 0 = no meshes are kept
+	// Drops meshes no .cfg file uses, least recently used first, while they take more than the limit
+	// or the memory budget is exceeded
+	void trim();
+	// Must be called before the GL context is destroyed
+	void clear();
+
+	void print_statistics();
+}
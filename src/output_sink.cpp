@@ -0,0 +1,441 @@
+#include "output_sink.h"
+
+#include <iostream>
+#include <fstream>
+#include <mutex>
+#include <atomic>
+#include <vector>
+#include <string>
+#include <string_view>
+#include <cstring>
+#include <unordered_map>
+
+#include "mapped_file.h"
+#include "snow_exception.h"
+
+namespace fs = std::filesystem;
+using namespace output_archive_format;
+
+// The records are written and read as they are, their layout must not depend on the compiler
+static_assert(sizeof(Header) == 8 && sizeof(Entry) == 32 && sizeof(Footer) == 32);
+
+static std::mutex archive_mutex;
+static bool is_open = false;
+static std::ofstream archive_file;
+static std::vector<char> archive_buffer; // Few large writes instead of one per file
+static fs::path archive_file_path;
+static fs::path archive_root;
+static uint64_t archive_size = 0;
+static std::vector<Entry> entries;
+static std::string paths;
+static std::unordered_map<std::string, size_t> entry_by_path; // Latest entry of each path
+static bool has_write_error = false;
+
+static thread_local output_sink::Capture* current_capture = nullptr;
+
+static std::atomic<size_t> written_file_count = 0;
+static std::atomic<uint64_t> written_bytes = 0;
+static std::atomic<size_t> unchanged_file_count = 0;
+static std::atomic<uint64_t> unchanged_bytes = 0;
+static std::atomic<size_t> linked_file_count = 0;
+static std::atomic<uint64_t> linked_bytes = 0;
+
+// Compares with the file from the last run, so that unchanged files keep their modification time
+static bool is_file_unchanged(const fs::path& path, const void* data, size_t size)
+{
+	std::error_code error;
+	if (fs::file_size(path, error) != size || error) return false;
+	MappedFile existing_file(path);
+	if (!existing_file.is_open()) return false;
+	return size == 0 || std::memcmp(existing_file.data(), data, size) == 0;
+}
+
+static bool write_loose_file(const fs::path& path, const void* data, size_t size)
+{
+	if (is_file_unchanged(path, data, size)) {
+		unchanged_file_count++;
+		unchanged_bytes += size;
+		return true;
+	}
+	std::error_code error;
+	fs::create_directories(path.parent_path(), error);
+	fs::remove(path, error); // If it was hard-linked by link_file(), writing into it would change the other file too
+	std::ofstream file(path, std::ofstream::binary);
+	file.write((const char*)data, size);
+	if (!file) return false;
+	written_file_count++;
+	written_bytes += size;
+	return true;
+}
+
+static bool are_files_identical(const fs::path& path, const fs::path& other_path)
+{
+	std::error_code error;
+	if (fs::equivalent(path, other_path, error)) return true;
+	MappedFile other_file(other_path);
+	return other_file.is_open() && is_file_unchanged(path, other_file.data(), other_file.size());
+}
+
+// Relative to the root with forward slashes, or empty if the path is not below the root
+static std::string archive_path_of(const fs::path& path)
+{
+	std::error_code error;
+	fs::path absolute_path = fs::absolute(path, error);
+	if (error) absolute_path = path;
+	fs::path relative_path = absolute_path.lexically_normal().lexically_relative(archive_root);
+	if (relative_path.empty() || relative_path.is_absolute() || *relative_path.begin() == "..") return "";
+	std::u8string key = relative_path.generic_u8string();
+	return std::string(key.begin(), key.end());
+}
+
+bool output_sink::open_archive(const fs::path& archive_path, const fs::path& root_directory)
+{
+	std::lock_guard<std::mutex> lock(archive_mutex);
+	if (is_open) return false;
+	std::error_code error;
+	archive_root = fs::absolute(root_directory, error).lexically_normal();
+	archive_file_path = archive_path;
+	fs::create_directories(archive_path.parent_path(), error);
+
+	archive_buffer.resize(4 * 1024 * 1024);
+	archive_file.rdbuf()->pubsetbuf(archive_buffer.data(), archive_buffer.size()); // Only works before opening
+	archive_file.open(archive_path, std::ofstream::binary | std::ofstream::trunc);
+	if (!archive_file) {
+		std::cout << "Could not create " << archive_path.string() << std::endl;
+		return false;
+	}
+	Header header{};
+	std::memcpy(header.magic, magic, 4);
+	header.version = version;
+	archive_file.write((const char*)&header, sizeof(Header));
+	archive_size = sizeof(Header);
+	entries.clear();
+	paths.clear();
+	entry_by_path.clear();
+	has_write_error = false;
+	is_open = true;
+	return true;
+}
+
+bool output_sink::is_archive_open()
+{
+	std::lock_guard<std::mutex> lock(archive_mutex);
+	return is_open;
+}
+
+std::vector<output_sink::CapturedFile> output_sink::Capture::take_files()
+{
+	std::lock_guard<std::mutex> lock(files_mutex);
+	std::vector<CapturedFile> taken_files = std::move(files);
+	files.clear();
+	file_by_path.clear();
+	return taken_files;
+}
+
+void output_sink::Capture::add(const fs::path& path, const void* data, size_t size)
+{
+	std::lock_guard<std::mutex> lock(files_mutex);
+	auto [captured, is_new] = file_by_path.try_emplace(path.lexically_normal().generic_string(), files.size());
+	if (is_new) files.push_back(CapturedFile{ path, {} });
+	files[captured->second].bytes.assign((const uint8_t*)data, (const uint8_t*)data + size);
+}
+
+bool output_sink::Capture::link(const fs::path& existing_path, const fs::path& path, uint64_t* linked_bytes)
+{
+	std::vector<uint8_t> bytes;
+	{
+		std::lock_guard<std::mutex> lock(files_mutex);
+		auto existing_file = file_by_path.find(existing_path.lexically_normal().generic_string());
+		if (existing_file == file_by_path.end()) return false;
+		bytes = files[existing_file->second].bytes;
+	}
+	add(path, bytes.data(), bytes.size());
+	*linked_bytes += bytes.size();
+	return true;
+}
+
+output_sink::CaptureScope::CaptureScope(Capture* capture) : previous_capture(current_capture)
+{
+	current_capture = capture;
+}
+
+output_sink::CaptureScope::~CaptureScope()
+{
+	current_capture = previous_capture;
+}
+
+bool output_sink::write_file(const fs::path& path, const void* data, size_t size)
+{
+	if (current_capture) {
+		current_capture->add(path, data, size);
+		written_file_count++;
+		written_bytes += size;
+		return true;
+	}
+	std::unique_lock<std::mutex> lock(archive_mutex);
+	if (!is_open) {
+		lock.unlock();
+		return write_loose_file(path, data, size);
+	}
+
+	std::string archive_path = archive_path_of(path);
+	if (archive_path.empty()) return false;
+	Entry entry{};
+	entry.offset = archive_size;
+	entry.size = size;
+	entry.path_offset = paths.size();
+	entry.path_length = archive_path.size();
+	archive_file.write((const char*)data, size);
+	if (!archive_file) {
+		has_write_error = true;
+		return false;
+	}
+	archive_size += size;
+	written_file_count++;
+	written_bytes += size;
+	paths += archive_path;
+	entry_by_path[archive_path] = entries.size();
+	entries.push_back(entry);
+	return true;
+}
+
+output_sink::StreamedFile::StreamedFile(const fs::path& path) : path(path), capture(current_capture)
+{
+	std::error_code error;
+	if (capture) return;
+	if (is_archive_open()) {
+		static std::atomic<size_t> streamed_file_count = 0;
+		std::lock_guard<std::mutex> lock(archive_mutex);
+		temporary_path = fs::path(archive_file_path).concat(".part" + std::to_string(streamed_file_count++));
+	}
+	else {
+		// Saves of the same path are never running at the same time
+		temporary_path = fs::path(path).concat(".part");
+		fs::create_directories(path.parent_path(), error);
+	}
+	file.open(temporary_path, std::ofstream::binary | std::ofstream::trunc);
+}
+
+output_sink::StreamedFile::~StreamedFile()
+{
+	if (is_finished || capture) return;
+	file.close();
+	std::error_code error;
+	fs::remove(temporary_path, error);
+}
+
+bool output_sink::StreamedFile::append(const void* data, size_t size)
+{
+	if (capture) {
+		captured_bytes.insert(captured_bytes.end(), (const uint8_t*)data, (const uint8_t*)data + size);
+		return true;
+	}
+	file.write((const char*)data, size);
+	return bool(file);
+}
+
+bool output_sink::StreamedFile::finish()
+{
+	is_finished = true;
+	if (capture) {
+		capture->add(path, captured_bytes.data(), captured_bytes.size());
+		written_file_count++;
+		written_bytes += captured_bytes.size();
+		return true;
+	}
+	file.close();
+	std::error_code error;
+	uintmax_t size = fs::file_size(temporary_path, error);
+	if (!file || error) {
+		fs::remove(temporary_path, error);
+		return false;
+	}
+	if (is_archive_open()) {
+		// Copied through the mapping, the file never has to fit into memory
+		bool is_written;
+		{
+			MappedFile temporary_file(temporary_path);
+			is_written = temporary_file.is_open() && write_file(path, temporary_file.data(), temporary_file.size());
+		}
+		fs::remove(temporary_path, error);
+		return is_written;
+	}
+	if (are_files_identical(temporary_path, path)) {
+		unchanged_file_count++;
+		unchanged_bytes += size;
+		fs::remove(temporary_path, error);
+		return true;
+	}
+	// Replaces the directory entry: a file hard-linked to the old one by link_file() keeps its bytes
+	fs::rename(temporary_path, path, error);
+	if (error) {
+		fs::remove(temporary_path, error);
+		return false;
+	}
+	written_file_count++;
+	written_bytes += size;
+	return true;
+}
+
+bool output_sink::link_file(const fs::path& existing_path, const fs::path& path)
+{
+	if (current_capture) {
+		uint64_t captured_bytes = 0;
+		if (!current_capture->link(existing_path, path, &captured_bytes)) return false;
+		linked_file_count++;
+		linked_bytes += captured_bytes;
+		return true;
+	}
+	std::unique_lock<std::mutex> lock(archive_mutex);
+	if (is_open) {
+		// The new entry points to the bytes of the existing one
+		std::string archive_path = archive_path_of(path);
+		auto existing_entry = entry_by_path.find(archive_path_of(existing_path));
+		if (archive_path.empty() || existing_entry == entry_by_path.end()) return false;
+		Entry entry = entries[existing_entry->second];
+		entry.path_offset = paths.size();
+		entry.path_length = archive_path.size();
+		linked_file_count++;
+		linked_bytes += entry.size;
+		paths += archive_path;
+		entry_by_path[archive_path] = entries.size();
+		entries.push_back(entry);
+		return true;
+	}
+	lock.unlock();
+
+	std::error_code error;
+	uintmax_t size = fs::file_size(existing_path, error);
+	if (error) return false;
+	if (are_files_identical(existing_path, path)) {
+		unchanged_file_count++;
+		unchanged_bytes += size;
+		return true;
+	}
+	fs::create_directories(path.parent_path(), error);
+	fs::remove(path, error);
+	fs::create_hard_link(existing_path, path, error);
+	if (error) {
+		// Not supported by the file system (FAT32, some network shares) or across volumes
+		error.clear();
+		fs::copy_file(existing_path, path, fs::copy_options::overwrite_existing, error);
+		if (error) return false;
+	}
+	linked_file_count++;
+	linked_bytes += size;
+	return true;
+}
+
+void output_sink::close_archive()
+{
+	std::lock_guard<std::mutex> lock(archive_mutex);
+	if (!is_open) return;
+	is_open = false;
+
+	Footer footer{};
+	footer.entry_table_offset = archive_size;
+	footer.entry_count = entries.size();
+	footer.path_bytes = paths.size();
+	std::memcpy(footer.magic, magic, 4);
+	footer.version = version;
+	archive_file.write((const char*)entries.data(), entries.size() * sizeof(Entry));
+	archive_file.write(paths.data(), paths.size());
+	archive_file.write((const char*)&footer, sizeof(Footer));
+	archive_file.close();
+
+	if (!archive_file || has_write_error) {
+		std::cout << "WARNING: Could not write " << archive_file_path.string() << ", the archive is incomplete." << std::endl;
+	}
+	else {
+		std::cout << "Saved " << entries.size() << " files (" << archive_size / (1024 * 1024) << " MB) to "
+			<< archive_file_path.string() << std::endl;
+	}
+	entries = std::vector<Entry>();
+	paths = std::string();
+	entry_by_path.clear();
+	archive_buffer = std::vector<char>();
+}
+
+void output_sink::print_statistics()
+{
+	std::cout << "Wrote " << written_file_count << " files (" << written_bytes / (1024 * 1024) << " MB)";
+	if (unchanged_file_count > 0) {
+		std::cout << ", left " << unchanged_file_count << " unchanged files (" << unchanged_bytes / (1024 * 1024) << " MB) untouched";
+	}
+	if (linked_file_count > 0) {
+		std::cout << ", linked " << linked_file_count << " files (" << linked_bytes / (1024 * 1024) << " MB) to identical ones";
+	}
+	std::cout << std::endl;
+}
+
+// Entries must not write outside of the directory they are extracted to
+static bool is_safe_relative_path(const fs::path& path)
+{
+	if (path.empty() || path.has_root_name() || path.has_root_directory()) return false;
+	for (const fs::path& part : path) {
+		if (part == "..") return false;
+	}
+	return true;
+}
+
+size_t output_sink::extract_archive(const fs::path& archive_path, const fs::path& out_directory)
+{
+	MappedFile archive(archive_path);
+	if (!archive.is_open()) throw snow_exception("Could not open the archive");
+	const char* data = archive.data();
+	uint64_t archive_bytes = archive.size();
+
+	Header header;
+	Footer footer;
+	if (archive_bytes < sizeof(Header) + sizeof(Footer)) throw snow_exception("The archive is incomplete");
+	std::memcpy(&header, data, sizeof(Header));
+	std::memcpy(&footer, data + archive_bytes - sizeof(Footer), sizeof(Footer));
+	if (std::memcmp(header.magic, magic, 4) != 0 || header.version != version) {
+		throw snow_exception("Not an archive of this version of the snowgenerator");
+	}
+	if (std::memcmp(footer.magic, magic, 4) != 0 || footer.version != version) {
+		throw snow_exception("The archive is incomplete, the run that wrote it was probably interrupted");
+	}
+	uint64_t tables_end = archive_bytes - sizeof(Footer);
+	if (footer.entry_table_offset < sizeof(Header) || footer.entry_table_offset > tables_end
+		|| footer.entry_count > (tables_end - footer.entry_table_offset) / sizeof(Entry)
+		|| footer.path_bytes != tables_end - footer.entry_table_offset - footer.entry_count * sizeof(Entry)) {
+		throw snow_exception("The table of the archive is damaged");
+	}
+	const char* path_table = data + footer.entry_table_offset + footer.entry_count * sizeof(Entry);
+
+	std::vector<Entry> archive_entries(footer.entry_count);
+	if (footer.entry_count > 0) {
+		std::memcpy(archive_entries.data(), data + footer.entry_table_offset, footer.entry_count * sizeof(Entry));
+	}
+	// Only the last version of a file that was written twice is extracted
+	std::unordered_map<std::string_view, size_t> last_entry_by_path;
+	for (size_t i = 0; i < archive_entries.size(); i++) {
+		const Entry& entry = archive_entries[i];
+		if (entry.offset < sizeof(Header) || entry.offset > footer.entry_table_offset
+			|| entry.size > footer.entry_table_offset - entry.offset
+			|| entry.path_offset > footer.path_bytes || entry.path_length > footer.path_bytes - entry.path_offset) {
+			throw snow_exception("An entry of the archive is damaged");
+		}
+		last_entry_by_path[std::string_view(path_table + entry.path_offset, entry.path_length)] = i;
+	}
+
+	size_t extracted_count = 0;
+	for (size_t i = 0; i < archive_entries.size(); i++) {
+		const Entry& entry = archive_entries[i];
+		std::string_view entry_path(path_table + entry.path_offset, entry.path_length);
+		if (last_entry_by_path[entry_path] != i) continue;
+		fs::path relative_path = fs::path(std::u8string(entry_path.begin(), entry_path.end()));
+		if (!is_safe_relative_path(relative_path)) {
+			std::cout << "Skipped " << entry_path << ", it is not a path below the output directory" << std::endl;
+			continue;
+		}
+		fs::path out_path = fs::path(out_directory) / relative_path;
+		if (!write_loose_file(out_path, data + entry.offset, entry.size)) {
+			std::cout << "Could not save to \"" << out_path.string() << "\"" << std::endl;
+			continue;
+		}
+		extracted_count++;
+	}
+	return extracted_count;
+}
@@ -0,0 +1,131 @@
+#pragma once
+#include <cstdint>
+#include <cstddef>
+#include <filesystem>
+#include <fstream>
+#include <vector>
+#include <string>
+#include <mutex>
+#include <unordered_map>
+
+/*
+Where the generated files go. By default, every file is written to its path below the output directory.
+After open_archive() (--output_archive), all of them are appended to a single archive instead.
+
+Archive layout: a Header, then the contents of the files one after another, then the table of entries and
+one table with all paths, found through the Footer at the very end of the file. The writer never seeks back,
+an archive is written in one sequential pass. The tables are only written by close_archive(), so an interrupted
+run leaves an archive without a footer, which extract_archive() rejects.
+Paths are relative to the output directory, with forward slashes. If a path was written twice, the last entry counts.
+
+While a CaptureScope exists on a thread, the files written on it are kept in memory by its Capture instead, for
+programs using the library (see snowgen.h). Other threads, and other Generators, still write to the disk or archive.
+
+Loose files whose bytes are the same as those of the existing file are not written again, so that their
+modification time does not change and tools that package the output do not see them as modified.
+*/
+
+namespace output_archive_format {
+	constexpr char magic[4] = { 'S', 'G', 'O', 'A' };
+	constexpr uint32_t version = 1;
+
+	struct Header {
+		char magic[4];
+		uint32_t version;
+	};
+
+	struct Entry {
+		uint64_t offset; // From the start of the archive
+		uint64_t size;
+		uint64_t path_offset; // Into the path table
+		uint64_t path_length;
+	};
+
+	struct Footer {
+		uint64_t entry_table_offset; // The path table follows the entries
+		uint64_t entry_count;
+		uint64_t path_bytes;
+		char magic[4];
+		uint32_t version;
+	};
+}
+
+namespace output_sink {
+	// All files written afterwards go into the archive, their paths are stored relative to root_directory.
+	// Returns false if the archive cannot be created.
+	bool open_archive(const std::filesystem::path& archive_path, const std::filesystem::path& root_directory);
+	bool is_archive_open();
+
+	struct CapturedFile {
+		std::filesystem::path path;
+		std::vector<uint8_t> bytes;
+	};
+	// Files kept in memory instead of being written. Can be used from any thread.
+	class Capture {
+	public:
+		// The files captured since the last call, in the order they were first written. A path written twice is
+		// returned once, with its last bytes.
+		std::vector<CapturedFile> take_files();
+
+		void add(const std::filesystem::path& path, const void* data, size_t size);
+		// Captures path with the bytes of existing_path and adds their number to linked_bytes.
+		// Returns false if existing_path was not captured.
+		bool link(const std::filesystem::path& existing_path, const std::filesystem::path& path, uint64_t* linked_bytes);
+
+	private:
+		std::mutex files_mutex;
+		std::vector<CapturedFile> files;
+		std::unordered_map<std::string, size_t> file_by_path;
+	};
+	// The files written on this thread go to capture while the scope exists, nullptr: to the disk or archive.
+	// Scopes can be nested.
+	class CaptureScope {
+	public:
+		explicit CaptureScope(Capture* capture);
+		~CaptureScope();
+		CaptureScope(const CaptureScope&) = delete;
+		CaptureScope& operator=(const CaptureScope&) = delete;
+
+	private:
+		Capture* previous_capture;
+	};
+	// Writes the file to its path, creating the directories, or appends it to the archive.
+	// An existing file with the same bytes is left untouched.
+	// Can be called from any thread. Prints nothing, returns false on errors.
+	bool write_file(const std::filesystem::path& path, const void* data, size_t size);
+	// Makes path a file with the same bytes as existing_path, which must have been written before: a hard link
+	// (a copy where the file system has none) or, in the archive, a second entry pointing to the same bytes.
+	// Can be called from any thread. Prints nothing, returns false on errors.
+	bool link_file(const std::filesystem::path& existing_path, const std::filesystem::path& path);
+	// A file that is too large to be built in memory, written in parts. The parts go to a temporary file (next to the
+	// file or the archive), which finish() moves to its path or into the archive, or drops if the file is unchanged.
+	class StreamedFile {
+	public:
+		explicit StreamedFile(const std::filesystem::path& path);
+		// Removes the temporary file if finish() was not called
+		~StreamedFile();
+		StreamedFile(const StreamedFile&) = delete;
+		StreamedFile& operator=(const StreamedFile&) = delete;
+
+		bool append(const void* data, size_t size);
+		// Can be called from any thread. Prints nothing, returns false on errors.
+		bool finish();
+
+	private:
+		std::filesystem::path path;
+		std::filesystem::path temporary_path;
+		std::ofstream file;
+		Capture* capture = nullptr; // If set, the parts are collected in captured_bytes instead of the temporary file
+		std::vector<uint8_t> captured_bytes;
+		bool is_finished = false;
+	};
+
+	// Writes the tables of the archive. Must be called when all files are written.
+	void close_archive();
+	// How many files and bytes were written, linked and how many were already up to date
+	void print_statistics();
+
+	// Writes the files of an archive below out_directory and returns their number.
+	// Throws snow_exception if the archive is incomplete or damaged.
+	size_t extract_archive(const std::filesystem::path& archive_path, const std::filesystem::path& out_directory);
+}
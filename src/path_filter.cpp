@@ -0,0 +1,188 @@
+#include "path_filter.h"
+
+#include <fstream>
+#include <iostream>
+#include <random>
+#include <chrono>
+#include <deque>
+#include <algorithm>
+
+#include "filelist.h"
+
+static uint8_t normalize_character(uint8_t c) {
+	return c == '\\' ? '/' : c;
+}
+
+void PatternMatcher::add_pattern(std::string_view pattern, uint32_t categories)
+{
+	if (pattern.empty()) return; // Would match every path
+	patterns.push_back(Pattern{ std::string(pattern), categories });
+}
+
+void PatternMatcher::compile()
+{
+	// Character classes keep the transition table small: one column per character used in a pattern
+	std::fill(std::begin(character_classes), std::end(character_classes), uint8_t(0));
+	class_count = 1;
+	for (const Pattern& pattern : patterns) {
+		for (char c : pattern.text) {
+			uint8_t character = normalize_character(uint8_t(c));
+			if (character_classes[character] == 0 && class_count < 256) character_classes[character] = uint8_t(class_count++);
+		}
+	}
+	character_classes[uint8_t('\\')] = character_classes[uint8_t('/')];
+
+	// Trie of all patterns. -1 = no edge yet.
+	constexpr uint32_t no_state = 0xFFFFFFFF;
+	transitions.assign(class_count, no_state);
+	state_categories.assign(1, 0);
+	for (const Pattern& pattern : patterns) {
+		uint32_t state = 0;
+		for (char c : pattern.text) {
+			uint32_t& next = transitions[state * class_count + character_classes[uint8_t(c)]];
+			if (next == no_state) {
+				next = uint32_t(state_categories.size());
+				state_categories.push_back(0);
+				transitions.resize(transitions.size() + class_count, no_state);
+			}
+			state = transitions[state * class_count + character_classes[uint8_t(c)]]; // resize() may have moved next
+		}
+		state_categories[state] |= pattern.categories;
+	}
+
+	// Breadth-first: fill in the missing transitions with those of the longest suffix that is also in the trie,
+	// which turns the trie into a deterministic automaton without failure links at match time
+	std::vector<uint32_t> suffix_states(state_categories.size(), 0);
+	std::deque<uint32_t> queue;
+	for (uint32_t c = 0; c < class_count; c++) {
+		uint32_t& next = transitions[c];
+		if (next == no_state) next = 0;
+		else queue.push_back(next);
+	}
+	while (!queue.empty()) {
+		uint32_t state = queue.front();
+		queue.pop_front();
+		uint32_t suffix_state = suffix_states[state];
+		for (uint32_t c = 0; c < class_count; c++) {
+			uint32_t& next = transitions[state * class_count + c];
+			if (next == no_state) {
+				next = transitions[suffix_state * class_count + c];
+			}
+			else {
+				suffix_states[next] = transitions[suffix_state * class_count + c];
+				state_categories[next] |= state_categories[suffix_states[next]];
+				queue.push_back(next);
+			}
+		}
+	}
+}
+
+uint32_t PatternMatcher::match(std::string_view path) const
+{
+	if (transitions.empty()) return 0; // Not compiled
+	uint32_t state = 0;
+	uint32_t categories = 0;
+	for (char c : path) {
+		state = transitions[state * class_count + character_classes[uint8_t(c)]];
+		categories |= state_categories[state];
+	}
+	return categories;
+}
+
+bool add_rules_from_file(PatternMatcher* matcher, std::filesystem::path rules_file)
+{
+	std::ifstream rules_stream(rules_file);
+	if (!rules_stream) {
+		std::cout << "Could not read filter rules from " << rules_file.string() << std::endl;
+		return false;
+	}
+	const std::pair<std::string_view, uint32_t> rule_types[] = {
+		{ "blacklist ", path_categories::blacklist },
+		{ "whitelist ", path_categories::whitelist },
+		{ "texture_blacklist ", path_categories::texture_blacklist },
+	};
+	std::string line;
+	int line_number = 0;
+	int rule_count = 0;
+	while (std::getline(rules_stream, line)) {
+		line_number++;
+		if (!line.empty() && line.back() == '\r') line.pop_back();
+		if (line.empty() || line[0] == '#') continue;
+
+		bool is_known_rule = false;
+		for (const auto& [prefix, categories] : rule_types) {
+			if (line.starts_with(prefix)) {
+				matcher->add_pattern(std::string_view(line).substr(prefix.size()), categories);
+				is_known_rule = true;
+				rule_count++;
+				break;
+			}
+		}
+		if (!is_known_rule) std::cout << rules_file.string() << ":" << line_number << ": Unknown rule: " << line << std::endl;
+	}
+	std::cout << "Loaded " << rule_count << " filter rules from " << rules_file.string() << std::endl;
+	return true;
+}
+
+// The classification as it was done before the automaton: one std::string::find per pattern
+static uint32_t match_with_find(std::string path) {
+	std::replace(path.begin(), path.end(), '\\', '/');
+	uint32_t categories = 0;
+	for (int i = 0; i < BLACKLIST_SIZE; i++) {
+		if (path.find(blacklist[i]) != std::string::npos) categories |= path_categories::blacklist;
+	}
+	for (int i = 0; i < WHITELIST_SIZE; i++) {
+		if (path.find(whitelist[i]) != std::string::npos) categories |= path_categories::whitelist;
+	}
+	for (int i = 0; i < TEXTURE_BLACKLIST_SIZE; i++) {
+		if (path.find(texture_blacklist[i]) != std::string::npos) categories |= path_categories::texture_blacklist;
+	}
+	return categories;
+}
+
+void benchmark_path_filters()
+{
+	constexpr size_t path_count = 1000000;
+	PatternMatcher matcher;
+	add_builtin_filter_rules(&matcher);
+	matcher.compile();
+
+	// Paths that look like those of the game, with a pattern in some of them
+	const char* directories[] = { "data/graphics/buildings/", "data/dlc03/graphics/buildings/", "data/dlc06/graphics/",
+		"data/graphics/props/", "data/cdlc05/graphics/", "data\\graphics\\buildings\\", "data/graphics/ui/" };
+	const char* names[] = { "residence_tier01", "production", "public", "special", "ornamental", "harbor", "farm_field" };
+	std::mt19937 random(1800);
+	std::vector<std::string> paths;
+	paths.reserve(path_count);
+	for (size_t i = 0; i < path_count; i++) {
+		std::string path = "C:/Program Files/Anno 1800/mods/some_mod/";
+		path += directories[random() % std::size(directories)];
+		path += names[random() % std::size(names)];
+		if (random() % 4 == 0) path += std::string("/") + blacklist[random() % BLACKLIST_SIZE];
+		if (random() % 16 == 0) path += std::string("/") + whitelist[random() % WHITELIST_SIZE];
+		if (random() % 8 == 0) path += std::string("/") + texture_blacklist[random() % TEXTURE_BLACKLIST_SIZE];
+		path += "/building_" + std::to_string(i) + ".cfg";
+		paths.push_back(std::move(path));
+	}
+
+	std::vector<uint32_t> results_find(path_count);
+	std::vector<uint32_t> results_matcher(path_count);
+
+	auto start = std::chrono::steady_clock::now();
+	for (size_t i = 0; i < path_count; i++) results_find[i] = match_with_find(paths[i]);
+	double seconds_find = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+	start = std::chrono::steady_clock::now();
+	for (size_t i = 0; i < path_count; i++) results_matcher[i] = matcher.match(paths[i]);
+	double seconds_matcher = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+	size_t mismatches = 0;
+	for (size_t i = 0; i < path_count; i++) {
+		if (results_find[i] != results_matcher[i]) mismatches++;
+	}
+	std::cout << "Classified " << path_count << " paths against " << matcher.pattern_count() << " patterns" << std::endl;
+	std::cout << "  std::string::find: " << seconds_find * 1e9 / path_count << " ns per path" << std::endl;
+	std::cout << "  Automaton:         " << seconds_matcher * 1e9 / path_count << " ns per path" << std::endl;
+	if (mismatches == 0) std::cout << "  Both classify all paths the same way" << std::endl;
+	else std::cout << "  ERROR: " << mismatches << " paths are classified differently" << std::endl;
+}
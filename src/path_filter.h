@@ -0,0 +1,53 @@
+#pragma once
+#include <string>
+#include <string_view>
+#include <vector>
+#include <cstdint>
+#include <filesystem>
+
+/*
+Matches a path against many substrings at once (Aho-Corasick automaton).
+
+All patterns are compiled into one table of state transitions, so a path is classified in a single pass
+over its characters, no matter how many patterns there are. Each pattern belongs to one or more categories
+(bit flags), match() returns the categories of all patterns found in the path.
+Backslashes in the path are treated as forward slashes.
+*/
+
+namespace path_categories {
+	constexpr uint32_t blacklist = 1;         // .cfg files not belonging to the Old World
+	constexpr uint32_t whitelist = 2;         // Exceptions from the blacklist
+	constexpr uint32_t texture_blacklist = 4; // Textures that are not snowed
+}
+
+class PatternMatcher
+{
+public:
+	void add_pattern(std::string_view pattern, uint32_t categories);
+	// Must be called after adding patterns and before match()
+	void compile();
+
+	uint32_t match(std::string_view path) const;
+	size_t pattern_count() const { return patterns.size(); }
+
+private:
+	struct Pattern {
+		std::string text;
+		uint32_t categories;
+	};
+	std::vector<Pattern> patterns;
+
+	// Characters that do not occur in any pattern share class 0
+	uint8_t character_classes[256] = {};
+	uint32_t class_count = 1;
+	std::vector<uint32_t> transitions; // [state * class_count + character class] -> next state
+	std::vector<uint32_t> state_categories; // Categories of all patterns ending in this state
+};
+
+// Adds the rules of a text file to a matcher. One rule per line: "blacklist <text>", "whitelist <text>" or
+// "texture_blacklist <text>". Empty lines and lines starting with # are ignored. Returns false if the file cannot be read.
+bool add_rules_from_file(PatternMatcher* matcher, std::filesystem::path rules_file);
+
+// Compares a matcher of the built-in lists with plain std::string::find loops on a million generated paths
+// (--benchmark_filters). Also checks that both classify every path the same way.
+void benchmark_path_filters();
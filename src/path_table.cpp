@@ -0,0 +1,44 @@
+#include "path_table.h"
+
+#include <deque>
+#include <mutex>
+#include <unordered_map>
+
+// A deque does not move its elements when it grows, so the string_view keys stay valid
+static std::deque<std::string> paths;
+static std::unordered_map<std::string_view, uint32_t> ids_by_path;
+static std::mutex path_table_mutex;
+
+std::string path_table::normalize(std::string_view path) {
+	std::string normalized;
+	normalized.reserve(path.size());
+	for (size_t i = 0; i < path.size(); i++) {
+		char c = path[i];
+		if (c == '\\') c = '/';
+		if (c == '/' && i > 1 && normalized.back() == '/') continue;
+		normalized += c;
+	}
+	return normalized;
+}
+
+uint32_t path_table::intern(std::string_view path) {
+	std::string normalized = normalize(path);
+	std::lock_guard<std::mutex> lock(path_table_mutex);
+	auto found = ids_by_path.find(normalized);
+	if (found != ids_by_path.end()) return found->second;
+
+	uint32_t id = uint32_t(paths.size());
+	paths.push_back(std::move(normalized));
+	ids_by_path.emplace(std::string_view(paths.back()), id);
+	return id;
+}
+
+const std::string& path_table::get(uint32_t id) {
+	std::lock_guard<std::mutex> lock(path_table_mutex);
+	return paths.at(id);
+}
+
+size_t path_table::size() {
+	std::lock_guard<std::mutex> lock(path_table_mutex);
+	return paths.size();
+}
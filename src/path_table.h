@@ -0,0 +1,44 @@
+#pragma once
+#include <string>
+#include <string_view>
+#include <cstdint>
+#include <vector>
+
+/*
+Interned paths: every texture and mesh path is normalized once and gets a 32-bit id.
+Resources are identified by these ids instead of comparing and hashing strings over and over.
+Ids are dense (0, 1, 2, ...), so they can be used as indices into plain arrays.
+*/
+
+namespace path_table {
+	constexpr uint32_t invalid_id = 0xFFFFFFFF;
+
+	// Forward slashes only, runs of slashes (such as "\\" in .cfg files) collapsed to one.
+	// A leading "//" (network path) is kept. Linear in the length of the path.
+	std::string normalize(std::string_view path);
+
+	// Returns the id of the normalized path, adding it if necessary. Thread-safe.
+	uint32_t intern(std::string_view path);
+	// The normalized path. The reference stays valid until the program ends.
+	const std::string& get(uint32_t id);
+	// Number of ids issued so far
+	size_t size();
+
+	// Where the entries of path ids are in a small array of the caller, e.g. the textures of a .cfg file: a table
+	// indexed by the id instead of a hash map. It takes 4 bytes per id, the entries themselves only take the slots in use.
+	// A slot must only be used if the entry there still has the id, so the table never has to be cleared when the
+	// array is emptied or reordered.
+	class SlotTable
+	{
+	public:
+		// The slot last set for the id, or invalid_id
+		uint32_t get(uint32_t id) const { return id < slots.size() ? slots[id] : invalid_id; }
+		void set(uint32_t id, uint32_t slot) {
+			if (id >= slots.size()) slots.resize(size_t(id) + 1, invalid_id);
+			slots[id] = slot;
+		}
+
+	private:
+		std::vector<uint32_t> slots;
+	};
+}
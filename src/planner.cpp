@@ -0,0 +1,246 @@
+#include "planner.h"
+
+#include <iostream>
+#include <iomanip>
+#include <sstream>
+#include <algorithm>
+#include <unordered_map>
+#include <chrono>
+
+#include "rdm2gl.h"
+#include "dds2gl.h"
+#include "snow_exception.h"
+
+namespace fs = std::filesystem;
+
+// Rough guesses of the time per texel/triangle, not calibrated: they follow the relative cost of the stages
+// (BC7 compression is by far the most expensive one). Only the ratios matter for the order; the absolute
+// numbers only affect the printed ETA, which can be off by a factor for other graphics cards.
+namespace cost_model {
+	constexpr double seconds_per_cfg = 0.02;                  // Parsing, preview, swapping buffers
+	constexpr double seconds_per_decoded_texel = 8e-9;        // BC7 decode + upload
+	constexpr double seconds_per_combined_texel = 2e-9;       // Combine pass + readback
+	constexpr double seconds_per_mipmap_texel = 4e-9;         // Generating mipmaps on the CPU
+	constexpr double seconds_per_compressed_texel = 5e-8;     // BC7 compression
+	constexpr double seconds_per_fast_compressed_texel = 5e-9; // BC1 to BC5 compression on the CPU
+	constexpr double seconds_per_triangle = 2e-8;             // Snowmap pass + preview pass
+}
+
+static uint64_t texels_of_mipmaps(uint64_t width, uint64_t height, size_t mipmap_count) {
+	uint64_t texels = 0;
+	for (size_t level = 0; level < mipmap_count; level++) {
+		texels += (width > 0 ? width : 1) * (height > 0 ? height : 1);
+		width /= 2;
+		height /= 2;
+	}
+	return texels;
+}
+
+static void plan_cfg(PlannedCfg& planned, CfgFile& cfg_file, const SnowOptions& cli_options)
+{
+	for (Texture& texture : cfg_file.textures) {
+		size_t width, height;
+		DXGI_FORMAT source_format;
+		if (!get_dds_dimensions(texture.abs_path.wstring(), &width, &height, &source_format)) continue;
+		planned.texels += uint64_t(width) * height;
+		planned.texture_paths.push_back(texture.abs_path.generic_string());
+
+		// The same conditions as when saving in main(): normal maps and vanilla textures are not written
+		if (texture.type == 1 || !texture.save_snowed_texture) continue;
+		uint64_t snowed_texels = texels_of_mipmaps(width, height, texture.mipmap_count);
+		planned.snowed_texels += snowed_texels;
+		planned.mipmap_count += texture.mipmap_count;
+		DXGI_FORMAT format = get_output_dds_format(source_format,
+			texture.type == 0 ? cli_options.diff_dds_format : cli_options.metal_dds_format);
+		if (format == DXGI_FORMAT_BC7_UNORM || format == DXGI_FORMAT_BC7_UNORM_SRGB) planned.bc7_texels += snowed_texels;
+	}
+	for (CfgModel& cfg_model : cfg_file.cfg_models) {
+		uint32_t corner_count, vertices_count;
+		if (HardwareRdm::read_counts(cfg_model.rdm_filename, &corner_count, &vertices_count)) {
+			planned.triangle_count += corner_count / 3;
+		}
+	}
+}
+
+static double estimate_seconds(const PlannedCfg& planned, const SnowOptions& cli_options) {
+	if (planned.has_error) return 0.;
+	double seconds = cost_model::seconds_per_cfg
+		+ planned.texels * cost_model::seconds_per_decoded_texel
+		+ planned.triangle_count * cost_model::seconds_per_triangle;
+	if (planned.snowed_texels == 0) return seconds; // Skipped after parsing
+	seconds += planned.snowed_texels * cost_model::seconds_per_combined_texel;
+	if (cli_options.save_dds) {
+		seconds += planned.snowed_texels * cost_model::seconds_per_mipmap_texel
+			+ planned.bc7_texels * cost_model::seconds_per_compressed_texel
+			+ (planned.snowed_texels - planned.bc7_texels) * cost_model::seconds_per_fast_compressed_texel;
+	}
+	return seconds;
+}
+
+std::vector<PlannedCfg> plan_work(const std::vector<CfgDescription>& descriptions,
+	std::vector<Texture>* default_textures, const SnowOptions& cli_options, bool keep_cfg_files)
+{
+	std::vector<PlannedCfg> plan(descriptions.size());
+
+	for (size_t i = 0; i < descriptions.size(); i++) {
+		plan[i].cfg_path = descriptions[i].cfg_path;
+		plan[i].description_index = i;
+		if (!descriptions[i].error.empty()) {
+			plan[i].has_error = true;
+			continue;
+		}
+		// The messages of resolving belong to the processing of the file, not to the plan
+		std::ostringstream resolve_log;
+		try {
+			auto cfg_file = std::make_unique<CfgFile>(descriptions[i], default_textures, cli_options, resolve_log);
+			plan_cfg(plan[i], *cfg_file, cli_options);
+			if (keep_cfg_files) {
+				plan[i].cfg_file = std::move(cfg_file);
+				plan[i].resolve_log = resolve_log.str();
+			}
+		}
+		catch (const snow_exception&) {
+			plan[i].has_error = true;
+		}
+		catch (const std::exception&) {
+			plan[i].has_error = true;
+		}
+	}
+
+	// Fan-out: how many .cfg files load the same texture
+	std::unordered_map<std::string, uint32_t> texture_users;
+	for (const PlannedCfg& planned : plan) {
+		for (const std::string& texture_path : planned.texture_paths) texture_users[texture_path]++;
+	}
+	for (PlannedCfg& planned : plan) {
+		for (const std::string& texture_path : planned.texture_paths) {
+			if (texture_users[texture_path] > planned.shared_fanout) planned.shared_fanout = texture_users[texture_path];
+		}
+		planned.estimated_seconds = estimate_seconds(planned, cli_options);
+	}
+	return plan;
+}
+
+void order_longest_first(std::vector<PlannedCfg>& plan)
+{
+	std::stable_sort(plan.begin(), plan.end(), [](const PlannedCfg& a, const PlannedCfg& b) {
+		if (a.has_error != b.has_error) return b.has_error;
+		return a.estimated_seconds > b.estimated_seconds;
+	});
+}
+
+void print_plan(const std::vector<PlannedCfg>& plan)
+{
+	double total_seconds = 0.;
+	uint64_t total_texels = 0;
+	size_t error_count = 0;
+
+	std::cout << std::endl << "   est. s   MTexels  mips  triangles  fan-out  cfg" << std::endl;
+	std::cout << std::fixed;
+	for (const PlannedCfg& planned : plan) {
+		if (planned.has_error) {
+			error_count++;
+			std::cout << "     ERROR                                       " << planned.cfg_path.string() << std::endl;
+			continue;
+		}
+		std::cout << std::setprecision(2) << std::setw(9) << planned.estimated_seconds
+			<< std::setw(10) << planned.texels / 1e6
+			<< std::setw(6) << planned.mipmap_count
+			<< std::setw(11) << planned.triangle_count
+			<< std::setw(9) << planned.shared_fanout
+			<< "  " << planned.cfg_path.string() << std::endl;
+		total_seconds += planned.estimated_seconds;
+		total_texels += planned.texels;
+	}
+	std::cout << std::defaultfloat << std::setprecision(6);
+
+	std::cout << std::endl << plan.size() << " files planned, " << error_count << " could not be parsed." << std::endl;
+	std::cout << total_texels / 1e6 << " MTexels to decode." << std::endl;
+	if (!plan.empty() && !plan.front().has_error) {
+		std::cout << "Longest file: " << plan.front().estimated_seconds << " s (" << plan.front().cfg_path.string() << ")" << std::endl;
+	}
+	std::cout << "ETA: " << int(total_seconds / 60) << " min " << int(total_seconds) % 60 << " s" << std::endl;
+}
+
+CfgFeed::CfgFeed(BlockingQueue<fs::path>* discovered_cfgs, ThreadPool* thread_pool, const CfgIndex* cfg_index,
+	const SnowOptions& cli_options)
+	: discovered(discovered_cfgs), pool(thread_pool), index(cfg_index), options(cli_options)
+{
+}
+
+std::vector<CfgDescription> CfgFeed::parse(const std::vector<fs::path>& cfg_paths)
+{
+	auto parse_start = std::chrono::steady_clock::now();
+	std::vector<CfgDescription> descriptions = read_cfg_descriptions(cfg_paths, *pool, index);
+	parse_seconds += std::chrono::duration<double>(std::chrono::steady_clock::now() - parse_start).count();
+
+	found_count += cfg_paths.size();
+	for (const CfgDescription& description : descriptions) {
+		if (description.is_from_index) indexed_count++;
+		auto [known, is_new] = parsed_index_by_path.try_emplace(description.cfg_path.generic_string(), parsed_descriptions.size());
+		if (is_new) parsed_descriptions.push_back(description);
+		else parsed_descriptions[known->second] = description;
+	}
+	return descriptions;
+}
+
+bool CfgFeed::next(CfgDescription* description)
+{
+	if (batch_position == batch.size()) {
+		std::vector<fs::path> cfg_paths;
+		if (!discovered->pop_all(&cfg_paths)) {
+			scan_done = true;
+			return false;
+		}
+		batch = parse(cfg_paths);
+		batch_plan.clear();
+		batch_position = 0;
+		batch_count++;
+
+		if (batch.size() > 1) {
+			if (!default_textures && planning_default_textures.empty()) planning_default_textures = load_default_textures(false);
+			batch_plan = plan_work(batch, default_textures ? default_textures : &planning_default_textures, options, default_textures != nullptr);
+			order_longest_first(batch_plan);
+			std::vector<CfgDescription> ordered_batch;
+			ordered_batch.reserve(batch_plan.size());
+			for (const PlannedCfg& planned : batch_plan) ordered_batch.push_back(std::move(batch[planned.description_index]));
+			batch = std::move(ordered_batch);
+		}
+	}
+	*description = std::move(batch[batch_position++]);
+	return true;
+}
+
+bool CfgFeed::wait_for_files(std::chrono::milliseconds timeout)
+{
+	return batch_position < batch.size() || discovered->wait_for(timeout);
+}
+
+std::unique_ptr<CfgFile> CfgFeed::take_resolved(std::string* resolve_log)
+{
+	if (batch_position == 0 || batch_position > batch_plan.size()) return nullptr;
+	PlannedCfg& planned = batch_plan[batch_position - 1];
+	*resolve_log = std::move(planned.resolve_log);
+	return std::move(planned.cfg_file);
+}
+
+std::vector<CfgDescription> CfgFeed::take_all()
+{
+	std::vector<fs::path> cfg_paths;
+	while (discovered->pop_all(&cfg_paths)) {}
+	scan_done = true;
+
+	std::vector<CfgDescription> descriptions;
+	for (; batch_position < batch.size(); batch_position++) descriptions.push_back(std::move(batch[batch_position]));
+	batch_plan.clear();
+	for (CfgDescription& description : parse(cfg_paths)) descriptions.push_back(std::move(description));
+	return descriptions;
+}
+
+void CfgFeed::print_parse_summary() const
+{
+	std::cout << "Parsed " << found_count << " .cfg files (" << indexed_count << " unchanged, taken from the index) in "
+		<< parse_seconds << " s on " << pool->size() << " threads ("
+		<< (parse_seconds > 0. ? found_count / parse_seconds : 0.) << " CFGs/s), "
+		<< batch_count << " batches while scanning" << std::endl;
+}
@@ -0,0 +1,112 @@
+#pragma once
+#include <string>
+#include <vector>
+#include <cstdint>
+#include <filesystem>
+#include <memory>
+#include <chrono>
+#include <unordered_map>
+
+#include "CfgFile.h"
+#include "snow_options.h"
+#include "cfg_parser.h"
+#include "cfg_index.h"
+#include "thread_pool.h"
+#include "blocking_queue.h"
+
+/*
+Cost model for the .cfg files to process (--plan).
+
+Planning parses the .cfg files and reads only the headers of the .dds and .rdm files, nothing is decoded.
+The estimates are used to process the most expensive files first (longest processing time first),
+so that a run does not end with a single big atlas that keeps one worker busy while the others idle.
+*/
+
+struct PlannedCfg {
+	std::filesystem::path cfg_path;
+	size_t description_index = 0; // Index into the descriptions passed to plan_work
+
+	uint64_t texels = 0;        // Texels of miplevel 0 of all textures that are loaded
+	uint64_t snowed_texels = 0; // Texels of all miplevels that are written
+	uint64_t bc7_texels = 0;    // The part of snowed_texels that is compressed to BC7, the rest is BC1 to BC5
+	size_t mipmap_count = 0;    // Miplevels that are written
+	uint64_t triangle_count = 0;
+	uint32_t shared_fanout = 1; // Highest number of .cfg files that share one of the textures of this .cfg
+
+	std::vector<std::string> texture_paths; // Only needed to count the fan-out
+	double estimated_seconds = 0.;
+	bool has_error = false;
+
+	// With keep_cfg_files: the file as resolved for planning, and what resolving it reported
+	std::unique_ptr<CfgFile> cfg_file;
+	std::string resolve_log;
+};
+
+// Resolves each .cfg file without printing anything. keep_cfg_files: the resolved files are kept in the plan, so that
+// they do not have to be resolved again when they are processed with the same options and default textures.
+std::vector<PlannedCfg> plan_work(const std::vector<CfgDescription>& descriptions,
+	std::vector<Texture>* default_textures, const SnowOptions& cli_options, bool keep_cfg_files = false);
+
+// Stable: files with the same estimate keep their order. Files that could not be planned go last.
+void order_longest_first(std::vector<PlannedCfg>& plan);
+
+void print_plan(const std::vector<PlannedCfg>& plan);
+
+/*
+Hands out the .cfg files found by the DirectoryWalker while it is still scanning.
+Whenever the current batch is used up, all files found since are parsed on the thread pool and ordered longest first.
+During a slow scan the batches are small and the first files are processed early; files that are found
+while a batch is processed are planned together with each other.
+*/
+class CfgFeed
+{
+public:
+	CfgFeed(BlockingQueue<std::filesystem::path>* discovered_cfgs, ThreadPool* thread_pool, const CfgIndex* cfg_index,
+		const SnowOptions& cli_options);
+
+	// The default textures the files are resolved with. Without them, planning uses its own ones and the files are
+	// resolved again when they are processed.
+	void set_default_textures(std::vector<Texture>* textures) { default_textures = textures; }
+	// Waits for the next .cfg file. Returns false when the scan is done and all files were handed out.
+	bool next(CfgDescription* description);
+	// Waits up to timeout. Returns true if next() would not have to wait.
+	bool wait_for_files(std::chrono::milliseconds timeout);
+	// The file last handed out by next(), as planning resolved it with the options and default textures of the feed,
+	// and what resolving it reported. nullptr if it was not planned (a batch of one file).
+	std::unique_ptr<CfgFile> take_resolved(std::string* resolve_log);
+	// Waits for the scan to finish and returns all remaining files, parsed but not ordered
+	std::vector<CfgDescription> take_all();
+
+	// True if next() has to wait for files that have not been parsed yet
+	bool is_batch_used_up() const { return batch_position == batch.size(); }
+	size_t get_found_count() const { return found_count; }
+	bool is_scan_done() const { return scan_done; }
+	// The descriptions handed out so far, the last one of each file, for CfgIndex::save
+	const std::vector<CfgDescription>& get_parsed_descriptions() const { return parsed_descriptions; }
+	// True if a file was not in the index or has changed since, then the index should be saved
+	bool has_parsed_changed_files() const { return indexed_count != found_count; }
+	void print_parse_summary() const;
+
+private:
+	std::vector<CfgDescription> parse(const std::vector<std::filesystem::path>& cfg_paths);
+
+	BlockingQueue<std::filesystem::path>* discovered;
+	ThreadPool* pool;
+	const CfgIndex* index;
+	const SnowOptions& options;
+
+	std::vector<CfgDescription> batch;
+	std::vector<PlannedCfg> batch_plan; // Empty or in the order of batch
+	size_t batch_position = 0;
+	std::vector<CfgDescription> parsed_descriptions;
+	// --watch and --serve parse the same files again: their descriptions are replaced
+	std::unordered_map<std::string, size_t> parsed_index_by_path;
+	std::vector<Texture>* default_textures = nullptr;
+	std::vector<Texture> planning_default_textures; // Without default_textures, loaded with the first batch that is planned
+
+	size_t found_count = 0;
+	size_t indexed_count = 0;
+	size_t batch_count = 0;
+	double parse_seconds = 0.;
+	bool scan_done = false;
+};
@@ -0,0 +1,108 @@
+#include "profiler.h"
+
+#include <vector>
+#include <mutex>
+#include <atomic>
+#include <fstream>
+#include <iostream>
+
+namespace fs = std::filesystem;
+
+struct TraceEvent {
+	const char* name;
+	int64_t start_us;
+	int64_t duration_us;
+	uint32_t thread_id;
+	std::string path;
+};
+
+static std::atomic<bool> profiling_enabled = false;
+static std::mutex trace_events_mutex;
+static std::vector<TraceEvent> trace_events;
+static const std::chrono::steady_clock::time_point trace_start = std::chrono::steady_clock::now();
+
+static uint32_t current_thread_number() {
+	// Small sequential numbers are easier to read in the trace viewer than the ids of the OS
+	static std::atomic<uint32_t> next_thread_number = 1;
+	thread_local uint32_t thread_number = next_thread_number++;
+	return thread_number;
+}
+
+static std::string escape_json(const std::string& original) {
+	std::string escaped;
+	escaped.reserve(original.size());
+	for (char c : original) {
+		if (c == '\\' || c == '"') escaped += '\\';
+		if (((unsigned char)c) < 0x20) continue;
+		escaped += c;
+	}
+	return escaped;
+}
+
+void profiler::enable() {
+	profiling_enabled = true;
+}
+
+bool profiler::is_enabled() {
+	return profiling_enabled;
+}
+
+void profiler::add_span(const char* stage_name,
+	std::chrono::steady_clock::time_point start, std::chrono::steady_clock::time_point end,
+	const std::string& path_argument)
+{
+	TraceEvent trace_event{
+		stage_name,
+		std::chrono::duration_cast<std::chrono::microseconds>(start - trace_start).count(),
+		std::chrono::duration_cast<std::chrono::microseconds>(end - start).count(),
+		current_thread_number(),
+		path_argument };
+
+	std::lock_guard<std::mutex> lock(trace_events_mutex);
+	trace_events.push_back(std::move(trace_event));
+}
+
+void profiler::write_trace_file(fs::path filename) {
+	if (!profiling_enabled) return;
+	std::lock_guard<std::mutex> lock(trace_events_mutex);
+
+	fs::create_directories(filename.parent_path());
+	std::ofstream trace_file(filename);
+	if (!trace_file) {
+		std::cout << "Could not write profile to " << filename.string() << std::endl;
+		return;
+	}
+	trace_file << "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n";
+	trace_file << "{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":1,\"tid\":0,\"args\":{\"name\":\"snowgenerator\"}}";
+	for (const TraceEvent& trace_event : trace_events) {
+		trace_file << ",\n{\"name\":\"" << trace_event.name
+			<< "\",\"cat\":\"snowgenerator\",\"ph\":\"X\",\"pid\":1,\"tid\":" << trace_event.thread_id
+			<< ",\"ts\":" << trace_event.start_us
+			<< ",\"dur\":" << trace_event.duration_us;
+		if (!trace_event.path.empty()) trace_file << ",\"args\":{\"path\":\"" << escape_json(trace_event.path) << "\"}";
+		trace_file << "}";
+	}
+	trace_file << "\n]}\n";
+	std::cout << "Wrote " << trace_events.size() << " profiling events to " << filename.string() << std::endl;
+}
+
+ProfileScope::ProfileScope(const char* stage_name, std::string path_argument)
+{
+	name = stage_name;
+	active = profiling_enabled;
+	if (active) {
+		path = std::move(path_argument);
+		start = std::chrono::steady_clock::now();
+	}
+}
+
+ProfileScope::~ProfileScope()
+{
+	end();
+}
+
+void ProfileScope::end()
+{
+	if (active) profiler::add_span(name, start, std::chrono::steady_clock::now(), path);
+	active = false;
+}
@@ -0,0 +1,62 @@
+#pragma once
+#include <string>
+#include <chrono>
+#include <filesystem>
+
+/*
+Timeline tracing of the processing stages (--profile).
+
+Every ProfileScope records one "complete" event (ph = "X") of the Chrome trace event format.
+The events are written to a .json file when the program ends. Open it in https://ui.perfetto.dev/
+or chrome://tracing to see where the time goes for each .cfg file.
+*/
+
+namespace profiler {
+	void enable();
+	bool is_enabled();
+
+	void add_span(const char* stage_name,
+		std::chrono::steady_clock::time_point start, std::chrono::steady_clock::time_point end,
+		const std::string& path_argument);
+
+	void write_trace_file(std::filesystem::path filename);
+}
+
+// Writes the trace file at the latest when it goes out of scope, so that every return of main() writes it, once
+class TraceFileScope
+{
+public:
+	explicit TraceFileScope(std::filesystem::path filename) : filename(filename) {}
+	~TraceFileScope() { write(); }
+
+	TraceFileScope(const TraceFileScope&) = delete;
+	TraceFileScope& operator=(const TraceFileScope&) = delete;
+
+	void write()
+	{
+		if (is_written) return;
+		is_written = true;
+		profiler::write_trace_file(filename);
+	}
+
+private:
+	std::filesystem::path filename;
+	bool is_written = false;
+};
+
+class ProfileScope
+{
+public:
+	// path_argument is the .cfg or texture file the stage is working on. It is shown as "path" in the trace viewer.
+	ProfileScope(const char* stage_name, std::string path_argument = "");
+	~ProfileScope();
+
+	// Close the span before the end of the C++ scope
+	void end();
+
+private:
+	const char* name;
+	std::string path;
+	bool active;
+	std::chrono::steady_clock::time_point start;
+};
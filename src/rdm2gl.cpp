@@ -1,5 +1,11 @@
 #include "rdm2gl.h"
 #include "snow_exception.h"
+#include "memory_accounting.h"
+#include "gl_stuff.h"
+
+#include <cstring>
+#include <cmath>
+#include <string_view>
 /*
 Everything in this file that is not GL-specific was copied from kskudkliks rdm-obj converter.
 */
@@ -20,84 +26,340 @@ HardwareRdm::HardwareRdm()
     GLuint indexbuffer = GLuint(0);
 }
 
+// Offsets in the file are checked before anything is read, a broken file must not crash the whole batch
+class RdmReader
+{
+public:
+    RdmReader(std::string_view file) : file(file) {}
+
+    bool contains(uint64_t offset, uint64_t byte_count) const {
+        return offset <= file.size() && byte_count <= file.size() - offset;
+    }
+
+    bool try_read_uint32(uint64_t offset, uint32_t* value) const {
+        if (!contains(offset, 4)) return false;
+        memcpy(value, file.data() + offset, 4); // Not necessarily aligned
+        return true;
+    }
+
+    uint32_t read_uint32(uint64_t offset, const char* field_name) const {
+        uint32_t value;
+        if (!try_read_uint32(offset, &value)) throw snow_exception((std::string("Broken RDM file (") + field_name + " behind file length)").c_str());
+        return value;
+    }
+
+    std::span<const char> get_span(uint64_t offset, uint64_t byte_count, const char* field_name) const {
+        if (!contains(offset, byte_count)) throw snow_exception((std::string("Broken RDM file (") + field_name + " behind file length)").c_str());
+        return std::span<const char>(file.data() + offset, size_t(byte_count));
+    }
+
+private:
+    std::string_view file;
+};
+
+struct RdmOffsets {
+    uint32_t to_vertices;
+    uint32_t to_triangles;
+    uint32_t to_materials;
+};
+
+static RdmOffsets read_offsets(const RdmReader& reader)
+{
+    // Each block is preceded by its element count and element size
+    const uint64_t offset_to_offsets = reader.read_uint32(32, "offset table");
+    RdmOffsets offsets;
+    offsets.to_vertices  = reader.read_uint32(offset_to_offsets + 12, "offset to vertices");
+    offsets.to_triangles = reader.read_uint32(offset_to_offsets + 16, "offset to triangles");
+    offsets.to_materials = reader.read_uint32(offset_to_offsets + 20, "offset to materials");
+    if (offsets.to_vertices < 8 || offsets.to_triangles < 8 || offsets.to_materials < 8)
+        throw snow_exception("Broken RDM file (Offset in front of the header)");
+    return offsets;
+}
+
+template <typename Corner>
+static uint32_t max_corner(std::span<const char> index_data)
+{
+    uint32_t max_value = 0;
+    for (size_t i = 0; i + sizeof(Corner) <= index_data.size(); i += sizeof(Corner)) {
+        Corner corner;
+        memcpy(&corner, index_data.data() + i, sizeof(Corner));
+        if (corner > max_value) max_value = corner;
+    }
+    return max_value;
+}
+
 int HardwareRdm::load_rdm(std::filesystem::path input_path)
 {
-    std::ifstream rdm_file(input_path, std::ifstream::binary);
-    if (rdm_file) {
-        // Read RDM file
+    std::shared_ptr<MappedFile> file = std::make_shared<MappedFile>(input_path);
+    if (!file->is_open()) {
+        std::cout << "Could not open " << input_path << std::endl;
+        throw snow_exception("Could not open RDM file");
+    }
+    if (file->size() < 32)
+        throw snow_exception("Broken RDM file (Smaller than 32 Bytes)");
+
+    RdmReader reader(file->view());
+    RdmOffsets offsets = read_offsets(reader);
+
+    if (reader.read_uint32(offsets.to_materials - 4, "material size") != 28)
+        throw snow_exception("Broken RDM file (Materialsize != 28)");
+    const uint32_t file_materials_count = reader.read_uint32(offsets.to_materials - 8, "material count");
+    reader.get_span(offsets.to_materials, uint64_t(file_materials_count) * 28, "materials");
+
+    const uint32_t file_vertices_count = reader.read_uint32(offsets.to_vertices - 8, "vertex count");
+    const uint32_t file_vertices_size = reader.read_uint32(offsets.to_vertices - 4, "vertex size");
+    const uint32_t file_corner_count = reader.read_uint32(offsets.to_triangles - 8, "corner count"); // Dividing this by 3 gives the amount of triangles
+    const uint32_t file_corner_size = reader.read_uint32(offsets.to_triangles - 4, "corner size");
+    if (file_vertices_size == 0)
+        throw snow_exception("Broken RDM file (Vertex size is 0)");
+    if (file_corner_size != 2 && file_corner_size != 4)
+        throw snow_exception("Broken RDM file (Corner size is neither 2 nor 4)");
 
-        // Fetch length
-        rdm_file.seekg(0, rdm_file.end);
-        const uint64_t length = rdm_file.tellg();
+    std::span<const char> file_vertex_data = reader.get_span(offsets.to_vertices, uint64_t(file_vertices_count) * file_vertices_size, "vertices");
+    std::span<const char> file_index_data = reader.get_span(offsets.to_triangles, uint64_t(file_corner_count) * file_corner_size, "triangles");
 
-        // Copy file to buffer
-        rdm_file.seekg(0, rdm_file.beg);
-        std::unique_ptr<char[]> file = std::make_unique<char[]>(length);
-        rdm_file.read(file.get(), length);
-        rdm_file.close();
+    std::vector<Material> file_materials;
+    file_materials.reserve(file_materials_count);
+    for (uint32_t i = 0; i < file_materials_count; i++) {
+        const uint64_t material_offset = offsets.to_materials + 28 * uint64_t(i);
+        Material material = Material{ reader.read_uint32(material_offset + 0, "material"),
+                                      reader.read_uint32(material_offset + 4, "material"),
+                                      reader.read_uint32(material_offset + 8, "material") };
+        if (uint64_t(material.offset) + material.size > file_corner_count)
+            throw snow_exception("Broken RDM file (Material uses more corners than there are)");
+        file_materials.push_back(material);
+    }
 
+    // The GPU would read behind the vertex buffer
+    uint32_t highest_corner = file_corner_size == 2 ? max_corner<uint16_t>(file_index_data) : max_corner<uint32_t>(file_index_data);
+    if (file_corner_count > 0 && highest_corner >= file_vertices_count)
+        throw snow_exception("Broken RDM file (Triangle refers to a vertex that does not exist)");
 
-        if (length < 32)
-            throw snow_exception("Broken RDM file (Smaller than 32 Bytes)");
+    // Everything is valid, nothing is changed before this point
+    cleanup();
+    vertices_count = file_vertices_count;
+    vertices_size = file_vertices_size;
+    corner_count = file_corner_count;
+    corner_size = file_corner_size;
+    materials = std::move(file_materials);
+    materials_count = file_materials_count;
+    cpu_vertices.assign(file_vertex_data.begin(), file_vertex_data.end());
+    cpu_indices.assign(file_index_data.begin(), file_index_data.end());
+    vertex_data = cpu_vertices;
+    index_data = cpu_indices;
 
-        // How to read information stored as an uint32_t from the buffer:
-        // Element at offset:            file[offset]
-        // Pointer to this element:      &file[offset]
-        // cast pointer to uint32_t:     (uint32_t*)&file[offset]
-        // Dereferentiate the pointer:   *(uint32_t*)&file[offset];
+    // Upload vertices to GL
+    glGenBuffers(1, &vertexbuffer);
+    glBindBuffer(GL_ARRAY_BUFFER, vertexbuffer);
+    glBufferData(GL_ARRAY_BUFFER, vertex_data.size(), vertex_data.data(), GL_STATIC_DRAW);
+
+    // Upload indices to GL
+    glGenBuffers(1, &indexbuffer);
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, indexbuffer);
+    glBufferData(GL_ELEMENT_ARRAY_BUFFER, index_data.size(), index_data.data(), GL_STATIC_DRAW);
 
-        const uintptr_t offset_to_offsets = *(uint32_t*)&file[32];
+    memory_accounting::add(memory_accounting::Category::gl_objects, get_buffer_bytes());
+    memory_accounting::add(memory_accounting::Category::mesh_data, get_host_bytes());
+    return 0;
+}
 
-        if (length - 16 < offset_to_offsets)
-            throw snow_exception("Broken RDM file (Offset behind file length)");
+bool HardwareRdm::read_counts(std::filesystem::path input_path, uint32_t* corner_count, uint32_t* vertices_count)
+{
+    // Only the pages of the header are read from the disk
+    MappedFile file(input_path);
+    if (!file.is_open()) return false;
+    RdmReader reader(file.view());
 
-        const uint32_t offset_to_vertices  = *(uint32_t*)&file[offset_to_offsets + 12];
-        const uint32_t offset_to_triangles = *(uint32_t*)&file[offset_to_offsets + 16];
-        const uint32_t offset_to_materials = *(uint32_t*)&file[offset_to_offsets + 20];
+    uint32_t offset_to_offsets, offset_to_vertices, offset_to_triangles;
+    if (!reader.try_read_uint32(32, &offset_to_offsets)) return false;
+    if (!reader.try_read_uint32(uint64_t(offset_to_offsets) + 12, &offset_to_vertices)) return false;
+    if (!reader.try_read_uint32(uint64_t(offset_to_offsets) + 16, &offset_to_triangles)) return false;
+    if (offset_to_vertices < 8 || offset_to_triangles < 8) return false;
 
-        if (*(uint32_t*)&file[offset_to_materials - 4] != 28)
-            throw snow_exception("Broken RDM file (Materialsize != 28)");
-        if (length - 8 <= offset_to_vertices || length - 4 <= offset_to_triangles)
-            throw snow_exception("Broken RDM file (length - 8 <= offset_to_vertices || length - 4 <= offset_to_triangles)");
+    return reader.try_read_uint32(offset_to_vertices - 8, vertices_count)
+        && reader.try_read_uint32(offset_to_triangles - 8, corner_count);
+}
 
-        materials_count = *(uint32_t*)&file[offset_to_materials - 8];
+// IEEE 754 half precision, as in the 'h' attributes of the vertex formats
+static float half_to_float(uint16_t half)
+{
+    const uint32_t sign = uint32_t(half >> 15) << 31;
+    const uint32_t exponent = (half >> 10) & 0x1F;
+    const uint32_t mantissa = half & 0x3FF;
+    float magnitude;
+    if (exponent == 0) magnitude = std::ldexp(float(mantissa), -24);                      // Subnormal
+    else if (exponent == 31) magnitude = mantissa == 0 ? INFINITY : NAN;
+    else magnitude = std::ldexp(float(mantissa | 0x400), int(exponent) - 25);
+    return sign ? -magnitude : magnitude;
+}
 
-        for (uint32_t i = 0; i < materials_count; i++) {
-            materials.push_back(Material{*(uint32_t*)&file[offset_to_materials + 0 + 28 * i],
-                                         *(uint32_t*)&file[offset_to_materials + 4 + 28 * i],
-                                         *(uint32_t*)&file[offset_to_materials + 8 + 28 * i] });
+// The y component as the snow vertex shader sees it: attribute * 2 - 1 ('b' attributes are normalized to [0, 1])
+static float read_normal_y(const char* vertex, uint32_t normal_offset, char datatype)
+{
+    switch (datatype) {
+    case 'f': {
+        float value;
+        memcpy(&value, vertex + normal_offset + 4, 4);
+        return value * 2.f - 1.f;
+    }
+    case 'h': {
+        uint16_t value;
+        memcpy(&value, vertex + normal_offset + 2, 2);
+        return half_to_float(value) * 2.f - 1.f;
+    }
+    default:
+        return uint8_t(vertex[normal_offset + 1]) / 255.f * 2.f - 1.f;
+    }
+}
+
+template <typename Corner>
+static void append_snow_triangles(std::span<const char> index_data, const Material& material,
+    const std::vector<uint8_t>& can_receive_snow, std::vector<char>* snow_index_data)
+{
+    for (uint64_t corner = material.offset; corner + 3 <= uint64_t(material.offset) + material.size; corner += 3) {
+        Corner triangle[3];
+        memcpy(triangle, index_data.data() + corner * sizeof(Corner), sizeof(triangle));
+        if (can_receive_snow[triangle[0]] || can_receive_snow[triangle[1]] || can_receive_snow[triangle[2]]) {
+            snow_index_data->insert(snow_index_data->end(), (const char*)triangle, (const char*)triangle + sizeof(triangle));
         }
+    }
+}
 
-        vertices_size = *(uint32_t*)&file[offset_to_vertices - 4];
-        vertices_count = *(uint32_t*)&file[offset_to_vertices - 8];
+void HardwareRdm::build_snow_indices(const std::vector<std::string>& vertex_formats, float min_normal_y)
+{
+    if (index_data.empty() && corner_count > 0) return; // Not loaded by load_rdm
+    if (snow_indexbuffer != 0 && vertex_formats == snow_vertex_formats && min_normal_y == snow_min_normal_y) return;
+    std::vector<char> snow_index_data;
+    snow_index_data.reserve(index_data.size());
+    snow_materials.clear();
 
-        corner_count = *(unsigned long*)&file[offset_to_triangles - 8]; // Dividing this by 3 gives the amount of triangles
-        corner_size = *(unsigned long*)&file[offset_to_triangles - 4];
+    // Vertices are usually shared by all materials with the same format, decode each format once
+    std::string decoded_format;
+    std::vector<uint8_t> can_receive_snow(vertices_count, 0);
+    for (size_t j = 0; j < materials.size(); j++) {
+        Material snow_material = Material{ uint32_t(snow_index_data.size() / corner_size), 0, materials[j].index };
 
-        // Upload vertices to GL
-        glGenBuffers(1, &vertexbuffer);
-        glBindBuffer(GL_ARRAY_BUFFER, vertexbuffer);
-        glBufferData(GL_ARRAY_BUFFER,
-            vertices_count * vertices_size,
-            &file[offset_to_vertices],
-            GL_STATIC_DRAW);
+        uint32_t normal_offset;
+        uint8_t normal_size;
+        char normal_datatype;
+        bool has_normal = j < vertex_formats.size()
+            && find_vertex_attribute(vertex_formats[j], 'N', &normal_offset, &normal_size, &normal_datatype)
+            && normal_size >= 2
+            && uint64_t(normal_offset) + uint64_t(normal_size) * (normal_datatype == 'f' ? 4 : normal_datatype == 'h' ? 2 : 1) <= vertices_size;
 
-        // Upload indices to GL
-        glGenBuffers(1, &indexbuffer);
-        glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, indexbuffer);
-        glBufferData(GL_ELEMENT_ARRAY_BUFFER,
-            corner_size * corner_count,
-            &file[offset_to_triangles],
-            GL_STATIC_DRAW);
+        if (!has_normal) {
+            // Unknown layout: keep the whole material
+            const char* material_begin = index_data.data() + uint64_t(materials[j].offset) * corner_size;
+            snow_index_data.insert(snow_index_data.end(), material_begin, material_begin + uint64_t(materials[j].size) * corner_size);
+        }
+        else {
+            if (decoded_format != vertex_formats[j]) {
+                for (uint32_t v = 0; v < vertices_count; v++) {
+                    // A little below the threshold: the shader interpolates in floats
+                    can_receive_snow[v] = read_normal_y(vertex_data.data() + uint64_t(v) * vertices_size, normal_offset, normal_datatype)
+                        >= min_normal_y - 0.001f;
+                }
+                decoded_format = vertex_formats[j];
+            }
+            if (corner_size == 2) append_snow_triangles<uint16_t>(index_data, materials[j], can_receive_snow, &snow_index_data);
+            else append_snow_triangles<uint32_t>(index_data, materials[j], can_receive_snow, &snow_index_data);
+        }
+        snow_material.size = uint32_t(snow_index_data.size() / corner_size) - snow_material.offset;
+        snow_materials.push_back(snow_material);
+    }
 
-        rdm_file.close();
+    if (snow_indexbuffer != 0) {
+        memory_accounting::remove(memory_accounting::Category::gl_objects, size_t(snow_corner_count) * corner_size);
+        glDeleteBuffers(1, &snow_indexbuffer);
+        snow_indexbuffer = 0;
+    }
+    snow_corner_count = uint32_t(snow_index_data.size() / corner_size);
+    if (snow_index_data.empty()) {
+        // GL does not accept empty buffers. Nothing is drawn anyway.
+        snow_index_data.resize(corner_size * 3, 0);
+    }
+    glGenBuffers(1, &snow_indexbuffer);
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, snow_indexbuffer);
+    glBufferData(GL_ELEMENT_ARRAY_BUFFER, snow_index_data.size(), snow_index_data.data(), GL_STATIC_DRAW);
+    memory_accounting::add(memory_accounting::Category::gl_objects, size_t(snow_corner_count) * corner_size);
+    snow_vertex_formats = vertex_formats;
+    snow_min_normal_y = min_normal_y;
+}
 
+// Texture coordinates as the snow vertex shader sees them ('b' attributes are normalized to [0, 1])
+static void read_texcoord(const char* vertex, uint32_t texcoord_offset, char datatype, float* u, float* v)
+{
+    switch (datatype) {
+    case 'f':
+        memcpy(u, vertex + texcoord_offset, 4);
+        memcpy(v, vertex + texcoord_offset + 4, 4);
+        break;
+    case 'h': {
+        uint16_t values[2];
+        memcpy(values, vertex + texcoord_offset, 4);
+        *u = half_to_float(values[0]);
+        *v = half_to_float(values[1]);
+        break;
     }
-    else {
-        std::cout << "Could not open " << input_path << std::endl;
-        throw snow_exception("Could not open RDM file");
+    default:
+        *u = uint8_t(vertex[texcoord_offset]) / 255.f;
+        *v = uint8_t(vertex[texcoord_offset + 1]) / 255.f;
     }
-    return 0;
+}
+
+template <typename Corner>
+static void mark_snow_triangles(std::span<const char> index_data, std::span<const char> vertex_data, uint32_t vertices_size,
+    const Material& material, const std::vector<uint8_t>& can_receive_snow, uint32_t texcoord_offset, char texcoord_datatype, TileMask* mask)
+{
+    for (uint64_t corner = material.offset; corner + 3 <= uint64_t(material.offset) + material.size; corner += 3) {
+        Corner triangle[3];
+        memcpy(triangle, index_data.data() + corner * sizeof(Corner), sizeof(triangle));
+        if (!can_receive_snow.empty() && !can_receive_snow[triangle[0]] && !can_receive_snow[triangle[1]] && !can_receive_snow[triangle[2]]) continue;
+        float u[3];
+        float v[3];
+        for (int i = 0; i < 3; i++) {
+            read_texcoord(vertex_data.data() + uint64_t(triangle[i]) * vertices_size, texcoord_offset, texcoord_datatype, &u[i], &v[i]);
+        }
+        mask->mark_triangle(u, v);
+    }
+}
+
+void HardwareRdm::mark_snow_footprint(size_t j, const std::string& vertex_format, float min_normal_y, TileMask* mask) const
+{
+    uint32_t texcoord_offset;
+    uint8_t texcoord_size;
+    char texcoord_datatype;
+    if (j >= materials.size() || (index_data.empty() && corner_count > 0)
+        || !find_vertex_attribute(vertex_format, 'T', &texcoord_offset, &texcoord_size, &texcoord_datatype)
+        || texcoord_size < 2
+        || uint64_t(texcoord_offset) + 2 * (texcoord_datatype == 'f' ? 4 : texcoord_datatype == 'h' ? 2 : 1) > vertices_size) {
+        mask->mark_all();
+        return;
+    }
+
+    uint32_t normal_offset;
+    uint8_t normal_size;
+    char normal_datatype;
+    bool has_normal = find_vertex_attribute(vertex_format, 'N', &normal_offset, &normal_size, &normal_datatype)
+        && normal_size >= 2
+        && uint64_t(normal_offset) + uint64_t(normal_size) * (normal_datatype == 'f' ? 4 : normal_datatype == 'h' ? 2 : 1) <= vertices_size;
+    // Empty: all triangles, like build_snow_indices for formats without a normal
+    std::vector<uint8_t> can_receive_snow;
+    if (has_normal) {
+        can_receive_snow.resize(vertices_count);
+        for (uint32_t v = 0; v < vertices_count; v++) {
+            can_receive_snow[v] = read_normal_y(vertex_data.data() + uint64_t(v) * vertices_size, normal_offset, normal_datatype)
+                >= min_normal_y - 0.001f;
+        }
+    }
+    if (corner_size == 2) mark_snow_triangles<uint16_t>(index_data, vertex_data, vertices_size, materials[j], can_receive_snow, texcoord_offset, texcoord_datatype, mask);
+    else mark_snow_triangles<uint32_t>(index_data, vertex_data, vertices_size, materials[j], can_receive_snow, texcoord_offset, texcoord_datatype, mask);
+}
+
+void HardwareRdm::bind_snow_buffers()
+{
+    glBindBuffer(GL_ARRAY_BUFFER, vertexbuffer);
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, snow_indexbuffer != 0 ? snow_indexbuffer : indexbuffer);
 }
 
 void HardwareRdm::bind_buffers()
@@ -108,8 +370,30 @@ void HardwareRdm::bind_buffers()
 
 void HardwareRdm::cleanup()
 {
+    vertex_data = std::span<const char>();
+    index_data = std::span<const char>();
+    memory_accounting::remove(memory_accounting::Category::mesh_data, get_host_bytes());
+    cpu_vertices = std::vector<char>();
+    cpu_indices = std::vector<char>();
+    if (snow_indexbuffer != 0) {
+        memory_accounting::remove(memory_accounting::Category::gl_objects, size_t(snow_corner_count) * corner_size);
+        glDeleteBuffers(1, &snow_indexbuffer);
+        snow_indexbuffer = 0;
+    }
+    snow_materials.clear();
+    snow_corner_count = 0;
+    snow_vertex_formats.clear();
+    if (vertexbuffer == 0 && indexbuffer == 0) return;
+    memory_accounting::remove(memory_accounting::Category::gl_objects, get_buffer_bytes());
     glDeleteBuffers(1, &vertexbuffer);
     glDeleteBuffers(1, &indexbuffer);
+    vertexbuffer = 0;
+    indexbuffer = 0;
+}
+
+size_t HardwareRdm::get_buffer_bytes()
+{
+    return size_t(vertices_count) * vertices_size + size_t(corner_count) * corner_size;
 }
 
 void HardwareRdm::print_information()
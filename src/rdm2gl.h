@@ -4,6 +4,11 @@
 #include <iostream>
 #include <filesystem>
 #include <fstream>
+#include <vector>
+#include <span>
+#include <memory>
+#include "mapped_file.h"
+#include "tile_mask.h"
 #include "../external/glew-2.2.0/include/GL/glew.h"
 #include "../external/glfw-3.3.6/include/GLFW/glfw3.h"
 
@@ -19,12 +24,32 @@ public:
     HardwareRdm();
 	
     ~HardwareRdm();
+    // Maps the file, checks all offsets and counts against its size and uploads the buffers straight from the mapping.
+    // Throws a snow_exception for files that are broken.
     int load_rdm(std::filesystem::path input_path);
+    // Reads only the counts from the header, without uploading anything. Returns false for broken files.
+    static bool read_counts(std::filesystem::path input_path, uint32_t* corner_count, uint32_t* vertices_count);
     void bind_buffers();
     void cleanup();
 
+    // Snowmap pass: a fragment with a geometry normal_y below min_normal_y gets depth 0, which never passes the
+    // depth test of flat_overwrites_steep. Triangles whose three vertex normals are all below it are left out of a
+    // second index buffer. vertex_formats has the vertex format of each material. Keeps all triangles of a material
+    // whose format has no normal. Does nothing if the buffer was built with the same arguments before (cached meshes).
+    void build_snow_indices(const std::vector<std::string>& vertex_formats, float min_normal_y);
+    // Binds the index buffer of build_snow_indices, if there is one
+    void bind_snow_buffers();
+    // Range of material j in the buffer bound by bind_snow_buffers
+    const Material& get_snow_range(size_t j) const { return snow_indexbuffer != 0 ? snow_materials[j] : materials[j]; }
+    // Marks the texture coordinates of the triangles of material j that build_snow_indices keeps, with the same
+    // criterion. Marks everything if the vertex format has no usable texture coordinates.
+    void mark_snow_footprint(size_t j, const std::string& vertex_format, float min_normal_y, TileMask* mask) const;
+
     void print_information();
     GLenum get_corner_datatype();
+    size_t get_buffer_bytes();
+    // The copies of vertex_data and index_data
+    size_t get_host_bytes() const { return cpu_vertices.size() + cpu_indices.size(); }
 
     uint32_t vertices_size = 0; // byte size
     uint32_t vertices_count = 0;
@@ -37,5 +62,21 @@ public:
 
     GLuint vertexbuffer = GLuint(0);
     GLuint indexbuffer = GLuint(0);
+
+    GLuint snow_indexbuffer = GLuint(0);
+    std::vector<Material> snow_materials;
+    uint32_t snow_corner_count = 0;
+    std::vector<std::string> snow_vertex_formats; // Arguments snow_indexbuffer was built with
+    float snow_min_normal_y = 0.f;
+
+    // Copies of the buffers (vertices_count * vertices_size and corner_count * corner_size bytes), for work on the
+    // CPU. Valid until cleanup(). The file is not kept mapped: on Windows, that would stop other programs from
+    // replacing it while the mesh is cached (--watch).
+    std::span<const char> vertex_data;
+    std::span<const char> index_data;
+
+private:
+    std::vector<char> cpu_vertices;
+    std::vector<char> cpu_indices;
 };
 
@@ -0,0 +1,107 @@
+#include "readback_ring.h"
+
+#include <iostream>
+
+#include "memory_accounting.h"
+#include "profiler.h"
+
+ReadbackRing::ReadbackRing(size_t buffer_count)
+	: slots(buffer_count > 0 ? buffer_count : 1)
+{
+}
+
+ReadbackRing::~ReadbackRing()
+{
+	cleanup();
+}
+
+void ReadbackRing::start(GLuint texture_id, std::string path_argument, Handler on_ready)
+{
+	Slot& slot = slots[next_slot];
+	if (slot.fence != nullptr) complete(slot);
+	next_slot = (next_slot + 1) % slots.size();
+
+	glBindTexture(GL_TEXTURE_2D, texture_id);
+	glGetTexLevelParameteriv(GL_TEXTURE_2D, 0, GL_TEXTURE_WIDTH, &slot.width);
+	glGetTexLevelParameteriv(GL_TEXTURE_2D, 0, GL_TEXTURE_HEIGHT, &slot.height);
+	size_t bytes = size_t(slot.width) * slot.height * 4;
+
+	if (slot.pixel_buffer == 0) glGenBuffers(1, &slot.pixel_buffer);
+	glBindBuffer(GL_PIXEL_PACK_BUFFER, slot.pixel_buffer);
+	if (slot.capacity < bytes) {
+		memory_accounting::remove(memory_accounting::Category::gl_objects, slot.capacity);
+		glBufferData(GL_PIXEL_PACK_BUFFER, bytes, nullptr, GL_STREAM_READ);
+		slot.capacity = bytes;
+		memory_accounting::add(memory_accounting::Category::gl_objects, slot.capacity);
+	}
+
+	glPixelStorei(GL_PACK_ALIGNMENT, 1);
+	glGetTexImage(GL_TEXTURE_2D, 0, GL_RGBA, GL_UNSIGNED_BYTE, (void*)0); // Into the buffer, returns immediately
+	glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+
+	slot.fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+	glFlush(); // Otherwise the fence may never reach the GPU while poll() is waiting for it
+	slot.path_argument = std::move(path_argument);
+	slot.on_ready = std::move(on_ready);
+}
+
+void ReadbackRing::complete(Slot& slot)
+{
+	ProfileScope scope("readback", std::move(slot.path_argument));
+	while (true) {
+		GLenum result = glClientWaitSync(slot.fence, GL_SYNC_FLUSH_COMMANDS_BIT, 1000000000); // 1 s in ns
+		if (result == GL_ALREADY_SIGNALED || result == GL_CONDITION_SATISFIED) break;
+		if (result == GL_WAIT_FAILED) {
+			std::cout << "GL ERROR while waiting for a texture readback" << std::endl;
+			break;
+		}
+	}
+	glDeleteSync(slot.fence);
+	slot.fence = nullptr;
+
+	size_t bytes = size_t(slot.width) * slot.height * 4;
+	glBindBuffer(GL_PIXEL_PACK_BUFFER, slot.pixel_buffer);
+	const uint8_t* pixels = (const uint8_t*)glMapBufferRange(GL_PIXEL_PACK_BUFFER, 0, bytes, GL_MAP_READ_BIT);
+	Handler on_ready = std::move(slot.on_ready);
+	slot.on_ready = nullptr;
+	if (pixels == nullptr) {
+		std::cout << "GL ERROR while mapping a texture readback" << std::endl;
+	}
+	else {
+		on_ready(pixels, slot.width, slot.height);
+		glUnmapBuffer(GL_PIXEL_PACK_BUFFER);
+	}
+	glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+}
+
+void ReadbackRing::poll()
+{
+	// Oldest first
+	for (size_t i = 0; i < slots.size(); i++) {
+		Slot& slot = slots[(next_slot + i) % slots.size()];
+		if (slot.fence == nullptr) continue;
+		GLenum result = glClientWaitSync(slot.fence, 0, 0);
+		if (result != GL_ALREADY_SIGNALED && result != GL_CONDITION_SATISFIED) return;
+		complete(slot);
+	}
+}
+
+void ReadbackRing::finish()
+{
+	for (size_t i = 0; i < slots.size(); i++) {
+		Slot& slot = slots[(next_slot + i) % slots.size()];
+		if (slot.fence != nullptr) complete(slot);
+	}
+}
+
+void ReadbackRing::cleanup()
+{
+	finish();
+	for (Slot& slot : slots) {
+		if (slot.pixel_buffer == 0) continue;
+		glDeleteBuffers(1, &slot.pixel_buffer);
+		slot.pixel_buffer = 0;
+		memory_accounting::remove(memory_accounting::Category::gl_objects, slot.capacity);
+		slot.capacity = 0;
+	}
+}
@@ -0,0 +1,53 @@
+#pragma once
+#include <cstdint>
+#include <cstddef>
+#include <vector>
+#include <string>
+#include <functional>
+#include "../external/glew-2.2.0/include/GL/glew.h"
+
+/*
+Reads textures back from the GPU without waiting for it.
+
+start() only queues a copy of the texture into a pixel buffer object and a fence behind it. The pixels are handed
+to the handler once the fence has signaled (poll(), finish(), or when the buffer is needed for a new readback),
+so the GPU keeps working on the next material while the CPU encodes the previous one.
+Only needs OpenGL 3.2 (sync objects), so it also runs on software renderers like Mesa llvmpipe.
+*/
+
+class ReadbackRing
+{
+public:
+	// Pixels are RGBA8, rows bottom to top as in GL. Only valid during the call.
+	using Handler = std::function<void(const uint8_t* pixels, int width, int height)>;
+
+	ReadbackRing(size_t buffer_count = 4);
+	~ReadbackRing();
+
+	ReadbackRing(const ReadbackRing&) = delete;
+	ReadbackRing& operator=(const ReadbackRing&) = delete;
+
+	// Queues the readback of miplevel 0. If all buffers are in use, the oldest readback is completed first.
+	// The texture may be deleted right after this call. path_argument names the readback in the --profile trace.
+	void start(GLuint texture_id, std::string path_argument, Handler on_ready);
+	// Completes the readbacks that are done, without waiting
+	void poll();
+	// Completes all readbacks
+	void finish();
+	void cleanup();
+
+private:
+	struct Slot {
+		GLuint pixel_buffer = 0;
+		size_t capacity = 0;
+		GLsync fence = nullptr;
+		int width = 0;
+		int height = 0;
+		std::string path_argument;
+		Handler on_ready;
+	};
+	void complete(Slot& slot);
+
+	std::vector<Slot> slots;
+	size_t next_slot = 0; // Used round-robin, so the next slot is also the oldest one in use
+};
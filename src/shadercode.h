@@ -42,6 +42,15 @@ layout(location = 2) in vec3 vertex_g;
 layout(location = 3) in vec3 vertex_b;
 layout(location = 4) in vec2 vertex_t;
 
+// Compiled with the #defines of tile_variant_defines()
+#if TILED
+// In texels: the whole texture, the texel of it at (0, 0) of the tile, and the GL textures the tile is drawn to and
+// its sources are decoded into
+uniform vec2 texture_size;
+uniform vec2 tile_origin;
+uniform vec2 tile_texture_size;
+#endif
+
 // Output data ; will be interpolated for each fragment.
 out vec2 out_t;
 // Multiply a normal from the normalmap by this matrix
@@ -50,7 +59,11 @@ out mat3 ngb_matrix; // normal-tangent-bitangent
 
 void main() {
 	// Output position is texture coordinate
+#if TILED
+    gl_Position = vec4((fract(vertex_t) * texture_size - tile_origin) / tile_texture_size * 2.0 - vec2(1.0, 1.0), 0.5, 1.);
+#else
     gl_Position = vec4(fract(vertex_t)*2.0 - vec2(1.0, 1.0), 0.5, 1.);
+#endif
 	
     ngb_matrix = mat3(vertex_n * 2.0 - vec3(1., 1., 1.),
                       vertex_g * 2.0 - vec3(1., 1., 1.),
@@ -69,23 +82,36 @@ uniform sampler2D diff_texture;
 uniform sampler2D norm_texture;
 uniform sampler2D metallic_texture;
 
+// Compiled with the #defines of snow_parameter_defines() and tile_variant_defines()
+#if TILED
+uniform vec2 texture_size;
+uniform vec2 tile_origin;
+uniform vec2 tile_texture_size;
+#endif
+
 void main() {
+#if TILED
+    // The sources hold the same tile as the snowmap
+    vec2 source_t = (fract(out_t) * texture_size - tile_origin) / tile_texture_size;
+#else
+    vec2 source_t = out_t;
+#endif
     float geometry_normal_y_component = ngb_matrix[0][1];
-    if (geometry_normal_y_component < 0.3) {
+    if (geometry_normal_y_component < MIN_NORMAL_Y) {
         // Do not generate snow where the geometry is steep
         // On the upper edge of bricks, the normal map would make the fragments appear inclined horizontally.
         gl_FragDepth = 0.; //color = vec3(0., 0, 0.5);
         return;
     }
     
-    vec3 normalmap_color = texture2D(norm_texture, out_t).rgb;
+    vec3 normalmap_color = texture2D(norm_texture, source_t).rgb;
     vec3 normalmap_vector = vec3(0.0, normalmap_color.x*(-2.0) + 1.0, normalmap_color.y*(-2.0) + 1.0);
     // Calculate the blue component (missing in norm_texture)
     normalmap_vector.x = 1 - normalmap_vector.y * normalmap_vector.y - normalmap_vector.z * normalmap_vector.z;
     vec3 norm_vector = ngb_matrix * normalmap_vector;
 
-    float normal_y = clamp(norm_vector.y, 0., 0.95);
-    if (texture2D(diff_texture, out_t).a < 0.1) {
+    float normal_y = clamp(norm_vector.y, 0., MAX_SNOWMAP_NORMAL_Y);
+    if (texture2D(diff_texture, source_t).a < 0.1) {
         // No snow on transparent parts
         normal_y = 0.;
     }
@@ -108,6 +134,9 @@ const std::string combine_to_snowed_textures_fragmentshader_code = R"<shadercode
 #version 330 core
 in vec2 out_t;
 
+// Compiled with the #defines of snow_parameter_defines(), combine_variant_defines() and tile_variant_defines(),
+// in one variant with and one without metallic output
+
 // Input textures
 uniform sampler2D snowmap;
 uniform sampler2D noise;
@@ -117,17 +146,55 @@ uniform sampler2D metallic_texture;
 
 // Output targets
 layout(location = 0) out vec4 diff_output;
+#if HAS_METALLIC_OUTPUT
 layout(location = 2) out vec4 metallic_output;
+#endif
+
+#if TILED
+// In texels: the whole texture, the texel of it at (0, 0) of the snowmap and the sources, which reach around the
+// tile, and the one at (0, 0) of the outputs
+uniform vec2 texture_size;
+uniform ivec2 tile_origin;
+uniform ivec2 output_origin;
+#endif
 
 void main() {
+#if TILED
+    ivec2 texel = output_origin + ivec2(gl_FragCoord.xy);
+    ivec2 tex_coord = texel - tile_origin;
+    vec2 noise_t = (vec2(texel) + 0.5) / texture_size;
+    vec2 metallic_t = (vec2(tex_coord) + 0.5) / vec2(textureSize(metallic_texture, 0));
+    vec2 snowmap_t = (vec2(tex_coord) + 0.5) / vec2(textureSize(snowmap, 0));
+#else
     ivec2 tex_coord = ivec2(floor(out_t * vec2(textureSize(diff_texture, 0))));
-    vec4 diff_color     = texelFetch(diff_texture, tex_coord + ivec2(1., 0.), 0);
-    vec4 metallic_color = texture2D(metallic_texture, out_t);
-
-    float noise_value = texture2D(noise, out_t*4.).r;
+    vec2 noise_t = out_t;
+    vec2 metallic_t = out_t;
+    vec2 snowmap_t = out_t;
+#endif
+    vec4 diff_color     = texelFetch(diff_texture, tex_coord, 0);
+#if HAS_METALLIC_OUTPUT
+    vec4 metallic_color = texture2D(metallic_texture, metallic_t);
+#endif
+
+#if HAS_NOISE
+    float noise_value = texture2D(noise, noise_t*NOISE_SCALE).r;
+#else
+    float noise_value = 0.5;
+#endif
 
     float normal_y = 0.;
-    if (texture2D(snowmap, out_t).r < 0.98) { // snowmap is 1 at the parts not used by the mesh
+#if FLAT_OVERWRITES_STEEP
+    // The snowmap is cleared to 0 and never reaches 0.98: no texel is marked as unused
+    for (int x_off=-1; x_off<2; x_off++) {
+        for (int y_off=-1; y_off<2; y_off++) {
+            float new_color = texelFetch(snowmap, tex_coord + ivec2(x_off, y_off), 0).r;
+            if (new_color > normal_y) {
+                normal_y = (normal_y + new_color) / 2.;
+            }
+        }
+    }
+#else
+    if (texture2D(snowmap, snowmap_t).r < 0.98) { // snowmap is 1 at the parts not used by the mesh
         for (int x_off=-1; x_off<2; x_off++) {
             for (int y_off=-1; y_off<2; y_off++) {
                 float new_color = texelFetch(snowmap, tex_coord + ivec2(x_off, y_off), 0).r;
@@ -137,31 +204,40 @@ void main() {
             }
         }
     }
+#endif
 
     // Calculate the likeliness of snow on this fragment, depending only on its inclination
     // With regards to the y-component of norm_vector:
-    // Below 0.4  -> No snow
-    // 0.4 to 0.8 -> Interpolate linearly
-    // 0.8 to 1.0 -> Always snow
+    // Up to MIN_NORMAL_Y                         -> No snow
+    // MIN_NORMAL_Y to FULL_SNOW_NORMAL_Y         -> Snow color mixed in, increasing linearly from PARTIAL_SNOW_NORMAL_Y
+    //                                               on (shifted by the noise)
+    // Above FULL_SNOW_NORMAL_Y                   -> Always snow
 
     // Make sure snow is not the same everywhere
-    if (normal_y > 0.8) {
+    if (normal_y > FULL_SNOW_NORMAL_Y) {
         // Snow covers original texture entirely
         float snow_offset = (noise_value - 0.5) * 0.0625;
-        diff_color = clamp(vec4(0.755 + snow_offset, 0.791 + snow_offset, 0.806 + snow_offset, 1.), 0., 1.);
+        diff_color = clamp(vec4(SNOW_COLOR + vec3(snow_offset), 1.), 0., 1.);
+#if HAS_METALLIC_OUTPUT
         metallic_color.rgb = vec3(0., 0., 0.);
+#endif
     }
-    else if (normal_y > 0.3) {
+    else if (normal_y > MIN_NORMAL_Y) {
         // The final color is mixed from a (global constant) snow color
         // and some remainders of the original texture
-        float snow_color_part = clamp((normal_y-0.4)*5. - noise_value*1., 0., 1.);
+        // Without noise, noise_value is its mean 0.5
+        float snow_color_part = clamp((normal_y-PARTIAL_SNOW_NORMAL_Y)*5. - noise_value, 0., 1.);
         float orig_color_part = 1. - snow_color_part;
-        diff_color = vec4(0.755, 0.791, 0.806, 1.) * snow_color_part + diff_color * orig_color_part;
+        diff_color = vec4(SNOW_COLOR, 1.) * snow_color_part + diff_color * orig_color_part;
+#if HAS_METALLIC_OUTPUT
         metallic_color.rgb = metallic_color.rgb * orig_color_part;
+#endif
     }
     
     diff_output     = diff_color;
+#if HAS_METALLIC_OUTPUT
     metallic_output = metallic_color; 
+#endif
 })<shadercode>";
 
 
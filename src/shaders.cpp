@@ -3,6 +3,7 @@
 #include "../external/glfw-3.3.6/include/GLFW/glfw3.h"
 #include <vector>
 #include <iostream>
+#include <sstream>
 
 
 GLuint compile_shader(const std::string shader_code, GLenum type)
@@ -83,4 +84,44 @@ GLuint compile_compute_shader_to_program(const std::string computeshader_code)
     glDeleteShader(compute_shader);
 
     return shader_program;
-}
\ No newline at end of file
+}
+
+std::string specialize_shader_code(const std::string& shader_code, const std::string& defines)
+{
+    // The #version directive must come first
+    size_t version_start = shader_code.find("#version");
+    if (version_start == std::string::npos) return defines + shader_code;
+    size_t version_end = shader_code.find('\n', version_start);
+    if (version_end == std::string::npos) return shader_code + "\n" + defines;
+    return std::string(shader_code).insert(version_end + 1, defines);
+}
+
+std::string snow_parameter_defines(const SnowParameters& snow_parameters)
+{
+    std::ostringstream defines;
+    defines.imbue(std::locale::classic());
+    // Always with a decimal point, GLSL 3.30 does not convert int to float everywhere
+    defines << std::showpoint;
+    defines << "#define MIN_NORMAL_Y " << snow_parameters.min_normal_y << "\n";
+    defines << "#define PARTIAL_SNOW_NORMAL_Y " << snow_parameters.partial_snow_normal_y << "\n";
+    defines << "#define FULL_SNOW_NORMAL_Y " << snow_parameters.full_snow_normal_y << "\n";
+    defines << "#define MAX_SNOWMAP_NORMAL_Y " << max_snowmap_normal_y << "\n";
+    defines << "#define SNOW_COLOR vec3(" << snow_parameters.snow_color[0] << ", " << snow_parameters.snow_color[1] << ", "
+        << snow_parameters.snow_color[2] << ")\n";
+    defines << "#define NOISE_SCALE " << snow_parameters.noise_scale << "\n";
+    return defines.str();
+}
+
+std::string combine_variant_defines(const SnowOptions& cli_options, bool has_metallic_output)
+{
+    std::string defines;
+    defines += std::string("#define FLAT_OVERWRITES_STEEP ") + (cli_options.flat_overwrites_steep ? "1" : "0") + "\n";
+    defines += std::string("#define HAS_NOISE ") + (cli_options.snow_parameters.noise_scale > 0.f ? "1" : "0") + "\n";
+    defines += std::string("#define HAS_METALLIC_OUTPUT ") + (has_metallic_output ? "1" : "0") + "\n";
+    return defines;
+}
+
+std::string tile_variant_defines(bool is_tiled)
+{
+    return std::string("#define TILED ") + (is_tiled ? "1" : "0") + "\n";
+}
@@ -3,7 +3,18 @@
 #include "../external/glfw-3.3.6/include/GLFW/glfw3.h"
 #include <string>
 #include "shadercode.h"
+#include "snow_options.h"
 
 GLuint compile_shaders_to_program(const std::string vertexshader_code, const std::string fragmentshader_code);
 GLuint compile_compute_shader_to_program(const std::string computeshader_code);
 GLuint compile_shader(std::string shader_code, GLenum type);
+
+// Inserts #define lines after the #version line of the shader code
+std::string specialize_shader_code(const std::string& shader_code, const std::string& defines);
+// MIN_NORMAL_Y, PARTIAL_SNOW_NORMAL_Y, FULL_SNOW_NORMAL_Y, SNOW_COLOR and NOISE_SCALE
+std::string snow_parameter_defines(const SnowParameters& snow_parameters);
+// FLAT_OVERWRITES_STEEP, HAS_NOISE and HAS_METALLIC_OUTPUT for combine_to_snowed_textures_fragmentshader_code.
+// Each variant only contains the branches it needs, instead of deciding per fragment.
+std::string combine_variant_defines(const SnowOptions& cli_options, bool has_metallic_output);
+// TILED for the snow and the combine shaders: the variant for textures processed in tiles (see Texture::is_tiled)
+std::string tile_variant_defines(bool is_tiled);
@@ -0,0 +1,56 @@
+#pragma once
+
+#include <filesystem>
+#include <string>
+
+// Format of the saved .dds files
+enum class DdsFormat {
+    source, // The format of the original texture
+    bc1,
+    bc3,
+    bc4,
+    bc7
+};
+
+enum class PreviewMode {
+    off,       // The window is hidden, nothing is rendered unless --save_renderings
+    throttled, // The window shows the current .cfg file at most a few times per second
+    every      // Every .cfg file is shown
+};
+
+// The snowmap stores normal_y clamped to this, values of 0.98 and more mark the texels no mesh covers.
+// full_snow_normal_y must be below it, or no texel would ever be covered entirely.
+constexpr float max_snowmap_normal_y = 0.95f;
+
+// The rules for where snow lies and how it looks, compiled into the shaders (see snow_parameter_defines)
+struct SnowParameters {
+    float min_normal_y = 0.3f;          // Fragments whose normal has a smaller y component get no snow
+    float partial_snow_normal_y = 0.4f; // From here on, the snow color is mixed into the original
+    float full_snow_normal_y = 0.8f;    // From here on, snow covers the original entirely. Below max_snowmap_normal_y.
+    float snow_color[3] = { 0.755f, 0.791f, 0.806f };
+    float noise_scale = 4.f;            // Repetitions of the noise texture across a texture. 0 = no noise
+};
+
+// What is generated and how: everything the library (snowgen.h) needs. CliOptions fills it from the command line,
+// programs using the library set the fields themselves.
+struct SnowOptions
+{
+    std::filesystem::path out_path; // The snowed textures are saved below it, with the paths they have below the data directory
+
+    bool has_extracted_maindata_path = false; // Was a fallback path with the extracted maindata passed as command line argument?
+    std::filesystem::path extracted_maindata_path;
+
+    bool disable_texture_blacklist = false;
+    bool atlas_mode = false;
+    bool save_non_mod_textures = false;
+
+    bool flat_overwrites_steep = true;
+    SnowParameters snow_parameters;
+
+    bool save_png = false;
+    bool save_dds = true;
+    DdsFormat diff_dds_format = DdsFormat::source;
+    DdsFormat metal_dds_format = DdsFormat::source;
+    bool full_decode = false; // Decode whole textures, not only the tiles the snow can reach (see TileMask)
+    bool save_renderings = false;
+};
@@ -0,0 +1,861 @@
+#include "snowgen.h"
+
+#include <algorithm>
+#include <array>
+#include <iostream>
+#include <memory>
+#include <unordered_map>
+
+#include "shaders.h"
+#include "snow_exception.h"
+#include "filelist.h"
+#include "path_table.h"
+#include "mesh_cache.h"
+#include "profiler.h"
+#include "memory_accounting.h"
+
+namespace fs = std::filesystem;
+
+// Tiles are band_rows high (see dds2gl.h), a row of them is a band of the encoder
+constexpr size_t tile_columns = 2048;
+// Texels drawn and decoded around a tile: the combine pass reads the neighbours of a texel in the snowmap, and the snow
+// pass samples the sources linearly. A multiple of 4, so that the padded tile starts on the border of a block.
+constexpr size_t tile_halo = 4;
+// Of the source textures and the snowmap of a tile, which hold the padded tile
+constexpr size_t tile_source_width = tile_columns + 2 * tile_halo;
+constexpr size_t tile_source_height = band_rows + 2 * tile_halo;
+
+struct snowgen::Generator::Tile {
+	size_t texture_width = 0;
+	size_t texture_height = 0;
+	uint32_t index = 0; // Row by row
+	// In texels
+	size_t x = 0;
+	size_t y = 0;
+	size_t width = 0;
+	size_t height = 0;
+	// With the halo, as far as the texture reaches
+	size_t padded_x = 0;
+	size_t padded_y = 0;
+	size_t padded_width = 0;
+	size_t padded_height = 0;
+
+	Tile(size_t texture_width, size_t texture_height, uint32_t index)
+		: texture_width(texture_width), texture_height(texture_height), index(index)
+	{
+		x = index % get_columns(texture_width) * tile_columns;
+		y = index / get_columns(texture_width) * band_rows;
+		width = std::min(tile_columns, texture_width - x);
+		height = band_rows;
+		padded_x = x >= tile_halo ? x - tile_halo : 0;
+		padded_y = y >= tile_halo ? y - tile_halo : 0;
+		padded_width = std::min(x + width + tile_halo, texture_width) - padded_x;
+		padded_height = std::min(y + height + tile_halo, texture_height) - padded_y;
+	}
+	static uint32_t get_columns(size_t texture_width) { return uint32_t((texture_width + tile_columns - 1) / tile_columns); }
+	static uint32_t get_count(size_t texture_width, size_t texture_height) { return get_columns(texture_width) * uint32_t(texture_height / band_rows); }
+	bool is_last_of_band() const { return x + width == texture_width; }
+};
+
+class snowgen::Generator::TileSources
+{
+public:
+	explicit TileSources(const GLuint* source_textures) : source_textures(source_textures) {}
+
+	// Binds the textures to the samplers of the shader program like bind_textures(): those with a .dds file decoded
+	// in the padded tile, the default textures as they are. Throws snow_exception if a file cannot be decoded.
+	void bind(Texture* const* textures, const Tile& tile, GLuint shader_program_id)
+	{
+		for (int i = 0; i < texture_types_count; i++) {
+			GLuint texture_id = textures[i]->texture_id;
+			if (textures[i]->has_file()) {
+				if (decoded_textures[i] != textures[i] || decoded_tiles[i] != tile.index) {
+					std::unique_ptr<MappedDds>& file = files[textures[i]];
+					if (!file) file = std::make_unique<MappedDds>(textures[i]->abs_path);
+					if (!file->decode_to_gl_texture(tile.padded_x, tile.padded_y, tile.padded_width, tile.padded_height, source_textures[i])) {
+						throw snow_exception((std::string("Could not decode a tile of ").append(textures[i]->rel_path)).c_str());
+					}
+					decoded_textures[i] = textures[i];
+					decoded_tiles[i] = tile.index;
+				}
+				texture_id = source_textures[i];
+			}
+			GLuint texture_location_in_shader = glGetUniformLocation(shader_program_id, cfg_constants::texture_names[i]);
+			glActiveTexture(GL_TEXTURE0 + i);
+			glBindTexture(GL_TEXTURE_2D, texture_id);
+			glUniform1i(texture_location_in_shader, i);
+		}
+	}
+
+private:
+	const GLuint* source_textures;
+	std::unordered_map<const Texture*, std::unique_ptr<MappedDds>> files; // Mapped once per texture
+	// Which tile of which texture each source texture holds
+	const Texture* decoded_textures[texture_types_count] = { nullptr, nullptr, nullptr };
+	uint32_t decoded_tiles[texture_types_count] = { 0, 0, 0 };
+};
+
+// The format a snowed texture is saved in, with a warning if the format of its .dds file cannot be kept
+static DXGI_FORMAT find_dds_format(const Texture* texture, const SnowOptions& options)
+{
+	DdsFormat requested_format = texture->type == 0 ? options.diff_dds_format : options.metal_dds_format;
+	if (texture->source_format != 0 && !is_source_format_kept(DXGI_FORMAT(texture->source_format), requested_format)) {
+		std::cout << "WARNING: " << texture->rel_path << " has the format "
+			<< get_format_name(DXGI_FORMAT(texture->source_format)) << ", which cannot be kept, it is saved as BC7" << std::endl;
+	}
+	return get_output_dds_format(DXGI_FORMAT(texture->source_format), requested_format);
+}
+
+CfgDescription snowgen::describe_cfg(std::string_view cfg_xml, const fs::path& cfg_path)
+{
+	CfgDescription description;
+	description.cfg_path = cfg_path;
+	scan_cfg(cfg_xml, &description);
+	return description;
+}
+
+snowgen::Generator::Generator(const SnowOptions& options, bool visible_window)
+	: options(options), context_gl(true, visible_window)
+{
+	if (!(options.snow_parameters.full_snow_normal_y < max_snowmap_normal_y)) {
+		cleanup();
+		throw snow_exception("full_snow_normal_y must be below max_snowmap_normal_y");
+	}
+	while (glGetError() != GL_NO_ERROR) std::cout << "GL ERROR while initializing" << std::endl;
+	std::string snow_defines = snow_parameter_defines(options.snow_parameters);
+	for (int is_tiled = 0; is_tiled < 2; is_tiled++) {
+		std::string tile_defines = tile_variant_defines(is_tiled == 1);
+		snow_programs[is_tiled] = compile_shaders_to_program(
+			specialize_shader_code(texcoord_as_positon_with_tangents_vertexshader_code, tile_defines),
+			specialize_shader_code(snow_fragmentshader_code, snow_defines + tile_defines));
+		for (int has_metallic_output = 0; has_metallic_output < 2; has_metallic_output++) {
+			combine_to_snowed_textures_programs[is_tiled][has_metallic_output] = compile_shaders_to_program(empty_vertexshader_code,
+				specialize_shader_code(combine_to_snowed_textures_fragmentshader_code,
+					snow_defines + combine_variant_defines(options, has_metallic_output == 1) + tile_defines));
+		}
+	}
+	if (glGetError() != GL_NO_ERROR) {
+		cleanup();
+		throw snow_exception("GL ERROR while compiling shaders");
+	}
+	while (glGetError() != GL_NO_ERROR) {}
+
+	context_gl.load_square_vertexbuffer();
+	context_gl.load_noise_texture(1024);
+	default_textures = load_default_textures();
+	if (options.atlas_mode) {
+		// Without a budget, all snowmaps stay in memory. With one, they may take a quarter of it.
+		atlas_snowmaps = std::make_unique<AtlasSnowmaps>(memory_accounting::get_budget() / 4,
+			fs::path(options.out_path).append("atlas_snowmaps.tmp"));
+	}
+	if (glGetError() != GL_NO_ERROR) {
+		cleanup();
+		throw snow_exception("GL ERROR while initialising data");
+	}
+}
+
+snowgen::Generator::~Generator()
+{
+	cleanup();
+}
+
+bool snowgen::Generator::has_textures_to_save(const CfgFile& cfg_file)
+{
+	for (const Texture& texture : cfg_file.textures) {
+		if (texture.save_snowed_texture) return true;
+	}
+	return false;
+}
+
+snowgen::Result snowgen::Generator::process_cfg(const CfgDescription& description)
+{
+	Result result;
+	FileScopes file_scopes = enter_file_scopes();
+	CfgFile cfg_file = CfgFile(description, &default_textures, options);
+	if (!has_textures_to_save(cfg_file)) return result;
+	result.has_textures = true;
+
+	// Waits if other work holds too much of the memory budget
+	MemoryReservation memory_reservation(cfg_file.estimate_memory_bytes(options, false));
+	try {
+		load(&cfg_file, options, false);
+		draw_snowmaps(&cfg_file, options);
+		if (!atlas_snowmaps) combine(&cfg_file); // Otherwise by save_atlases()
+		result.saved_texture_count = save_textures(&cfg_file, options, &result.snowed_texels);
+	}
+	catch (...) {
+		finish_cfg();
+		throw;
+	}
+	finish_cfg();
+	return result;
+}
+
+snowgen::Result snowgen::Generator::process_cfg(std::string_view cfg_xml, const fs::path& cfg_path)
+{
+	return process_cfg(describe_cfg(cfg_xml, cfg_path));
+}
+
+void snowgen::Generator::load(CfgFile* cfg_file, const SnowOptions& options, bool is_rendered)
+{
+	while (glGetError() != GL_NO_ERROR) {} // Clear Error stack
+	FileScopes file_scopes = enter_file_scopes();
+	cfg_file->load_models_and_textures(options, is_rendered);
+	if (glGetError() != GL_NO_ERROR) throw snow_exception("GL ERROR while loading textures");
+}
+
+void snowgen::Generator::draw_snowmaps(CfgFile* cfg_file, const SnowOptions& options)
+{
+	// With flat_overwrites_steep, the depth 0 of steep fragments never passes the depth test:
+	// triangles that are steep everywhere do not need to be drawn
+	if (options.flat_overwrites_steep) {
+		for (CfgModel& cfg_model : cfg_file->cfg_models) cfg_model.build_snow_indices(this->options.snow_parameters.min_normal_y);
+	}
+
+	ProfileScope snowmap_scope("draw_snowmaps", cfg_file->cfg_path.generic_string());
+	std::vector<uint16_t> depth_values; // Of the merged snowmaps of atlases
+	for (int i = 0; i < cfg_file->cfg_models.size(); i++) {
+		HardwareRdm& mesh = *cfg_file->cfg_models[i].mesh;
+		for (int j = 0; j < mesh.materials_count; j++) {
+			size_t cfg_material_index = std::min<size_t>(mesh.materials[j].index, cfg_file->cfg_models[i].cfg_materials.size() - 1);
+			CfgMaterial& cfg_material = cfg_file->cfg_models[i].cfg_materials[cfg_material_index];
+			// Drawn tile by tile below, or by save_textures()
+			if (cfg_material.textures[0]->is_tiled) continue;
+
+			int width, height;
+
+			uint32_t diffuse_path_id = cfg_material.textures[0]->path_id;
+			Snowmap* snowmap = find_snowmap(diffuse_path_id);
+
+			if (!snowmap) {
+				get_dimensions(cfg_material.textures[0]->texture_id, &width, &height);
+
+				// Create render target. The snowmap itself is the depth attachment, no renderbuffer needed.
+				snowmap_slots.set(diffuse_path_id, uint32_t(snowmaps.size()));
+				snowmap = &snowmaps.emplace_back();
+				snowmap->diffuse_path_id = diffuse_path_id;
+				snowmap->depth_texture = create_empty_depth_texture(width, height);
+				snowmap->framebuffer = create_framebuffer(0);
+
+				glFramebufferTexture(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, snowmap->depth_texture, 0);
+
+				is_framebuffer_ok();
+				if (atlas_snowmaps && atlas_snowmaps->load(diffuse_path_id, width, height, &depth_values)) {
+					// Continue from the snowmap merged from the earlier .cfg files using the atlas
+					glBindTexture(GL_TEXTURE_2D, snowmap->depth_texture);
+					glPixelStorei(GL_UNPACK_ALIGNMENT, 2);
+					glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, width, height, GL_DEPTH_COMPONENT, GL_UNSIGNED_SHORT, depth_values.data());
+					glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+				}
+				else {
+					// Clear snowmap
+					if (options.flat_overwrites_steep) glClearDepth(0.);
+					else glClearDepth(1.);
+					glClear(GL_DEPTH_BUFFER_BIT);
+				}
+			}
+			else {
+				get_dimensions(snowmap->depth_texture, &width, &height);
+			}
+
+			glViewport(0, 0, width, height);
+			glBindFramebuffer(GL_FRAMEBUFFER, snowmap->framebuffer); // Render to snowmap
+
+			// Render snowmap
+			GLuint snow_program = snow_programs[0];
+			glUseProgram(snow_program);
+			glEnable(GL_DEPTH_TEST);
+			if (options.flat_overwrites_steep) glDepthFunc(GL_GREATER);
+			else glDepthFunc(GL_LESS);
+
+			cfg_material.bind_textures(snow_program);
+
+			mesh.bind_snow_buffers();
+			context_gl.bind_vertexformat(cfg_material.vertex_format, mesh.vertices_size);
+
+			const Material& snow_range = mesh.get_snow_range(j);
+			glDrawElements(
+				GL_TRIANGLES,
+				snow_range.size,
+				mesh.get_corner_datatype(),
+				(void*)(uint64_t(snow_range.offset) * mesh.corner_size)
+			);
+			context_gl.unbind_vertexformat(cfg_material.vertex_format);
+
+			glDisable(GL_DEPTH_TEST);
+
+			if (glGetError() != GL_NO_ERROR) throw snow_exception("GL ERROR while generating snowmaps");
+		}
+	}
+	if (atlas_snowmaps) {
+		// The snowmap of an atlas processed in tiles is merged tile by tile
+		for (Texture& texture : cfg_file->textures) {
+			if (texture.type != 0 || !texture.is_tiled) continue;
+			std::vector<SnowDraw> draws = find_snow_draws(cfg_file, &texture);
+			size_t width, height;
+			if (draws.empty() || !get_dds_dimensions(texture.abs_path.wstring(), &width, &height)) continue;
+			create_tile_targets();
+			TileSources sources(tile_targets.source_textures);
+			for (uint32_t tile_index = 0; tile_index < Tile::get_count(width, height); tile_index++) {
+				Tile tile(width, height, tile_index);
+				bool has_part = atlas_snowmaps->load(texture.path_id, int(tile.padded_width), int(tile.padded_height), &depth_values, tile.index);
+				begin_tile_snowmap(tile, has_part ? &depth_values : nullptr, options);
+				draw_tile_snowmap(draws, tile, sources, options);
+				depth_values.resize(tile.padded_width * tile.padded_height);
+				glPixelStorei(GL_PACK_ALIGNMENT, 1);
+				glReadPixels(0, 0, GLsizei(tile.padded_width), GLsizei(tile.padded_height), GL_DEPTH_COMPONENT, GL_UNSIGNED_SHORT, depth_values.data());
+				if (glGetError() != GL_NO_ERROR) throw snow_exception("GL ERROR while reading back the snowmap of an atlas");
+				atlas_snowmaps->store(texture.path_id, int(tile.padded_width), int(tile.padded_height), depth_values, tile.index);
+			}
+		}
+	}
+	snowmap_scope.end();
+	if (atlas_snowmaps) store_atlas_snowmaps(cfg_file, options);
+}
+
+void snowgen::Generator::combine(CfgFile* cfg_file)
+{
+	ProfileScope combine_scope("combine", cfg_file->cfg_path.generic_string());
+	for (int i = 0; i < cfg_file->cfg_models.size(); i++) {
+		HardwareRdm& mesh = *cfg_file->cfg_models[i].mesh;
+		for (int j = 0; j < cfg_file->cfg_models[i].cfg_materials.size(); j++) {
+			size_t cfg_material_index = std::min<size_t>(mesh.materials[j].index, cfg_file->cfg_models[i].cfg_materials.size() - 1);
+			CfgMaterial& cfg_material = cfg_file->cfg_models[i].cfg_materials[cfg_material_index];
+
+			// diff and metallic have already been processed
+			if (cfg_material.textures[0]->is_snow_generated && cfg_material.textures[2]->is_snow_generated) continue;
+			// diff and metallic do not have to be saved (e.g. default textures)
+			if ((!cfg_material.textures[0]->save_snowed_texture) && (!cfg_material.textures[2]->save_snowed_texture)) continue;
+			// diff and metallic are never used by the mesh (which can't be possible at this point but is checked anyway)
+			Snowmap* snowmap = find_snowmap(cfg_material.textures[0]->path_id);
+			if (!snowmap) continue;
+
+			combine_textures(cfg_material.textures, snowmap->depth_texture);
+		}
+	}
+}
+
+void snowgen::Generator::combine_textures(Texture* const* textures, GLuint snowmap_texture)
+{
+	int width, height;
+	get_dimensions(textures[0]->texture_id, &width, &height);
+
+	// All textures involved must have the same dimensions, namely those of the diff texture
+	if (textures[0]->snowed_texture_id == 0 && textures[0]->save_snowed_texture) {
+		textures[0]->snowed_texture_id = create_empty_texture(
+			width, height, GL_RGBA, GL_NEAREST, GL_NEAREST, GL_REPEAT);
+	}
+	if (textures[2]->snowed_texture_id == 0 && textures[2]->save_snowed_texture) {
+		textures[2]->snowed_texture_id = create_empty_texture(
+			width, height, GL_RGBA, GL_NEAREST, GL_NEAREST, GL_REPEAT);
+	}
+
+	GLuint framebuffer_id = create_framebuffer(texture_types_count);
+	glFramebufferTexture(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, textures[0]->snowed_texture_id, 0);
+	glFramebufferTexture(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT2, textures[2]->snowed_texture_id, 0);
+
+	GLuint combine_to_snowed_textures_program = combine_to_snowed_textures_programs[0][textures[2]->snowed_texture_id != 0];
+	glViewport(0, 0, width, height);
+	glUseProgram(combine_to_snowed_textures_program);
+	glDisable(GL_BLEND);
+
+	bind_textures(textures, combine_to_snowed_textures_program);
+
+	GLuint texture_location_in_shader = glGetUniformLocation(combine_to_snowed_textures_program, "snowmap");
+	glActiveTexture(GL_TEXTURE3);
+	glBindTexture(GL_TEXTURE_2D, snowmap_texture);
+	glUniform1i(texture_location_in_shader, 3);
+
+	texture_location_in_shader = glGetUniformLocation(combine_to_snowed_textures_program, "noise");
+	glActiveTexture(GL_TEXTURE4);
+	glBindTexture(GL_TEXTURE_2D, context_gl.noise_texture);
+	glUniform1i(texture_location_in_shader, 4);
+
+	context_gl.bind_square_buffers();
+	glDrawElements(GL_TRIANGLES, 6, GL_UNSIGNED_INT, (void*)0);
+	context_gl.unbind_square_buffers();
+
+	if (glGetError() != GL_NO_ERROR) throw snow_exception((std::string("GL ERROR while combining original texture and snowmap ").append(textures[0]->rel_path)).c_str());
+
+	for (int k = 0; k < texture_types_count; k++)
+		textures[k]->is_snow_generated = true;
+	glDeleteFramebuffers(1, &framebuffer_id);
+}
+
+bool snowgen::Generator::save_texture(Texture* texture, const SnowOptions& options, uint64_t* snowed_texels)
+{
+	if (texture->type == 1) {
+		// Do not save normalmaps
+		texture->is_snowed_version_saved = true;
+	}
+	else if (texture->is_snowed_version_saved) {
+		// std::cout << "Do not safe texture twice" << endl;
+	} else if (texture->rel_path.find("default_model_") != std::string::npos) {
+		// std::cout << "Do not save the default texture " << cfg_constants::texture_names[k];
+	}
+	else if (!texture->save_snowed_texture) {
+		std::cout << "Do not save vanilla texture " << texture->abs_path << std::endl;
+		texture->is_snowed_version_saved = true;
+	}
+	else{
+		if (is_forbidden_texture(texture->rel_path)) {
+			// If filenamefilters are active, default textures are loaded instead of blacklisted ones.
+			// If the program reaches this points, filenamefilters are disabled.
+			std::cout << "Save blacklisted texture " << texture->out_path.string() << std::endl;
+		}
+		if (options.save_png) {
+			gl_texture_to_png_file(texture->snowed_texture_id, texture->out_path.string() + "0.png", true);
+		}
+		if (options.save_dds) {
+			DXGI_FORMAT dds_format = find_dds_format(texture, options);
+			texture_encoder.save_dds(texture->snowed_texture_id, texture->out_path, texture->mipmap_count, dds_format,
+				BlockPassthrough{ texture->decoded_tiles, texture->get_abs_path_until_mipmap_indication() });
+		}
+		if (snowed_texels) {
+			int width, height;
+			get_dimensions(texture->snowed_texture_id, &width, &height);
+			*snowed_texels += uint64_t(width) * height;
+		}
+		texture->is_snowed_version_saved = true;
+		return true;
+	}
+	return false;
+}
+
+size_t snowgen::Generator::save_textures(CfgFile* cfg_file, const SnowOptions& options, uint64_t* snowed_texels)
+{
+	FileScopes file_scopes = enter_file_scopes();
+	size_t saved_texture_count = 0;
+	if (!atlas_snowmaps) {
+		// Drawn, combined and saved tile by tile
+		for (Texture& texture : cfg_file->textures) {
+			if (texture.type != 0 || !texture.is_tiled) continue;
+			std::vector<Texture* const*> materials;
+			for (CfgModel& cfg_model : cfg_file->cfg_models) {
+				for (CfgMaterial& cfg_material : cfg_model.cfg_materials) {
+					if (cfg_material.textures[0] == &texture) materials.push_back(cfg_material.textures);
+				}
+			}
+			if (materials.empty()) continue;
+			std::vector<SnowDraw> draws = find_snow_draws(cfg_file, &texture);
+			saved_texture_count += save_tiled_textures(materials, [&](const Tile& tile, TileSources& sources) {
+				begin_tile_snowmap(tile, nullptr, options);
+				draw_tile_snowmap(draws, tile, sources, options);
+			}, options, snowed_texels);
+		}
+	}
+	for (Texture& texture : cfg_file->textures) {
+		if (save_texture(&texture, options, snowed_texels)) saved_texture_count++;
+		if (glGetError() != GL_NO_ERROR) throw snow_exception("GL ERROR while saving texture");
+		texture.cleanup();
+	}
+	texture_encoder.poll();
+	return saved_texture_count;
+}
+
+void snowgen::Generator::store_atlas_snowmaps(CfgFile* cfg_file, const SnowOptions& options)
+{
+	ProfileScope atlas_scope("store_atlas_snowmaps", cfg_file->cfg_path.generic_string());
+	std::vector<uint32_t> stored_ids;
+	for (CfgModel& cfg_model : cfg_file->cfg_models) {
+		for (CfgMaterial& cfg_material : cfg_model.cfg_materials) {
+			if (!cfg_material.textures[0]->save_snowed_texture && !cfg_material.textures[2]->save_snowed_texture) continue;
+			uint32_t snowmap_id = cfg_material.textures[0]->path_id;
+			// The parts of the tiles are stored by draw_snowmaps()
+			bool is_tiled = cfg_material.textures[0]->is_tiled;
+			if (!find_snowmap(snowmap_id) && !is_tiled) continue;
+			AtlasMaterial material;
+			for (int k = 0; k < texture_types_count; k++) {
+				const Texture& texture = *cfg_material.textures[k];
+				material[k] = AtlasTexture{ texture.path_id, texture.rel_path, texture.abs_path, options.out_path,
+					texture.save_snowed_texture, &texture == &default_textures[k] };
+			}
+			atlas_snowmaps->add_material(snowmap_id, material);
+			if (is_tiled) continue;
+			if (std::find(stored_ids.begin(), stored_ids.end(), snowmap_id) == stored_ids.end()) stored_ids.push_back(snowmap_id);
+		}
+	}
+
+	// The depth values are read back as they are, 16 bit like the depth texture
+	std::vector<uint16_t> depth_values;
+	glPixelStorei(GL_PACK_ALIGNMENT, 1);
+	for (uint32_t snowmap_id : stored_ids) {
+		GLuint depth_texture = find_snowmap(snowmap_id)->depth_texture;
+		int width, height;
+		get_dimensions(depth_texture, &width, &height);
+		depth_values.resize(size_t(width) * height);
+		glBindTexture(GL_TEXTURE_2D, depth_texture);
+		glGetTexImage(GL_TEXTURE_2D, 0, GL_DEPTH_COMPONENT, GL_UNSIGNED_SHORT, depth_values.data());
+		if (glGetError() != GL_NO_ERROR) throw snow_exception("GL ERROR while reading back the snowmap of an atlas");
+		atlas_snowmaps->store(snowmap_id, width, height, depth_values);
+	}
+
+	// Saved by save_atlases(), from the original textures
+	for (Texture& texture : cfg_file->textures) {
+		if (texture.type != 1 && texture.save_snowed_texture) texture.is_snowed_version_saved = true;
+	}
+}
+
+size_t snowgen::Generator::save_atlases(const SnowOptions& options)
+{
+	if (!atlas_snowmaps) return 0;
+	FileScopes file_scopes = enter_file_scopes();
+	size_t saved_texture_count = 0;
+	std::vector<uint16_t> depth_values;
+	for (uint32_t snowmap_id : atlas_snowmaps->take_changed()) {
+		const std::vector<AtlasMaterial>& materials = atlas_snowmaps->get_materials(snowmap_id);
+		if (materials.empty()) continue;
+		ProfileScope atlas_scope("save_atlas", materials[0][0].rel_path);
+
+		// Each texture once, even if several materials of the atlas use it
+		std::unordered_map<uint32_t, std::unique_ptr<Texture>> textures;
+		auto get_texture = [&](const AtlasTexture& atlas_texture, int type) {
+			if (atlas_texture.is_default) return &default_textures[type];
+			std::unique_ptr<Texture>& texture = textures[atlas_texture.path_id];
+			if (!texture) {
+				texture = std::make_unique<Texture>(atlas_texture.rel_path, atlas_texture.abs_path, atlas_texture.out_base_path,
+					type, atlas_texture.save_snowed_texture);
+			}
+			return texture.get();
+		};
+		std::vector<std::array<Texture*, texture_types_count>> material_textures;
+		std::vector<const Texture*> combined_textures;
+		for (const AtlasMaterial& material : materials) {
+			std::array<Texture*, texture_types_count>& textures_of_material = material_textures.emplace_back();
+			for (int k = 0; k < texture_types_count; k++) {
+				textures_of_material[k] = get_texture(material[k], k);
+				if (k != 0 && !material[k].is_default) combined_textures.push_back(textures_of_material[k]);
+			}
+		}
+
+		Texture* diffuse_texture = material_textures[0][0];
+		if (!materials[0][0].is_default && is_processed_in_tiles(*diffuse_texture, combined_textures, options, false)) {
+			// Combined and saved tile by tile with the parts of the snowmap. A tile without one was not drawn to.
+			std::vector<Texture* const*> tiled_materials;
+			for (std::array<Texture*, texture_types_count>& textures_of_material : material_textures) tiled_materials.push_back(textures_of_material.data());
+			for (auto& [path_id, texture] : textures) {
+				texture->is_tiled = true;
+				texture->load();
+			}
+			saved_texture_count += save_tiled_textures(tiled_materials, [&](const Tile& tile, TileSources& sources) {
+				bool has_part = atlas_snowmaps->load(snowmap_id, int(tile.padded_width), int(tile.padded_height), &depth_values, tile.index);
+				begin_tile_snowmap(tile, has_part ? &depth_values : nullptr, options);
+			}, options, nullptr);
+			for (auto& [path_id, texture] : textures) texture->cleanup();
+			texture_encoder.poll();
+			continue;
+		}
+		for (auto& [path_id, texture] : textures) texture->load();
+		int width, height;
+		get_dimensions(diffuse_texture->texture_id, &width, &height);
+		if (!atlas_snowmaps->load(snowmap_id, width, height, &depth_values)) continue;
+		GLuint snowmap_texture = create_empty_depth_texture(width, height);
+		glPixelStorei(GL_UNPACK_ALIGNMENT, 2);
+		glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, width, height, GL_DEPTH_COMPONENT, GL_UNSIGNED_SHORT, depth_values.data());
+		glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+
+		for (std::array<Texture*, texture_types_count>& textures_of_material : material_textures) {
+			if (textures_of_material[0]->is_snow_generated && textures_of_material[2]->is_snow_generated) continue;
+			combine_textures(textures_of_material.data(), snowmap_texture);
+		}
+		for (auto& [path_id, texture] : textures) {
+			if (save_texture(texture.get(), options, nullptr)) saved_texture_count++;
+			if (glGetError() != GL_NO_ERROR) throw snow_exception("GL ERROR while saving an atlas");
+			texture->cleanup();
+		}
+		delete_gl_texture(&snowmap_texture);
+		texture_encoder.poll();
+	}
+	return saved_texture_count;
+}
+
+std::vector<snowgen::Generator::SnowDraw> snowgen::Generator::find_snow_draws(CfgFile* cfg_file, const Texture* diffuse_texture)
+{
+	std::vector<SnowDraw> draws;
+	for (CfgModel& cfg_model : cfg_file->cfg_models) {
+		HardwareRdm& mesh = *cfg_model.mesh;
+		for (int j = 0; j < mesh.materials_count; j++) {
+			size_t cfg_material_index = std::min<size_t>(mesh.materials[j].index, cfg_model.cfg_materials.size() - 1);
+			CfgMaterial& cfg_material = cfg_model.cfg_materials[cfg_material_index];
+			if (cfg_material.textures[0] == diffuse_texture) draws.push_back(SnowDraw{ &mesh, j, &cfg_material });
+		}
+	}
+	return draws;
+}
+
+void snowgen::Generator::begin_tile_snowmap(const Tile& tile, const std::vector<uint16_t>* depth_values, const SnowOptions& options)
+{
+	glBindFramebuffer(GL_FRAMEBUFFER, tile_targets.depth_framebuffer);
+	// Also beyond the padded tile, where the combine pass reads the neighbours of the texels on the border of the texture
+	if (options.flat_overwrites_steep) glClearDepth(0.);
+	else glClearDepth(1.);
+	glClear(GL_DEPTH_BUFFER_BIT);
+	if (depth_values) {
+		glBindTexture(GL_TEXTURE_2D, tile_targets.depth_texture);
+		glPixelStorei(GL_UNPACK_ALIGNMENT, 2);
+		glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, GLsizei(tile.padded_width), GLsizei(tile.padded_height),
+			GL_DEPTH_COMPONENT, GL_UNSIGNED_SHORT, depth_values->data());
+		glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+	}
+}
+
+void snowgen::Generator::draw_tile_snowmap(const std::vector<SnowDraw>& draws, const Tile& tile, TileSources& sources,
+	const SnowOptions& options)
+{
+	// The vertex shader moves the padded tile to (0, 0) of the snowmap, the rest of the mesh is clipped
+	GLuint snow_program = snow_programs[1];
+	glViewport(0, 0, GLsizei(tile_source_width), GLsizei(tile_source_height));
+	glUseProgram(snow_program);
+	glUniform2f(glGetUniformLocation(snow_program, "texture_size"), GLfloat(tile.texture_width), GLfloat(tile.texture_height));
+	glUniform2f(glGetUniformLocation(snow_program, "tile_origin"), GLfloat(tile.padded_x), GLfloat(tile.padded_y));
+	glUniform2f(glGetUniformLocation(snow_program, "tile_texture_size"), GLfloat(tile_source_width), GLfloat(tile_source_height));
+	glEnable(GL_DEPTH_TEST);
+	if (options.flat_overwrites_steep) glDepthFunc(GL_GREATER);
+	else glDepthFunc(GL_LESS);
+
+	for (const SnowDraw& draw : draws) {
+		sources.bind(draw.cfg_material->textures, tile, snow_program);
+
+		draw.mesh->bind_snow_buffers();
+		context_gl.bind_vertexformat(draw.cfg_material->vertex_format, draw.mesh->vertices_size);
+
+		const Material& snow_range = draw.mesh->get_snow_range(draw.material_index);
+		glDrawElements(
+			GL_TRIANGLES,
+			snow_range.size,
+			draw.mesh->get_corner_datatype(),
+			(void*)(uint64_t(snow_range.offset) * draw.mesh->corner_size)
+		);
+		context_gl.unbind_vertexformat(draw.cfg_material->vertex_format);
+	}
+	glDisable(GL_DEPTH_TEST);
+
+	if (glGetError() != GL_NO_ERROR) throw snow_exception("GL ERROR while generating snowmaps");
+}
+
+size_t snowgen::Generator::save_tiled_textures(const std::vector<Texture* const*>& materials,
+	const std::function<void(const Tile& tile, TileSources& sources)>& draw_snowmap, const SnowOptions& options,
+	uint64_t* snowed_texels)
+{
+	Texture* diffuse_texture = materials[0][0];
+	ProfileScope tiles_scope("save_tiled_textures", diffuse_texture->rel_path);
+	size_t width, height;
+	if (!get_dds_dimensions(diffuse_texture->abs_path.wstring(), &width, &height)) {
+		throw snow_exception((std::string("Could not read the header of ").append(diffuse_texture->rel_path)).c_str());
+	}
+
+	// The diffuse texture and the metallic textures, each with a material it is combined with
+	struct TiledOutput {
+		Texture* texture;
+		Texture* const* material;
+		std::shared_ptr<TextureEncoder::BandedSave> save; // nullptr: not saved as .dds
+		std::vector<uint8_t> band; // The tiles read back, until the band is handed over
+	};
+	std::vector<TiledOutput> outputs;
+	auto is_saved_from_tiles = [&](const Texture* texture) {
+		if (!texture->is_tiled || !texture->save_snowed_texture || texture->is_snowed_version_saved) return false;
+		if (texture->rel_path.find("default_model_") != std::string::npos) return false;
+		for (const TiledOutput& output : outputs) {
+			if (output.texture == texture) return false;
+		}
+		return true;
+	};
+	if (is_saved_from_tiles(diffuse_texture)) outputs.push_back(TiledOutput{ diffuse_texture, materials[0] });
+	bool has_diffuse_output = !outputs.empty();
+	for (Texture* const* material : materials) {
+		if (is_saved_from_tiles(material[2])) outputs.push_back(TiledOutput{ material[2], material });
+	}
+
+	bool has_saves = false;
+	for (TiledOutput& output : outputs) {
+		Texture* texture = output.texture;
+		if (is_forbidden_texture(texture->rel_path)) {
+			std::cout << "Save blacklisted texture " << texture->out_path.string() << std::endl;
+		}
+		if (options.save_png) {
+			std::cout << "WARNING: " << texture->rel_path << " is processed in tiles, it is not saved as .png" << std::endl;
+		}
+		if (options.save_dds) {
+			output.save = texture_encoder.begin_banded_save(texture->out_path, width, height, texture->mipmap_count,
+				find_dds_format(texture, options));
+		}
+		if (output.save) {
+			output.band.resize(width * band_rows * 4);
+			has_saves = true;
+		}
+	}
+
+	try {
+		if (has_saves) create_tile_targets();
+		TileSources sources(tile_targets.source_textures);
+		uint32_t tile_count = has_saves ? Tile::get_count(width, height) : 0;
+		for (uint32_t tile_index = 0; tile_index < tile_count; tile_index++) {
+			Tile tile(width, height, tile_index);
+			draw_snowmap(tile, sources);
+
+			// One pass per metallic texture, the first one also reads back the diffuse texture. Without metallic
+			// textures, one pass for the diffuse texture.
+			bool is_diffuse_read_back = !has_diffuse_output;
+			for (TiledOutput& output : outputs) {
+				bool has_metallic_output = output.texture != diffuse_texture;
+				if (!has_metallic_output && outputs.size() > 1) continue;
+				GLuint combine_program = combine_to_snowed_textures_programs[1][has_metallic_output];
+				glBindFramebuffer(GL_FRAMEBUFFER, tile_targets.output_framebuffer);
+				glViewport(0, 0, GLsizei(tile.width), GLsizei(tile.height));
+				glUseProgram(combine_program);
+				glDisable(GL_BLEND);
+
+				sources.bind(output.material, tile, combine_program);
+				glUniform2f(glGetUniformLocation(combine_program, "texture_size"), GLfloat(width), GLfloat(height));
+				glUniform2i(glGetUniformLocation(combine_program, "tile_origin"), GLint(tile.padded_x), GLint(tile.padded_y));
+				glUniform2i(glGetUniformLocation(combine_program, "output_origin"), GLint(tile.x), GLint(tile.y));
+
+				GLuint texture_location_in_shader = glGetUniformLocation(combine_program, "snowmap");
+				glActiveTexture(GL_TEXTURE3);
+				glBindTexture(GL_TEXTURE_2D, tile_targets.depth_texture);
+				glUniform1i(texture_location_in_shader, 3);
+
+				texture_location_in_shader = glGetUniformLocation(combine_program, "noise");
+				glActiveTexture(GL_TEXTURE4);
+				glBindTexture(GL_TEXTURE_2D, context_gl.noise_texture);
+				glUniform1i(texture_location_in_shader, 4);
+
+				context_gl.bind_square_buffers();
+				glDrawElements(GL_TRIANGLES, 6, GL_UNSIGNED_INT, (void*)0);
+				context_gl.unbind_square_buffers();
+
+				// Into the band at the column of the tile
+				glPixelStorei(GL_PACK_ALIGNMENT, 1);
+				glPixelStorei(GL_PACK_ROW_LENGTH, GLint(width));
+				auto read_back = [&](GLenum attachment, TiledOutput& band_output) {
+					if (!band_output.save) return;
+					glReadBuffer(attachment);
+					glReadPixels(0, 0, GLsizei(tile.width), GLsizei(tile.height), GL_RGBA, GL_UNSIGNED_BYTE,
+						band_output.band.data() + tile.x * 4);
+				};
+				if (has_metallic_output) read_back(GL_COLOR_ATTACHMENT2, output);
+				if (!is_diffuse_read_back) {
+					read_back(GL_COLOR_ATTACHMENT0, outputs[0]);
+					is_diffuse_read_back = true;
+				}
+				glPixelStorei(GL_PACK_ROW_LENGTH, 0);
+			}
+			if (glGetError() != GL_NO_ERROR) {
+				throw snow_exception((std::string("GL ERROR while combining a tile of ").append(diffuse_texture->rel_path)).c_str());
+			}
+
+			if (tile.is_last_of_band()) {
+				for (TiledOutput& output : outputs) texture_encoder.add_band(output.save, output.band.data());
+				glfwPollEvents();
+			}
+		}
+	}
+	catch (...) {
+		for (TiledOutput& output : outputs) texture_encoder.finish_banded_save(output.save, false);
+		throw;
+	}
+
+	for (TiledOutput& output : outputs) {
+		texture_encoder.finish_banded_save(output.save);
+		if (snowed_texels) *snowed_texels += uint64_t(width) * height;
+		output.texture->is_snowed_version_saved = true;
+	}
+	for (Texture* const* material : materials) {
+		for (int k = 0; k < texture_types_count; k++) material[k]->is_snow_generated = true;
+	}
+	return outputs.size();
+}
+
+void snowgen::Generator::create_tile_targets()
+{
+	if (tile_targets.depth_framebuffer != 0) return;
+	for (GLuint& source_texture : tile_targets.source_textures) {
+		// Filtered like the textures that are loaded as a whole
+		source_texture = create_empty_texture(int(tile_source_width), int(tile_source_height), GL_RGBA, GL_LINEAR, GL_NEAREST, GL_REPEAT,
+			memory_accounting::Category::decoded_textures);
+	}
+	tile_targets.depth_texture = create_empty_depth_texture(int(tile_source_width), int(tile_source_height));
+	tile_targets.depth_framebuffer = create_framebuffer(0);
+	glFramebufferTexture(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, tile_targets.depth_texture, 0);
+	glReadBuffer(GL_NONE); // The snowmaps of atlases are read back from it
+	is_framebuffer_ok();
+
+	for (GLuint& output_texture : tile_targets.output_textures) {
+		output_texture = create_empty_texture(int(tile_columns), int(band_rows), GL_RGBA, GL_NEAREST, GL_NEAREST, GL_REPEAT);
+	}
+	tile_targets.output_framebuffer = create_framebuffer(texture_types_count);
+	glFramebufferTexture(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, tile_targets.output_textures[0], 0);
+	glFramebufferTexture(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT2, tile_targets.output_textures[1], 0);
+	is_framebuffer_ok();
+	if (glGetError() != GL_NO_ERROR) throw snow_exception("GL ERROR while creating the render targets of the tiles");
+}
+
+snowgen::Generator::Snowmap* snowgen::Generator::find_snowmap(uint32_t diffuse_path_id)
+{
+	uint32_t slot = snowmap_slots.get(diffuse_path_id);
+	if (slot < snowmaps.size() && snowmaps[slot].diffuse_path_id == diffuse_path_id) return &snowmaps[slot];
+	return nullptr;
+}
+
+void snowgen::Generator::finish_cfg()
+{
+	for (Snowmap& snowmap : snowmaps) {
+		delete_gl_texture(&snowmap.depth_texture);
+		glDeleteFramebuffers(1, &snowmap.framebuffer);
+	}
+	snowmaps.clear();
+	mesh_cache::trim();
+}
+
+void snowgen::Generator::finish()
+{
+	save_atlases(options);
+	texture_encoder.finish();
+}
+
+void snowgen::Generator::set_source_resolver(SourceResolver resolver)
+{
+	source_resolver = std::move(resolver);
+	texture_encoder.set_file_scopes(&source_resolver, capture.get());
+}
+
+void snowgen::Generator::keep_outputs_in_memory()
+{
+	if (!capture) capture = std::make_unique<output_sink::Capture>();
+	texture_encoder.set_file_scopes(&source_resolver, capture.get());
+}
+
+std::vector<output_sink::CapturedFile> snowgen::Generator::take_outputs()
+{
+	finish();
+	if (!capture) return {};
+	return capture->take_files();
+}
+
+void snowgen::Generator::cleanup()
+{
+	if (is_cleaned_up) return;
+	is_cleaned_up = true;
+	finish_cfg();
+	try {
+		save_atlases(options);
+	}
+	catch (snow_exception) {
+		std::cout << "Could not save the atlases" << std::endl;
+	}
+	atlas_snowmaps.reset();
+	texture_encoder.cleanup(); // Waits for the last textures
+	mesh_cache::clear();
+	default_textures.clear(); // Deletes their GL textures, while there is a context
+	for (GLuint& source_texture : tile_targets.source_textures) delete_gl_texture(&source_texture);
+	delete_gl_texture(&tile_targets.depth_texture);
+	for (GLuint& output_texture : tile_targets.output_textures) delete_gl_texture(&output_texture);
+	glDeleteFramebuffers(1, &tile_targets.depth_framebuffer);
+	glDeleteFramebuffers(1, &tile_targets.output_framebuffer);
+	for (GLuint snow_program : snow_programs) glDeleteProgram(snow_program);
+	for (auto& tiled_programs : combine_to_snowed_textures_programs) {
+		for (GLuint combine_program : tiled_programs) glDeleteProgram(combine_program);
+	}
+	context_gl.cleanup();
+	glfwTerminate();
+}
@@ -0,0 +1,184 @@
+#pragma once
+#include <cstdint>
+#include <string_view>
+#include <vector>
+#include <memory>
+#include <filesystem>
+#include <functional>
+
+#include "snow_options.h"
+#include "cfg_parser.h"
+#include "CfgFile.h"
+#include "gl_stuff.h"
+#include "texture_encoder.h"
+#include "output_sink.h"
+#include "atlas_snowmaps.h"
+#include "path_table.h"
+#include "mapped_file.h"
+
+/*
+libsnowgen: generates the snowed textures of .cfg files without the command line program, for asset pipelines and
+for benchmarks of single stages. snowgenerator.cpp is a thin wrapper around it that adds what a run over a directory
+needs: the search for .cfg files, the planning, the preview window, --watch and --serve.
+
+	snowgen::Generator generator(options);
+	generator.set_source_resolver([&](const std::filesystem::path& path) { return bytes_from_my_archive(path); });
+	generator.keep_outputs_in_memory();
+	snowgen::Result result = generator.process_cfg(cfg_xml, cfg_path);
+	for (output_sink::CapturedFile& file : generator.take_outputs()) ...
+
+The .cfg file can be passed as a buffer. Its .rdm and .dds files are named by paths, resolved against cfg_path as the
+program does; the source resolver returns their bytes, or nullptr to read them from the disk. Without
+keep_outputs_in_memory(), the files are saved below options.out_path.
+The stages can also be called one by one (load, draw_snowmaps, combine, save_textures, finish_cfg), e.g. to time
+them or to render the snowed model in between, as the program does for the preview.
+
+The Generator owns the GL context (in a hidden window, GLFW creates it on the main thread): only one at a time, used
+from the thread that created it. The encoding runs on worker threads, so the next .cfg file is drawn while the last
+one is compressed. Errors throw snow_exception.
+
+With atlas_mode, the snowmaps of the textures are merged across the .cfg files, and the textures are only combined
+and saved by save_atlases(), which finish() and take_outputs() call.
+
+Textures processed in tiles (see Texture::is_tiled) have no snowmap of their own: save_textures() draws, combines and
+reads them back one tile at a time, into tile-sized render targets shared by all of them, and hands each band of tiles
+to the encoder. With atlas_mode, draw_snowmaps() keeps their snowmap as one part per tile and save_atlases() combines
+them tile by tile.
+*/
+
+namespace snowgen {
+
+	// Parses a .cfg file that is already in memory. cfg_path is where it lies, the paths in it are resolved against it.
+	// Errors are returned in CfgDescription::error, as by read_cfg_description().
+	CfgDescription describe_cfg(std::string_view cfg_xml, const std::filesystem::path& cfg_path);
+
+	struct Result {
+		bool has_textures = false; // false: no textures to generate snow for were found, nothing was saved
+		size_t saved_texture_count = 0;
+		uint64_t snowed_texels = 0;
+	};
+
+	class Generator
+	{
+	public:
+		// visible_window: show the window of the GL context, for a preview. Throws snow_exception if GL fails.
+		Generator(const SnowOptions& options, bool visible_window = false);
+		~Generator();
+
+		Generator(const Generator&) = delete;
+		Generator& operator=(const Generator&) = delete;
+
+		// All stages for one .cfg file, with the options of the Generator
+		Result process_cfg(const CfgDescription& description);
+		Result process_cfg(std::string_view cfg_xml, const std::filesystem::path& cfg_path);
+
+		// The stages one by one. The options may differ from those the Generator was created with, except for
+		// snow_parameters, which are compiled into its shaders.
+		static bool has_textures_to_save(const CfgFile& cfg_file);
+		void load(CfgFile* cfg_file, const SnowOptions& options, bool is_rendered);
+		void draw_snowmaps(CfgFile* cfg_file, const SnowOptions& options);
+		// With atlas_mode, only needed to render the snowed model: save_atlases() combines the atlases again
+		void combine(CfgFile* cfg_file);
+		// Queues the snowed textures for encoding and frees the GL textures. Adds the texels to snowed_texels, if not nullptr.
+		// Returns the number of saved textures.
+		size_t save_textures(CfgFile* cfg_file, const SnowOptions& options, uint64_t* snowed_texels = nullptr);
+		// Deletes the snowmaps. Also after an error in one of the stages above.
+		void finish_cfg();
+		// atlas_mode: combines the textures whose snowmaps changed since the last call with their merged snowmaps and
+		// queues them for encoding. Returns the number of saved textures.
+		size_t save_atlases(const SnowOptions& options);
+
+		// Saves the atlases and waits until all queued textures are written
+		void finish();
+		// The .cfg, .rdm and .dds files the stages read are asked from resolver first, by their absolute paths (see
+		// mapped_file.h), also by the encoder workers. Call it before the first .cfg file. When calling the stages one by
+		// one, construct the CfgFile in a SourceResolverScope of the resolver, it looks for the files.
+		void set_source_resolver(SourceResolver resolver);
+		// The files of this Generator are kept in memory instead of being saved, until take_outputs(). Other Generators
+		// and an output archive of the process are not affected.
+		void keep_outputs_in_memory();
+		// Waits for the queued textures and returns the files written since the last call
+		std::vector<output_sink::CapturedFile> take_outputs();
+
+		// Saves the atlases, waits for the queued textures, then frees everything and ends the GL context.
+		// Called by the destructor.
+		void cleanup();
+
+		GlStuff& get_gl() { return context_gl; }
+		std::vector<Texture>* get_default_textures() { return &default_textures; }
+		TextureEncoder& get_encoder() { return texture_encoder; }
+		const SnowOptions& get_options() const { return options; }
+
+	private:
+		// The stages read through source_resolver and write into capture, on the calling thread while it exists
+		struct FileScopes {
+			SourceResolverScope resolver_scope;
+			output_sink::CaptureScope capture_scope;
+		};
+		FileScopes enter_file_scopes() { return FileScopes{ SourceResolverScope(&source_resolver), output_sink::CaptureScope(capture.get()) }; }
+
+		// Renders the snowed diffuse and metallic texture of a material (of those that are saved)
+		void combine_textures(Texture* const* textures, GLuint snowmap_texture);
+		// Returns whether the texture was saved
+		bool save_texture(Texture* texture, const SnowOptions& options, uint64_t* snowed_texels);
+		// atlas_mode: keeps the snowmaps just drawn for the next .cfg files and for save_atlases()
+		void store_atlas_snowmaps(CfgFile* cfg_file, const SnowOptions& options);
+
+		// A tile of a texture processed in tiles, see snowgen.cpp
+		struct Tile;
+		// The .dds files of the textures processed in tiles, decoded tile by tile into tile_targets.source_textures
+		class TileSources;
+		// A material of a mesh that is drawn into the snowmap of its diffuse texture
+		struct SnowDraw {
+			HardwareRdm* mesh;
+			int material_index;
+			CfgMaterial* cfg_material;
+		};
+		// The materials of the .cfg file that draw into the snowmap of diffuse_texture
+		static std::vector<SnowDraw> find_snow_draws(CfgFile* cfg_file, const Texture* diffuse_texture);
+		// Binds the snowmap of the tile and clears it, or sets it to depth_values of the padded tile
+		void begin_tile_snowmap(const Tile& tile, const std::vector<uint16_t>* depth_values, const SnowOptions& options);
+		void draw_tile_snowmap(const std::vector<SnowDraw>& draws, const Tile& tile, TileSources& sources, const SnowOptions& options);
+		// Combines the diffuse texture of the materials (a tiled one) and their metallic textures with the snowmap of each
+		// tile, which draw_snowmap renders, and saves them band by band. Returns the number of saved textures.
+		size_t save_tiled_textures(const std::vector<Texture* const*>& materials,
+			const std::function<void(const Tile& tile, TileSources& sources)>& draw_snowmap, const SnowOptions& options,
+			uint64_t* snowed_texels);
+		void create_tile_targets();
+
+		// Depth texture the snowmap of a diffuse texture is rendered to
+		struct Snowmap {
+			uint32_t diffuse_path_id = path_table::invalid_id;
+			GLuint depth_texture = 0;
+			GLuint framebuffer = 0;
+		};
+		// nullptr if the .cfg file has not drawn a snowmap for the diffuse texture
+		Snowmap* find_snowmap(uint32_t diffuse_path_id);
+
+		SnowOptions options;
+		GlStuff context_gl;
+		// Indexed by whether the texture is processed in tiles
+		GLuint snow_programs[2] = { 0, 0 };
+		// Indexed by whether the texture is processed in tiles and whether the material has a metallic texture to save
+		GLuint combine_to_snowed_textures_programs[2][2] = { { 0, 0 }, { 0, 0 } };
+		// The render targets of a tile, created with the first texture processed in tiles
+		struct TileTargets {
+			GLuint source_textures[texture_types_count] = { 0, 0, 0 };
+			GLuint depth_texture = 0;
+			GLuint depth_framebuffer = 0;
+			GLuint output_textures[2] = { 0, 0 }; // Diffuse and metallic
+			GLuint output_framebuffer = 0;
+		};
+		TileTargets tile_targets;
+		std::vector<Texture> default_textures;
+		std::vector<Snowmap> snowmaps; // Of the current .cfg file
+		path_table::SlotTable snowmap_slots;
+		// Reads snowed textures back while the GPU continues, compresses them on worker threads
+		TextureEncoder texture_encoder;
+		std::unique_ptr<AtlasSnowmaps> atlas_snowmaps; // Only with atlas_mode
+		SourceResolver source_resolver; // Empty: the files are read from the disk
+		std::unique_ptr<output_sink::Capture> capture; // Only after keep_outputs_in_memory()
+		bool is_cleaned_up = false;
+	};
+
+}
@@ -0,0 +1,426 @@
+#include "texture_encoder.h"
+
+#include <iostream>
+#include <sstream>
+#include <memory>
+#include <vector>
+#include <chrono>
+
+#include "dds2gl.h"
+#include "memory_accounting.h"
+#include "output_sink.h"
+#include "profiler.h"
+#include "snow_exception.h"
+#include "content_hash.h"
+
+// Beyond this, the textures encoded before are forgotten: --serve and --watch would otherwise collect them forever
+constexpr size_t max_remembered_textures = 16384;
+
+static std::filesystem::path miplevel_path(const std::filesystem::path& filename_until_mipmap_indication, size_t miplevel)
+{
+	return std::filesystem::path(filename_until_mipmap_indication).concat(std::to_string(miplevel)).concat(".dds");
+}
+
+TextureEncoder::TextureEncoder(size_t thread_count, size_t readback_buffer_count)
+	: readback_ring(readback_buffer_count), workers(thread_count > 0 ? thread_count : 1)
+{
+	save_ranges.emplace_back();
+	// A few textures per worker may wait for it, more would only hold memory
+	max_queued_tasks = workers.size() * 2;
+}
+
+TextureEncoder::~TextureEncoder()
+{
+	cleanup();
+}
+
+void TextureEncoder::save_dds(GLuint texture_id, std::filesystem::path filename_until_mipmap_indication, size_t mipmap_count, DXGI_FORMAT format,
+	BlockPassthrough passthrough)
+{
+	if (mipmap_count == 0) return;
+	saved_count++;
+	size_t range_index;
+	{
+		std::lock_guard<std::mutex> lock(save_ranges_mutex);
+		range_index = first_range_index + save_ranges.size() - 1;
+		save_ranges.back().unfinished_count++;
+	}
+	readback_ring.start(texture_id, filename_until_mipmap_indication.string(), [this, filename_until_mipmap_indication, mipmap_count, format, passthrough, range_index,
+		resolver = source_resolver, capture = capture](const uint8_t* pixels, int width, int height) {
+		// Runs on the GL thread when the pixels have arrived
+		workers.wait_until_fewer_than(max_queued_tasks);
+		print_messages();
+		// Waits while the textures queued before hold too much of the --memory_budget_mb
+		auto encode_reservation = std::make_shared<MemoryReservation>(estimate_encode_memory_bytes(width, height), true);
+
+		auto pixel_storage = std::make_shared<DirectX::ScratchImage>();
+		auto readback_memory = std::make_shared<TrackedAllocation>(memory_accounting::Category::mip_scratch, size_t(width) * height * 4);
+		if (!gl_pixels_to_dx_image(pixels, width, height, *pixel_storage)) {
+			std::cout << "Could not allocate memory for reading back " << filename_until_mipmap_indication.string() << std::endl;
+			failed_count++;
+			finish_save(range_index, false);
+			return;
+		}
+
+		// Tasks are started in the order they are submitted, so the previous save of the path is running or done
+		auto saved_miplevels = std::make_shared<std::promise<size_t>>();
+		std::shared_future<size_t> this_save = saved_miplevels->get_future().share();
+		std::shared_future<size_t> previous_save = replace_last_save(filename_until_mipmap_indication, this_save);
+
+		workers.submit([this, encode_reservation, pixel_storage, readback_memory, filename_until_mipmap_indication, mipmap_count, format, passthrough,
+			saved_miplevels, this_save, previous_save, range_index, resolver, capture] {
+			if (previous_save.valid()) previous_save.wait();
+			SourceResolverScope resolver_scope(resolver);
+			output_sink::CaptureScope capture_scope(capture);
+			std::ostringstream log;
+			size_t saved_miplevel_count = 0;
+			try {
+				saved_miplevel_count = encode_or_link(*pixel_storage->GetImage(0, 0, 0), filename_until_mipmap_indication, mipmap_count,
+					format, passthrough, this_save, log);
+			}
+			catch (const snow_exception& exception) {
+				log << "Could not save " << filename_until_mipmap_indication.string() << "0.dds: " << exception.what() << std::endl;
+			}
+			catch (const std::exception& exception) {
+				// E.g. a filesystem_error or bad_alloc. Escaping the ThreadPool would terminate the program.
+				log << "Could not save " << filename_until_mipmap_indication.string() << "0.dds: " << exception.what() << std::endl;
+			}
+			catch (...) {
+				log << "Could not save " << filename_until_mipmap_indication.string() << "0.dds" << std::endl;
+			}
+			if (saved_miplevel_count == 0) failed_count++;
+			saved_miplevels->set_value(saved_miplevel_count);
+			messages.push(log.str());
+			finish_save(range_index, saved_miplevel_count > 0);
+		});
+	});
+}
+
+std::shared_future<size_t> TextureEncoder::replace_last_save(const std::filesystem::path& filename_until_mipmap_indication,
+	std::shared_future<size_t> this_save)
+{
+	if (last_save_by_path.size() >= max_remembered_textures) {
+		// Saves that are done cannot delay a later one anymore
+		std::erase_if(last_save_by_path, [](const auto& entry) {
+			return entry.second.wait_for(std::chrono::seconds(0)) == std::future_status::ready;
+		});
+	}
+	std::shared_future<size_t>& last_save = last_save_by_path[filename_until_mipmap_indication.generic_string()];
+	std::shared_future<size_t> previous_save = last_save;
+	last_save = this_save;
+	return previous_save;
+}
+
+size_t TextureEncoder::encode_or_link(const DirectX::Image& image, std::filesystem::path filename_until_mipmap_indication, size_t mipmap_count,
+	DXGI_FORMAT format, const BlockPassthrough& passthrough, std::shared_future<size_t> saved_miplevels, std::ostream& log)
+{
+	ProfileScope hash_scope("hash_pixels", filename_until_mipmap_indication.string());
+	ContentHasher hasher;
+	hasher.add_value(uint64_t(image.width));
+	hasher.add_value(uint64_t(image.height));
+	hasher.add_value(uint64_t(format));
+	hasher.add_value(uint64_t(mipmap_count));
+	if (passthrough.decoded_tiles) {
+		// Only the decoded tiles were read back, the rest of the texture comes from the original
+		std::string source_path = passthrough.source_until_mipmap_indication.generic_string();
+		hasher.add_value(uint64_t(source_path.size()));
+		hasher.add(source_path);
+	}
+	hasher.add(image.pixels, image.slicePitch);
+	ContentHash hash = hasher.finish();
+	hash_scope.end();
+
+	return link_or_encode(hash, filename_until_mipmap_indication, uint64_t(image.width) * image.height, saved_miplevels, log, [&] {
+		return dx_image_to_dds_mipmaps(image, filename_until_mipmap_indication, mipmap_count, format, log, passthrough);
+	});
+}
+
+size_t TextureEncoder::link_or_encode(const ContentHash& hash, const std::filesystem::path& filename_until_mipmap_indication, uint64_t texels,
+	std::shared_future<size_t> saved_miplevels, std::ostream& log, const std::function<size_t()>& encode)
+{
+	std::string path_key = filename_until_mipmap_indication.generic_string();
+	EncodedTexture source;
+	bool is_duplicate = false;
+	{
+		std::lock_guard<std::mutex> lock(encoded_textures_mutex);
+		// The file of an entry must not be used anymore once the path has been saved with other pixels
+		auto previous_hash = hash_by_path.find(path_key);
+		if (previous_hash != hash_by_path.end() && previous_hash->second != hash) {
+			auto replaced = encoded_textures.find(previous_hash->second);
+			if (replaced != encoded_textures.end() && replaced->second.filename_until_mipmap_indication == filename_until_mipmap_indication) {
+				encoded_textures.erase(replaced);
+			}
+		}
+		if (encoded_textures.size() >= max_remembered_textures || hash_by_path.size() >= max_remembered_textures) {
+			encoded_textures.clear();
+			hash_by_path.clear();
+		}
+		hash_by_path[path_key] = hash;
+
+		auto found = encoded_textures.find(hash);
+		if (found != encoded_textures.end() && found->second.filename_until_mipmap_indication != filename_until_mipmap_indication) {
+			source = found->second;
+			is_duplicate = true;
+		}
+		else {
+			encoded_textures[hash] = EncodedTexture{ filename_until_mipmap_indication, saved_miplevels };
+		}
+	}
+
+	if (is_duplicate) {
+		// The source task was started before this one and is not waiting for it
+		size_t source_miplevels = source.saved_miplevels.get();
+		bool is_linked = source_miplevels > 0;
+		for (size_t i = 0; i < source_miplevels && is_linked; i++) {
+			is_linked = output_sink::link_file(miplevel_path(source.filename_until_mipmap_indication, i), miplevel_path(filename_until_mipmap_indication, i));
+		}
+		if (is_linked) {
+			linked_count++;
+			linked_texels += texels;
+			log << "Same pixels as " << source.filename_until_mipmap_indication.string() << ", linked " << source_miplevels
+				<< " miplevels for " << filename_until_mipmap_indication.string() << std::endl;
+			return source_miplevels;
+		}
+		log << "Could not link to " << source.filename_until_mipmap_indication.string() << ", compress again" << std::endl;
+		std::lock_guard<std::mutex> lock(encoded_textures_mutex);
+		encoded_textures[hash] = EncodedTexture{ filename_until_mipmap_indication, saved_miplevels };
+	}
+	return encode();
+}
+
+struct TextureEncoder::BandedSave {
+	std::filesystem::path filename_until_mipmap_indication;
+	size_t width = 0;
+	size_t height = 0;
+	size_t mipmap_count = 0;
+	DXGI_FORMAT format = DXGI_FORMAT_UNKNOWN;
+	size_t range_index = 0;
+	const SourceResolver* resolver = nullptr;
+	output_sink::Capture* capture = nullptr;
+	std::shared_ptr<std::promise<size_t>> saved_miplevels;
+	std::shared_future<size_t> this_save;
+	std::shared_future<size_t> previous_save;
+	std::shared_future<void> last_task; // Only used on the GL thread
+
+	// Only used by the tasks, which run one after the other
+	ContentHasher hasher;
+	std::unique_ptr<DdsBandWriter> writer;
+	size_t written_mipmap_count = 0;
+	bool is_failed = false;
+	std::ostringstream log;
+};
+
+void TextureEncoder::submit_banded_task(const std::shared_ptr<BandedSave>& save, std::function<void(BandedSave& save)> task)
+{
+	auto is_done = std::make_shared<std::promise<void>>();
+	std::shared_future<void> previous_task = save->last_task;
+	save->last_task = is_done->get_future().share();
+	// Tasks are started in the order they are submitted, so the previous one is running or done
+	workers.submit([save, task = std::move(task), previous_task, is_done] {
+		if (previous_task.valid()) previous_task.wait();
+		SourceResolverScope resolver_scope(save->resolver);
+		output_sink::CaptureScope capture_scope(save->capture);
+		try {
+			task(*save);
+		}
+		catch (const std::exception& exception) {
+			save->log << "Could not save " << save->filename_until_mipmap_indication.string() << "0.dds: " << exception.what() << std::endl;
+			save->is_failed = true;
+		}
+		catch (...) {
+			save->log << "Could not save " << save->filename_until_mipmap_indication.string() << "0.dds" << std::endl;
+			save->is_failed = true;
+		}
+		is_done->set_value();
+	});
+}
+
+std::shared_ptr<TextureEncoder::BandedSave> TextureEncoder::begin_banded_save(std::filesystem::path filename_until_mipmap_indication,
+	size_t width, size_t height, size_t mipmap_count, DXGI_FORMAT format)
+{
+	if (mipmap_count == 0) return nullptr;
+	// The textures before take their place in last_save_by_path once they are read back
+	readback_ring.finish();
+	saved_count++;
+	auto save = std::make_shared<BandedSave>();
+	save->filename_until_mipmap_indication = filename_until_mipmap_indication;
+	save->width = width;
+	save->height = height;
+	save->mipmap_count = mipmap_count;
+	save->format = format;
+	save->resolver = source_resolver;
+	save->capture = capture;
+	{
+		std::lock_guard<std::mutex> lock(save_ranges_mutex);
+		save->range_index = first_range_index + save_ranges.size() - 1;
+		save_ranges.back().unfinished_count++;
+	}
+	save->saved_miplevels = std::make_shared<std::promise<size_t>>();
+	save->this_save = save->saved_miplevels->get_future().share();
+	save->previous_save = replace_last_save(filename_until_mipmap_indication, save->this_save);
+
+	workers.wait_until_fewer_than(max_queued_tasks);
+	print_messages();
+	submit_banded_task(save, [](BandedSave& save) {
+		if (save.previous_save.valid()) save.previous_save.wait();
+		// As by encode_or_link, so that a copy of a texture saved as a whole is found, too
+		save.hasher.add_value(uint64_t(save.width));
+		save.hasher.add_value(uint64_t(save.height));
+		save.hasher.add_value(uint64_t(save.format));
+		save.hasher.add_value(uint64_t(save.mipmap_count));
+		// Generate mipmaps also if the original did not have them, as dx_image_to_dds_mipmaps does
+		save.written_mipmap_count = save.mipmap_count == 1 && save.width >= 32 && save.height >= 32 ? 4 : save.mipmap_count;
+		save.writer = std::make_unique<DdsBandWriter>(save.filename_until_mipmap_indication, save.width, save.height,
+			save.written_mipmap_count, save.format);
+	});
+	return save;
+}
+
+void TextureEncoder::add_band(const std::shared_ptr<BandedSave>& save, const uint8_t* pixels)
+{
+	if (!save) return;
+	workers.wait_until_fewer_than(max_queued_tasks);
+	print_messages();
+	// Waits while the textures queued before hold too much of the --memory_budget_mb
+	auto encode_reservation = std::make_shared<MemoryReservation>(estimate_encode_memory_bytes(save->width, band_rows), true);
+	size_t band_bytes = save->width * band_rows * 4;
+	auto band_memory = std::make_shared<TrackedAllocation>(memory_accounting::Category::mip_scratch, band_bytes);
+	auto band = std::make_shared<std::vector<uint8_t>>(pixels, pixels + band_bytes);
+	submit_banded_task(save, [encode_reservation, band_memory, band](BandedSave& save) {
+		if (save.is_failed) return;
+		ProfileScope band_scope("encode_band", save.filename_until_mipmap_indication.string());
+		save.hasher.add(band->data(), band->size());
+		DirectX::Image image{};
+		image.width = save.width;
+		image.height = band_rows;
+		image.format = DXGI_FORMAT_R8G8B8A8_UNORM;
+		image.rowPitch = save.width * 4;
+		image.slicePitch = band->size();
+		image.pixels = band->data();
+		HRESULT hr = save.writer->add_band(image);
+		if (FAILED(hr)) {
+			save.log << "Could not save the miplevels of " << save.filename_until_mipmap_indication.string() << "0.dds in bands, error "
+				<< static_cast<unsigned int>(hr) << std::endl;
+			save.is_failed = true;
+		}
+	});
+}
+
+void TextureEncoder::finish_banded_save(const std::shared_ptr<BandedSave>& save, bool is_complete)
+{
+	if (!save) return;
+	workers.wait_until_fewer_than(max_queued_tasks);
+	submit_banded_task(save, [this, is_complete](BandedSave& save) {
+		size_t saved_miplevel_count = 0;
+		if (!is_complete) {
+			save.log << "Could not draw all tiles of " << save.filename_until_mipmap_indication.string() << "0.dds, it is not saved" << std::endl;
+		}
+		else if (!save.is_failed) {
+			try {
+				saved_miplevel_count = link_or_encode(save.hasher.finish(), save.filename_until_mipmap_indication,
+					uint64_t(save.width) * save.height, save.this_save, save.log, [&] {
+						HRESULT hr = save.writer->finish();
+						if (FAILED(hr)) {
+							save.log << "Could not save the miplevels of " << save.filename_until_mipmap_indication.string()
+								<< "0.dds in bands, error " << static_cast<unsigned int>(hr) << std::endl;
+							return size_t(0);
+						}
+						save.log << "Saved " << save.written_mipmap_count << " miplevels for " << save.filename_until_mipmap_indication.string() << std::endl;
+						return save.written_mipmap_count;
+					});
+			}
+			catch (const std::exception& exception) {
+				save.log << "Could not save " << save.filename_until_mipmap_indication.string() << "0.dds: " << exception.what() << std::endl;
+			}
+		}
+		// Removes the files that were not finished: a copy is linked, a failed texture keeps its earlier files
+		save.writer.reset();
+		if (saved_miplevel_count == 0) failed_count++;
+		save.saved_miplevels->set_value(saved_miplevel_count);
+		messages.push(save.log.str());
+		finish_save(save.range_index, saved_miplevel_count > 0);
+	});
+}
+
+void TextureEncoder::set_file_scopes(const SourceResolver* resolver, output_sink::Capture* capture)
+{
+	source_resolver = resolver;
+	this->capture = capture;
+}
+
+void TextureEncoder::when_written(std::function<void(size_t failed_count)> on_written)
+{
+	std::lock_guard<std::mutex> lock(save_ranges_mutex);
+	save_ranges.back().on_written = std::move(on_written);
+	save_ranges.emplace_back();
+}
+
+bool TextureEncoder::has_unwritten_ranges()
+{
+	std::lock_guard<std::mutex> lock(save_ranges_mutex);
+	return save_ranges.size() > 1;
+}
+
+void TextureEncoder::finish_save(size_t range_index, bool is_saved)
+{
+	std::lock_guard<std::mutex> lock(save_ranges_mutex);
+	SaveRange& range = save_ranges[range_index - first_range_index];
+	range.unfinished_count--;
+	if (!is_saved) range.failed_count++;
+}
+
+void TextureEncoder::call_written_callbacks()
+{
+	while (true) {
+		SaveRange written_range;
+		{
+			std::lock_guard<std::mutex> lock(save_ranges_mutex);
+			// The last range is still open
+			if (save_ranges.size() < 2 || save_ranges.front().unfinished_count > 0) return;
+			written_range = std::move(save_ranges.front());
+			save_ranges.pop_front();
+			first_range_index++;
+		}
+		// Without the lock: the callback may queue textures or call when_written()
+		if (written_range.on_written) written_range.on_written(written_range.failed_count);
+	}
+}
+
+void TextureEncoder::print_messages()
+{
+	std::vector<std::string> finished_messages;
+	messages.try_pop_all(&finished_messages);
+	for (const std::string& message : finished_messages) std::cout << message;
+}
+
+void TextureEncoder::print_statistics()
+{
+	std::cout << "Saved " << saved_count << " textures as .dds, " << linked_count << " of them ("
+		<< linked_texels / 1000000 << " megapixels) were identical to one compressed before and linked to it" << std::endl;
+}
+
+void TextureEncoder::poll()
+{
+	readback_ring.poll();
+	print_messages();
+	call_written_callbacks();
+}
+
+void TextureEncoder::finish()
+{
+	readback_ring.finish();
+	workers.wait();
+	print_messages();
+	call_written_callbacks();
+	// The files may be changed before the next run, it must not link to them
+	last_save_by_path.clear();
+	std::lock_guard<std::mutex> lock(encoded_textures_mutex);
+	encoded_textures.clear();
+	hash_by_path.clear();
+}
+
+void TextureEncoder::cleanup()
+{
+	finish();
+	readback_ring.cleanup();
+}
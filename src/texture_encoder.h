@@ -0,0 +1,130 @@
+#pragma once
+#include <string>
+#include <filesystem>
+#include <future>
+#include <mutex>
+#include <atomic>
+#include <unordered_map>
+#include <deque>
+#include <functional>
+#include <iostream>
+#include "../external/glew-2.2.0/include/GL/glew.h"
+#include "../external/DirectXTex/DirectXTex.h"
+
+#include "dds2gl.h"
+#include "readback_ring.h"
+#include "thread_pool.h"
+#include "blocking_queue.h"
+#include "content_hash.h"
+#include "mapped_file.h"
+#include "output_sink.h"
+
+/*
+Saves snowed textures as .dds mipmaps without stalling the GL thread: the readback goes through a ReadbackRing,
+mipmap generation, block compression and writing run on worker threads.
+The messages of the workers are printed by the GL thread (poll()), because planning redirects std::cout.
+
+The read back pixels are hashed (SHA-256, see content_hash.h). Mods often ship copies of the same texture under different paths: if they are used
+the same way, the snowed textures are identical, and only the first one is compressed. The other paths are
+hard-linked to its .dds files (see output_sink::link_file). The hashes are forgotten by finish(), so a run does not
+link to files of an earlier one, and when too many have been collected.
+
+Textures processed in tiles (see Texture::is_tiled) are never read back as a whole: their bands are handed over one by
+one (begin_banded_save()), and the workers hash, mipmap, compress and append each band in order while the next ones are
+drawn. The hash is complete with the last band, a texture found to be a copy then drops its files and is linked.
+*/
+
+class TextureEncoder
+{
+public:
+	TextureEncoder(size_t thread_count = 2, size_t readback_buffer_count = 4);
+	~TextureEncoder();
+
+	TextureEncoder(const TextureEncoder&) = delete;
+	TextureEncoder& operator=(const TextureEncoder&) = delete;
+
+	// Like gl_texture_to_dds_mipmaps, but returns before the texture is read back. The texture may be deleted afterwards.
+	void save_dds(GLuint texture_id, std::filesystem::path filename_until_mipmap_indication, size_t mipmap_count, DXGI_FORMAT format,
+		BlockPassthrough passthrough = BlockPassthrough());
+	// A texture whose pixels arrive in bands, see begin_banded_save()
+	struct BandedSave;
+	// Like save_dds, for a texture whose pixels are handed over with add_band(), from row 0 on. Its sides must be
+	// multiples of band_rows (see dds2gl.h).
+	std::shared_ptr<BandedSave> begin_banded_save(std::filesystem::path filename_until_mipmap_indication, size_t width, size_t height,
+		size_t mipmap_count, DXGI_FORMAT format);
+	// pixels: width x band_rows RGBA8 texels, copied before returning. Waits while too many bands are queued.
+	void add_band(const std::shared_ptr<BandedSave>& save, const uint8_t* pixels);
+	// is_complete false: not all bands could be drawn, nothing is saved and the texture counts as failed
+	void finish_banded_save(const std::shared_ptr<BandedSave>& save, bool is_complete = true);
+	// The workers read the original .dds files through resolver and write into capture, for the textures queued
+	// afterwards. Both may be nullptr, they must outlive the queued textures.
+	void set_file_scopes(const SourceResolver* resolver, output_sink::Capture* capture);
+	// Hands finished readbacks to the workers and prints their messages, without waiting
+	void poll();
+	// Calls on_written on the GL thread, from poll() or finish(), once the textures queued since the last call are
+	// written, with the number of them that could not be saved. The caller can go on with the next textures meanwhile.
+	void when_written(std::function<void(size_t failed_count)> on_written);
+	// Whether a callback of when_written() has not been called yet
+	bool has_unwritten_ranges();
+	// Waits until all textures are written and forgets them for the deduplication
+	void finish();
+	// Must be called before the GL context is destroyed
+	void cleanup();
+
+	size_t get_saved_count() const { return saved_count; }
+	// Textures that could not be written, they are only known to have failed after finish()
+	size_t get_failed_count() const { return failed_count; }
+	void print_statistics();
+
+private:
+	// The first texture with the same pixels that was submitted for compression
+	struct EncodedTexture {
+		std::filesystem::path filename_until_mipmap_indication;
+		std::shared_future<size_t> saved_miplevels; // Result of dx_image_to_dds_mipmaps
+	};
+
+	void print_messages();
+	// Runs on a worker, or on the GL thread if the readback could not be copied
+	void finish_save(size_t range_index, bool is_saved);
+	void call_written_callbacks();
+	// Runs on a worker
+	size_t encode_or_link(const DirectX::Image& image, std::filesystem::path filename_until_mipmap_indication, size_t mipmap_count,
+		DXGI_FORMAT format, const BlockPassthrough& passthrough, std::shared_future<size_t> saved_miplevels, std::ostream& log);
+	// Links to the files of a texture with the same hash saved under another path, or calls encode(), which returns
+	// the number of saved miplevels. Runs on a worker.
+	size_t link_or_encode(const ContentHash& hash, const std::filesystem::path& filename_until_mipmap_indication, uint64_t texels,
+		std::shared_future<size_t> saved_miplevels, std::ostream& log, const std::function<size_t()>& encode);
+	// Makes this_save the last save of the path and returns the one before, on the GL thread
+	std::shared_future<size_t> replace_last_save(const std::filesystem::path& filename_until_mipmap_indication, std::shared_future<size_t> this_save);
+	// Runs task on a worker after the task submitted for the save before
+	void submit_banded_task(const std::shared_ptr<BandedSave>& save, std::function<void(BandedSave& save)> task);
+
+	ReadbackRing readback_ring;
+	ThreadPool workers;
+	size_t max_queued_tasks;
+	BlockingQueue<std::string> messages;
+	size_t saved_count = 0;
+	const SourceResolver* source_resolver = nullptr;
+	output_sink::Capture* capture = nullptr;
+
+	// The last save of each path, only used on the GL thread. Atlas mode saves a path again, the later version has to win.
+	std::unordered_map<std::string, std::shared_future<size_t>> last_save_by_path;
+
+	std::mutex encoded_textures_mutex;
+	// By hash of the pixels, size, mipmap count, format and the original of the blocks passed through
+	std::unordered_map<ContentHash, EncodedTexture, ContentHashHasher> encoded_textures;
+	std::unordered_map<std::string, ContentHash> hash_by_path; // For removing entries whose file has been replaced
+	std::atomic<size_t> failed_count = 0;
+
+	// The textures queued between two calls of when_written()
+	struct SaveRange {
+		size_t unfinished_count = 0;
+		size_t failed_count = 0;
+		std::function<void(size_t failed_count)> on_written;
+	};
+	std::mutex save_ranges_mutex;
+	std::deque<SaveRange> save_ranges; // The last one is open, textures queued now are counted in it
+	size_t first_range_index = 0; // Of save_ranges.front(), ranges are numbered in the order they were opened
+	std::atomic<size_t> linked_count = 0;
+	std::atomic<uint64_t> linked_texels = 0;
+};
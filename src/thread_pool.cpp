@@ -0,0 +1,76 @@
+#include "thread_pool.h"
+
+#include <atomic>
+
+ThreadPool::ThreadPool(size_t thread_count)
+{
+	if (thread_count == 0) thread_count = std::thread::hardware_concurrency();
+	if (thread_count == 0) thread_count = 1; // hardware_concurrency() may not know
+	workers.reserve(thread_count);
+	for (size_t i = 0; i < thread_count; i++) workers.emplace_back(&ThreadPool::work, this);
+}
+
+ThreadPool::~ThreadPool()
+{
+	{
+		std::lock_guard<std::mutex> lock(tasks_mutex);
+		is_stopping = true;
+	}
+	task_available.notify_all();
+	for (std::thread& worker : workers) worker.join();
+}
+
+void ThreadPool::submit(std::function<void()> task)
+{
+	{
+		std::lock_guard<std::mutex> lock(tasks_mutex);
+		tasks.push_back(std::move(task));
+	}
+	task_available.notify_one();
+}
+
+void ThreadPool::wait()
+{
+	std::unique_lock<std::mutex> lock(tasks_mutex);
+	all_done.wait(lock, [this] { return tasks.empty() && active_task_count == 0; });
+}
+
+void ThreadPool::wait_until_fewer_than(size_t task_count)
+{
+	std::unique_lock<std::mutex> lock(tasks_mutex);
+	all_done.wait(lock, [this, task_count] { return tasks.size() + active_task_count < task_count; });
+}
+
+void ThreadPool::parallel_for(size_t count, const std::function<void(size_t)>& task)
+{
+	// One task per worker that takes indices from a shared counter, instead of one task per index
+	std::atomic<size_t> next_index = 0;
+	size_t task_count = count < workers.size() ? count : workers.size();
+	for (size_t t = 0; t < task_count; t++) {
+		submit([&] {
+			for (size_t i = next_index++; i < count; i = next_index++) task(i);
+		});
+	}
+	wait();
+}
+
+void ThreadPool::work()
+{
+	while (true) {
+		std::function<void()> task;
+		{
+			std::unique_lock<std::mutex> lock(tasks_mutex);
+			task_available.wait(lock, [this] { return is_stopping || !tasks.empty(); });
+			if (tasks.empty()) return; // Stopping and nothing left to do
+			task = std::move(tasks.front());
+			tasks.pop_front();
+			active_task_count++;
+		}
+		task();
+		{
+			std::lock_guard<std::mutex> lock(tasks_mutex);
+			active_task_count--;
+		}
+		all_done.notify_all();
+	}
+}
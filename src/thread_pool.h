@@ -0,0 +1,44 @@
+#pragma once
+#include <vector>
+#include <deque>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+
+/*
+Fixed number of worker threads executing tasks from a shared queue.
+Only for CPU work: the GL context belongs to the main thread.
+*/
+
+class ThreadPool
+{
+public:
+	// 0 = one thread per hardware thread
+	ThreadPool(size_t thread_count = 0);
+	~ThreadPool();
+
+	ThreadPool(const ThreadPool&) = delete;
+	ThreadPool& operator=(const ThreadPool&) = delete;
+
+	void submit(std::function<void()> task);
+	// Blocks until all submitted tasks are done
+	void wait();
+	// Blocks until fewer than task_count tasks are queued or running, to keep producers from running far ahead
+	void wait_until_fewer_than(size_t task_count);
+	size_t size() const { return workers.size(); }
+
+	// Calls task(i) for each i in [0, count) and waits for all of them
+	void parallel_for(size_t count, const std::function<void(size_t)>& task);
+
+private:
+	void work();
+
+	std::vector<std::thread> workers;
+	std::deque<std::function<void()>> tasks;
+	std::mutex tasks_mutex;
+	std::condition_variable task_available;
+	std::condition_variable all_done;
+	size_t active_task_count = 0;
+	bool is_stopping = false;
+};
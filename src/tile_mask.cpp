@@ -0,0 +1,121 @@
+#include "tile_mask.h"
+
+#include <cmath>
+
+TileMask::TileMask(int texture_width, int texture_height)
+{
+	width = texture_width > 0 ? texture_width : 1;
+	height = texture_height > 0 ? texture_height : 1;
+	columns = (width + tile_size - 1) / tile_size;
+	rows = (height + tile_size - 1) / tile_size;
+	marks.assign(size_t(columns) * rows, 0);
+}
+
+// Splits [min, max] into at most two ranges of tiles inside [0, size), like GL_REPEAT
+static int wrap_tile_ranges(double min, double max, int size, int count, int ranges[2][2])
+{
+	if (max - min >= size) {
+		ranges[0][0] = 0;
+		ranges[0][1] = count - 1;
+		return 1;
+	}
+	double wrapped_min = min - std::floor(min / size) * size;
+	double wrapped_max = wrapped_min + (max - min);
+	auto tile_of = [count](double texel) {
+		int tile = int(texel / TileMask::tile_size);
+		return tile < 0 ? 0 : (tile >= count ? count - 1 : tile);
+	};
+	ranges[0][0] = tile_of(wrapped_min);
+	if (wrapped_max < size) {
+		ranges[0][1] = tile_of(wrapped_max);
+		return 1;
+	}
+	ranges[0][1] = count - 1;
+	ranges[1][0] = 0;
+	ranges[1][1] = tile_of(wrapped_max - size);
+	return 2;
+}
+
+void TileMask::mark_texel_rectangle(double x_min, double y_min, double x_max, double y_max)
+{
+	if (!(x_min <= x_max) || !(y_min <= y_max) || !std::isfinite(x_max - x_min) || !std::isfinite(y_max - y_min)) {
+		mark_all();
+		return;
+	}
+	int column_ranges[2][2];
+	int row_ranges[2][2];
+	int column_range_count = wrap_tile_ranges(x_min, x_max, width, columns, column_ranges);
+	int row_range_count = wrap_tile_ranges(y_min, y_max, height, rows, row_ranges);
+	for (int i = 0; i < row_range_count; i++) {
+		for (int row = row_ranges[i][0]; row <= row_ranges[i][1]; row++) {
+			for (int j = 0; j < column_range_count; j++) {
+				for (int column = column_ranges[j][0]; column <= column_ranges[j][1]; column++) {
+					marks[size_t(row) * columns + column] = 1;
+				}
+			}
+		}
+	}
+}
+
+void TileMask::mark_triangle(const float u[3], const float v[3])
+{
+	// A coordinate that is not a number would be skipped by the comparisons below
+	for (int i = 0; i < 3; i++) {
+		if (!std::isfinite(u[i]) || !std::isfinite(v[i])) {
+			mark_all();
+			return;
+		}
+	}
+	// Conservative: the bounding rectangle of the triangle, with one texel of margin for filtering
+	double u_min = u[0], u_max = u[0], v_min = v[0], v_max = v[0];
+	double fract_u_min = 1., fract_u_max = 0., fract_v_min = 1., fract_v_max = 0.;
+	for (int i = 0; i < 3; i++) {
+		if (u[i] < u_min) u_min = u[i];
+		if (u[i] > u_max) u_max = u[i];
+		if (v[i] < v_min) v_min = v[i];
+		if (v[i] > v_max) v_max = v[i];
+		double fract_u = u[i] - std::floor(u[i]);
+		double fract_v = v[i] - std::floor(v[i]);
+		if (fract_u < fract_u_min) fract_u_min = fract_u;
+		if (fract_u > fract_u_max) fract_u_max = fract_u;
+		if (fract_v < fract_v_min) fract_v_min = fract_v;
+		if (fract_v > fract_v_max) fract_v_max = fract_v;
+	}
+	// Sampled with GL_REPEAT
+	mark_texel_rectangle(u_min * width - 1., v_min * height - 1., u_max * width + 1., v_max * height + 1.);
+	// Drawn by the snow pass
+	if (std::floor(u_min) != std::floor(u_max) || std::floor(v_min) != std::floor(v_max)) {
+		mark_texel_rectangle(fract_u_min * width - 1., fract_v_min * height - 1., fract_u_max * width + 1., fract_v_max * height + 1.);
+	}
+}
+
+void TileMask::mark_all()
+{
+	marks.assign(marks.size(), 1);
+}
+
+void TileMask::dilate()
+{
+	std::vector<uint8_t> dilated = marks;
+	for (int row = 0; row < rows; row++) {
+		for (int column = 0; column < columns; column++) {
+			if (!is_marked(column, row)) continue;
+			// Neighbours across the edge are those of the next repetition, like GL_REPEAT
+			for (int row_offset = -1; row_offset <= 1; row_offset++) {
+				for (int column_offset = -1; column_offset <= 1; column_offset++) {
+					int neighbour_row = (row + row_offset + rows) % rows;
+					int neighbour_column = (column + column_offset + columns) % columns;
+					dilated[size_t(neighbour_row) * columns + neighbour_column] = 1;
+				}
+			}
+		}
+	}
+	marks = dilated;
+}
+
+size_t TileMask::get_marked_count() const
+{
+	size_t marked_count = 0;
+	for (uint8_t mark : marks) marked_count += mark;
+	return marked_count;
+}
@@ -0,0 +1,48 @@
+#pragma once
+#include <cstdint>
+#include <cstddef>
+#include <vector>
+
+/*
+The parts of a texture the snow pass can touch, in tiles of 64x64 texels (16x16 blocks of the block-compressed formats).
+
+Only the triangles that can receive snow are marked, at their texture coordinates: the snowmap is only drawn there,
+the normal map is only sampled there and the combine pass only changes the texels there. The tiles around them are
+marked too (dilate()), because the combine pass reads neighbouring texels.
+Textures are decoded only in the marked tiles, and the blocks of the other tiles are copied from the original
+.dds files when saving, instead of being compressed again (see dds_file_to_gl_texture and dx_image_to_dds_mipmaps).
+*/
+
+class TileMask
+{
+public:
+	static constexpr int tile_size = 64; // Texels at miplevel 0, a multiple of the 4x4 blocks
+
+	// Size of miplevel 0 of the texture in texels
+	TileMask(int texture_width, int texture_height);
+
+	// Marks the tiles under a triangle, given by its texture coordinates. The snow pass draws each vertex at the
+	// fractional part of its coordinates, while the textures are sampled with GL_REPEAT: both are marked.
+	void mark_triangle(const float u[3], const float v[3]);
+	void mark_all();
+	// Also marks the 8 neighbours of each marked tile
+	void dilate();
+
+	bool is_marked(int column, int row) const { return marks[size_t(row) * columns + column] != 0; }
+	int get_columns() const { return columns; }
+	int get_rows() const { return rows; }
+	int get_width() const { return width; }
+	int get_height() const { return height; }
+	size_t get_marked_count() const;
+	bool is_everything_marked() const { return get_marked_count() == marks.size(); }
+
+private:
+	// Texel coordinates, may be outside of the texture: they wrap around
+	void mark_texel_rectangle(double x_min, double y_min, double x_max, double y_max);
+
+	int width;
+	int height;
+	int columns;
+	int rows;
+	std::vector<uint8_t> marks;
+};
@@ -0,0 +1,79 @@
+#include "tests.h"
+
+#include <iostream>
+#include <vector>
+#include <string>
+#include <exception>
+
+namespace fs = std::filesystem;
+
+struct Test {
+	const char* name;
+	TestFunction function;
+};
+
+// Registered by the static TestRegistrations, before main()
+static std::vector<Test>& get_tests()
+{
+	static std::vector<Test> tests;
+	return tests;
+}
+
+static size_t failure_count = 0;
+static std::vector<fs::path> test_directories;
+
+TestRegistration::TestRegistration(const char* name, TestFunction function)
+{
+	get_tests().push_back(Test{ name, function });
+}
+
+void report_failure(const char* file, int line, const char* expression)
+{
+	std::cout << "FAILED: " << fs::path(file).filename().string() << ":" << line << ": " << expression << std::endl;
+	failure_count++;
+}
+
+fs::path make_test_directory(const char* name)
+{
+	fs::path directory = fs::temp_directory_path() / "libsnowgen_tests" / name;
+	std::error_code error;
+	fs::remove_all(directory, error);
+	fs::create_directories(directory);
+	test_directories.push_back(directory);
+	return directory;
+}
+
+// Runs the tests whose names contain the first argument, or all of them
+int main(int argc, char* argv[])
+{
+	std::string filter = argc > 1 ? argv[1] : "";
+	size_t test_count = 0;
+	size_t failed_test_count = 0;
+	for (const Test& test : get_tests()) {
+		if (std::string(test.name).find(filter) == std::string::npos) continue;
+		std::cout << test.name << std::endl;
+		size_t failures_before = failure_count;
+		try {
+			test.function();
+		}
+		catch (const std::exception& exception) {
+			report_failure(test.name, 0, (std::string("unexpected exception: ") + exception.what()).c_str());
+		}
+		catch (...) {
+			report_failure(test.name, 0, "unexpected exception");
+		}
+		for (const fs::path& directory : test_directories) {
+			std::error_code error;
+			fs::remove_all(directory, error);
+		}
+		test_directories.clear();
+		test_count++;
+		if (failure_count > failures_before) failed_test_count++;
+	}
+	if (failed_test_count > 0) {
+		std::cout << failed_test_count << " of " << test_count << " tests failed" << std::endl;
+		return 1;
+	}
+	std::cout << "All " << test_count << " tests passed" << std::endl;
+	return 0;
+}
@@ -0,0 +1,130 @@
+#include "tests.h"
+#include "../src/atlas_snowmaps.h"
+
+#include <vector>
+#include <cstdint>
+
+static std::vector<uint16_t> round_trip(const std::vector<uint16_t>& values)
+{
+	std::vector<uint16_t> encoded;
+	AtlasSnowmaps::encode(values.data(), values.size(), &encoded);
+	std::vector<uint16_t> decoded(values.size(), 0x1234);
+	if (!AtlasSnowmaps::decode(encoded, decoded.size(), decoded.data())) decoded.clear();
+	return decoded;
+}
+
+TEST(atlas_encode_of_a_cleared_snowmap_is_one_run)
+{
+	std::vector<uint16_t> values(4096, 0xFFFF);
+	std::vector<uint16_t> encoded;
+	AtlasSnowmaps::encode(values.data(), values.size(), &encoded);
+	CHECK(encoded == std::vector<uint16_t>({ uint16_t(0x8000 | 4095), 0xFFFF }));
+	CHECK(round_trip(values) == values);
+}
+
+TEST(atlas_encode_copies_short_runs)
+{
+	std::vector<uint16_t> values = { 1, 2, 2, 3, 3, 3, 4 };
+	std::vector<uint16_t> encoded;
+	AtlasSnowmaps::encode(values.data(), values.size(), &encoded);
+	// Copy of 1 2 2, run of three 3, copy of 4
+	CHECK(encoded == std::vector<uint16_t>({ 2, 1, 2, 2, 0x8002, 3, 0, 4 }));
+	CHECK(round_trip(values) == values);
+}
+
+TEST(atlas_encode_splits_long_runs_and_copies)
+{
+	std::vector<uint16_t> values(0x8000 * 2 + 5, 7);
+	for (size_t i = 0; i < 0x8000 + 10; i++) values.push_back(uint16_t(i));
+	CHECK(round_trip(values) == values);
+
+	std::vector<uint16_t> encoded;
+	AtlasSnowmaps::encode(values.data(), values.size(), &encoded);
+	for (size_t i = 0; i < encoded.size();) {
+		size_t length = size_t(encoded[i] & 0x7FFF) + 1;
+		CHECK(length <= 0x8000);
+		i += (encoded[i] & 0x8000) ? 2 : 1 + length;
+	}
+}
+
+TEST(atlas_encode_of_nothing_is_empty)
+{
+	std::vector<uint16_t> encoded = { 1, 2 };
+	AtlasSnowmaps::encode(nullptr, 0, &encoded);
+	CHECK(encoded.empty());
+	CHECK(AtlasSnowmaps::decode(encoded, 0, nullptr));
+}
+
+TEST(atlas_decode_rejects_wrong_counts)
+{
+	std::vector<uint16_t> values = { 5, 5, 5, 5, 9 };
+	std::vector<uint16_t> encoded;
+	AtlasSnowmaps::encode(values.data(), values.size(), &encoded);
+	std::vector<uint16_t> decoded(8);
+	CHECK(!AtlasSnowmaps::decode(encoded, 4, decoded.data())); // Too many values
+	CHECK(!AtlasSnowmaps::decode(encoded, 6, decoded.data())); // Too few values
+	CHECK(AtlasSnowmaps::decode(encoded, 5, decoded.data()));
+
+	// Cut off in the middle of a run and of a copy
+	CHECK(!AtlasSnowmaps::decode(std::vector<uint16_t>({ 0x8003 }), 4, decoded.data()));
+	CHECK(!AtlasSnowmaps::decode(std::vector<uint16_t>({ 3, 1, 2 }), 4, decoded.data()));
+}
+
+TEST(atlas_spilled_snowmaps_load_again)
+{
+	std::filesystem::path directory = make_test_directory("atlas_spill");
+	std::vector<std::vector<uint16_t>> snowmaps;
+	{
+		AtlasSnowmaps atlas_snowmaps(64, directory / "snowmaps.bin");
+		for (uint16_t id = 0; id < 8; id++) {
+			std::vector<uint16_t> values(256);
+			for (size_t i = 0; i < values.size(); i++) values[i] = uint16_t(i * (id + 1));
+			atlas_snowmaps.store(id, 16, 16, values);
+			snowmaps.push_back(values);
+		}
+		CHECK(atlas_snowmaps.get_spilled_count() > 0);
+		// Stored again: the last version counts
+		snowmaps[0].assign(256, 3);
+		atlas_snowmaps.store(0, 16, 16, snowmaps[0]);
+
+		for (uint16_t id = 0; id < 8; id++) {
+			std::vector<uint16_t> loaded;
+			CHECK(atlas_snowmaps.load(id, 16, 16, &loaded));
+			CHECK(loaded == snowmaps[id]);
+		}
+		std::vector<uint16_t> loaded;
+		CHECK(!atlas_snowmaps.load(1, 32, 8, &loaded)); // Other dimensions
+		CHECK(!atlas_snowmaps.load(100, 16, 16, &loaded));
+
+		std::vector<uint32_t> changed = atlas_snowmaps.take_changed();
+		CHECK(changed.size() == 8 && changed[0] == 0);
+		CHECK(atlas_snowmaps.take_changed().empty());
+	}
+	CHECK(!std::filesystem::exists(directory / "snowmaps.bin"));
+}
+
+TEST(atlas_parts_of_a_tiled_snowmap_are_kept_apart)
+{
+	std::filesystem::path directory = make_test_directory("atlas_parts");
+	AtlasSnowmaps atlas_snowmaps(64, directory / "snowmaps.bin");
+	std::vector<std::vector<uint16_t>> parts;
+	for (uint16_t part = 0; part < 6; part += 2) {
+		std::vector<uint16_t> values(128);
+		for (size_t i = 0; i < values.size(); i++) values[i] = uint16_t(i * (part + 3));
+		atlas_snowmaps.store(7, 16, 8, values, part);
+		parts.push_back(values);
+	}
+	CHECK(atlas_snowmaps.get_spilled_count() > 0);
+
+	for (uint16_t part = 0; part < 6; part += 2) {
+		std::vector<uint16_t> loaded;
+		CHECK(atlas_snowmaps.load(7, 16, 8, &loaded, part));
+		CHECK(loaded == parts[part / 2]);
+	}
+	std::vector<uint16_t> loaded;
+	CHECK(!atlas_snowmaps.load(7, 16, 8, &loaded, 1)); // Skipped
+	CHECK(!atlas_snowmaps.load(7, 16, 8, &loaded, 6)); // Never stored
+
+	// The atlas changed once, however many parts were stored
+	CHECK(atlas_snowmaps.take_changed() == std::vector<uint32_t>({ 7 }));
+}
@@ -0,0 +1,64 @@
+#include "tests.h"
+#include "../src/dependency_index.h"
+
+#include <fstream>
+
+namespace fs = std::filesystem;
+
+static bool is_cfg(std::string_view path)
+{
+	return path.ends_with(".cfg");
+}
+
+TEST(dependencies_map_files_to_their_cfgs)
+{
+	DependencyIndex index;
+	index.set_dependencies("data/house.cfg", { "data/house.rdm", "data/textures/wall_diff_0.dds" });
+	index.set_dependencies("data/tower.cfg", { "data/tower.rdm", "data/textures/wall_diff_0.dds" });
+	CHECK(index.get_cfg_count() == 2);
+
+	CHECK(index.find_affected_cfgs({ "data/house.rdm" }, is_cfg) == std::vector<fs::path>({ "data/house.cfg" }));
+	std::vector<fs::path> affected = index.find_affected_cfgs({ "data/textures/wall_diff_0.dds", "data/house.rdm" }, is_cfg);
+	CHECK(affected == std::vector<fs::path>({ "data/house.cfg", "data/tower.cfg" }));
+	CHECK(index.find_affected_cfgs({ "data/other.rdm" }, is_cfg).empty());
+}
+
+TEST(dependencies_of_a_dds_cover_all_miplevels)
+{
+	DependencyIndex index;
+	index.set_dependencies("house.cfg", { "textures/wall_diff_0.dds" });
+	CHECK(index.find_affected_cfgs({ "textures/wall_diff_3.dds" }, is_cfg).size() == 1);
+	CHECK(index.find_affected_cfgs({ "textures/wall_diff_12.dds" }, is_cfg).size() == 1);
+	CHECK(index.find_affected_cfgs({ "textures/wall_norm_0.dds" }, is_cfg).empty());
+	CHECK(index.find_affected_cfgs({ "textures/wall_diff_0.png" }, is_cfg).empty());
+}
+
+TEST(dependencies_compare_normalized_absolute_paths)
+{
+	DependencyIndex index;
+	index.set_dependencies("data/house.cfg", { "data/meshes/../house.rdm" });
+	CHECK(index.find_affected_cfgs({ fs::absolute("data/house.rdm") }, is_cfg).size() == 1);
+	CHECK(index.find_affected_cfgs({ "./data/./house.rdm" }, is_cfg).size() == 1);
+}
+
+TEST(dependencies_are_replaced)
+{
+	DependencyIndex index;
+	index.set_dependencies("house.cfg", { "old.rdm" });
+	index.set_dependencies("house.cfg", { "new.rdm" });
+	CHECK(index.get_cfg_count() == 1);
+	CHECK(index.find_affected_cfgs({ "old.rdm" }, is_cfg).empty());
+	CHECK(index.find_affected_cfgs({ "new.rdm" }, is_cfg).size() == 1);
+}
+
+TEST(dependencies_include_changed_cfgs_that_exist)
+{
+	fs::path directory = make_test_directory("dependency_index");
+	fs::path cfg_path = directory / "new.cfg";
+	std::ofstream(cfg_path) << "<Config/>";
+
+	DependencyIndex index;
+	CHECK(index.find_affected_cfgs({ cfg_path, cfg_path }, is_cfg) == std::vector<fs::path>({ cfg_path }));
+	// Temporary files of editors may be gone already
+	CHECK(index.find_affected_cfgs({ directory / "deleted.cfg" }, is_cfg).empty());
+}
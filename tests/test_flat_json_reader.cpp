@@ -0,0 +1,67 @@
+#include "tests.h"
+#include "../src/flat_json_reader.h"
+
+#include <string>
+#include <vector>
+#include <utility>
+
+using Fields = std::vector<std::pair<std::string, std::string>>;
+
+static bool read(const std::string& text, Fields* fields, std::string* error = nullptr)
+{
+	std::string ignored_error;
+	FlatJsonReader reader(text);
+	return reader.read_object(fields, error ? error : &ignored_error);
+}
+
+TEST(json_reads_strings_numbers_and_booleans)
+{
+	Fields fields;
+	CHECK(read(" { \"id\": \"job 1\", \"mipmaps\" : 3, \"atlas\":true,\"scale\": -1.5e2 }\r\n", &fields));
+	CHECK(fields == Fields({ { "id", "job 1" }, { "mipmaps", "3" }, { "atlas", "true" }, { "scale", "-1.5e2" } }));
+
+	fields.clear();
+	CHECK(read("{}", &fields));
+	CHECK(fields.empty());
+}
+
+TEST(json_reads_escapes)
+{
+	Fields fields;
+	CHECK(read(R"({"path": "C:\\data\\a \"b\".cfg", "c": "\/\t\n", "u": "\u0041\u00e9\u20AC"})", &fields));
+	CHECK(fields.size() == 3);
+	CHECK(fields[0].second == "C:\\data\\a \"b\".cfg");
+	CHECK(fields[1].second == "/\t\n");
+	CHECK(fields[2].second == "A\xC3\xA9\xE2\x82\xAC");
+}
+
+TEST(json_rejects_what_jobs_do_not_use)
+{
+	Fields fields;
+	CHECK(!read("", &fields));
+	CHECK(!read("[]", &fields));
+	CHECK(!read("{\"a\": {\"b\": 1}}", &fields));
+	CHECK(!read("{\"a\": [1]}", &fields));
+	CHECK(!read("{\"a\": 1,}", &fields));
+	CHECK(!read("{\"a\" 1}", &fields));
+	CHECK(!read("{a: 1}", &fields));
+	CHECK(!read("{\"a\": \"open", &fields));
+	CHECK(!read("{\"a\": 1} {", &fields));
+}
+
+TEST(json_rejects_broken_escapes)
+{
+	Fields fields;
+	CHECK(!read(R"({"a": "\x"})", &fields));
+	CHECK(!read(R"({"a": "\u12"})", &fields));
+	CHECK(!read(R"({"a": "\u12g4"})", &fields));
+	CHECK(!read(R"({"a": "\)", &fields));
+}
+
+TEST(json_errors_name_the_position)
+{
+	Fields fields;
+	std::string error;
+	CHECK(!read("{\"a\": 1 \"b\": 2}", &fields, &error));
+	CHECK(error == "expected , or } at character 9");
+}
@@ -0,0 +1,155 @@
+#include "tests.h"
+#include "../src/output_sink.h"
+
+#include <chrono>
+#include <fstream>
+#include <iterator>
+#include <string>
+#include <vector>
+
+namespace fs = std::filesystem;
+
+static std::string read_file(const fs::path& path)
+{
+	std::ifstream file(path, std::ios::binary);
+	return std::string(std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>());
+}
+
+static bool write_text(const fs::path& path, const std::string& text)
+{
+	return output_sink::write_file(path, text.data(), text.size());
+}
+
+TEST(archive_round_trip)
+{
+	fs::path directory = make_test_directory("archive_round_trip");
+	fs::path root = directory / "out";
+	CHECK(output_sink::open_archive(directory / "output.sgoa", root));
+	CHECK(output_sink::is_archive_open());
+	CHECK(!output_sink::open_archive(directory / "second.sgoa", root));
+
+	CHECK(write_text(root / "textures/wall_diff_0.dds", "diffuse"));
+	CHECK(write_text(root / "textures/empty.dds", ""));
+	CHECK(write_text(root / "textures/wall_diff_0.dds", "diffuse, written again"));
+	CHECK(output_sink::link_file(root / "textures/wall_diff_0.dds", root / "copies/wall_diff_0.dds"));
+	CHECK(!output_sink::link_file(root / "missing.dds", root / "copies/missing.dds"));
+	CHECK(!write_text(directory / "outside_of_root.dds", "outside"));
+	{
+		output_sink::StreamedFile streamed_file(root / "streamed.dds");
+		CHECK(streamed_file.append("part 1, ", 8));
+		CHECK(streamed_file.append("part 2", 6));
+		CHECK(streamed_file.finish());
+	}
+	output_sink::close_archive();
+	CHECK(!output_sink::is_archive_open());
+	CHECK(!fs::exists(root)); // Nothing was written as loose files
+
+	fs::path extracted = directory / "extracted";
+	CHECK(output_sink::extract_archive(directory / "output.sgoa", extracted) == 4);
+	CHECK(read_file(extracted / "textures/wall_diff_0.dds") == "diffuse, written again");
+	CHECK(read_file(extracted / "copies/wall_diff_0.dds") == "diffuse, written again");
+	CHECK(fs::exists(extracted / "textures/empty.dds") && fs::file_size(extracted / "textures/empty.dds") == 0);
+	CHECK(read_file(extracted / "streamed.dds") == "part 1, part 2");
+}
+
+TEST(archive_rejects_incomplete_files)
+{
+	fs::path directory = make_test_directory("archive_incomplete");
+	fs::path root = directory / "out";
+	CHECK(output_sink::open_archive(directory / "output.sgoa", root));
+	CHECK(write_text(root / "a.dds", std::string(1000, 'a')));
+	output_sink::close_archive();
+	std::string archive = read_file(directory / "output.sgoa");
+
+	// Interrupted before close_archive(): no footer
+	std::ofstream(directory / "truncated.sgoa", std::ios::binary) << archive.substr(0, archive.size() - 20);
+	CHECK_THROWS(output_sink::extract_archive(directory / "truncated.sgoa", directory / "extracted"));
+
+	std::ofstream(directory / "tiny.sgoa", std::ios::binary) << archive.substr(0, 8);
+	CHECK_THROWS(output_sink::extract_archive(directory / "tiny.sgoa", directory / "extracted"));
+
+	std::string other_magic = archive;
+	other_magic[0] = 'X';
+	std::ofstream(directory / "other_magic.sgoa", std::ios::binary) << other_magic;
+	CHECK_THROWS(output_sink::extract_archive(directory / "other_magic.sgoa", directory / "extracted"));
+
+	// The entry points behind the contents: its size is the first field behind the offset
+	std::string damaged_entry = archive;
+	size_t entry_offset = sizeof(output_archive_format::Header) + 1000;
+	damaged_entry[entry_offset + sizeof(uint64_t) + 2] = char(0x7F);
+	std::ofstream(directory / "damaged_entry.sgoa", std::ios::binary) << damaged_entry;
+	CHECK_THROWS(output_sink::extract_archive(directory / "damaged_entry.sgoa", directory / "extracted"));
+
+	CHECK_THROWS(output_sink::extract_archive(directory / "missing.sgoa", directory / "extracted"));
+	CHECK(!fs::exists(directory / "extracted"));
+}
+
+TEST(loose_files_and_links)
+{
+	fs::path directory = make_test_directory("loose_files");
+	CHECK(write_text(directory / "a/b/file.dds", "bytes"));
+	CHECK(read_file(directory / "a/b/file.dds") == "bytes");
+	fs::file_time_type written_time = fs::last_write_time(directory / "a/b/file.dds");
+	fs::last_write_time(directory / "a/b/file.dds", written_time - std::chrono::hours(1));
+	// The same bytes again: the file is left untouched
+	CHECK(write_text(directory / "a/b/file.dds", "bytes"));
+	CHECK(fs::last_write_time(directory / "a/b/file.dds") == written_time - std::chrono::hours(1));
+
+	CHECK(output_sink::link_file(directory / "a/b/file.dds", directory / "c/linked.dds"));
+	CHECK(read_file(directory / "c/linked.dds") == "bytes");
+	CHECK(!output_sink::link_file(directory / "missing.dds", directory / "c/missing.dds"));
+
+	// Written again through a StreamedFile, the linked file keeps the old bytes
+	{
+		output_sink::StreamedFile streamed_file(directory / "a/b/file.dds");
+		CHECK(streamed_file.append("new bytes", 9));
+		CHECK(streamed_file.finish());
+	}
+	CHECK(read_file(directory / "a/b/file.dds") == "new bytes");
+	CHECK(read_file(directory / "c/linked.dds") == "bytes");
+	{
+		output_sink::StreamedFile dropped_file(directory / "dropped.dds");
+		CHECK(dropped_file.append("unfinished", 10));
+	}
+	CHECK(!fs::exists(directory / "a/b/file.dds.part"));
+	CHECK(!fs::exists(directory / "dropped.dds") && !fs::exists(directory / "dropped.dds.part"));
+}
+
+TEST(captured_files_stay_in_memory)
+{
+	fs::path directory = make_test_directory("capture");
+	output_sink::Capture capture;
+	{
+		output_sink::CaptureScope scope(&capture);
+		CHECK(write_text(directory / "first.dds", "first"));
+		CHECK(write_text(directory / "second.dds", "second"));
+		CHECK(write_text(directory / "./first.dds", "first, written again"));
+		CHECK(output_sink::link_file(directory / "second.dds", directory / "linked.dds"));
+		CHECK(!output_sink::link_file(directory / "missing.dds", directory / "linked_missing.dds"));
+		{
+			output_sink::StreamedFile streamed_file(directory / "streamed.dds");
+			CHECK(streamed_file.append("streamed", 8));
+			CHECK(streamed_file.finish());
+		}
+		{
+			// Nested: the files go to the disk again
+			output_sink::CaptureScope disk_scope(nullptr);
+			CHECK(write_text(directory / "on_disk.dds", "on disk"));
+		}
+	}
+	CHECK(write_text(directory / "after_scope.dds", "after"));
+
+	std::vector<output_sink::CapturedFile> files = capture.take_files();
+	CHECK(files.size() == 4);
+	if (files.size() == 4) {
+		CHECK(files[0].path == directory / "first.dds");
+		CHECK(std::string(files[0].bytes.begin(), files[0].bytes.end()) == "first, written again");
+		CHECK(std::string(files[1].bytes.begin(), files[1].bytes.end()) == "second");
+		CHECK(files[2].path == directory / "linked.dds");
+		CHECK(std::string(files[2].bytes.begin(), files[2].bytes.end()) == "second");
+		CHECK(std::string(files[3].bytes.begin(), files[3].bytes.end()) == "streamed");
+	}
+	CHECK(capture.take_files().empty());
+	CHECK(!fs::exists(directory / "first.dds") && !fs::exists(directory / "streamed.dds"));
+	CHECK(fs::exists(directory / "on_disk.dds") && fs::exists(directory / "after_scope.dds"));
+}
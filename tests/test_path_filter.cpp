@@ -0,0 +1,107 @@
+#include "tests.h"
+#include "../src/path_filter.h"
+
+#include <fstream>
+#include <random>
+#include <string>
+#include <vector>
+#include <algorithm>
+
+using namespace path_categories;
+
+TEST(path_filter_finds_substrings_anywhere)
+{
+	PatternMatcher matcher;
+	matcher.add_pattern("/dlc03/", blacklist);
+	matcher.add_pattern("old_world", whitelist);
+	matcher.add_pattern("_ice_", texture_blacklist);
+	matcher.compile();
+	CHECK(matcher.pattern_count() == 3);
+
+	CHECK(matcher.match("data/dlc03/graphics/house.cfg") == blacklist);
+	CHECK(matcher.match("data/dlc03/old_world/house.cfg") == (blacklist | whitelist));
+	CHECK(matcher.match("textures/floe_ice_diff_0.dds") == texture_blacklist);
+	CHECK(matcher.match("data/dlc03") == 0);
+	CHECK(matcher.match("") == 0);
+}
+
+TEST(path_filter_treats_backslashes_as_slashes)
+{
+	PatternMatcher matcher;
+	matcher.add_pattern("graphics/ships/", blacklist);
+	matcher.add_pattern("props\\fences\\", whitelist);
+	matcher.compile();
+	CHECK(matcher.match("data\\graphics\\ships\\boat.cfg") == blacklist);
+	CHECK(matcher.match("data/props/fences/fence.cfg") == whitelist);
+	CHECK(matcher.match("data\\props/fences\\fence.cfg") == whitelist);
+}
+
+TEST(path_filter_finds_overlapping_patterns)
+{
+	PatternMatcher matcher;
+	matcher.add_pattern("abcd", blacklist);
+	matcher.add_pattern("bc", whitelist);
+	matcher.add_pattern("cde", texture_blacklist);
+	matcher.compile();
+	// "bc" ends inside "abcd", "cde" starts inside it
+	CHECK(matcher.match("xabcdex") == (blacklist | whitelist | texture_blacklist));
+	CHECK(matcher.match("abcx") == whitelist);
+	CHECK(matcher.match("aabcd") == (blacklist | whitelist));
+}
+
+TEST(path_filter_ignores_empty_patterns_and_needs_compile)
+{
+	PatternMatcher matcher;
+	matcher.add_pattern("", blacklist);
+	CHECK(matcher.pattern_count() == 0);
+	matcher.add_pattern("house", blacklist);
+	CHECK(matcher.match("house.cfg") == 0);
+	matcher.compile();
+	CHECK(matcher.match("house.cfg") == blacklist);
+	CHECK(matcher.match("other.cfg") == 0);
+}
+
+TEST(path_filter_agrees_with_find)
+{
+	const std::string alphabet = "ab/\\_.";
+	std::mt19937 random(7);
+	auto random_text = [&](size_t max_length) {
+		std::string text(1 + random() % max_length, ' ');
+		for (char& c : text) c = alphabet[random() % alphabet.size()];
+		return text;
+	};
+	PatternMatcher matcher;
+	std::vector<std::pair<std::string, uint32_t>> patterns;
+	for (int i = 0; i < 40; i++) {
+		std::string pattern = random_text(5);
+		uint32_t categories = 1u << (random() % 3);
+		matcher.add_pattern(pattern, categories);
+		std::replace(pattern.begin(), pattern.end(), '\\', '/');
+		patterns.emplace_back(pattern, categories);
+	}
+	matcher.compile();
+	for (int i = 0; i < 2000; i++) {
+		std::string path = random_text(30);
+		std::string slashed_path = path;
+		std::replace(slashed_path.begin(), slashed_path.end(), '\\', '/');
+		uint32_t expected = 0;
+		for (const auto& [pattern, categories] : patterns) {
+			if (slashed_path.find(pattern) != std::string::npos) expected |= categories;
+		}
+		CHECK(matcher.match(path) == expected);
+	}
+}
+
+TEST(path_filter_reads_rule_files)
+{
+	std::filesystem::path directory = make_test_directory("path_filter");
+	std::ofstream(directory / "rules.txt") << "# Comment\r\n\r\nblacklist /dlc07/\r\nwhitelist /dlc07/old/\ntexture_blacklist _snow_\nunknown rule\n";
+
+	PatternMatcher matcher;
+	CHECK(add_rules_from_file(&matcher, directory / "rules.txt"));
+	CHECK(matcher.pattern_count() == 3);
+	matcher.compile();
+	CHECK(matcher.match("data/dlc07/old/a.cfg") == (blacklist | whitelist));
+	CHECK(matcher.match("textures/roof_snow_0.dds") == texture_blacklist);
+	CHECK(!add_rules_from_file(&matcher, directory / "missing.txt"));
+}
@@ -0,0 +1,151 @@
+#include "tests.h"
+#include "../src/rdm2gl.h"
+#include "../src/mapped_file.h"
+
+#include <cstring>
+#include <memory>
+#include <vector>
+
+namespace fs = std::filesystem;
+
+// The smallest file load_rdm accepts: one material with one triangle of 3 vertices of 4 bytes, 2 byte corners
+struct RdmLayout {
+	static constexpr uint32_t offset_table = 36;
+	static constexpr uint32_t materials = 72;
+	static constexpr uint32_t vertices = 108;
+	static constexpr uint32_t triangles = 128;
+	static constexpr uint32_t size = 134;
+};
+
+static void put_uint32(std::vector<char>* file, size_t offset, uint32_t value)
+{
+	std::memcpy(file->data() + offset, &value, 4);
+}
+
+static std::vector<char> make_rdm()
+{
+	std::vector<char> file(RdmLayout::size, 0);
+	put_uint32(&file, 32, RdmLayout::offset_table);
+	put_uint32(&file, RdmLayout::offset_table + 12, RdmLayout::vertices);
+	put_uint32(&file, RdmLayout::offset_table + 16, RdmLayout::triangles);
+	put_uint32(&file, RdmLayout::offset_table + 20, RdmLayout::materials);
+	// Each block is preceded by its element count and size
+	put_uint32(&file, RdmLayout::materials - 8, 1);
+	put_uint32(&file, RdmLayout::materials - 4, 28);
+	put_uint32(&file, RdmLayout::materials + 4, 3); // Corners 0 to 2
+	put_uint32(&file, RdmLayout::vertices - 8, 3);
+	put_uint32(&file, RdmLayout::vertices - 4, 4);
+	put_uint32(&file, RdmLayout::triangles - 8, 3);
+	put_uint32(&file, RdmLayout::triangles - 4, 2);
+	const uint16_t corners[3] = { 0, 1, 2 };
+	std::memcpy(file.data() + RdmLayout::triangles, corners, sizeof(corners));
+	return file;
+}
+
+// The file is only given to the reader through a SourceResolver, nothing is written to the disk
+class ResolvedRdm
+{
+public:
+	ResolvedRdm(std::vector<char> file)
+		: bytes(std::make_shared<const std::vector<char>>(std::move(file))),
+		resolver([this](const fs::path& requested_path) { return requested_path == path ? bytes : nullptr; }),
+		scope(&resolver) {}
+
+	const fs::path path = fs::absolute("resolved/test.rdm");
+
+private:
+	std::shared_ptr<const std::vector<char>> bytes;
+	SourceResolver resolver;
+	SourceResolverScope scope;
+};
+
+static bool load_throws(std::vector<char> file)
+{
+	ResolvedRdm rdm(std::move(file));
+	HardwareRdm mesh;
+	try {
+		mesh.load_rdm(rdm.path);
+	}
+	catch (...) {
+		return true;
+	}
+	return false;
+}
+
+TEST(rdm_counts_are_read_from_the_header)
+{
+	ResolvedRdm rdm(make_rdm());
+	uint32_t corner_count = 0, vertices_count = 0;
+	CHECK(HardwareRdm::read_counts(rdm.path, &corner_count, &vertices_count));
+	CHECK(corner_count == 3 && vertices_count == 3);
+	CHECK(!HardwareRdm::read_counts(fs::absolute("resolved/missing.rdm"), &corner_count, &vertices_count));
+}
+
+TEST(rdm_counts_reject_offsets_behind_the_file)
+{
+	uint32_t corner_count = 0, vertices_count = 0;
+	std::vector<char> file = make_rdm();
+	file.resize(30);
+	CHECK(!HardwareRdm::read_counts(ResolvedRdm(file).path, &corner_count, &vertices_count));
+
+	file = make_rdm();
+	put_uint32(&file, 32, 0xFFFFFFF0); // The offset table would wrap around in 32 bits
+	CHECK(!HardwareRdm::read_counts(ResolvedRdm(file).path, &corner_count, &vertices_count));
+
+	file = make_rdm();
+	put_uint32(&file, RdmLayout::offset_table + 12, RdmLayout::size + 8);
+	CHECK(!HardwareRdm::read_counts(ResolvedRdm(file).path, &corner_count, &vertices_count));
+
+	file = make_rdm();
+	put_uint32(&file, RdmLayout::offset_table + 16, 4); // The count would be in front of the file
+	CHECK(!HardwareRdm::read_counts(ResolvedRdm(file).path, &corner_count, &vertices_count));
+}
+
+// Every check of load_rdm throws before anything is uploaded, so no GL context is needed
+TEST(rdm_load_rejects_broken_files)
+{
+	std::vector<char> file = make_rdm();
+	file.resize(31);
+	CHECK(load_throws(file));
+
+	file = make_rdm();
+	put_uint32(&file, 32, RdmLayout::size);
+	CHECK(load_throws(file));
+
+	file = make_rdm();
+	put_uint32(&file, RdmLayout::offset_table + 20, 4);
+	CHECK(load_throws(file));
+
+	file = make_rdm();
+	put_uint32(&file, RdmLayout::materials - 4, 32);
+	CHECK(load_throws(file));
+
+	file = make_rdm();
+	put_uint32(&file, RdmLayout::materials - 8, 0x10000000);
+	CHECK(load_throws(file));
+
+	file = make_rdm();
+	put_uint32(&file, RdmLayout::vertices - 4, 0);
+	CHECK(load_throws(file));
+
+	file = make_rdm();
+	put_uint32(&file, RdmLayout::vertices - 8, 0x40000000); // 4 GB of vertices
+	CHECK(load_throws(file));
+
+	file = make_rdm();
+	put_uint32(&file, RdmLayout::triangles - 4, 3);
+	CHECK(load_throws(file));
+
+	file = make_rdm();
+	put_uint32(&file, RdmLayout::triangles - 8, 4); // One corner more than the file has
+	CHECK(load_throws(file));
+
+	file = make_rdm();
+	put_uint32(&file, RdmLayout::materials + 4, 6);
+	CHECK(load_throws(file));
+
+	file = make_rdm();
+	const uint16_t corner = 3; // There are only vertices 0 to 2
+	std::memcpy(file.data() + RdmLayout::triangles + 4, &corner, 2);
+	CHECK(load_throws(file));
+}
@@ -0,0 +1,97 @@
+#include "tests.h"
+#include "../src/tile_mask.h"
+
+#include <cmath>
+
+TEST(tile_mask_rounds_up_partial_tiles)
+{
+	TileMask mask(130, 64);
+	CHECK(mask.get_columns() == 3 && mask.get_rows() == 1);
+	CHECK(mask.get_marked_count() == 0);
+	mask.mark_all();
+	CHECK(mask.is_everything_marked());
+
+	TileMask empty_mask(0, -5);
+	CHECK(empty_mask.get_width() == 1 && empty_mask.get_height() == 1);
+	CHECK(empty_mask.get_columns() == 1 && empty_mask.get_rows() == 1);
+}
+
+TEST(tile_mask_marks_the_bounding_rectangle_with_a_margin)
+{
+	TileMask mask(512, 512);
+	// Texels 100 to 140 in x, 300 to 310 in y
+	const float u[3] = { 100.f / 512, 140.f / 512, 120.f / 512 };
+	const float v[3] = { 300.f / 512, 300.f / 512, 310.f / 512 };
+	mask.mark_triangle(u, v);
+	CHECK(mask.get_marked_count() == 2);
+	CHECK(mask.is_marked(1, 4) && mask.is_marked(2, 4));
+
+	// One texel of margin reaches into the tile to the left
+	TileMask edge_mask(512, 512);
+	const float edge_u[3] = { 64.5f / 512, 70.f / 512, 70.f / 512 };
+	edge_mask.mark_triangle(edge_u, v);
+	CHECK(edge_mask.get_marked_count() == 2);
+	CHECK(edge_mask.is_marked(0, 4) && edge_mask.is_marked(1, 4));
+}
+
+TEST(tile_mask_wraps_like_repeat)
+{
+	TileMask mask(256, 256);
+	// Coordinates 3.1 to 3.2 are sampled at 0.1 to 0.2 of the texture
+	const float u[3] = { 3.1f, 3.2f, 3.2f };
+	const float v[3] = { -0.9f, -0.9f, -0.8f };
+	mask.mark_triangle(u, v);
+	CHECK(mask.get_marked_count() == 1);
+	CHECK(mask.is_marked(0, 0));
+
+	// The margin reaches across the edge: the last and the first column
+	TileMask edge_mask(256, 256);
+	const float edge_u[3] = { 0.f, 0.02f, 0.02f };
+	const float edge_v[3] = { 0.6f, 0.6f, 0.62f };
+	edge_mask.mark_triangle(edge_u, edge_v);
+	CHECK(edge_mask.get_marked_count() == 2);
+	CHECK(edge_mask.is_marked(3, 2) && edge_mask.is_marked(0, 2));
+}
+
+TEST(tile_mask_marks_where_the_snow_pass_draws)
+{
+	// Across an integer, the snow pass draws the vertices at 0.95 and 0.05: everything in between
+	TileMask mask(256, 256);
+	const float u[3] = { 0.95f, 1.05f, 1.05f };
+	const float v[3] = { 0.6f, 0.6f, 0.62f };
+	mask.mark_triangle(u, v);
+	CHECK(mask.get_marked_count() == 4);
+	for (int column = 0; column < 4; column++) CHECK(mask.is_marked(column, 2));
+}
+
+TEST(tile_mask_marks_everything_for_large_or_broken_triangles)
+{
+	TileMask mask(256, 256);
+	const float u[3] = { 0.f, 2.f, 1.f };
+	const float v[3] = { 0.f, 2.f, 1.f };
+	mask.mark_triangle(u, v);
+	CHECK(mask.is_everything_marked());
+
+	TileMask broken_mask(256, 256);
+	const float nan_u[3] = { 0.5f, NAN, 0.5f };
+	broken_mask.mark_triangle(nan_u, v);
+	CHECK(broken_mask.is_everything_marked());
+
+	TileMask infinite_mask(256, 256);
+	const float infinite_v[3] = { 0.5f, 0.5f, -INFINITY };
+	infinite_mask.mark_triangle(u, infinite_v);
+	CHECK(infinite_mask.is_everything_marked());
+}
+
+TEST(tile_mask_dilates_across_the_edges)
+{
+	TileMask mask(320, 320);
+	const float u[3] = { 10.f / 320, 12.f / 320, 12.f / 320 };
+	const float v[3] = { 10.f / 320, 10.f / 320, 12.f / 320 };
+	mask.mark_triangle(u, v);
+	CHECK(mask.get_marked_count() == 1);
+	mask.dilate();
+	CHECK(mask.get_marked_count() == 9);
+	CHECK(mask.is_marked(4, 4) && mask.is_marked(0, 4) && mask.is_marked(4, 0) && mask.is_marked(1, 1));
+	CHECK(!mask.is_marked(2, 2));
+}
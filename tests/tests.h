@@ -0,0 +1,42 @@
+#pragma once
+#include <filesystem>
+
+/*
+The behaviour checks of libsnowgen. Each TEST registers itself, main.cpp runs them all and returns 1 if a CHECK failed.
+Only the parts without GL are tested: the formats, the parsers and the bookkeeping the program relies on.
+
+	TEST(encode_keeps_runs) {
+		CHECK(values == decoded);
+		CHECK_THROWS(output_sink::extract_archive(truncated_path, out_path));
+	}
+*/
+
+using TestFunction = void (*)();
+
+struct TestRegistration {
+	TestRegistration(const char* name, TestFunction function);
+};
+
+void report_failure(const char* file, int line, const char* expression);
+
+// An empty directory below the temporary directory, removed after the test
+std::filesystem::path make_test_directory(const char* name);
+
+#define TEST(name) \
+	static void name(); \
+	static TestRegistration name##_registration(#name, name); \
+	static void name()
+
+#define CHECK(expression) \
+	do { \
+		if (!(expression)) report_failure(__FILE__, __LINE__, #expression); \
+	} while (false)
+
+// snow_exception prints its message when it is created, so the expected errors show up in the output
+#define CHECK_THROWS(statement) \
+	do { \
+		bool has_thrown = false; \
+		try { statement; } \
+		catch (...) { has_thrown = true; } \
+		if (!has_thrown) report_failure(__FILE__, __LINE__, "throws " #statement); \
+	} while (false)
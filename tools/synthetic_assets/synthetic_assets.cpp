@@ -0,0 +1,467 @@
+/*
+Generator for synthetic Anno-like assets.
+
+Real game assets cannot be shipped with this repository. This tool writes a directory tree that looks
+like an extracted mod so that the snowgenerator can be benchmarked on any machine:
+- .cfg files with <MeshRadius>, <Models> and some subtrees the snowgenerator ignores (particles, decals)
+- .rdm meshes in the layout HardwareRdm::load_rdm expects, vertex format P4h_N4b_G4b_B4b_T2h
+  (a house: four walls and a gabled roof, subdivided to the requested triangle count)
+- BC7_UNORM _0.dds, _1.dds, ... mipmap chains for diffuse, normal and metallic textures
+
+It only uses the C++ standard library and builds on Windows and Linux:
+    g++ -std=c++20 -O2 -o synthetic_assets synthetic_assets.cpp
+
+Usage:
+    synthetic_assets -o "path/to/corpus/" [-cfgs 100] [-size 1024] [-share 0.5] [-triangles 2000] [-seed 1]
+
+-share is the share of .cfg files that use a texture set from a pool of shared textures
+(like the shared atlases and prop textures of the game) instead of their own textures.
+
+Benchmark the snowgenerator on the corpus afterwards with:
+    snowgenerator -i "path/to/corpus/" -o "path/to/output/" --benchmark --no_prompt
+*/
+
+#include <iostream>
+#include <fstream>
+#include <filesystem>
+#include <string>
+#include <vector>
+#include <cstdint>
+#include <cstring>
+#include <cmath>
+#include <algorithm>
+#include <random>
+
+namespace fs = std::filesystem;
+
+struct GeneratorOptions {
+	fs::path out_path = "synthetic_corpus";
+	int cfg_count = 100;
+	int texture_size = 1024;
+	double share = 0.5;
+	int triangles = 2000;
+	uint32_t seed = 1;
+};
+
+struct Vec3 {
+	float x, y, z;
+};
+
+Vec3 operator-(Vec3 a, Vec3 b) { return Vec3{ a.x - b.x, a.y - b.y, a.z - b.z }; }
+Vec3 operator+(Vec3 a, Vec3 b) { return Vec3{ a.x + b.x, a.y + b.y, a.z + b.z }; }
+Vec3 operator*(Vec3 a, float s) { return Vec3{ a.x * s, a.y * s, a.z * s }; }
+
+Vec3 normalize(Vec3 v) {
+	float length = std::sqrt(v.x * v.x + v.y * v.y + v.z * v.z);
+	if (length == 0.f) return Vec3{ 0.f, 1.f, 0.f };
+	return v * (1.f / length);
+}
+
+Vec3 cross(Vec3 a, Vec3 b) {
+	return Vec3{ a.y * b.z - a.z * b.y, a.z * b.x - a.x * b.z, a.x * b.y - a.y * b.x };
+}
+
+// IEEE 754 binary16, round towards zero is precise enough for positions and texture coordinates
+uint16_t float_to_half(float value) {
+	uint32_t bits;
+	std::memcpy(&bits, &value, 4);
+	uint32_t sign = (bits >> 16) & 0x8000;
+	int32_t exponent = ((bits >> 23) & 0xff) - 127 + 15;
+	uint32_t mantissa = bits & 0x7fffff;
+	if (exponent <= 0) return (uint16_t)sign;
+	if (exponent >= 31) return (uint16_t)(sign | 0x7c00);
+	return (uint16_t)(sign | (exponent << 10) | (mantissa >> 13));
+}
+
+uint8_t unit_to_unorm8(float value) {
+	// Normals, tangents and bitangents are stored as v * 0.5 + 0.5 (The vertexshader does v * 2 - 1)
+	float unorm = value * 0.5f + 0.5f;
+	if (unorm < 0.f) unorm = 0.f;
+	if (unorm > 1.f) unorm = 1.f;
+	return (uint8_t)std::lround(unorm * 255.f);
+}
+
+struct Vertex {
+	Vec3 position;
+	Vec3 normal;
+	Vec3 tangent;
+	float u, v;
+};
+
+constexpr uint32_t VERTEX_SIZE = 24; // P4h_N4b_G4b_B4b_T2h
+
+class MeshBuilder
+{
+public:
+	std::vector<Vertex> vertices;
+	std::vector<uint32_t> indices;
+
+	// Adds a quad subdivided into subdivisions*subdivisions*2 triangles. uv_rect: u0, v0, u1, v1
+	void add_quad(Vec3 origin, Vec3 edge_u, Vec3 edge_v, const float uv_rect[4], int subdivisions) {
+		Vec3 normal = normalize(cross(edge_u, edge_v));
+		Vec3 tangent = normalize(edge_u);
+		uint32_t first_vertex = (uint32_t)vertices.size();
+		for (int j = 0; j <= subdivisions; j++) {
+			for (int i = 0; i <= subdivisions; i++) {
+				float s = float(i) / subdivisions;
+				float t = float(j) / subdivisions;
+				vertices.push_back(Vertex{
+					origin + edge_u * s + edge_v * t, normal, tangent,
+					uv_rect[0] + (uv_rect[2] - uv_rect[0]) * s,
+					uv_rect[1] + (uv_rect[3] - uv_rect[1]) * t });
+			}
+		}
+		for (int j = 0; j < subdivisions; j++) {
+			for (int i = 0; i < subdivisions; i++) {
+				uint32_t corner = first_vertex + j * (subdivisions + 1) + i;
+				indices.insert(indices.end(), { corner, corner + 1, corner + subdivisions + 1 });
+				indices.insert(indices.end(), { corner + 1, corner + subdivisions + 2, corner + subdivisions + 1 });
+			}
+		}
+	}
+};
+
+MeshBuilder build_house(int triangle_count, float width, float depth, float wall_height, float roof_height) {
+	// 6 quads (4 walls, 2 roof sides), each with subdivisions^2 * 2 triangles
+	int subdivisions = std::max(1, (int)std::lround(std::sqrt(triangle_count / 12.0)));
+	float hw = width / 2.f;
+	float hd = depth / 2.f;
+
+	// Walls use the lower half of the texture, the roof the upper half
+	const float wall_uv[4] = { 0.f, 0.5f, 1.f, 1.f };
+	const float roof_uv_left[4] = { 0.f, 0.f, 0.5f, 0.5f };
+	const float roof_uv_right[4] = { 0.5f, 0.f, 1.f, 0.5f };
+
+	MeshBuilder mesh;
+	mesh.add_quad(Vec3{ -hw, 0.f, hd }, Vec3{ width, 0.f, 0.f }, Vec3{ 0.f, wall_height, 0.f }, wall_uv, subdivisions);
+	mesh.add_quad(Vec3{ hw, 0.f, -hd }, Vec3{ -width, 0.f, 0.f }, Vec3{ 0.f, wall_height, 0.f }, wall_uv, subdivisions);
+	mesh.add_quad(Vec3{ hw, 0.f, hd }, Vec3{ 0.f, 0.f, -depth }, Vec3{ 0.f, wall_height, 0.f }, wall_uv, subdivisions);
+	mesh.add_quad(Vec3{ -hw, 0.f, -hd }, Vec3{ 0.f, 0.f, depth }, Vec3{ 0.f, wall_height, 0.f }, wall_uv, subdivisions);
+
+	// Both roof sides rise from the eaves to the ridge along x
+	mesh.add_quad(Vec3{ -hw, wall_height, -hd }, Vec3{ 0.f, 0.f, depth }, Vec3{ hw, roof_height, 0.f },
+		roof_uv_left, subdivisions);
+	mesh.add_quad(Vec3{ hw, wall_height, hd }, Vec3{ 0.f, 0.f, -depth }, Vec3{ -hw, roof_height, 0.f },
+		roof_uv_right, subdivisions);
+	return mesh;
+}
+
+void append_u32(std::vector<char>& buffer, uint32_t value) {
+	char bytes[4];
+	std::memcpy(bytes, &value, 4);
+	buffer.insert(buffer.end(), bytes, bytes + 4);
+}
+
+void append_u16(std::vector<char>& buffer, uint16_t value) {
+	char bytes[2];
+	std::memcpy(bytes, &value, 2);
+	buffer.insert(buffer.end(), bytes, bytes + 2);
+}
+
+void put_u32(std::vector<char>& buffer, size_t offset, uint32_t value) {
+	std::memcpy(&buffer[offset], &value, 4);
+}
+
+// Layout as read by HardwareRdm::load_rdm:
+// [32] offset_to_offsets; offsets block: [+12] vertices, [+16] triangles, [+20] materials
+// Each data block is preceded by its element count and element size.
+std::vector<char> build_rdm(const MeshBuilder& mesh) {
+	std::vector<char> rdm(32, 0);
+	std::memcpy(rdm.data(), "RDM\x01", 4);
+
+	append_u32(rdm, 0); // [32] offset_to_offsets, filled in below
+	while (rdm.size() < 48) rdm.push_back(0);
+	size_t offset_to_offsets = rdm.size();
+	put_u32(rdm, 32, (uint32_t)offset_to_offsets);
+	rdm.resize(rdm.size() + 24, 0);
+
+	// Materials: One material covering all triangles
+	append_u32(rdm, 1);
+	append_u32(rdm, 28);
+	put_u32(rdm, offset_to_offsets + 20, (uint32_t)rdm.size());
+	append_u32(rdm, 0); // offset (in corners)
+	append_u32(rdm, (uint32_t)mesh.indices.size()); // size (in corners)
+	append_u32(rdm, 0); // material index
+	rdm.resize(rdm.size() + 16, 0);
+
+	append_u32(rdm, (uint32_t)mesh.vertices.size());
+	append_u32(rdm, VERTEX_SIZE);
+	put_u32(rdm, offset_to_offsets + 12, (uint32_t)rdm.size());
+	for (const Vertex& vertex : mesh.vertices) {
+		Vec3 bitangent = cross(vertex.normal, vertex.tangent);
+		append_u16(rdm, float_to_half(vertex.position.x));
+		append_u16(rdm, float_to_half(vertex.position.y));
+		append_u16(rdm, float_to_half(vertex.position.z));
+		append_u16(rdm, float_to_half(1.f));
+		for (Vec3 direction : { vertex.normal, vertex.tangent, bitangent }) {
+			rdm.push_back((char)unit_to_unorm8(direction.x));
+			rdm.push_back((char)unit_to_unorm8(direction.y));
+			rdm.push_back((char)unit_to_unorm8(direction.z));
+			rdm.push_back((char)255);
+		}
+		append_u16(rdm, float_to_half(vertex.u));
+		append_u16(rdm, float_to_half(vertex.v));
+	}
+
+	bool use_16bit_indices = mesh.vertices.size() <= 0xffff;
+	append_u32(rdm, (uint32_t)mesh.indices.size());
+	append_u32(rdm, use_16bit_indices ? 2 : 4);
+	put_u32(rdm, offset_to_offsets + 16, (uint32_t)rdm.size());
+	for (uint32_t index : mesh.indices) {
+		if (use_16bit_indices) append_u16(rdm, (uint16_t)index);
+		else append_u32(rdm, index);
+	}
+	rdm.resize(rdm.size() + 16, 0); // The loader expects some bytes after the last block
+	return rdm;
+}
+
+class BitWriter
+{
+public:
+	uint8_t bytes[16] = {};
+	int position = 0;
+
+	void write(uint32_t value, int bit_count) {
+		for (int i = 0; i < bit_count; i++) {
+			if ((value >> i) & 1) bytes[position / 8] |= (uint8_t)(1 << (position % 8));
+			position++;
+		}
+	}
+};
+
+// A BC7 mode 6 block with both endpoints set to the same color, which decodes to a single color
+void encode_solid_bc7_block(uint8_t r, uint8_t g, uint8_t b, uint8_t a, uint8_t* block) {
+	BitWriter bits;
+	bits.write(1 << 6, 7); // Mode 6
+	for (uint8_t channel : { r, g, b, a }) {
+		bits.write(channel >> 1, 7);
+		bits.write(channel >> 1, 7);
+	}
+	// The p-bits are shared by all channels of an endpoint, use the one of red
+	bits.write(r & 1, 1);
+	bits.write(r & 1, 1);
+	// All indices stay 0
+	std::memcpy(block, bits.bytes, 16);
+}
+
+std::vector<char> build_dds_header(uint32_t width, uint32_t height, size_t data_size) {
+	std::vector<char> header;
+	append_u32(header, 0x20534444); // "DDS "
+	append_u32(header, 124);        // dwSize
+	append_u32(header, 0x1 | 0x2 | 0x4 | 0x1000 | 0x80000); // CAPS | HEIGHT | WIDTH | PIXELFORMAT | LINEARSIZE
+	append_u32(header, height);
+	append_u32(header, width);
+	append_u32(header, (uint32_t)data_size); // dwPitchOrLinearSize
+	append_u32(header, 0);          // dwDepth
+	append_u32(header, 1);          // dwMipMapCount
+	for (int i = 0; i < 11; i++) append_u32(header, 0);
+	append_u32(header, 32);         // ddspf.dwSize
+	append_u32(header, 0x4);        // DDPF_FOURCC
+	append_u32(header, 0x30315844); // "DX10"
+	for (int i = 0; i < 5; i++) append_u32(header, 0);
+	append_u32(header, 0x1000);     // DDSCAPS_TEXTURE
+	for (int i = 0; i < 4; i++) append_u32(header, 0);
+	// DDS_HEADER_DXT10
+	append_u32(header, 98);         // DXGI_FORMAT_BC7_UNORM
+	append_u32(header, 3);          // D3D10_RESOURCE_DIMENSION_TEXTURE2D
+	append_u32(header, 0);
+	append_u32(header, 1);          // arraySize
+	append_u32(header, 0);
+	return header;
+}
+
+enum class TextureKind { diffuse, normal, metallic };
+
+// Writes path_until_mipmap_indication + "0.dds", "1.dds", ... down to 4x4 texels
+void write_texture(fs::path path_until_mipmap_indication, int size, TextureKind kind, std::mt19937& random) {
+	std::uniform_int_distribution<int> variation(0, 40);
+	uint8_t base[3] = { (uint8_t)(120 + variation(random)), (uint8_t)(70 + variation(random)), (uint8_t)(50 + variation(random)) };
+	fs::create_directories(path_until_mipmap_indication.parent_path());
+
+	int mip = 0;
+	for (int mip_size = size; mip_size >= 4; mip_size /= 2, mip++) {
+		uint32_t blocks_per_row = mip_size / 4;
+		std::vector<char> data(blocks_per_row * blocks_per_row * 16);
+		for (uint32_t by = 0; by < blocks_per_row; by++) {
+			for (uint32_t bx = 0; bx < blocks_per_row; bx++) {
+				uint8_t* block = (uint8_t*)&data[(by * blocks_per_row + bx) * 16];
+				// Cheap per-block hash, so that the textures are not trivially compressible
+				uint32_t hash = (bx * 73856093u) ^ (by * 19349663u) ^ (mip * 83492791u);
+				uint8_t noise = (uint8_t)((hash >> 8) & 31);
+				switch (kind) {
+				case TextureKind::diffuse:
+					encode_solid_bc7_block(base[0] + noise, base[1] + noise, base[2] + noise, 255, block);
+					break;
+				case TextureKind::normal:
+					encode_solid_bc7_block(128 + (noise >> 2), 128 - (noise >> 2), 255, 255, block);
+					break;
+				case TextureKind::metallic:
+					encode_solid_bc7_block(noise * 4, noise * 2, 0, 255, block);
+					break;
+				}
+			}
+		}
+		std::vector<char> header = build_dds_header(mip_size, mip_size, data.size());
+		std::ofstream dds_file(fs::path(path_until_mipmap_indication).concat(std::to_string(mip) + ".dds"), std::ios::binary);
+		dds_file.write(header.data(), header.size());
+		dds_file.write(data.data(), data.size());
+	}
+}
+
+struct TextureSet {
+	std::string rel_path_until_type; // e.g. data/graphics/buildings/synthetic/shared/maps/shared_3
+};
+
+void write_texture_set(const GeneratorOptions& options, const TextureSet& texture_set, std::mt19937& random) {
+	fs::path base = fs::path(options.out_path).append(texture_set.rel_path_until_type);
+	write_texture(fs::path(base).concat("_diff_"), options.texture_size, TextureKind::diffuse, random);
+	write_texture(fs::path(base).concat("_norm_"), options.texture_size, TextureKind::normal, random);
+	write_texture(fs::path(base).concat("_metal_"), options.texture_size, TextureKind::metallic, random);
+}
+
+std::string build_cfg(const std::string& rdm_rel_path, const TextureSet& texture_set, float mesh_radius) {
+	const std::string& t = texture_set.rel_path_until_type;
+	return std::string("<Config>\n")
+		+ "  <FileNames />\n"
+		+ "  <ConfigType>MAIN</ConfigType>\n"
+		+ "  <RenderPropertyFlags>0</RenderPropertyFlags>\n"
+		+ "  <MeshRadius>" + std::to_string(mesh_radius) + "</MeshRadius>\n"
+		+ "  <Models>\n"
+		+ "    <Config>\n"
+		+ "      <ConfigType>MODEL</ConfigType>\n"
+		+ "      <FileName>" + rdm_rel_path + "</FileName>\n"
+		+ "      <Materials>\n"
+		+ "        <Config>\n"
+		+ "          <ConfigType>MATERIAL</ConfigType>\n"
+		+ "          <Name>synthetic</Name>\n"
+		+ "          <ShaderID>8</ShaderID>\n"
+		+ "          <VertexFormat>P4h_N4b_G4b_B4b_T2h</VertexFormat>\n"
+		+ "          <cModelDiffTex>" + t + "_diff.psd</cModelDiffTex>\n"
+		+ "          <DIFFUSE_ENABLED>1</DIFFUSE_ENABLED>\n"
+		+ "          <cModelNormalTex>" + t + "_norm.psd</cModelNormalTex>\n"
+		+ "          <NORMAL_ENABLED>1</NORMAL_ENABLED>\n"
+		+ "          <cModelMetallicTex>" + t + "_metal.psd</cModelMetallicTex>\n"
+		+ "          <METALLIC_TEX_ENABLED>1</METALLIC_TEX_ENABLED>\n"
+		+ "        </Config>\n"
+		+ "      </Materials>\n"
+		+ "    </Config>\n"
+		+ "  </Models>\n"
+		+ "  <Particles>\n"
+		+ "    <Config><ConfigType>PARTICLE</ConfigType><FileName>data/graphics/effects/smoke.rpx</FileName></Config>\n"
+		+ "  </Particles>\n"
+		+ "  <Decals>\n"
+		+ "    <Config><ConfigType>DECAL</ConfigType><Extents>4 0 4</Extents></Config>\n"
+		+ "  </Decals>\n"
+		+ "</Config>\n";
+}
+
+static void print_usage()
+{
+	std::cout << "Usage: synthetic_assets -o \"path/to/corpus/\" [-cfgs 100] [-size 1024] [-share 0.5] [-triangles 2000] [-seed 1]" << std::endl
+		<< "-size is the size of the textures, a power of two of at least 4" << std::endl;
+}
+
+// Returns false, after printing why, if the arguments are not valid
+bool parse_arguments(int argc, char* argv[], GeneratorOptions* options) {
+	std::string last_word = "";
+	for (int i = 1; i < argc; i++) {
+		std::string arg = std::string(argv[i]);
+		if (last_word.empty() && (arg == "-o" || arg == "-cfgs" || arg == "-size" || arg == "-share" || arg == "-triangles" || arg == "-seed")) {
+			last_word = arg;
+			continue;
+		}
+		try {
+			if (last_word == "-o") options->out_path = fs::path(arg);
+			else if (last_word == "-cfgs") options->cfg_count = std::stoi(arg);
+			else if (last_word == "-size") options->texture_size = std::stoi(arg);
+			else if (last_word == "-share") options->share = std::stod(arg);
+			else if (last_word == "-triangles") options->triangles = std::stoi(arg);
+			else if (last_word == "-seed") options->seed = (uint32_t)std::stoul(arg);
+			else {
+				std::cout << "Unknown argument: " << arg << std::endl;
+				return false;
+			}
+		}
+		catch (const std::exception&) {
+			std::cout << "Not a number for " << last_word << ": " << arg << std::endl;
+			return false;
+		}
+		last_word = "";
+	}
+	if (!last_word.empty()) {
+		std::cout << last_word << " needs a value" << std::endl;
+		return false;
+	}
+	if (options->texture_size < 4 || (options->texture_size & (options->texture_size - 1)) != 0) {
+		std::cout << "-size must be a power of two: " << options->texture_size << std::endl;
+		return false;
+	}
+	return true;
+}
+
+int main(int argc, char* argv[])
+{
+	GeneratorOptions options;
+	if (!parse_arguments(argc, argv, &options)) {
+		print_usage();
+		return 1;
+	}
+	std::mt19937 random(options.seed);
+	std::uniform_real_distribution<double> unit(0., 1.);
+	std::uniform_real_distribution<float> dimension(4.f, 10.f);
+
+	const std::string base_rel_path = "data/graphics/buildings/synthetic/";
+
+	// Roughly one shared texture set for every 10 .cfg files that use shared textures
+	int shared_pool_size = std::max(1, (int)std::lround(options.cfg_count * options.share / 10.));
+	std::vector<TextureSet> shared_texture_sets;
+	for (int i = 0; i < shared_pool_size; i++) {
+		shared_texture_sets.push_back(TextureSet{ base_rel_path + "shared/maps/shared_" + std::to_string(i) });
+	}
+	std::vector<bool> is_shared_set_written(shared_pool_size, false);
+
+	uint64_t triangle_total = 0;
+	int own_texture_sets = 0;
+	for (int i = 0; i < options.cfg_count; i++) {
+		std::string name = "house_" + std::to_string(i);
+		std::string rdm_rel_path = base_rel_path + name + "/rdm/" + name + "_lod0.rdm";
+
+		float width = dimension(random);
+		float depth = dimension(random);
+		float wall_height = dimension(random) * 0.6f;
+		float roof_height = dimension(random) * 0.4f;
+		MeshBuilder mesh = build_house(options.triangles, width, depth, wall_height, roof_height);
+		triangle_total += mesh.indices.size() / 3;
+
+		std::vector<char> rdm = build_rdm(mesh);
+		fs::path rdm_path = fs::path(options.out_path).append(rdm_rel_path);
+		fs::create_directories(rdm_path.parent_path());
+		std::ofstream(rdm_path, std::ios::binary).write(rdm.data(), rdm.size());
+
+		TextureSet texture_set;
+		if (unit(random) < options.share) {
+			int shared_index = (int)(random() % shared_pool_size);
+			texture_set = shared_texture_sets[shared_index];
+			if (!is_shared_set_written[shared_index]) {
+				write_texture_set(options, texture_set, random);
+				is_shared_set_written[shared_index] = true;
+			}
+		}
+		else {
+			texture_set = TextureSet{ base_rel_path + name + "/maps/" + name };
+			write_texture_set(options, texture_set, random);
+			own_texture_sets++;
+		}
+
+		float mesh_radius = std::sqrt(width * width + depth * depth) / 2.f + wall_height;
+		fs::path cfg_path = fs::path(options.out_path).append(base_rel_path + name + "/" + name + ".cfg");
+		std::ofstream(cfg_path) << build_cfg(rdm_rel_path, texture_set, mesh_radius);
+	}
+
+	int shared_sets_written = 0;
+	for (bool is_written : is_shared_set_written) shared_sets_written += is_written;
+	std::cout << "Wrote " << options.cfg_count << " .cfg files with " << triangle_total << " triangles, "
+		<< own_texture_sets << " own and " << shared_sets_written << " shared texture sets ("
+		<< options.texture_size << "x" << options.texture_size << ") to " << options.out_path.string() << std::endl;
+	return 0;
+}